@@ -0,0 +1,280 @@
+/*
+ * main.c
+ *
+ *  Created on: Dec 27, 2012
+ *      Author: bouchier
+ *
+ *  Check the colour conversion kernels in watchVideo/server/colorconv.c against scalar
+ *  references, then time them. The RGB & Y references are the loops uvccapture.c &
+ *  rrclient.c used before; HSV & the threshold mask have no older version, so their
+ *  references are the plain definitions. Every Y, U, V combination is checked, at an
+ *  odd alignment & with a ragged tail, & the program exits 1 if any pixel differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "colorconv.h"
+
+#define ROW 256					// pixels: one pair for each two Y values
+#define CHECK_PIXELS (256 * ROW)	// every V & Y for one U
+#define BENCH_MS 300
+
+static void refRgb(const unsigned char *yuyv, unsigned char *rgb, int pixels)
+{
+	const unsigned char *end = yuyv + 2 * pixels;
+	int r, g, b;
+	int y0, y2, u, v;
+
+	for (; yuyv < end; yuyv += 4) {
+		y0 = yuyv[0] << 8;
+		u = yuyv[1] - 128;
+		v = yuyv[3] - 128;
+
+		r = (y0 + (359 * v)) >> 8;
+		g = (y0 - (88 * u) - (183 * v)) >> 8;
+		b = (y0 + (454 * u)) >> 8;
+
+		*(rgb++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
+		*(rgb++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
+		*(rgb++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
+
+		y2 = yuyv[2] << 8;
+
+		r = (y2 + (359 * v)) >> 8;
+		g = (y2 - (88 * u) - (183 * v)) >> 8;
+		b = (y2 + (454 * u)) >> 8;
+
+		*(rgb++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
+		*(rgb++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
+		*(rgb++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
+	}
+}
+
+static void refY(const unsigned char *yuyv, unsigned char *y, int pixels)
+{
+	const unsigned char *end = yuyv + 2 * pixels;
+
+	for (; yuyv < end; yuyv += 2, y++)
+		*y = *yuyv;
+}
+
+static void refHsv(const unsigned char *yuyv, unsigned char *hsv, int pixels)
+{
+	unsigned char rgb[6];
+	int i, j, r, g, b, max, min, delta, h;
+
+	for (i = 0; i < pixels; i += 2, yuyv += 4) {
+		refRgb(yuyv, rgb, 2);
+		for (j = 0; j < 2; j++, hsv += 3) {
+			r = rgb[3 * j];
+			g = rgb[3 * j + 1];
+			b = rgb[3 * j + 2];
+			max = r;
+			if (g > max) max = g;
+			if (b > max) max = b;
+			min = r;
+			if (g < min) min = g;
+			if (b < min) min = b;
+			delta = max - min;
+
+			if (delta == 0)
+				h = 0;
+			else if (max == r)
+				h = 43 * (g - b) / delta;
+			else if (max == g)
+				h = 85 + 43 * (b - r) / delta;
+			else
+				h = 171 + 43 * (r - g) / delta;
+			if (h < 0)
+				h += 256;
+			hsv[0] = h;
+			hsv[1] = (max == 0) ? 0 : 255 * delta / max;
+			hsv[2] = max;
+		}
+	}
+}
+
+static void refThreshold(const unsigned char *yuyv, unsigned char *mask, int pixels,
+		const yuvRange *range)
+{
+	int i, y, u, v;
+
+	for (i = 0; i < pixels; i++) {
+		y = yuyv[2 * i];
+		u = yuyv[4 * (i / 2) + 1];
+		v = yuyv[4 * (i / 2) + 3];
+		if (y >= range->yMin && y <= range->yMax && u >= range->uMin && u <= range->uMax &&
+				v >= range->vMin && v <= range->vMax)
+			mask[i] = 255;
+		else
+			mask[i] = 0;
+	}
+}
+
+// a U, a V, & the Y values, in a row of pairs; for the timings, anything
+static void fill(unsigned char *yuyv, int u, int pixels)
+{
+	int i;
+
+	for (i = 0; i < pixels; i += 2) {
+		yuyv[2 * i] = i % ROW;
+		yuyv[2 * i + 1] = u;
+		yuyv[2 * i + 2] = i % ROW + 1;
+		yuyv[2 * i + 3] = i / ROW;
+	}
+}
+
+static const yuvRange ranges[] = {
+	{ 0, 255, 0, 255, 0, 255 },
+	{ 40, 200, 90, 110, 150, 255 },		// an orange can
+	{ 100, 100, 128, 128, 0, 0 },
+	{ 200, 50, 0, 255, 0, 255 },		// empty
+	{ 0, 255, 255, 255, 0, 127 },
+};
+#define NUM_RANGES (int)(sizeof(ranges) / sizeof(ranges[0]))
+
+static int compare(const char *what, const unsigned char *ref, const unsigned char *out,
+		int bytes, int u)
+{
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		if (ref[i] != out[i]) {
+			printf("%s differs at U %d, byte %d: %d, should be %d\n", what, u, i, out[i], ref[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// every Y, U & V; shifted by 2 pixels & short, to exercise the unaligned tails
+static int check()
+{
+	unsigned char *yuyv = malloc(2 * CHECK_PIXELS + 4);
+	unsigned char *ref = malloc(3 * CHECK_PIXELS);
+	unsigned char *out = malloc(3 * CHECK_PIXELS + 1);
+	unsigned char *src;
+	int u, r, n, off, errors = 0;
+
+	for (u = 0; u < 256 && errors == 0; u++) {
+		for (off = 0; off < 2; off++) {
+			src = yuyv + 4 * off;
+			fill(src, u, CHECK_PIXELS - 2 * off);
+			n = CHECK_PIXELS - 2 * off - 6 * off;
+
+			refRgb(src, ref, n);
+			yuyvToRgb(src, out + off, n);
+			errors += compare("RGB", ref, out + off, 3 * n, u);
+
+			refY(src, ref, n);
+			yuyvToY(src, out + off, n);
+			errors += compare("Y", ref, out + off, n, u);
+
+			refHsv(src, ref, n);
+			yuyvToHsv(src, out + off, n);
+			errors += compare("HSV", ref, out + off, 3 * n, u);
+
+			for (r = 0; r < NUM_RANGES; r++) {
+				refThreshold(src, ref, n, &ranges[r]);
+				yuyvThreshold(src, out + off, n, &ranges[r]);
+				errors += compare("threshold", ref, out + off, n, u);
+			}
+		}
+	}
+	free(yuyv);
+	free(ref);
+	free(out);
+	return errors;
+}
+
+static double msSince(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_usec - start->tv_usec) / 1000.0;
+}
+
+typedef void (*kernel)(const unsigned char *, unsigned char *, int);
+
+static void thresholdCan(const unsigned char *yuyv, unsigned char *mask, int pixels)
+{
+	yuyvThreshold(yuyv, mask, pixels, &ranges[1]);
+}
+
+static void refThresholdCan(const unsigned char *yuyv, unsigned char *mask, int pixels)
+{
+	refThreshold(yuyv, mask, pixels, &ranges[1]);
+}
+
+// ns per pixel, converting the frame over & over for BENCH_MS
+static double timeKernel(kernel k, const unsigned char *yuyv, unsigned char *out, int pixels)
+{
+	struct timeval start;
+	unsigned long frames = 0;
+	double ms;
+
+	gettimeofday(&start, NULL);
+	do {
+		k(yuyv, out, pixels);
+		frames++;
+	} while ((ms = msSince(&start)) < BENCH_MS);
+	return ms * 1e6 / ((double)frames * pixels);
+}
+
+static const struct {
+	const char *name;
+	kernel ref, fast;
+} kernels[] = {
+	{ "YUYV to RGB24", refRgb, yuyvToRgb },
+	{ "YUYV to Y8", refY, yuyvToY },
+	{ "YUYV to HSV", refHsv, yuyvToHsv },
+	{ "YUYV threshold", refThresholdCan, thresholdCan },
+};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static const struct {
+	int width, height;
+} sizes[] = {
+	{ 160, 120 },
+	{ 320, 240 },
+	{ 640, 480 },
+};
+#define NUM_SIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+int main(int argc, char **argv)
+{
+	unsigned char *yuyv, *out;
+	double ref, fast;
+	int k, s, pixels;
+
+#ifdef COLORCONV_NO_SIMD
+	printf("ColorBench: portable kernels\n");
+#else
+	printf("ColorBench: vector kernels where there are any\n");
+#endif
+	if (check() != 0) {
+		printf("FAILED: kernels differ from the references\n");
+		return 1;
+	}
+	printf("all kernels match the references, every Y, U & V\n");
+
+	for (s = 0; s < NUM_SIZES; s++) {
+		pixels = sizes[s].width * sizes[s].height;
+		yuyv = malloc(2 * pixels);
+		out = malloc(3 * pixels);
+		fill(yuyv, 100, pixels);
+		printf("%dx%d:\n", sizes[s].width, sizes[s].height);
+		for (k = 0; k < NUM_KERNELS; k++) {
+			ref = timeKernel(kernels[k].ref, yuyv, out, pixels);
+			fast = timeKernel(kernels[k].fast, yuyv, out, pixels);
+			printf("  %-16s reference %6.2f ns/pixel, kernel %6.2f ns/pixel, %5.1fx, %7.0f us/frame\n",
+					kernels[k].name, ref, fast, ref / fast, fast * pixels / 1000.0);
+		}
+		free(yuyv);
+		free(out);
+	}
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ * fakerr.c
+ *
+ *  Created on: Dec 30, 2012
+ *      Author: bouchier
+ *
+ *  A stand-in for the Roborealm server, to test rrClient & measure its throughput without
+ *  a Windows PC running Roborealm. It answers the requests rrClient makes, one client at
+ *  a time & in order, as Roborealm does:
+ *
+ *  set_image: reads the RGB or compressed image, takes the processing time (-d) &
+ *    answers ok
+ *  get_variable SHAPES: answers with a shape whose xMin & xMax are the last image's tag,
+ *    so a client can tell which frame a result is for. An RGB image's tag is its first 4
+ *    bytes, little endian, & a JPEG's is the number in its first comment
+ *  anything else: answers ok
+ *
+ *  -k drops the connection every N requests, to test reconnecting, & -s sends each
+ *  response a byte at a time, to test reading responses split across packets. -b makes
+ *  images take as long to arrive as they would over a link of that many KB/s, such as
+ *  the robot's WiFi.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_REQUEST 4096
+
+int port = 6060;
+int delayMs = 0;			// Roborealm's processing time for each image
+int dropEvery = 0;			// requests between dropped connections; 0 never drops
+int linkKBs = 0;			// link speed to simulate; 0 is as fast as the socket
+int splitResponses = 0;
+int verbose = 0;
+
+char request[MAX_REQUEST + 1];
+int requestLen;
+unsigned char *image;
+int imageSize;
+unsigned int lastTag;
+unsigned long images, imageBytes;
+
+// read all len bytes, which an image takes many recv()s for
+static int readAll(int fd, unsigned char *buf, int len)
+{
+	int n;
+
+	while (len > 0) {
+		n = recv(fd, buf, len, 0);
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int sendResponse(int fd, const char *response)
+{
+	int len = strlen(response);
+	int i;
+
+	if (!splitResponses)
+		return (send(fd, response, len, MSG_NOSIGNAL) == len) ? 0 : -1;
+	for (i = 0; i < len; i++) {
+		if (send(fd, response + i, 1, MSG_NOSIGNAL) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+// the number in a JPEG's first comment segment, before the scan, or 0
+static unsigned int jpegTag(const unsigned char *jpeg, int size)
+{
+	int i = 2;
+
+	while (i + 4 < size && jpeg[i] == 0xff && jpeg[i + 1] != 0xda) {
+		if (jpeg[i + 1] == 0xfe)
+			return strtoul((const char *)jpeg + i + 4, NULL, 10);
+		i += 2 + ((jpeg[i + 2] << 8) | jpeg[i + 3]);
+	}
+	return 0;
+}
+
+// the integer between <tag> & </tag> in the request, or 0
+static int tagValue(const char *tag)
+{
+	char open[32];
+	char *p;
+
+	snprintf(open, sizeof(open), "<%s>", tag);
+	p = strstr(request, open);
+	return p ? atoi(p + strlen(open)) : 0;
+}
+
+/*
+ * Answer one request, which is in request up to end. Returns -1 if the client's gone.
+ * Bytes after the request, the start of an image or the next request, are moved to the
+ * start of request
+ */
+static int answer(int fd, char *end)
+{
+	char response[256];
+	char first = *end;
+	int left, width, height, size, have, shapes, compressed;
+
+	left = request + requestLen - end;
+	*end = 0;
+	if (verbose)
+		fprintf(stderr, "%s\n", request);
+
+	if (strstr(request, "<set_image>") != NULL) {
+		compressed = tagValue("compressed");
+		if (compressed) {
+			size = tagValue("size");
+		} else {
+			width = tagValue("width");
+			height = tagValue("height");
+			size = 3 * width * height;
+		}
+		if (size + 1 > imageSize) {		// room for the 0 after a comment at the end
+			free(image);
+			image = malloc(size + 1);
+			imageSize = size + 1;
+		}
+		*end = first;
+		have = (left < size) ? left : size;
+		memcpy(image, end, have);
+		if (readAll(fd, image + have, size - have) < 0)
+			return -1;
+		memmove(request, end + have, left - have);
+		requestLen = left - have;
+		image[size] = 0;
+		if (compressed)
+			lastTag = jpegTag(image, size);
+		else
+			lastTag = (size >= 4) ? image[0] | (image[1] << 8) | (image[2] << 16) | (image[3] << 24) : 0;
+		images++;
+		imageBytes += size;
+		if (linkKBs > 0)
+			usleep((unsigned long long)size * 1000000 / (linkKBs * 1024));
+		if (delayMs > 0)
+			usleep(delayMs * 1000);
+		return sendResponse(fd, "<response>ok</response>");
+	}
+
+	shapes = (strstr(request, "<get_variable>SHAPES</get_variable>") != NULL);
+	*end = first;
+	memmove(request, end, left);
+	requestLen = left;
+	if (shapes) {
+		snprintf(response, sizeof(response),
+				"<response><SHAPES>90000,0,0,%u,%u,0,0,0,0</SHAPES></response>", lastTag, lastTag);
+		return sendResponse(fd, response);
+	}
+	return sendResponse(fd, "<response>ok</response>");
+}
+
+static void serve(int fd)
+{
+	static int requests = 0;
+	char *end;
+	int n;
+
+	requestLen = 0;
+	while (1) {
+		request[requestLen] = 0;
+		while ((end = strstr(request, "</request>")) != NULL) {
+			end += strlen("</request>");
+			if ((dropEvery > 0) && (++requests % dropEvery == 0)) {
+				fprintf(stderr, "dropping the connection after %d requests\n", requests);
+				return;
+			}
+			if (answer(fd, end) < 0)
+				return;
+			request[requestLen] = 0;
+		}
+		if (requestLen == MAX_REQUEST) {
+			fprintf(stderr, "request too long, dropping the connection\n");
+			return;
+		}
+		n = recv(fd, request + requestLen, MAX_REQUEST - requestLen, 0);
+		if (n <= 0)
+			return;
+		requestLen += n;
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: fakerr [-p port] [-d ms] [-b KB/s] [-k requests] [-s] [-v]\n"
+			"\t-p\tport to listen on, 6060 as Roborealm\n"
+			"\t-d\tms to process each image\n"
+			"\t-b\tspeed of the link to simulate\n"
+			"\t-k\tdrop the connection every this many requests\n"
+			"\t-s\tsend responses a byte at a time\n"
+			"\t-v\tprint the requests\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	int listener, fd, c, enable = 1;
+
+	while ((c = getopt(argc, argv, "p:d:b:k:sv")) != -1) {
+		switch (c) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'd':
+			delayMs = atoi(optarg);
+			break;
+		case 'b':
+			linkKBs = atoi(optarg);
+			break;
+		case 'k':
+			dropEvery = atoi(optarg);
+			break;
+		case 's':
+			splitResponses = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((listener = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return 1;
+	}
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if ((bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(listener, 1) < 0)) {
+		perror("bind");
+		return 1;
+	}
+	fprintf(stderr, "fake Roborealm listening on port %d, %d ms per image\n", port, delayMs);
+
+	while ((fd = accept(listener, NULL, NULL)) >= 0) {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+		if (verbose)
+			fprintf(stderr, "client connected\n");
+		images = imageBytes = 0;
+		serve(fd);
+		close(fd);
+		if (verbose)
+			fprintf(stderr, "client disconnected after %lu images, %lu bytes each\n", images,
+					images ? imageBytes / images : 0);
+	}
+	perror("accept");
+	return 1;
+}
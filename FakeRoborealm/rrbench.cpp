@@ -0,0 +1,308 @@
+/*
+ * rrbench.cpp
+ *
+ *  Created on: Dec 30, 2012
+ *      Author: bouchier
+ *
+ *  Pushes frames through rrClient's Roborealm calls to a Roborealm server, normally
+ *  fakerr, & measures the frames per second with one frame in flight, as rrclient used
+ *  to work, & with the pipeline rrclient uses now. Each frame carries its number in its
+ *  first pixels & fakerr echoes it back as the shape's x, so every result is checked
+ *  against the frame it should be for. Run fakerr with -k to check reconnecting.
+ *
+ *  With -j the frames go as JPEGs, encoded from a made up YUYV scene by rrClient's
+ *  jpegenc.c, with the frame number in a comment. Each setting's JPEG is first decoded
+ *  & compared with the RGB rrclient would send, to show what's lost, & its size. Run
+ *  fakerr with -b to see what the smaller frames do over a slow link.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <jpeglib.h>
+
+extern "C" {
+#include "colorconv.h"
+#include "jpegenc.h"
+}
+
+extern "C" int rrConnect(char *s, int p);
+extern "C" int rrSubmitImage(unsigned char *i, int w, int h);
+extern "C" int rrSubmitCompressedImage(unsigned char *i, int size);
+extern "C" int rrCollectShapeProperties(int *properties);
+extern "C" int rrPending();
+extern "C" void rrDisconnect();
+
+#define WIDTH 320
+#define HEIGHT 240
+#define MAX_DEPTH 8
+
+char *host = (char *)"127.0.0.1";
+int port = 6060;
+int frames = 200;
+int workMs = 0;			// time to capture & convert each frame before it's sent
+int depth = 2;			// frames in flight when pipelined, as RR_PIPELINE in rrclient.c
+int quality = 0;		// send JPEGs of this quality; 0 sends RGB
+int subsampling = 422;
+
+unsigned char yuyv[2 * WIDTH * HEIGHT];
+unsigned char image[3 * WIDTH * HEIGHT];
+unsigned char jpeg[3 * WIDTH * HEIGHT + 16];
+unsigned long sentBytes;
+
+static double msSince(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/*
+ * A camera frame to send: a lit floor & wall with some texture & noise, & a red can
+ * which moves along with the frame number
+ */
+static void scene(int n)
+{
+	static unsigned int seed = 1;
+	unsigned char *p = yuyv;
+	int x, y, left = 40 + 5 * (n % 40);
+	int Y, u, v, can;
+
+	for (y = 0; y < HEIGHT; y++) {
+		for (x = 0; x < WIDTH; x += 2, p += 4) {
+			can = (x >= left) && (x < left + 30) && (y >= 90) && (y < 150);
+			Y = can ? 90 + (x - left) : 60 + y / 2 + ((x / 8 + y / 8) % 2) * 12;
+			u = can ? 110 : 120 + y / 40;
+			v = can ? 200 : 132 - x / 80;
+			seed = seed * 1103515245 + 12345;
+			p[0] = Y + ((seed >> 16) % 13) - 6;
+			p[1] = u;
+			p[2] = Y + ((seed >> 24) % 13) - 6;
+			p[3] = v;
+		}
+	}
+}
+
+/*
+ * The JPEG of the scene, with n in a comment after the SOI marker for fakerr to echo
+ * back. Returns its length, or -1
+ */
+static int encodeTagged(int n)
+{
+	char comment[16];
+	int len, bytes;
+
+	len = snprintf(comment, sizeof(comment), "%d", n) + 1;
+	bytes = jpegEncodeYuyv(yuyv, WIDTH, HEIGHT, quality, subsampling, jpeg + 4 + len,
+			sizeof(jpeg) - 4 - len);
+	if (bytes < 0)
+		return -1;
+	jpeg[2 + len] = 0xff;		// SOI, then COM
+	jpeg[3 + len] = 0xd8;
+	jpeg[0] = 0xff;
+	jpeg[1] = 0xd8;
+	jpeg[2] = 0xff;
+	jpeg[3] = 0xfe;
+	jpeg[4] = 0;
+	jpeg[5] = len + 2;
+	memcpy(jpeg + 6, comment, len);
+	return bytes + 4 + len;		// the encoded SOI is overwritten
+}
+
+// one frame to Roborealm, as RGB or JPEG
+static int submit(int n)
+{
+	int bytes;
+
+	if (quality == 0) {
+		image[0] = n & 0xff;
+		image[1] = (n >> 8) & 0xff;
+		image[2] = (n >> 16) & 0xff;
+		image[3] = (n >> 24) & 0xff;
+		sentBytes += sizeof(image);
+		return rrSubmitImage(image, WIDTH, HEIGHT);
+	}
+	scene(n);
+	if ((bytes = encodeTagged(n)) < 0)
+		return -1;
+	sentBytes += bytes;
+	return rrSubmitCompressedImage(jpeg, bytes);
+}
+
+// decode the JPEG & compare it with the RGB of the scene: the mean difference per byte
+static double jpegError(const unsigned char *data, int size)
+{
+	struct jpeg_decompress_struct dinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *row;
+	long total = 0;
+	int x, d;
+
+	yuyvToRgb(yuyv, image, WIDTH * HEIGHT);
+	dinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&dinfo);
+	jpeg_mem_src(&dinfo, (unsigned char *)data, size);
+	jpeg_read_header(&dinfo, TRUE);
+	dinfo.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&dinfo);
+	row = (unsigned char *)malloc(3 * dinfo.output_width);
+	while (dinfo.output_scanline < dinfo.output_height) {
+		unsigned char *ref = image + 3 * WIDTH * dinfo.output_scanline;
+		jpeg_read_scanlines(&dinfo, &row, 1);
+		for (x = 0; x < 3 * WIDTH; x++) {
+			d = row[x] - ref[x];
+			total += (d < 0) ? -d : d;
+		}
+	}
+	jpeg_finish_decompress(&dinfo);
+	jpeg_destroy_decompress(&dinfo);
+	free(row);
+	return (double)total / sizeof(image);
+}
+
+// the size, encoding time & error of each subsampling at the quality asked for
+static void jpegSettings()
+{
+	static const int subsamplings[] = { 444, 422, 420 };
+	struct timeval start;
+	int i, n, bytes, chosen = subsampling;
+	double ms;
+
+	scene(0);
+	for (i = 0; i < 3; i++) {
+		subsampling = subsamplings[i];
+		gettimeofday(&start, NULL);
+		for (n = 0; n < 50; n++)
+			bytes = jpegEncodeYuyv(yuyv, WIDTH, HEIGHT, quality, subsampling, jpeg, sizeof(jpeg));
+		ms = msSince(&start) / 50;
+		printf("JPEG quality %d, %d: %d bytes, %.1fx smaller than RGB, %.2f ms to encode, mean error %.2f\n",
+				quality, subsampling, bytes, (double)sizeof(image) / bytes, ms, jpegError(jpeg, bytes));
+	}
+	subsampling = chosen;
+}
+
+// send frames keeping up to inFlight in flight; returns the mismatched results
+static int run(int inFlight)
+{
+	unsigned int sent[MAX_DEPTH];		// the frame numbers in flight, oldest first
+	int properties[9];
+	int n, i, pending = 0, results = 0, noShape = 0, mismatches = 0, lost = 0, drops = 0;
+	struct timeval start;
+	double ms;
+
+	sentBytes = 0;
+	gettimeofday(&start, NULL);
+	for (n = 0; n < frames || pending > 0; ) {
+		if (n < frames) {
+			if (workMs > 0)
+				usleep(workMs * 1000);
+			if (submit(n) == 0) {
+				sent[pending++] = n;
+			} else {
+				lost++;
+				if (rrPending() == 0) {		// the frames in flight went with the connection
+					if (pending > 0)
+						drops++;
+					lost += pending;
+					pending = 0;
+				}
+			}
+			n++;
+			if (pending < inFlight && n < frames)
+				continue;
+		}
+		if (pending == 0)
+			continue;
+
+		switch (rrCollectShapeProperties(properties)) {
+		case -1:
+			drops++;
+			lost += pending;		// whatever was in flight went with the connection
+			pending = 0;
+			continue;
+		case 0:
+			noShape++;
+			break;
+		default:
+			if ((properties[3] != (int)sent[0]) || (properties[4] != (int)sent[0])) {
+				if (mismatches++ < 5)
+					printf("  frame %u got the result for frame %d\n", sent[0], properties[3]);
+			}
+			results++;
+		}
+		for (i = 1; i < pending; i++)
+			sent[i - 1] = sent[i];
+		pending--;
+	}
+	ms = msSince(&start);
+
+	printf("%d in flight: %d frames in %.0f ms, %.1f frames/s, %.1f ms each", inFlight, frames,
+			ms, frames * 1000.0 / ms, ms / frames);
+	printf(", %lu bytes each", sentBytes / frames);
+	printf(", %d results, %d mismatched", results, mismatches);
+	if (noShape > 0)
+		printf(", %d with no shape", noShape);
+	if (drops > 0)
+		printf(", %d dropped connections, %d frames lost", drops, lost);
+	printf("\n");
+	return mismatches + noShape;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: RRBench [-h host] [-p port] [-n frames] [-w ms] [-d depth] [-j quality[,444|422|420]]\n"
+			"\t-h\tRoborealm's address, 127.0.0.1 for fakerr on this PC\n"
+			"\t-n\tframes to send each way\n"
+			"\t-w\tms to capture each frame\n"
+			"\t-d\tframes in flight when pipelined, up to %d\n"
+			"\t-j\tsend JPEGs of this quality & subsampling, default 422\n", MAX_DEPTH);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int c, errors;
+
+	while ((c = getopt(argc, argv, "h:p:n:w:d:j:")) != -1) {
+		switch (c) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'w':
+			workMs = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			if (depth < 1 || depth > MAX_DEPTH)
+				usage();
+			break;
+		case 'j':
+			if ((sscanf(optarg, "%d,%d", &quality, &subsampling) < 1) || (quality < 1) ||
+					((subsampling != 444) && (subsampling != 422) && (subsampling != 420)))
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (quality > 0)
+		jpegSettings();
+
+	if (rrConnect(host, port) < 0)
+		return 1;
+	printf("RRBench: %dx%d %s frames to %s:%d, %d ms to capture each\n", WIDTH, HEIGHT,
+			quality ? "JPEG" : "RGB", host, port, workMs);
+	errors = run(1);
+	errors += run(depth);
+	rrDisconnect();
+	return (errors == 0) ? 0 : 1;
+}
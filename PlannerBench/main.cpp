@@ -0,0 +1,241 @@
+/*
+ * main.cpp
+ *
+ *  Created on: Dec 21, 2012
+ *      Author: bouchier
+ *
+ *  Time the Roborama2012a path planner on synthetic maps. For each map it plans from
+ *  scratch, then drives the robot along the path a cell a tick & drops a new wall across
+ *  it, to time the D* Lite repair against planning again from scratch. The planner does
+ *  at most PLAN_MAX_EXPANSIONS cells of search per update, so the update times printed
+ *  are what it would add to one 50ms subsumption tick on this machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/time.h>
+#include "OccupancyGrid.h"
+#include "Planner.h"
+
+#define TICK_USEC 50000
+#define REPEATS 20
+
+typedef struct {
+	unsigned long ticks;		// updates until the search was done
+	unsigned long totalUsec, maxUsec;
+} Timing;
+
+static void wall(OccupancyGrid *grid, double x0, double y0, double x1, double y1)
+{
+	double len = sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+	double d;
+
+	for (d = 0.0; d <= len; d += GRID_CELL / 2)
+		grid->setOccupied(x0 + (x1 - x0) * d / len, y0 + (y1 - y0) * d / len);
+}
+
+static OccupancyGrid *openFloor()
+{
+	return new OccupancyGrid();
+}
+
+// a wall across the room with a doorway near one end
+static OccupancyGrid *doorway()
+{
+	OccupancyGrid *grid = new OccupancyGrid();
+
+	wall(grid, -90.0, 0.0, 54.0, 0.0);
+	wall(grid, 78.0, 0.0, 90.0, 0.0);
+	return grid;
+}
+
+// a random 3" obstacle on one cell in sixty, clear around the start & goal
+static OccupancyGrid *clutter()
+{
+	OccupancyGrid *grid = new OccupancyGrid();
+	double x, y;
+
+	srand(1);
+	for (y = -90.0; y < 90.0; y += GRID_CELL) {
+		for (x = -90.0; x < 90.0; x += GRID_CELL) {
+			if ((rand() % 60) != 0)
+				continue;
+			if ((fabs(x + 80.0) < 12.0 && fabs(y + 80.0) < 12.0) || (fabs(x - 80.0) < 12.0 && fabs(y - 80.0) < 12.0))
+				continue;
+			grid->setOccupied(x, y);
+		}
+	}
+	return grid;
+}
+
+// walls which force the path to zig-zag across the room
+static OccupancyGrid *zigzag()
+{
+	OccupancyGrid *grid = new OccupancyGrid();
+
+	wall(grid, -90.0, -45.0, 60.0, -45.0);
+	wall(grid, -60.0, 0.0, 90.0, 0.0);
+	wall(grid, -90.0, 45.0, 60.0, 45.0);
+	return grid;
+}
+
+static const struct {
+	const char *name;
+	OccupancyGrid *(*make)();
+	double x, y, goalX, goalY;
+} maps[] = {
+	{ "open floor", openFloor, -80.0, -80.0, 80.0, 80.0 },
+	{ "doorway", doorway, 0.0, -80.0, 0.0, 80.0 },
+	{ "clutter", clutter, -80.0, -80.0, 80.0, 80.0 },
+	{ "zigzag", zigzag, 0.0, -80.0, 0.0, 80.0 },
+};
+#define NUM_MAPS (int)(sizeof(maps) / sizeof(maps[0]))
+
+static unsigned long usecSince(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+// update until the search is done, timing each update
+static void run(Planner *planner, double x, double y, Timing *t)
+{
+	struct timeval start;
+	unsigned long usec;
+
+	do {
+		gettimeofday(&start, NULL);
+		planner->update(x, y);
+		usec = usecSince(&start);
+		t->ticks++;
+		t->totalUsec += usec;
+		if (usec > t->maxUsec)
+			t->maxUsec = usec;
+	} while (planner->isBusy());
+}
+
+// time including setGoal(), which reads the window from the grid
+static void search(Planner *planner, double x, double y, double goalX, double goalY, Timing *t)
+{
+	struct timeval start;
+	unsigned long usec;
+
+	gettimeofday(&start, NULL);
+	planner->setGoal(x, y, goalX, goalY);
+	usec = usecSince(&start);
+	t->totalUsec += usec;
+	if (usec > t->maxUsec)
+		t->maxUsec = usec;
+	run(planner, x, y, t);
+}
+
+static void printTiming(const char *what, Timing *t, int n)
+{
+	printf("  %-22s %4.1f updates, %7.1f us total, max %5lu us/update (%0.2f%% of a tick)\n",
+			what, (double)t->ticks / n, (double)t->totalUsec / n, t->maxUsec,
+			100.0 * t->maxUsec / TICK_USEC);
+}
+
+static void printPath(int *path)
+{
+	int i;
+
+	if (path == NULL) {
+		printf("  no path\n");
+		return;
+	}
+	printf("  path:");
+	for (i = 0; i < path[0]; i++)
+		printf(" (%d, %d)", path[1 + 2 * i], path[2 + 2 * i]);
+	printf("\n");
+}
+
+/*
+ * Drive a cell towards the next waypoint each tick. After a few ticks, drop a wall across
+ * the path ahead & time the repair, then plan again from scratch from the same place
+ */
+static void blockAhead(OccupancyGrid *(*make)(), double x, double y, double goalX, double goalY,
+		Timing *repair, Timing *scratch)
+{
+	OccupancyGrid *grid = make();
+	Planner *planner = new Planner(grid);
+	Planner *fresh = new Planner(grid);
+	Timing ignore;
+	int *path, i;
+	double dx, dy, d, ax, ay;
+
+	memset(&ignore, 0, sizeof(ignore));
+	search(planner, x, y, goalX, goalY, &ignore);
+	for (i = 0; i < 8 && (path = planner->getPath()) != NULL; i++) {
+		dx = path[1] - x;
+		dy = path[2] - y;
+		d = sqrt(dx * dx + dy * dy);
+		if (d < GRID_CELL)
+			break;
+		x += dx * GRID_CELL / d;
+		y += dy * GRID_CELL / d;
+		run(planner, x, y, &ignore);
+	}
+	if ((path = planner->getPath()) == NULL)
+		return;
+
+	// a 3' wall square across the first leg, 18" ahead
+	dx = path[1] - x;
+	dy = path[2] - y;
+	d = sqrt(dx * dx + dy * dy);
+	if (d < 18.0) {
+		dx = path[3] - x;
+		dy = path[4] - y;
+		d = sqrt(dx * dx + dy * dy);
+	}
+	ax = x + dx * 18.0 / d;
+	ay = y + dy * 18.0 / d;
+	wall(grid, ax - dy * 18.0 / d, ay + dx * 18.0 / d, ax + dy * 18.0 / d, ay - dx * 18.0 / d);
+
+	run(planner, x, y, repair);
+	search(fresh, x, y, goalX, goalY, scratch);
+	delete fresh;
+	delete planner;
+	delete grid;
+}
+
+int main(int argc, char **argv)
+{
+	OccupancyGrid *grid;
+	Planner *planner;
+	Timing full, repair, scratch;
+	int m, i;
+
+	printf("PlannerBench: %d x %d cell window, %d expansions/update, %d runs of each\n",
+			PLAN_SIZE, PLAN_SIZE, PLAN_MAX_EXPANSIONS, REPEATS);
+	for (m = 0; m < NUM_MAPS; m++) {
+		memset(&full, 0, sizeof(full));
+		memset(&repair, 0, sizeof(repair));
+		memset(&scratch, 0, sizeof(scratch));
+		grid = maps[m].make();
+		for (i = 0; i < REPEATS; i++) {
+			planner = new Planner(grid);
+			search(planner, maps[m].x, maps[m].y, maps[m].goalX, maps[m].goalY, &full);
+			if (i == REPEATS - 1) {
+				printf("%s, (%0.0f, %0.0f) to (%0.0f, %0.0f):\n", maps[m].name,
+						maps[m].x, maps[m].y, maps[m].goalX, maps[m].goalY);
+				printPath(planner->getPath());
+				planner->printData();
+			}
+			delete planner;
+		}
+		delete grid;
+		for (i = 0; i < REPEATS; i++)
+			blockAhead(maps[m].make, maps[m].x, maps[m].y, maps[m].goalX, maps[m].goalY,
+					&repair, &scratch);
+		printTiming("plan from scratch", &full, REPEATS);
+		printTiming("repair after new wall", &repair, REPEATS);
+		printTiming("same, from scratch", &scratch, REPEATS);
+	}
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * main.cpp
+ *
+ *  Created on: Dec 12, 2012
+ *      Author: bouchier
+ *
+ *  Replay an odometry & compass log, as recorded by roombaVEXPro -C -P <file>, through
+ *  PoseFilter & plain Odometry, or synthesize a log with known ground truth to test with.
+ *
+ *  Log lines are:
+ *    odo <sec.usec> <left ticks> <right ticks>
+ *    compass <sec.usec> <heading degrees>
+ *    truth <sec.usec> <x> <y> <theta degrees>		(synthetic logs only)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "Odometry.h"
+#include "PoseFilter.h"
+
+void usage()
+{
+	printf("Usage: PoseReplay [options] logfile\n"
+	"Options:\n"
+	"  -s deg         Compass standard deviation (default %0.1f)\n"
+	"  -g sigmas      Innovation gate (default %0.1f)\n"
+	"  -v             Print every compass update\n"
+	"  -S             Write a synthetic log with ground truth to logfile, then replay it\n",
+	POSE_COMPASS_SD, POSE_GATE_SIGMAS);
+}
+
+static double gaussian()
+{
+	double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2.0 * log(u1)) * cos(TWOPI * u2);
+}
+
+static void stamp(struct timeval *tv, double t)
+{
+	tv->tv_sec = (long)t;
+	tv->tv_usec = (long)((t - tv->tv_sec) * 1e6);
+}
+
+/*
+ * 60s of driving 3s legs & spinning 90 degrees right, with the true wheel base 5% larger
+ * than the calibration, compass noise, a 30 degree compass offset, a 40 degree error in
+ * the first compass reading & a 50 degree magnetic disturbance from 20s to 23s
+ */
+static int synthesize(const char *path)
+{
+	FILE *fp;
+	const double dt = 0.05, wheelBase = WHEEL_BASE * 1.05;
+	double t, x = 0.0, y = 0.0, theta = 0.0, lastTheta = 0.0;
+	double left, right, ds, dTheta, phase, compass;
+	double lResidue = 0.0, rResidue = 0.0;
+	short lTicks, rTicks;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	srand(1);
+	for (t = 1000.0; t < 1060.0; t += dt) {
+		phase = fmod(t - 1000.0, 5.0);
+		if (phase < 3.0) {
+			left = right = 10.0 * dt;				// 10 in/s
+		} else {
+			left = (M_PI / 2.0) * wheelBase / 2.0 / 2.0 * dt;	// 90 degrees in 2s
+			right = -left;
+		}
+		ds = (left + right) / 2.0;
+		dTheta = (left - right) / wheelBase;
+		x += ds * sin(theta + dTheta / 2.0);
+		y += ds * cos(theta + dTheta / 2.0);
+		lastTheta = theta;
+		theta += dTheta;
+
+		// whole ticks, carrying the fractions over
+		lResidue += left * LEFT_CLICKS_PER_INCH;
+		rResidue += right * RIGHT_CLICKS_PER_INCH;
+		lTicks = (short)floor(lResidue);
+		rTicks = (short)floor(rResidue);
+		lResidue -= lTicks;
+		rResidue -= rTicks;
+		fprintf(fp, "odo %0.6f %d %d\n", t, lTicks, rTicks);
+
+		// the compass reading is one loop old
+		compass = lastTheta * RADS + 30.0 + 2.0 * gaussian();
+		if (t == 1000.0)
+			compass += 40.0;
+		if ((t >= 1020.0) && (t < 1023.0))
+			compass += 50.0;
+		compass = fmod(compass + 720.0, 360.0);
+		fprintf(fp, "compass %0.6f %0.1f\n", t - dt, compass);
+		fprintf(fp, "truth %0.6f %0.3f %0.3f %0.3f\n", t, x, y, theta * RADS);
+	}
+	fclose(fp);
+	return 0;
+}
+
+static double angleError(double a, double b)
+{
+	double e = fmod(a - b, TWOPI);
+	if (e > M_PI)
+		e -= TWOPI;
+	else if (e < -M_PI)
+		e += TWOPI;
+	return e;
+}
+
+int main(int argc, char **argv)
+{
+	PoseFilter filter;
+	Odometry odometry;
+	FILE *fp;
+	char line[128], kind[16];
+	double t, a, b, c;
+	struct timeval tv;
+	double odoErr2 = 0.0, filterErr2 = 0.0, odoErrMax = 0.0, filterErrMax = 0.0, e;
+	double tx = 0.0, ty = 0.0, tTheta = 0.0;
+	unsigned long truths = 0;
+	bool verbose = false, synth = false, accepted;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "hs:g:vS")) != -1) {
+		switch (opt) {
+		case 's': filter.setCompassSd(atof(optarg)); break;
+		case 'g': filter.setGate(atof(optarg)); break;
+		case 'v': verbose = true; break;
+		case 'S': synth = true; break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		exit(1);
+	}
+	if (synth && (synthesize(argv[optind]) < 0))
+		exit(1);
+	if ((fp = fopen(argv[optind], "r")) == NULL) {
+		perror(argv[optind]);
+		exit(1);
+	}
+	filter.loadCalibration(ODOMETRY_CAL_FILE);
+	odometry.setParams(filter.getParams());
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		n = sscanf(line, "%15s %lf %lf %lf %lf", kind, &t, &a, &b, &c);
+		stamp(&tv, t);
+		if ((n == 4) && !strcmp(kind, "odo")) {
+			filter.updateOdometry((short)a, (short)b, tv);
+			odometry.update((short)a, (short)b);
+		} else if ((n == 3) && !strcmp(kind, "compass")) {
+			accepted = filter.updateCompass(a, tv);
+			if (verbose)
+				printf("%0.3f compass %5.1f %s, theta %6.1f sd %4.1f deg\n", t, a,
+						accepted ? "accepted" : "REJECTED", filter.getTheta() * RADS,
+						sqrt(filter.getCov(2, 2)) * RADS);
+		} else if ((n == 5) && !strcmp(kind, "truth")) {
+			tx = a;
+			ty = b;
+			tTheta = c / RADS;
+			e = fabs(angleError(odometry.getTheta(), tTheta)) * RADS;
+			odoErr2 += e * e;
+			if (e > odoErrMax)
+				odoErrMax = e;
+			e = fabs(angleError(filter.getTheta(), tTheta)) * RADS;
+			filterErr2 += e * e;
+			if (e > filterErrMax)
+				filterErrMax = e;
+			truths++;
+		}
+	}
+	fclose(fp);
+
+	printf("odometry:    ");
+	odometry.printData();
+	printf("pose filter: ");
+	filter.printData();
+	if (truths) {
+		printf("truth:       X: %0.2f Y: %0.2f theta: %0.1f deg\n", tx, ty, fmod(tTheta * RADS, 360.0));
+		printf("heading error vs truth: odometry rms %0.1f max %0.1f deg, pose filter rms %0.1f max %0.1f deg\n",
+				sqrt(odoErr2 / truths), odoErrMax, sqrt(filterErr2 / truths), filterErrMax);
+	}
+	return 0;
+}
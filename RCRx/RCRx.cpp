@@ -8,7 +8,8 @@
  * \file RCRx.cpp
  * \brief Source code for the R/C receiver class
  *
- * This class measures the pulse width of the positive pulse on the specified digital input
+ * This class measures the pulse width of the positive pulses on one or more digital inputs,
+ * or the channel intervals of a PPM sum-stream on a single digital input
  */
 #include <stdio.h>
 #include <unistd.h>
@@ -17,42 +18,183 @@
 #include "RCRx.h"
 
 
-//! Instantiate an instance of an R/C receiver object
+//! Instantiate an instance of an R/C receiver object for a single channel
 /*!
-
  * \param dioNumIn The Digital I/O number (1 - 16) on the VEXPro controller to which the R/C receiver
  * channel is wired
+ * \param gpioIn The GPIO interrupt singleton
  */
 RCRx::RCRx(int dioNumIn, CQEGpioInt& gpioIn) : gpio(gpioIn) {
-	//CQEGpioInt &gpio = CQEGpioInt::GetRef();
-	unsigned int i;
+	ppm = false;
+	init(1);
+	channels[0].dioIndex = dioNumIn - 1;
+	gpio.RegisterCallback(channels[0].dioIndex, (void *)&channels[0], &RCRx::pwmCallback);
+	gpio.SetInterruptMode(channels[0].dioIndex, QEG_INTERRUPT_POSEDGE);
+}
+
+//! Instantiate an R/C receiver object with each channel wired to its own digital I/O
+/*!
+ * \param gpioIn The GPIO interrupt singleton
+ * \param numChannelsIn Number of channels to decode (1 - RCRX_MAX_CHANNELS)
+ * \param dioNums Array of numChannelsIn Digital I/O numbers (1 - 16), in channel order
+ */
+RCRx::RCRx(CQEGpioInt& gpioIn, int numChannelsIn, const int *dioNums) : gpio(gpioIn) {
+	int i;
 
-	dioIndex = dioNumIn - 1;
-	i = (unsigned int)dioIndex;
-	waitRising = true;
-	//gpio.RegisterCallback(i, NULL, callback);
-	gpio.RegisterCallback(0,NULL,&RCRx::callback);
-	gpio.SetInterruptMode(0, QEG_INTERRUPT_NEGEDGE);
+	ppm = false;
+	init(numChannelsIn);
+	for (i=0; i<numChannels; i++) {
+		channels[i].dioIndex = dioNums[i] - 1;
+		gpio.RegisterCallback(channels[i].dioIndex, (void *)&channels[i], &RCRx::pwmCallback);
+		gpio.SetInterruptMode(channels[i].dioIndex, QEG_INTERRUPT_POSEDGE);
+	}
+}
+
+//! Instantiate an R/C receiver object decoding a PPM sum-stream
+/*!
+ * The PPM stream is decoded by timing the intervals between falling edges. An interval longer
+ * than RCRX_PPM_SYNC is the frame sync gap; the intervals after it are channels 0, 1, 2...
+ *
+ * \param gpioIn The GPIO interrupt singleton
+ * \param ppmDioNum The Digital I/O number (1 - 16) the PPM stream is wired to
+ * \param numChannelsIn Number of channels to decode (1 - RCRX_MAX_CHANNELS)
+ */
+RCRx::RCRx(CQEGpioInt& gpioIn, int ppmDioNum, int numChannelsIn) : gpio(gpioIn) {
+	ppm = true;
+	init(numChannelsIn);
+	ppmDioIndex = ppmDioNum - 1;
+	gpio.RegisterCallback(ppmDioIndex, (void *)this, &RCRx::ppmCallback);
+	gpio.SetInterruptMode(ppmDioIndex, QEG_INTERRUPT_NEGEDGE);
 }
 
 RCRx::~RCRx() {
-	CQEGpioInt::Release();
+	int i;
+
+	if (ppm) {
+		gpio.SetInterruptMode(ppmDioIndex, QEG_INTERRUPT_NONE);
+		gpio.UnregisterCallback(ppmDioIndex);
+	} else {
+		for (i=0; i<numChannels; i++) {
+			gpio.SetInterruptMode(channels[i].dioIndex, QEG_INTERRUPT_NONE);
+			gpio.UnregisterCallback(channels[i].dioIndex);
+		}
+	}
+	pthread_mutex_destroy(&lock);
+}
+
+void RCRx::init(int numChannelsIn)
+{
+	int i, j;
+
+	if (numChannelsIn < 1)
+		numChannelsIn = 1;
+	if (numChannelsIn > RCRX_MAX_CHANNELS)
+		numChannelsIn = RCRX_MAX_CHANNELS;
+	numChannels = numChannelsIn;
+	failsafeMs = RCRX_FAILSAFE_MS;
+	ppmChannel = numChannels;		// ignore intervals until the first sync gap
+	ppmStarted = false;
+	pthread_mutex_init(&lock, NULL);
+
+	for (i=0; i<RCRX_MAX_CHANNELS; i++) {
+		channels[i].rx = this;
+		channels[i].dioIndex = 0;
+		channels[i].waitRising = true;
+		channels[i].everGood = false;
+		for (j=0; j<RCRX_MEDIAN_LEN; j++)
+			channels[i].history[j] = 1500;
+		channels[i].historyIndex = 0;
+		channels[i].filteredPw = 0;
+		channels[i].glitches = 0;
+		channels[i].failsafe = 0.0;
+		channels[i].centerPw = 1500;
+		channels[i].halfRangePw = 500;
+	}
 }
 
-void RCRx::callback(unsigned int io, struct timeval *ptv, void *userdata)
+/*
+ * Called at interrupt level on each edge of a PWM channel. Alternates between
+ * waiting for the rising & falling edges of the pulse.
+ */
+void RCRx::pwmCallback(unsigned int io, struct timeval *ptv, void *userdata)
 {
-	if (waitRising)		// we just received the rising edge we were waiting for
-	{
-		tvRising = *ptv;
-		waitRising = false;
-		printf("+:");
-		gpio.SetInterruptMode(dioIndex, QEG_INTERRUPT_NEGEDGE);
+	RCChannelState *ch = (RCChannelState *)userdata;
+	RCRx *rx = ch->rx;
+
+	if (ch->waitRising) {	// we just received the rising edge we were waiting for
+		ch->tvRising = *ptv;
+		ch->waitRising = false;
+		rx->gpio.SetInterruptMode(ch->dioIndex, QEG_INTERRUPT_NEGEDGE);
 	} else {
-		lastPw = diff(&tvRising, ptv);
-		printf("-: %d\n", lastPw);
-		gpio.SetInterruptMode(dioIndex, QEG_INTERRUPT_POSEDGE);
+		ch->waitRising = true;
+		rx->gpio.SetInterruptMode(ch->dioIndex, QEG_INTERRUPT_POSEDGE);
+		rx->acceptPulse(ch, (long)rx->diff(&ch->tvRising, ptv), ptv);
+	}
+}
+
+/*
+ * Called at interrupt level on each falling edge of the PPM stream.
+ */
+void RCRx::ppmCallback(unsigned int io, struct timeval *ptv, void *userdata)
+{
+	RCRx *rx = (RCRx *)userdata;
+	long interval;
+
+	if (!rx->ppmStarted) {
+		rx->ppmStarted = true;
+		rx->tvPpmLast = *ptv;
+		return;
+	}
+	interval = (long)rx->diff(&rx->tvPpmLast, ptv);
+	rx->tvPpmLast = *ptv;
+
+	if (interval > RCRX_PPM_SYNC) {
+		rx->ppmChannel = 0;			// sync gap, next interval is channel 0
+	} else if (rx->ppmChannel < rx->numChannels) {
+		rx->acceptPulse(&rx->channels[rx->ppmChannel++], interval, ptv);
+	}
+}
+
+/*
+ * Reject out-of-range pulses, then run the rest through the median filter
+ */
+void RCRx::acceptPulse(RCChannelState *ch, long pw, struct timeval *ptv)
+{
+	int a, b, c;
+
+	pthread_mutex_lock(&lock);
+	if ((pw < RCRX_MIN_PW) || (pw > RCRX_MAX_PW)) {
+		ch->glitches++;
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	if (!ch->everGood) {		// prime the filter so the first pulse is used as-is
+		for (a=0; a<RCRX_MEDIAN_LEN; a++)
+			ch->history[a] = pw;
+		ch->everGood = true;
 	}
+	ch->history[ch->historyIndex] = pw;
+	ch->historyIndex = (ch->historyIndex + 1) % RCRX_MEDIAN_LEN;
 
+	// median of 3
+	a = ch->history[0];
+	b = ch->history[1];
+	c = ch->history[2];
+	if (a > b) { int t = a; a = b; b = t; }
+	if (b > c) { b = c; }
+	if (a > b) { b = a; }
+	ch->filteredPw = b;
+	ch->tvGood = *ptv;
+	pthread_mutex_unlock(&lock);
+}
+
+// caller must hold lock
+bool RCRx::isLost(RCChannelState *ch, struct timeval *now)
+{
+	if (!ch->everGood)
+		return true;
+	return (diff(&ch->tvGood, now) / 1000) > failsafeMs;
 }
 
 unsigned long RCRx::diff(struct timeval *ptv0, struct timeval *ptv1)
@@ -65,7 +207,125 @@ unsigned long RCRx::diff(struct timeval *ptv0, struct timeval *ptv1)
   return val;
 }
 
-int RCRx::getRCPulse()
+//! Get the filtered pulse width on a channel
+/*!
+ * \param channel Channel number, 0 - getNumChannels()-1
+ * \return filtered pulse width in us, or 0 if the channel has lost signal
+ */
+int RCRx::getRCPulse(int channel)
+{
+	struct timeval now;
+	int pw;
+
+	if ((channel < 0) || (channel >= numChannels))
+		return 0;
+	gettimeofday(&now, NULL);
+	pthread_mutex_lock(&lock);
+	pw = isLost(&channels[channel], &now) ? 0 : channels[channel].filteredPw;
+	pthread_mutex_unlock(&lock);
+	return pw;
+}
+
+//! Get the stick position on a channel
+/*!
+ * \param channel Channel number, 0 - getNumChannels()-1
+ * \return stick position normalized to -1.0 - 1.0 using the channel calibration,
+ * or the channel's failsafe value if the channel has lost signal
+ */
+float RCRx::getStick(int channel)
+{
+	struct timeval now;
+	RCChannelState *ch;
+	float stick;
+
+	if ((channel < 0) || (channel >= numChannels))
+		return 0.0;
+	ch = &channels[channel];
+	gettimeofday(&now, NULL);
+	pthread_mutex_lock(&lock);
+	if (isLost(ch, &now)) {
+		stick = ch->failsafe;
+	} else {
+		stick = (float)(ch->filteredPw - ch->centerPw) / (float)ch->halfRangePw;
+		if (stick > 1.0)
+			stick = 1.0;
+		else if (stick < -1.0)
+			stick = -1.0;
+	}
+	pthread_mutex_unlock(&lock);
+	return stick;
+}
+
+//! Get the age of the data on a channel
+/*!
+ * \return milliseconds since the last good pulse, or 0xffffffff if there has never been one
+ */
+unsigned long RCRx::getAge(int channel)
+{
+	struct timeval now;
+	unsigned long age;
+
+	if ((channel < 0) || (channel >= numChannels))
+		return 0xffffffff;
+	gettimeofday(&now, NULL);
+	pthread_mutex_lock(&lock);
+	if (channels[channel].everGood)
+		age = diff(&channels[channel].tvGood, &now) / 1000;
+	else
+		age = 0xffffffff;
+	pthread_mutex_unlock(&lock);
+	return age;
+}
+
+//! Check whether any channel is in failsafe
+bool RCRx::signalLost()
+{
+	struct timeval now;
+	bool lost = false;
+	int i;
+
+	gettimeofday(&now, NULL);
+	pthread_mutex_lock(&lock);
+	for (i=0; i<numChannels; i++) {
+		if (isLost(&channels[i], &now))
+			lost = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return lost;
+}
+
+//! Get the number of pulses rejected as glitches on a channel
+unsigned long RCRx::getGlitchCount(int channel)
+{
+	if ((channel < 0) || (channel >= numChannels))
+		return 0;
+	return channels[channel].glitches;
+}
+
+//! Set the stick value getStick() reports for a channel when signal is lost
+void RCRx::setFailsafe(int channel, float stickValue)
+{
+	if ((channel < 0) || (channel >= numChannels))
+		return;
+	channels[channel].failsafe = stickValue;
+}
+
+//! Set how long a channel can go without a good pulse before it is considered lost
+void RCRx::setFailsafeTimeout(unsigned long ms)
+{
+	failsafeMs = ms;
+}
+
+//! Set the pulse widths that map to stick center & full deflection on a channel
+/*!
+ * \param channel Channel number, 0 - getNumChannels()-1
+ * \param centerPw Pulse width in us that getStick() reports as 0.0
+ * \param halfRangePw Change in pulse width in us from center that getStick() reports as +/-1.0
+ */
+void RCRx::setCalibration(int channel, int centerPw, int halfRangePw)
 {
-	return lastPw;
+	if ((channel < 0) || (channel >= numChannels) || (halfRangePw == 0))
+		return;
+	channels[channel].centerPw = centerPw;
+	channels[channel].halfRangePw = halfRangePw;
 }
@@ -11,31 +11,88 @@
 #ifndef RCRX_H_
 #define RCRX_H_
 
+#include <sys/time.h>
+#include <pthread.h>
+
 class CQEGpioInt;
 
+#define RCRX_MAX_CHANNELS 8		//!< most channels one receiver object will decode
+#define RCRX_MIN_PW 800			//!< shortest pulse (us) accepted as a valid servo pulse
+#define RCRX_MAX_PW 2200		//!< longest pulse (us) accepted as a valid servo pulse
+#define RCRX_PPM_SYNC 3000		//!< PPM gap (us) longer than this marks the start of a frame
+#define RCRX_FAILSAFE_MS 250	//!< default time without a good pulse before failsafe
+#define RCRX_MEDIAN_LEN 3		//!< length of the median filter on each channel
+
 /*! \class RCRx
- * \brief Measure pulse width from an R/C receiver.
+ * \brief Decode one or more channels from an R/C receiver.
+ *
+ * This class measures servo pulse widths from an R/C receiver using GPIO interrupts. It can
+ * decode up to RCRX_MAX_CHANNELS channels, either with each channel wired to its own digital
+ * I/O, or as a PPM sum-stream on a single digital I/O. Measurement happens entirely in the
+ * interrupt callback, so the control loop can read the latest value at any rate.
  *
- * This class measures the pulse width on a single R/C channel. It detects loss of pulses by assuming
- * it gets called every 50ms frame. If it doesn't see a pulse after being called 3 times in
- * a row (assumed to be in 3 frametimes) it returns 0 for pulsewidth.
+ * Each channel is filtered: pulses outside RCRX_MIN_PW - RCRX_MAX_PW are counted as glitches
+ * and dropped, and the remaining pulses go through a median-of-3 filter so a single bad pulse
+ * can't make the robot twitch.
  *
+ * If a channel doesn't get a good pulse for the failsafe timeout (default RCRX_FAILSAFE_MS) it
+ * is considered lost: getRCPulse() returns 0 and getStick() returns the channel's configured
+ * failsafe value (default 0.0, i.e. centered).
  */
 class RCRx {
 public:
-	RCRx(int dioNumIn, CQEGpioInt& gpioIn);
+	RCRx(int dioNumIn, CQEGpioInt& gpioIn);	// single channel on one DIO
+	RCRx(CQEGpioInt& gpioIn, int numChannelsIn, const int *dioNums);	// one DIO per channel
+	RCRx(CQEGpioInt& gpioIn, int ppmDioNum, int numChannelsIn);	// PPM sum-stream on one DIO
 	virtual ~RCRx();
-	int getRCPulse();					// returns 0 for no pulse for last 2 polls, or pulse width in us
+	int getRCPulse(int channel=0);		// returns 0 for lost signal, or filtered pulse width in us
+	float getStick(int channel=0);		// returns stick position normalized to -1.0 - 1.0
+	unsigned long getAge(int channel=0);	// ms since the last good pulse on the channel
+	bool signalLost();					// true if any channel is in failsafe
+	unsigned long getGlitchCount(int channel=0);
+	void setFailsafe(int channel, float stickValue);
+	void setFailsafeTimeout(unsigned long ms);
+	void setCalibration(int channel, int centerPw, int halfRangePw);
+
+	int getNumChannels() const
+	{
+		return numChannels;
+	}
 
 private:
+	struct RCChannelState {
+		RCRx *rx;						// owning receiver, so the static callback can find it
+		unsigned int dioIndex;			// io index of the DIO (PWM mode only)
+		bool waitRising;				// true if waiting for a rising edge
+		timeval tvRising;				// timeval of the last rising edge
+		timeval tvGood;					// timeval of the last good pulse
+		bool everGood;					// true once any good pulse has been received
+		int history[RCRX_MEDIAN_LEN];	// last few good pulse widths
+		int historyIndex;				// where the next pulse goes in history
+		int filteredPw;					// median of history
+		unsigned long glitches;			// count of rejected pulses
+		float failsafe;					// stick value to report when signal is lost
+		int centerPw;					// pulse width at stick center
+		int halfRangePw;				// pulse width change from center to full stick
+	};
+
+	void init(int numChannelsIn);
+	static void pwmCallback(unsigned int io, struct timeval *ptv, void *userdata);
+	static void ppmCallback(unsigned int io, struct timeval *ptv, void *userdata);
+	void acceptPulse(RCChannelState *ch, long pw, struct timeval *ptv);
+	bool isLost(RCChannelState *ch, struct timeval *now);
 	unsigned long diff(struct timeval *ptv0, struct timeval *ptv1);
-	void callback(unsigned int io, struct timeval *ptv, void *userdata);
 
 	CQEGpioInt &gpio;
-	int lastPw;							// last measured pulse width
-	unsigned int dioIndex;						// io index of the DIO
-	timeval tvRising;			// timeval of the last rising edge
-	bool waitRising;					// true if system is waiting for a rising edge
+	pthread_mutex_t lock;				// callbacks run on the gpio interrupt thread
+	int numChannels;
+	bool ppm;							// true if decoding a PPM sum-stream
+	unsigned int ppmDioIndex;			// io index of the PPM DIO
+	int ppmChannel;						// channel the next PPM interval belongs to
+	timeval tvPpmLast;					// time of the last PPM edge
+	bool ppmStarted;					// true once the first PPM edge has been seen
+	unsigned long failsafeMs;
+	RCChannelState channels[RCRX_MAX_CHANNELS];
 };
 
 #endif /* RCRX_H_ */
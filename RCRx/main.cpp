@@ -15,16 +15,18 @@ CQEGpioInt &gpio = CQEGpioInt::GetRef();
 
 void usage()
 {
-	printf("Usage: ControlledMotor testNum\n");
+	printf("Usage: RCRx testNum\n");
 	printf("testNum can be:\n");
-	printf("0: print pulse-widths\n");
+	printf("1: print pulse-widths from DIO 1\n");
+	printf("2: print stick values & age from 2 channels on DIOs 1 & 2\n");
+	printf("3: print pulse-widths from a 6-channel PPM stream on DIO 1\n");
 }
 
 void test1()
 {
 	int pw;
 
-	RCRx rcrx = RCRx(0, gpio);
+	RCRx rcrx(1, gpio);
 	Metro metro = Metro(50);
 	while (1){
 		if (metro.check()) {
@@ -35,6 +37,38 @@ void test1()
 
 }
 
+void test2()
+{
+	int dios[] = {1, 2};
+
+	RCRx rcrx(gpio, 2, dios);
+	rcrx.setFailsafe(1, -1.0);		// full reverse on channel 1 to make failsafe easy to see
+	Metro metro = Metro(50);
+	while (1){
+		if (metro.check()) {
+			printf("ch0: %5.2f (%lums) ch1: %5.2f (%lums) glitches: %lu %lu%s\n",
+					rcrx.getStick(0), rcrx.getAge(0), rcrx.getStick(1), rcrx.getAge(1),
+					rcrx.getGlitchCount(0), rcrx.getGlitchCount(1),
+					rcrx.signalLost() ? " FAILSAFE" : "");
+		}
+	}
+}
+
+void test3()
+{
+	int i;
+
+	RCRx rcrx(gpio, 1, 6);
+	Metro metro = Metro(50);
+	while (1){
+		if (metro.check()) {
+			for (i=0; i<rcrx.getNumChannels(); i++)
+				printf("%5d ", rcrx.getRCPulse(i));
+			printf("%s\n", rcrx.signalLost() ? "FAILSAFE" : "");
+		}
+	}
+}
+
 int main(int argc, char **argv)
 {
 	int test = 1;	// which test to run
@@ -48,8 +82,8 @@ int main(int argc, char **argv)
 
 	switch (test) {
 	case 1:	test1(); break;
-	//case 2: test2(); break;
-	//case 3: test3(); break;
+	case 2: test2(); break;
+	case 3: test3(); break;
 	//case 4: test4(); break;
 	default:
 		printf("Invalid option\n");
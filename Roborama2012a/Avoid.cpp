@@ -0,0 +1,73 @@
+/*
+ * Avoid.cpp
+ *
+ *  Created on: Dec 19, 2012
+ *      Author: bouchier
+ */
+
+#include <stdio.h>
+#include "Avoid.h"
+#include "RoombaSensors.h"
+#include "OccupancyGrid.h"
+
+#define AVOID_NEAR 9.0			// inches ahead of the robot's centre to look
+#define AVOID_FAR 15.0
+#define AVOID_SIDE_BEARING 30.0	// degrees either side of the heading
+#define AVOID_RADIUS 200		// mm, turn radius to veer away from something to one side
+
+Avoid::Avoid(RoombaSensors *rsIn, int speed) : Layer(speed) {
+	rs = rsIn;
+	grid = rs->getGrid();		// start mapping
+	velRqst = speed;
+	rotRqst = 0;
+	flag = 0;
+	layerName = (char *)"Avoid";
+	spinDir = 0;
+	avoids = 0;
+}
+
+void Avoid::eval()
+{
+	double x = rs->getX_pos(), y = rs->getY_pos(), th = rs->getTheta();
+	int left = 0, ahead = 0, right = 0;
+	double d;
+
+	for (d = AVOID_NEAR; d <= AVOID_FAR; d += AVOID_FAR - AVOID_NEAR) {
+		left += grid->getAhead(x, y, th, -AVOID_SIDE_BEARING, d) >= GRID_OCCUPIED;
+		ahead += grid->getAhead(x, y, th, 0.0, d) >= GRID_OCCUPIED;
+		right += grid->getAhead(x, y, th, AVOID_SIDE_BEARING, d) >= GRID_OCCUPIED;
+	}
+
+	if (!left && !ahead && !right) {
+		if (flag)
+			printf("Avoid: way ahead is clear\n");
+		flag = 0;
+		spinDir = 0;
+		return;
+	}
+	if (!flag) {
+		printf("Avoid: known obstacle ahead at X: %0.1f Y: %0.1f, L: %d ahead: %d R: %d\n",
+				x, y, left, ahead, right);
+		avoids++;
+	}
+	flag = 1;
+	velRqst = top_speed;
+
+	if (ahead || spinDir) {
+		// spin toward the clearer side, & keep going that way so we don't dither
+		if (!spinDir)
+			spinDir = (left > right) ? -1 : 1;
+		rotRqst = spinDir;
+	} else if (left) {
+		rotRqst = -AVOID_RADIUS;		// veer right
+	} else {
+		rotRqst = AVOID_RADIUS;		// veer left
+	}
+}
+
+void Avoid::printData()
+{
+	printf("Avoid: took control %lu times\n", avoids);
+	grid->printData();
+	grid->printMap(rs->getX_pos(), rs->getY_pos(), 20);
+}
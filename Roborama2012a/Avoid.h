@@ -0,0 +1,36 @@
+/*
+ * Avoid.h
+ *
+ *  Created on: Dec 19, 2012
+ *      Author: bouchier
+ */
+
+#ifndef AVOID_H_
+#define AVOID_H_
+
+#include "Layer.h"
+
+class RoombaSensors;
+class OccupancyGrid;
+
+/*
+ * Steer away from obstacles already in the occupancy grid, before the bumpers find them
+ * again. It looks at a fan of cells ahead: if something is ahead to one side it turns
+ * away on an arc; if it's dead ahead it spins toward the clearer side until the way is
+ * clear. It doesn't want control otherwise.
+ */
+class Avoid : public Layer {
+public:
+	Avoid(RoombaSensors *rsIn, int speed);
+	void eval();
+	unsigned int getInputs() {return(IN_POSE | IN_BUMP | IN_CLIFF | IN_SONAR);}	// the map changes with these
+	void printData();
+
+private:
+	RoombaSensors *rs;
+	OccupancyGrid *grid;
+	int spinDir;		// 1 left, -1 right while spinning away from something dead ahead, else 0
+	unsigned long avoids;	// times we took control
+};
+
+#endif /* AVOID_H_ */
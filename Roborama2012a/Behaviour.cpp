@@ -0,0 +1,306 @@
+/*
+ * Behaviour.cpp
+ *
+ *  Created on: Dec 14, 2012
+ *      Author: bouchier
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Behaviour.h"
+
+// the -E algorithms, as behaviour descriptions
+static const char *builtinAlgorithms[] = {
+	// 0: wander around a space bouncing off walls & cliffs, steering clear of ones already
+	// found. cruise layer runs forever
+	"name wander\n"
+	"layers wheeldrop bump avoid cruise stop\n",
+	// 1: seek a list of waypoints. target replaces cruise in the wander algorithm
+	"name waypoints\n"
+	"layers wheeldrop bump target stop\n",
+	// 2: spin in place a number of degrees
+	"name spin\n"
+	"layers spin\n",
+	// 3: bounce around inside a virtual cage
+	"name virtualCage\n"
+	"layers wheeldrop bump virtualCage avoid cruise stop\n"
+	"cage 40 40\n",
+	// 4: drive waypoints & grab a can if one comes in range
+	"name grabWaypoints\n"
+	"layers wheeldrop bump grab target stop\n",
+	// 5: spin back and forth to find the visual target and end up pointing to it
+	"name point2VisTarget\n"
+	"layers spin target point2VisTarget missionControl stop\n"
+	"mission point2Target\n",
+	// 6: RoboColumbus
+	"name roboColumbus\n"
+	"layers bump spin target point2VisTarget missionControl stop\n"
+	"mission roboColumbus\n",
+	// 7: TableBot
+	"name tableBot\n"
+	"layers grab bump spin target cruise point2VisTarget missionControl stop\n"
+	"mission tableBot\n",
+};
+#define NUM_BUILTIN_ALGORITHMS (int)(sizeof(builtinAlgorithms) / sizeof(builtinAlgorithms[0]))
+
+// the waypoint lists -a selects for algorithms 1 & 4
+static const char *builtinWaypoints[] = {
+	"waypoints 0 24  0 0\n",								// seek 24" forward, then return to 0,0
+	"waypoints 0 24  24 24  24 0  0 0\n"					// 2 foot square, 4 times
+	"waypoints 0 24  24 24  24 0  0 0\n"
+	"waypoints 0 24  24 24  24 0  0 0\n"
+	"waypoints 0 24  24 24  24 0  0 0\n",
+	"waypoints 0 20\n",									// 20" line
+	"waypoints 0 72  72 72  72 0  0 0\n"					// 6' square, clockwise, for UMBmark
+	"stopAtWaypoints\n",
+	"waypoints 0 72  -72 72  -72 0  0 0\n"				// 6' square, counter-clockwise, for UMBmark
+	"stopAtWaypoints\n",
+	"waypoints 0 24  -24 24  -24 0  0 0\n",				// 2' square
+	"waypoints 0 60  0 0  0 60  0 0  0 60  0 0  0 60  0 0  0 60  0 0\n"	// out & back many times
+	"waypoints 0 60  0 0  0 60  0 0  0 60  0 0  0 60  0 0  0 60  0 0\n",
+};
+#define NUM_BUILTIN_WAYPOINTS (int)(sizeof(builtinWaypoints) / sizeof(builtinWaypoints[0]))
+
+static const struct {
+	const char *name;
+	int mission;
+} missionNames[] = {
+	{ "point2Target", MISSION_POINT2TARGET },
+	{ "roboColumbus", MISSION_ROBOCOLUMBUS },
+	{ "tableBot", MISSION_TABLEBOT },
+};
+
+void behaviourInit(BehaviourConfig *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	strcpy(cfg->name, "unnamed");
+	cfg->mission = MISSION_NONE;
+}
+
+// parse an integer argument, reporting a bad one
+static bool intArg(char *word, int *value, const char *source, int lineNo)
+{
+	char *end;
+
+	if (word == NULL) {
+		printf("%s line %d: missing argument\n", source, lineNo);
+		return false;
+	}
+	*value = strtol(word, &end, 10);
+	if (*end != '\0') {
+		printf("%s line %d: %s isn't a number\n", source, lineNo, word);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Parse behaviour text into cfg, adding to what's already there. source names the text in
+ * error messages. Returns false on a syntax error
+ */
+bool behaviourParse(const char *text, const char *source, BehaviourConfig *cfg)
+{
+	char line[256];
+	char *word, *save, *comment;
+	const char *p = text, *eol;
+	int lineNo = 0, len, i, x, y;
+
+	while (*p) {
+		eol = strchr(p, '\n');
+		len = eol ? eol - p : strlen(p);
+		if (len >= (int)sizeof(line))
+			len = sizeof(line) - 1;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		p = eol ? eol + 1 : p + len;
+		lineNo++;
+
+		if ((comment = strchr(line, '#')) != NULL)
+			*comment = '\0';
+		if ((word = strtok_r(line, " \t\r", &save)) == NULL)
+			continue;
+
+		if (!strcmp(word, "name")) {
+			if ((word = strtok_r(NULL, " \t\r", &save)) != NULL) {
+				strncpy(cfg->name, word, BEH_NAME_LEN - 1);
+				cfg->name[BEH_NAME_LEN - 1] = '\0';
+			}
+		} else if (!strcmp(word, "layers")) {
+			while ((word = strtok_r(NULL, " \t\r", &save)) != NULL) {
+				if (cfg->numLayers == BEH_MAX_LAYERS) {
+					printf("%s line %d: more than %d layers\n", source, lineNo, BEH_MAX_LAYERS);
+					return false;
+				}
+				strncpy(cfg->layers[cfg->numLayers], word, BEH_NAME_LEN - 1);
+				cfg->layers[cfg->numLayers][BEH_NAME_LEN - 1] = '\0';
+				cfg->numLayers++;
+			}
+		} else if (!strcmp(word, "waypoints")) {
+			while ((word = strtok_r(NULL, " \t\r", &save)) != NULL) {
+				if (!intArg(word, &x, source, lineNo) ||
+						!intArg(strtok_r(NULL, " \t\r", &save), &y, source, lineNo))
+					return false;
+				if (cfg->waypoints[0] == BEH_MAX_WAYPOINTS) {
+					printf("%s line %d: more than %d waypoints\n", source, lineNo, BEH_MAX_WAYPOINTS);
+					return false;
+				}
+				cfg->waypoints[1 + 2 * cfg->waypoints[0]] = x;
+				cfg->waypoints[2 + 2 * cfg->waypoints[0]] = y;
+				cfg->waypoints[0]++;
+				cfg->haveWaypoints = true;
+			}
+		} else if (!strcmp(word, "spin")) {
+			if (!intArg(strtok_r(NULL, " \t\r", &save), &cfg->spin, source, lineNo))
+				return false;
+			cfg->haveSpin = true;
+		} else if (!strcmp(word, "param")) {
+			if (!intArg(strtok_r(NULL, " \t\r", &save), &cfg->param, source, lineNo))
+				return false;
+			cfg->haveParam = true;
+		} else if (!strcmp(word, "cage")) {
+			if (!intArg(strtok_r(NULL, " \t\r", &save), &cfg->cageX, source, lineNo) ||
+					!intArg(strtok_r(NULL, " \t\r", &save), &cfg->cageY, source, lineNo))
+				return false;
+			cfg->haveCage = true;
+		} else if (!strcmp(word, "plan")) {
+			cfg->plan = true;
+		} else if (!strcmp(word, "stopAtWaypoints")) {
+			cfg->stopAtWaypoints = true;
+		} else if (!strcmp(word, "mission")) {
+			word = strtok_r(NULL, " \t\r", &save);
+			for (i = 0; i < (int)(sizeof(missionNames) / sizeof(missionNames[0])); i++) {
+				if ((word != NULL) && !strcmp(word, missionNames[i].name))
+					break;
+			}
+			if (i == (int)(sizeof(missionNames) / sizeof(missionNames[0]))) {
+				printf("%s line %d: unknown mission %s\n", source, lineNo, word ? word : "");
+				return false;
+			}
+			cfg->mission = missionNames[i].mission;
+		} else {
+			printf("%s line %d: unknown keyword %s\n", source, lineNo, word);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Load a behaviour file. Returns false if it can't be read or parsed
+ */
+bool behaviourLoad(const char *path, BehaviourConfig *cfg)
+{
+	FILE *fp;
+	char *text;
+	long len;
+	bool rv;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror(path);
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+	text = (char *)malloc(len + 1);
+	len = fread(text, 1, len, fp);
+	text[len] = '\0';
+	fclose(fp);
+
+	behaviourInit(cfg);
+	rv = behaviourParse(text, path, cfg);
+	free(text);
+	return rv;
+}
+
+/*
+ * The behaviour of -E algorithm with -a arg: arg picks the waypoint list for algorithms
+ * 1 & 4, the spin for algorithm 2 & missionControl's argument for 5 - 7
+ */
+bool behaviourBuiltin(int algorithm, int arg, BehaviourConfig *cfg)
+{
+	behaviourInit(cfg);
+	if ((algorithm < 0) || (algorithm >= NUM_BUILTIN_ALGORITHMS)) {
+		printf("invalid algorithm %d\n", algorithm);
+		return false;
+	}
+	if (!behaviourParse(builtinAlgorithms[algorithm], "built-in algorithm", cfg))
+		return false;
+	switch (algorithm) {
+	case 1:
+	case 4:
+		return behaviourParse(builtinWaypoints[((arg >= 0) && (arg < NUM_BUILTIN_WAYPOINTS)) ? arg : 0],
+				"built-in waypoints", cfg);
+	case 2:
+		cfg->spin = arg;
+		cfg->haveSpin = true;
+		break;
+	case 5:
+	case 6:
+	case 7:
+		cfg->param = arg;
+		cfg->haveParam = true;
+		break;
+	}
+	return true;
+}
+
+void behaviourPrint(const BehaviourConfig *cfg)
+{
+	int i;
+
+	printf("behaviour %s: layers", cfg->name);
+	for (i = 0; i < cfg->numLayers; i++)
+		printf(" %s", cfg->layers[i]);
+	if (cfg->haveWaypoints)
+		printf(", %d waypoints", cfg->waypoints[0]);
+	if (cfg->haveSpin)
+		printf(", spin %d", cfg->spin);
+	if (cfg->mission != MISSION_NONE)
+		printf(", mission %d", cfg->mission);
+	if (cfg->haveParam)
+		printf(", param %d", cfg->param);
+	if (cfg->haveCage)
+		printf(", cage %d x %d", cfg->cageX, cfg->cageY);
+	if (cfg->plan)
+		printf(", planned");
+	if (cfg->stopAtWaypoints)
+		printf(", stopping at waypoints");
+	printf("\n");
+}
+
+/*
+ * Write cfg in the behaviour file format, so behaviourParse() reads it back
+ */
+void behaviourWrite(FILE *fp, const BehaviourConfig *cfg)
+{
+	int i;
+
+	fprintf(fp, "name %s\n", cfg->name);
+	fprintf(fp, "layers");
+	for (i = 0; i < cfg->numLayers; i++)
+		fprintf(fp, " %s", cfg->layers[i]);
+	fprintf(fp, "\n");
+	for (i = 0; cfg->haveWaypoints && (i < cfg->waypoints[0]); i++) {
+		if ((i % 8) == 0)
+			fprintf(fp, "%swaypoints", i ? "\n" : "");	// keep lines short
+		fprintf(fp, "  %d %d", cfg->waypoints[1 + 2 * i], cfg->waypoints[2 + 2 * i]);
+	}
+	if (cfg->haveWaypoints)
+		fprintf(fp, "\n");
+	if (cfg->haveSpin)
+		fprintf(fp, "spin %d\n", cfg->spin);
+	for (i = 0; i < (int)(sizeof(missionNames) / sizeof(missionNames[0])); i++) {
+		if (cfg->mission == missionNames[i].mission)
+			fprintf(fp, "mission %s\n", missionNames[i].name);
+	}
+	if (cfg->haveParam)
+		fprintf(fp, "param %d\n", cfg->param);
+	if (cfg->haveCage)
+		fprintf(fp, "cage %d %d\n", cfg->cageX, cfg->cageY);
+	if (cfg->plan)
+		fprintf(fp, "plan\n");
+	if (cfg->stopAtWaypoints)
+		fprintf(fp, "stopAtWaypoints\n");
+}
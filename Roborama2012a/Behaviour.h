@@ -0,0 +1,67 @@
+/*
+ * Behaviour.h
+ *
+ *  Created on: Dec 14, 2012
+ *      Author: bouchier
+ *
+ *  A behaviour (mission) description: the subsumption layer stack & its parameters. It
+ *  can be loaded from a text file, so a new mission doesn't need a rebuild, or taken from
+ *  the built-in equivalents of the old -E algorithms.
+ *
+ *  The file format is one keyword per line; # starts a comment:
+ *
+ *    name tableBot
+ *    layers grab bump spin target cruise point2VisTarget missionControl stop
+ *    waypoints 0 72  72 72  72 0  0 0		(x y pairs in inches; may be repeated)
+ *    spin 360							(degrees, for the spin layer)
+ *    mission tableBot					(missionControl's state machine: point2Target,
+ *    									 roboColumbus or tableBot)
+ *    param 48							(missionControl's argument, e.g. seek distance)
+ *    cage 40 40							(virtualCage size)
+ *    plan								(target plans a way round obstacles in the map)
+ *    stopAtWaypoints					(target stops & turns on the spot at each waypoint
+ *    									 instead of rounding it, e.g. for UMBmark squares)
+ *
+ *  Layers are listed highest priority first.
+ */
+
+#ifndef BEHAVIOUR_H_
+#define BEHAVIOUR_H_
+
+#include <stdio.h>
+
+#define BEH_MAX_LAYERS 16
+#define BEH_MAX_WAYPOINTS 64
+#define BEH_NAME_LEN 32
+
+// missionControl state machines, numbered as the -E algorithms which used them
+#define MISSION_NONE 0
+#define MISSION_POINT2TARGET 5
+#define MISSION_ROBOCOLUMBUS 6
+#define MISSION_TABLEBOT 7
+
+typedef struct {
+	char name[BEH_NAME_LEN];
+	char layers[BEH_MAX_LAYERS][BEH_NAME_LEN];
+	int numLayers;
+	int waypoints[1 + 2 * BEH_MAX_WAYPOINTS];	// Target's format: count, then x, y pairs
+	bool haveWaypoints;
+	int spin;
+	bool haveSpin;
+	int mission;
+	int param;
+	bool haveParam;
+	int cageX, cageY;
+	bool haveCage;
+	bool plan;
+	bool stopAtWaypoints;
+} BehaviourConfig;
+
+void behaviourInit(BehaviourConfig *cfg);
+bool behaviourLoad(const char *path, BehaviourConfig *cfg);
+bool behaviourParse(const char *text, const char *source, BehaviourConfig *cfg);
+bool behaviourBuiltin(int algorithm, int arg, BehaviourConfig *cfg);
+void behaviourPrint(const BehaviourConfig *cfg);
+void behaviourWrite(FILE *fp, const BehaviourConfig *cfg);
+
+#endif /* BEHAVIOUR_H_ */
@@ -16,6 +16,7 @@ class Bump : public Layer {
 public:
 	Bump(RoombaSensors *rs, int speed);
 	void eval();
+	unsigned int getInputs() {return((state == 0) ? (IN_BUMP | IN_CLIFF) : IN_TICK);}
     void setBounceOffBumps(bool bounceOffBumps)
     {
         this->bounceOffBumps = bounceOffBumps;
@@ -10,6 +10,7 @@
 Cruise::Cruise(int speed) : Layer(speed) {
 	velRqst = 100;		// initialize the Cruise layer. Other variables initialized in Layer
 	flag = 1;
+	cruiseEnable = true;
 	layerName = (char *)"Cruise";
 }
 
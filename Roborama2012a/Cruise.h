@@ -14,11 +14,13 @@ class Cruise : public Layer {
 public:
 	Cruise(int speed);
 	void eval();
+	unsigned int getInputs() {return(0);}	// only cruiseEnable
 
 	// getters & setters
     void setCruiseEnable(bool cruiseEnable)
     {
         this->cruiseEnable = cruiseEnable;
+        touch();
     }
 
 private:
@@ -17,6 +17,7 @@ class Grab : public Layer {
 public:
 	Grab(RoombaSensors *rsIn);
 	void eval();
+	unsigned int getInputs() {return(IN_CLIFF | IN_SONAR);}
 	void openGrabber();
 
 private:
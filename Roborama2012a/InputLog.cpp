@@ -0,0 +1,488 @@
+/*
+ * InputLog.cpp
+ *
+ *  Created on: Dec 17, 2012
+ *      Author: bouchier
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "InputLog.h"
+
+#define MAX_DESYNC_REPORTS 10
+
+InputLog *inputLog = NULL;
+
+// payload bytes of each fixed size record type
+static int recordLength(int type)
+{
+	switch (type) {
+	case IL_TICK: return 8;
+	case IL_SENSORS: return ROOMBA_SENSOR_BYTES;
+	case IL_ENCODERS: return 4;
+	case IL_SONAR: return 5;
+	case IL_COMPASS: return 2;
+	case IL_VISION: return 16;
+	case IL_KEYS: return 1;
+	case IL_MOTOR: return 9;
+	}
+	return -1;
+}
+
+static const char *recordName(int type)
+{
+	static const char *names[] = { "?", "tick", "sensors", "encoders", "sonar", "compass",
+			"vision", "keys", "motor", "sensors" };
+
+	return ((type >= IL_TICK) && (type <= IL_SENSOR_DELTA)) ? names[type] : names[0];
+}
+
+InputLog::InputLog(FILE *fpIn, bool replayingIn)
+{
+	fp = fpIn;
+	replaying = replayingIn;
+	behaviourInit(&cfg);
+	velocity = DEFAULT_VELOCITY;
+	compass = false;
+	params.leftClicksPerInch = LEFT_CLICKS_PER_INCH;
+	params.rightClicksPerInch = RIGHT_CLICKS_PER_INCH;
+	params.wheelBase = WHEEL_BASE;
+
+	// both ends start from the same values, so the first tick only carries what's non-zero
+	memset(sensorBytes, 0, sizeof(sensorBytes));
+	lEncoder = rEncoder = 0;
+	sonarRange = sonarQuality = 0;
+	cancel = false;
+
+	firstStamp.tv_sec = firstStamp.tv_usec = 0;
+	stamp = firstStamp;
+	ticks = records = bytes = 0;
+	motors = mismatches = desyncs = 0;
+}
+
+InputLog::~InputLog()
+{
+	if (fp != NULL)
+		fclose(fp);
+}
+
+/*
+ * Start recording a run of cfg to path. Returns NULL if the file can't be written
+ */
+InputLog *InputLog::record(const char *path, const BehaviourConfig &cfg, int velocity,
+		bool compass, const OdometryParams &params)
+{
+	FILE *fp;
+	InputLog *log;
+
+	if ((fp = fopen(path, "wb")) == NULL) {
+		perror(path);
+		return NULL;
+	}
+	log = new InputLog(fp, false);
+	log->cfg = cfg;
+	log->velocity = velocity;
+	log->compass = compass;
+	log->params = params;
+	if (!log->writeHeader()) {
+		perror(path);
+		delete log;
+		return NULL;
+	}
+	printf("recording inputs to %s\n", path);
+	return log;
+}
+
+/*
+ * Open a recording to replay. Returns NULL if it can't be read
+ */
+InputLog *InputLog::replay(const char *path)
+{
+	FILE *fp;
+	InputLog *log;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		perror(path);
+		return NULL;
+	}
+	log = new InputLog(fp, true);
+	if (!log->readHeader(path)) {
+		delete log;
+		return NULL;
+	}
+	return log;
+}
+
+bool InputLog::writeHeader()
+{
+	fprintf(fp, "RBIL %d\n", INPUTLOG_VERSION);
+	fprintf(fp, "velocity %d\n", velocity);
+	fprintf(fp, "compass %d\n", compass ? 1 : 0);
+	fprintf(fp, "leftClicksPerInch %0.4f\n", params.leftClicksPerInch);
+	fprintf(fp, "rightClicksPerInch %0.4f\n", params.rightClicksPerInch);
+	fprintf(fp, "wheelBase %0.4f\n", params.wheelBase);
+	behaviourWrite(fp, &cfg);
+	fprintf(fp, "data\n");
+	return !ferror(fp);
+}
+
+bool InputLog::readHeader(const char *path)
+{
+	char line[256], name[64], *text;
+	int version, len = 0, size = 1024, n;
+	double value;
+	bool rv;
+
+	if ((fgets(line, sizeof(line), fp) == NULL) || (sscanf(line, "RBIL %d", &version) != 1)) {
+		printf("%s isn't an input log\n", path);
+		return false;
+	}
+	if (version != INPUTLOG_VERSION) {
+		printf("%s is input log version %d, this reads version %d\n", path, version, INPUTLOG_VERSION);
+		return false;
+	}
+
+	// everything which isn't ours is the behaviour
+	text = (char *)malloc(size);
+	text[0] = '\0';
+	while (true) {
+		if (fgets(line, sizeof(line), fp) == NULL) {
+			printf("%s: header isn't terminated\n", path);
+			free(text);
+			return false;
+		}
+		if (!strcmp(line, "data\n"))
+			break;
+		n = sscanf(line, "%63s %lf", name, &value);
+		if ((n == 2) && !strcmp(name, "velocity"))
+			velocity = (int)value;
+		else if ((n == 2) && !strcmp(name, "compass"))
+			compass = (value != 0.0);
+		else if ((n == 2) && !strcmp(name, "leftClicksPerInch"))
+			params.leftClicksPerInch = value;
+		else if ((n == 2) && !strcmp(name, "rightClicksPerInch"))
+			params.rightClicksPerInch = value;
+		else if ((n == 2) && !strcmp(name, "wheelBase"))
+			params.wheelBase = value;
+		else {
+			n = strlen(line);
+			if (len + n + 1 > size) {
+				size *= 2;
+				text = (char *)realloc(text, size);
+			}
+			strcpy(text + len, line);
+			len += n;
+		}
+	}
+	rv = behaviourParse(text, path, &cfg);
+	free(text);
+	return rv;
+}
+
+void InputLog::put8(unsigned int v)
+{
+	putc(v & 0xff, fp);
+	bytes++;
+}
+
+void InputLog::put16(unsigned int v)
+{
+	put8(v);
+	put8(v >> 8);
+}
+
+void InputLog::put32(unsigned long v)
+{
+	put16(v);
+	put16(v >> 16);
+}
+
+unsigned int InputLog::get8()
+{
+	int c = getc(fp);
+
+	return (c == EOF) ? 0 : c;
+}
+
+unsigned int InputLog::get16()
+{
+	unsigned int v = get8();
+
+	return v | (get8() << 8);
+}
+
+unsigned long InputLog::get32()
+{
+	unsigned long v = get16();
+
+	return v | ((unsigned long)get16() << 16);
+}
+
+/*
+ * Replay: consume the next record if it's type. Returns false, leaving it, if it isn't
+ */
+bool InputLog::expect(int type)
+{
+	int c = getc(fp);
+
+	if (c == EOF)
+		return false;
+	if (c != type) {
+		ungetc(c, fp);
+		return false;
+	}
+	records++;
+	return true;
+}
+
+// the replay read something other than the recording did at this point
+void InputLog::desync(int type)
+{
+	int c = getc(fp);
+
+	if (c != EOF)
+		ungetc(c, fp);
+	if (desyncs++ < MAX_DESYNC_REPORTS)
+		printf("replay tick %lu: expected a %s record, the recording has %s; the stack has diverged from the recording\n",
+				ticks, recordName(type), (c == EOF) ? "ended" : recordName(c));
+}
+
+/*
+ * Start a tick. Recording writes the time the sensors were read; replaying skips
+ * anything the last tick didn't read back & replaces stamp with the recorded time
+ */
+void InputLog::tick(struct timeval *stampIo)
+{
+	if (!replaying) {
+		put8(IL_TICK);
+		put32(stampIo->tv_sec);
+		put32(stampIo->tv_usec);
+		records++;
+	} else {
+		if (atEnd())
+			return;
+		expect(IL_TICK);
+		stampIo->tv_sec = get32();
+		stampIo->tv_usec = get32();
+	}
+	if (ticks == 0)
+		firstStamp = *stampIo;
+	stamp = *stampIo;
+	ticks++;
+}
+
+/*
+ * Replay: true if there are no more ticks. Records the last tick didn't read are skipped
+ */
+bool InputLog::atEnd()
+{
+	int c, len;
+
+	while ((c = getc(fp)) != EOF) {
+		if (c == IL_TICK) {
+			ungetc(c, fp);
+			return false;
+		}
+		if (c == IL_SENSOR_DELTA)
+			len = 2 * get8();
+		else
+			len = recordLength(c);
+		if (len < 0) {
+			printf("replay: bad record type %d after tick %lu, stopping\n", c, ticks);
+			fseek(fp, 0, SEEK_END);
+			return true;
+		}
+		if (desyncs++ < MAX_DESYNC_REPORTS)
+			printf("replay tick %lu: the recording has a %s record the replay didn't read\n",
+					ticks, recordName(c));
+		fseek(fp, len, SEEK_CUR);
+	}
+	return true;
+}
+
+// the replayed stack stopped, but the recording goes on
+void InputLog::stoppedEarly()
+{
+	desyncs++;
+	printf("replay: the stack stopped after tick %lu, but the recording goes on\n", ticks);
+}
+
+void InputLog::roombaInputs(Roomba *roomba)
+{
+	int i, n;
+
+	if (!replaying) {
+		for (i = n = 0; i < ROOMBA_SENSOR_BYTES; i++) {
+			if (roomba->sensor_bytes[i] != sensorBytes[i])
+				n++;
+		}
+		if (n > ROOMBA_SENSOR_BYTES / 2) {
+			put8(IL_SENSORS);
+			for (i = 0; i < ROOMBA_SENSOR_BYTES; i++)
+				put8(roomba->sensor_bytes[i]);
+			records++;
+		} else if (n) {
+			put8(IL_SENSOR_DELTA);
+			put8(n);
+			for (i = 0; i < ROOMBA_SENSOR_BYTES; i++) {
+				if (roomba->sensor_bytes[i] != sensorBytes[i]) {
+					put8(i);
+					put8(roomba->sensor_bytes[i]);
+				}
+			}
+			records++;
+		}
+		memcpy(sensorBytes, roomba->sensor_bytes, ROOMBA_SENSOR_BYTES);
+		if ((roomba->lEncoder != lEncoder) || (roomba->rEncoder != rEncoder)) {
+			lEncoder = roomba->lEncoder;
+			rEncoder = roomba->rEncoder;
+			put8(IL_ENCODERS);
+			put16(lEncoder);
+			put16(rEncoder);
+			records++;
+		}
+		return;
+	}
+	if (expect(IL_SENSORS)) {
+		for (i = 0; i < ROOMBA_SENSOR_BYTES; i++)
+			sensorBytes[i] = get8();
+	} else if (expect(IL_SENSOR_DELTA)) {
+		for (n = get8(); n > 0; n--) {
+			i = get8();
+			sensorBytes[i % ROOMBA_SENSOR_BYTES] = get8();
+		}
+	}
+	if (expect(IL_ENCODERS)) {
+		lEncoder = get16();
+		rEncoder = get16();
+	}
+	memcpy(roomba->sensor_bytes, sensorBytes, ROOMBA_SENSOR_BYTES);
+	roomba->lEncoder = lEncoder;
+	roomba->rEncoder = rEncoder;
+}
+
+void InputLog::sonar(int *range, int *quality)
+{
+	if (!replaying) {
+		if ((*range != sonarRange) || (*quality != sonarQuality)) {
+			sonarRange = *range;
+			sonarQuality = *quality;
+			put8(IL_SONAR);
+			put32(sonarRange);
+			put8(sonarQuality);
+			records++;
+		}
+		return;
+	}
+	if (expect(IL_SONAR)) {
+		sonarRange = (int)get32();
+		sonarQuality = get8();
+	}
+	*range = sonarRange;
+	*quality = sonarQuality;
+}
+
+void InputLog::compassHeading(unsigned short *heading)
+{
+	if (!replaying) {
+		put8(IL_COMPASS);
+		put16(*heading);
+		records++;
+	} else if (expect(IL_COMPASS)) {
+		*heading = get16();
+	} else {
+		desync(IL_COMPASS);
+		*heading = 0xffff;		// as a failed read
+	}
+}
+
+void InputLog::keys(bool *cancelIo)
+{
+	if (!replaying) {
+		if (*cancelIo != cancel) {
+			cancel = *cancelIo;
+			put8(IL_KEYS);
+			put8(cancel);
+			records++;
+		}
+		return;
+	}
+	if (expect(IL_KEYS))
+		cancel = get8();
+	*cancelIo = cancel;
+}
+
+void InputLog::vision(rrClientStruct *rrc)
+{
+	if (!replaying) {
+		put8(IL_VISION);
+		put32(rrc->getShapeParams);
+		put32(rrc->shapeParams[0]);
+		put32(rrc->shapeParams[1]);
+		put32(rrc->sonarRange);
+		records++;
+	} else if (expect(IL_VISION)) {
+		rrc->structInitialized = 6060;
+		rrc->getShapeParams = (int)get32();
+		rrc->shapeParams[0] = (int)get32();
+		rrc->shapeParams[1] = (int)get32();
+		rrc->sonarRange = (int)get32();
+	} else {
+		desync(IL_VISION);
+		rrc->structInitialized = 6060;
+		rrc->getShapeParams = 1;	// as if rrclient hadn't answered yet
+	}
+}
+
+/*
+ * MotorCmd's output for this tick: vel & rot for VEL_CMD, the mode for ROOMBA_MODE.
+ * Replaying compares it with the recording
+ */
+void InputLog::motor(int cmd, int a, int b)
+{
+	int rCmd, rA, rB;
+
+	motors++;
+	if (!replaying) {
+		put8(IL_MOTOR);
+		put8(cmd);
+		put32(a);
+		put32(b);
+		records++;
+		return;
+	}
+	if (!expect(IL_MOTOR)) {
+		desync(IL_MOTOR);
+		return;
+	}
+	rCmd = get8();
+	rA = (int)get32();
+	rB = (int)get32();
+	if ((cmd != rCmd) || (a != rA) || (b != rB)) {
+		if (mismatches++ < MAX_DESYNC_REPORTS)
+			printf("replay tick %lu: motor command %d %d %d, recorded %d %d %d\n",
+					ticks, cmd, a, b, rCmd, rA, rB);
+	}
+}
+
+// milliseconds from the first tick to the current one
+unsigned long InputLog::getRunMillis() const
+{
+	return (stamp.tv_sec - firstStamp.tv_sec) * 1000 + (stamp.tv_usec - firstStamp.tv_usec) / 1000;
+}
+
+void InputLog::printData()
+{
+	double secs = (stamp.tv_sec - firstStamp.tv_sec) + (stamp.tv_usec - firstStamp.tv_usec) / 1e6;
+
+	if (!replaying) {
+		fflush(fp);
+		printf("input log: %lu ticks over %0.1f s, %lu records, %lu bytes (%0.1f bytes/tick)\n",
+				ticks, secs, records, bytes, ticks ? (double)bytes / ticks : 0.0);
+	} else {
+		printf("replay: %lu ticks over %0.1f s recorded, %lu motor commands, %lu differ, %lu desyncs: %s\n",
+				ticks, secs, motors, mismatches, desyncs,
+				(mismatches || desyncs) ? "OUTPUT DIFFERS FROM THE RECORDING" : "output identical");
+	}
+}
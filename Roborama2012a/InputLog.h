@@ -0,0 +1,140 @@
+/*
+ * InputLog.h
+ *
+ *  Created on: Dec 17, 2012
+ *      Author: bouchier
+ *
+ *  Record every input the subsumption stack reads during a run, & replay them through
+ *  RoombaSensors & the layers later, without the Roomba, sonar, camera or compass.
+ *
+ *  The log starts with a text header, so it says what was run:
+ *
+ *    RBIL 1
+ *    velocity 200
+ *    compass 1
+ *    leftClicksPerInch 58.5000		(odometry calibration at the time)
+ *    rightClicksPerInch 58.5000
+ *    wheelBase 9.1300
+ *    name tableBot					(the behaviour, in Behaviour.h's format)
+ *    layers ...
+ *    data
+ *
+ *  followed by binary records, a type byte then little-endian fields. Inputs which rarely
+ *  change are only written when they do:
+ *
+ *    IL_TICK      u32 sec, u32 usec		when the sensors were read; starts each tick
+ *    IL_SENSORS   ROOMBA_SENSOR_BYTES	roomba->sensor_bytes, if most of them changed
+ *    IL_SENSOR_DELTA u8 n, n x (u8 index, u8 value)	otherwise, the ones which changed
+ *    IL_ENCODERS  u16 left, u16 right	if changed
+ *    IL_SONAR     s32 range, u8 quality	if changed
+ *    IL_COMPASS   u16 heading			tenths of a degree, every reading
+ *    IL_VISION    s32 x 4				rrClientStruct getShapeParams, shapeParams[2],
+ *    									sonarRange, every time Point2VisTarget reads it
+ *    IL_KEYS      u8 cancel				if changed
+ *    IL_MOTOR     u8 cmd, s32, s32		MotorCmd's output: vel & rot, or the mode
+ *
+ *  Each input point calls the method for its input: when recording it writes the value
+ *  it was given, when replaying it replaces it with the recorded one. MotorCmd's output
+ *  is checked against the recording instead, so a replay shows whether a change to the
+ *  layers alters what the robot would have done.
+ */
+
+#ifndef INPUTLOG_H_
+#define INPUTLOG_H_
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "roombalib.h"
+#include "Behaviour.h"
+#include "Odometry.h"
+#include "rrClient.h"
+
+#define INPUTLOG_VERSION 1
+
+// record types
+#define IL_TICK 1
+#define IL_SENSORS 2
+#define IL_ENCODERS 3
+#define IL_SONAR 4
+#define IL_COMPASS 5
+#define IL_VISION 6
+#define IL_KEYS 7
+#define IL_MOTOR 8
+#define IL_SENSOR_DELTA 9
+
+class InputLog {
+public:
+	static InputLog *record(const char *path, const BehaviourConfig &cfg, int velocity,
+			bool compass, const OdometryParams &params);
+	static InputLog *replay(const char *path);
+	~InputLog();
+
+	bool isReplay() const { return replaying; }
+	const BehaviourConfig &getConfig() const { return cfg; }
+	int getVelocity() const { return velocity; }
+	bool getCompass() const { return compass; }
+	const OdometryParams &getParams() const { return params; }
+
+	// the input points, in the order a tick reads them
+	void tick(struct timeval *stamp);
+	void roombaInputs(Roomba *roomba);
+	void sonar(int *range, int *quality);
+	void compassHeading(unsigned short *heading);
+	void keys(bool *cancel);
+	void vision(rrClientStruct *rrc);
+	void motor(int cmd, int a, int b);
+
+	// replay
+	bool atEnd();
+	void stoppedEarly();
+	unsigned long getTicks() const { return ticks; }
+	unsigned long getRunMillis() const;
+	unsigned long getMismatches() const { return mismatches; }
+	unsigned long getDesyncs() const { return desyncs; }
+	const struct timeval &getFirstStamp() const { return firstStamp; }
+	const struct timeval &getStamp() const { return stamp; }
+	void printData();
+
+private:
+	InputLog(FILE *fpIn, bool replayingIn);
+	bool writeHeader();
+	bool readHeader(const char *path);
+	bool expect(int type);
+	void desync(int type);
+
+	void put8(unsigned int v);
+	void put16(unsigned int v);
+	void put32(unsigned long v);
+	unsigned int get8();
+	unsigned int get16();
+	unsigned long get32();
+
+	FILE *fp;
+	bool replaying;
+	BehaviourConfig cfg;
+	int velocity;
+	bool compass;
+	OdometryParams params;
+
+	// the latest value of each input which is only written when it changes
+	unsigned char sensorBytes[ROOMBA_SENSOR_BYTES];
+	unsigned short lEncoder, rEncoder;
+	int sonarRange, sonarQuality;
+	bool cancel;
+
+	struct timeval firstStamp, stamp;
+	unsigned long ticks;
+	unsigned long records, bytes;
+	unsigned long motors, mismatches, desyncs;
+};
+
+// the log being recorded or replayed, or NULL
+extern InputLog *inputLog;
+
+// true if inputs come from inputLog rather than the hardware
+static inline bool inputReplaying()
+{
+	return (inputLog != NULL) && inputLog->isReplay();
+}
+
+#endif /* INPUTLOG_H_ */
@@ -13,6 +13,7 @@ Layer::Layer() {
 	velRqst = 0;
 	flag = 0;
 	top_speed = 0;
+	dirty = true;			// always evaluate the first time
 	//printf("setting speed to 0\n");
 }
 
@@ -22,6 +23,7 @@ Layer::Layer(int speed) {
 	velRqst = 0;
 	flag = 0;
 	top_speed = speed;
+	dirty = true;
 	//printf("setting speed to %d\n", speed);
 }
 
@@ -11,13 +11,26 @@
 // cmd defines
 #define VEL_CMD 0
 #define ROOMBA_MODE 1
-// Layer is an abstract class. Subclasses implement eval()
+
+// inputs a layer's eval() reads. Subsumption only re-evaluates a layer when one of them
+// has changed since its last eval, or something has touch()ed it
+#define IN_BUMP 0x01		// bumpers & wheel drops
+#define IN_CLIFF 0x02		// cliff sensors
+#define IN_POSE 0x04		// odometry X, Y & theta
+#define IN_SONAR 0x08		// sonar range
+#define IN_VISION 0x10		// visual target bearing
+#define IN_TICK 0x80		// every tick, e.g. while a state timer is running
+#define IN_ALL 0xff
+
+// Layer is an abstract class. Subclasses implement eval(), & getInputs() if they don't
+// need evaluating every tick
 
 class Layer {
 public:
 	Layer();
 	Layer(int speed);
 	virtual void eval() =0;	// pure virtual function
+	virtual unsigned int getInputs() {return(IN_ALL);}	// what eval() reads in the current state
 	int slew(int requested, int rate);
 
 protected:
@@ -30,6 +43,7 @@ protected:
     char *layerName;
     int top_speed;			// max speed
     int bot_speed;			// current bot speed
+    bool dirty;				// eval() must run next tick whatever the inputs do
 
 public:
     // getters & setters
@@ -69,6 +83,19 @@ public:
         return layerName;
     }
 
+    // something eval() reads, other than its inputs, has changed: evaluate next tick
+    void touch()
+    {
+        dirty = true;
+    }
+
+    bool takeDirty()
+    {
+        bool rv = dirty;
+        dirty = false;
+        return rv;
+    }
+
 };
 
 #endif /* LAYER_H_ */
@@ -10,6 +10,7 @@
 #include "roombalib.h"
 #include "MissionControl.h"
 #include "Subsumption.h"
+#include "Behaviour.h"
 #include "RoombaSensors.h"
 #include "Target.h"
 #include "Point2VisTarget.h"
@@ -32,6 +33,8 @@ MissionControl::MissionControl(RoombaSensors *rsIn, Target *tIn, Point2VisTarget
 	b = bIn;
 	c = cIn;
 
+	mission = MISSION_NONE;
+	param = 0;
 	state = 0;
 	target[0] = 1;
 	target[1] = 0;
@@ -43,16 +46,22 @@ void MissionControl::setSubPtr(Subsumption *subIn)
 	sub = subIn;
 }
 
+void MissionControl::setMission(int missionIn, int paramIn)
+{
+	mission = missionIn;
+	param = paramIn;
+}
+
 void MissionControl::eval()
 {
-	switch(sub->getAlgorithm()) {
-	case 5:
+	switch(mission) {
+	case MISSION_POINT2TARGET:
 		point2TargetSm();
 		break;
-	case 6:
+	case MISSION_ROBOCOLUMBUS:
 		roboColumbusSm();
 		break;
-	case 7:
+	case MISSION_TABLEBOT:
 		tableBotSm();
 		break;
 	default:
@@ -92,7 +101,7 @@ void MissionControl::roboColumbusSm()
 
 	switch (state) {
 	case 0:
-		target[2] = sub->getParam();	// set target Y coordinate to the argument passed with -a
+		target[2] = param;	// set target Y coordinate to the mission's param (-a)
 		t->setTargets(target);			// set the target in Target
 		t->setSeekSpeed(200);
 
@@ -148,7 +157,7 @@ void MissionControl::tableBotSm()
 
 	switch (state) {
 	case 0:
-		target[2] = sub->getParam();	// set target Y coordinate to the argument passed with -a
+		target[2] = param;	// set target Y coordinate to the mission's param (-a)
 		t->setTargets(target);			// set the target in Target
 		state = 1;
 		fprintf(stderr, "starting tableBot state machine\n");
@@ -252,7 +261,7 @@ void MissionControl::tableBotSm()
 		}
 		break;
 	case 10:
-		target[2] = sub->getParam();	// set target Y coordinate to the argument passed with -a - seek to near end
+		target[2] = param;	// set target Y coordinate to the mission's param (-a) - seek to near end
 		t->setTargets(target);			// set the target in Target
 		state = 11;
 		fprintf(stderr, "seeking to end of table\n");
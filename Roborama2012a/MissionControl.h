@@ -22,6 +22,7 @@ class MissionControl : public Layer {
 public:
 	MissionControl(RoombaSensors *rs, Target *t, Point2VisTarget *pv, Spin *s, Bump *b, Cruise *c);
 	void eval();
+	unsigned int getInputs() {return(IN_TICK);}	// state machines poll & time out
 	void setMission(int algorithm, int param);
 	void setSubPtr(Subsumption *subIn);
 
@@ -33,6 +34,8 @@ private:
 	Spin *s;
 	Bump *b;
 	Cruise *c;
+	int mission;	// which state machine, MISSION_* in Behaviour.h
+	int param;		// its argument
 	int state;
 	int stateTimer;
 	int target[3];	// 20" line
@@ -9,6 +9,7 @@
 #include "roombalib.h"
 #include "MotorCmd.h"
 #include "Layer.h"
+#include "InputLog.h"
 
 MotorCmd::MotorCmd(Roomba *roombaIn) {
 	// Force motors to stop
@@ -29,12 +30,16 @@ void MotorCmd::setSpeed(Layer * activeLayer)
 	case VEL_CMD:
 		vel = activeLayer->getVel();
 		rot = activeLayer->getRot();
+		if (inputLog != NULL)
+			inputLog->motor(VEL_CMD, vel, rot);
 		if ((vel != lastVel) || (rot != lastRot)) {
 			printf("\nActive layer %s, vel: %d rot: %d\n", activeLayer->getLayerName(), vel, rot);
 		}
 		lastVel = vel;
 		lastRot = rot;
 
+		// send it every tick anyway; roombalib drops unchanged commands but resends
+		// them every ROOMBA_TX_REFRESH_MS as a keep-alive
 		if (rot == 0) {
 			//printf("Driving forward at %d\n", cmd);
 			roomba_forward_at(roomba, vel);
@@ -49,6 +54,8 @@ void MotorCmd::setSpeed(Layer * activeLayer)
 		}
 		break;
 	case ROOMBA_MODE:
+		if (inputLog != NULL)
+			inputLog->motor(ROOMBA_MODE, activeLayer->getCmdArg(), 0);
 		printf("setting roomba mode to %d\n", activeLayer->getCmdArg());
 		roomba_mode(roomba, activeLayer->getCmdArg());
 		activeLayer->setCmd(VEL_CMD);		// set mode back to velocity
@@ -62,4 +69,5 @@ void MotorCmd::setSpeed(Layer * activeLayer)
 void MotorCmd::printData()
 {
 	printf("lastVel: %d lastRot: %d\n", lastVel, lastRot);
+	roomba_print_tx_stats(roomba);
 }
@@ -0,0 +1,253 @@
+/*
+ * OccupancyGrid.cpp
+ *
+ *  Created on: Dec 19, 2012
+ *      Author: bouchier
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "OccupancyGrid.h"
+
+#define DEG2RAD (M_PI / 180.0)
+
+// where the bumpers & cliff sensors are, degrees clockwise from straight ahead
+#define BUMP_LEFT_BEARING -40.0
+#define BUMP_RIGHT_BEARING 40.0
+static const double cliffBearing[4] = { -70.0, -25.0, 25.0, 70.0 };	// getCliff() bit order
+
+OccupancyGrid::OccupancyGrid() {
+	int i, j;
+
+	for (i = 0; i < GRID_SLOTS; i++) {
+		for (j = 0; j < GRID_SLOTS; j++)
+			tiles[i][j].used = false;
+	}
+	recycled = updates = maxUpdates = ticks = 0;
+	numChanged = 0;
+	changesLost = false;
+}
+
+int OccupancyGrid::toCell(double v)
+{
+	return (int)floor(v / GRID_CELL);
+}
+
+/*
+ * The tile holding cell cx, cy. If it isn't in the map it's made, replacing whatever
+ * tile was in its slot, if create is true; else NULL is returned
+ */
+OccupancyGrid::Tile *OccupancyGrid::tile(int cx, int cy, bool create)
+{
+	int tx = cx >> GRID_TILE_SHIFT;
+	int ty = cy >> GRID_TILE_SHIFT;
+	Tile *t = &tiles[tx & (GRID_SLOTS - 1)][ty & (GRID_SLOTS - 1)];
+
+	if (t->used && (t->tx == tx) && (t->ty == ty))
+		return t;
+	if (!create)
+		return NULL;
+	if (t->used) {
+		recycled++;
+		changesLost = true;		// whatever it held is forgotten
+	}
+	t->tx = tx;
+	t->ty = ty;
+	t->used = true;
+	memset(t->cells, 0x88, sizeof(t->cells));	// log-odds 0, unknown
+	return t;
+}
+
+// log-odds of a cell, 0 if it's unknown
+int OccupancyGrid::cell(int cx, int cy)
+{
+	Tile *t = tile(cx, cy, false);
+	int i;
+
+	if (t == NULL)
+		return 0;
+	i = ((cy & (GRID_TILE_CELLS - 1)) << GRID_TILE_SHIFT) | (cx & (GRID_TILE_CELLS - 1));
+	return ((i & 1) ? (t->cells[i >> 1] >> 4) : (t->cells[i >> 1] & 0xf)) - 8;
+}
+
+void OccupancyGrid::add(int cx, int cy, int delta)
+{
+	Tile *t = tile(cx, cy, true);
+	int i = ((cy & (GRID_TILE_CELLS - 1)) << GRID_TILE_SHIFT) | (cx & (GRID_TILE_CELLS - 1));
+	unsigned char *b = &t->cells[i >> 1];
+	int old = ((i & 1) ? (*b >> 4) : (*b & 0xf)) - 8;
+	int v = old + delta;
+
+	if (v > GRID_MAX)
+		v = GRID_MAX;
+	else if (v < GRID_MIN)
+		v = GRID_MIN;
+	if (i & 1)
+		*b = (*b & 0x0f) | ((v + 8) << 4);
+	else
+		*b = (*b & 0xf0) | (v + 8);
+	updates++;
+
+	if ((old >= GRID_OCCUPIED) != (v >= GRID_OCCUPIED)) {
+		if (numChanged < GRID_MAX_CHANGES) {
+			changed[numChanged].cx = cx;
+			changed[numChanged].cy = cy;
+			numChanged++;
+		} else {
+			changesLost = true;
+		}
+	}
+}
+
+/*
+ * Copy the cells which became or stopped being obstacles since the last call into
+ * changes, which must hold GRID_MAX_CHANGES, & return how many. -1 means some weren't
+ * kept, so the caller must look at the whole map again
+ */
+int OccupancyGrid::takeChanges(GridCell *changes)
+{
+	int n = numChanged;
+
+	if (changesLost)
+		n = -1;
+	else
+		memcpy(changes, changed, numChanged * sizeof(GridCell));
+	numChanged = 0;
+	changesLost = false;
+	return n;
+}
+
+// the point distance inches from x, y at bearing degrees clockwise from heading theta
+void OccupancyGrid::addAhead(double x, double y, double theta, double bearing, double distance, int delta)
+{
+	double a = theta + bearing * DEG2RAD;
+
+	add(toCell(x + distance * sin(a)), toCell(y + distance * cos(a)), delta);
+}
+
+int OccupancyGrid::get(double x, double y)
+{
+	return cell(toCell(x), toCell(y));
+}
+
+// an obstacle known without seeing it, e.g. an arena wall
+void OccupancyGrid::setOccupied(double x, double y)
+{
+	add(toCell(x), toCell(y), GRID_MAX - GRID_MIN);
+}
+
+int OccupancyGrid::getAhead(double x, double y, double theta, double bearing, double distance)
+{
+	double a = theta + bearing * DEG2RAD;
+
+	return get(x + distance * sin(a), y + distance * cos(a));
+}
+
+/*
+ * Step through the cells from x0, y0 towards x1, y1, at most cells of them, clearing
+ * them. If hit is true, the last one, at x1, y1, is marked as an echo instead
+ */
+void OccupancyGrid::ray(double x0, double y0, double x1, double y1, int cells, bool hit)
+{
+	int cx = toCell(x0), cy = toCell(y0);
+	int ex = toCell(x1), ey = toCell(y1);
+	int dx = ex > cx ? ex - cx : cx - ex;
+	int dy = ey > cy ? ey - cy : cy - ey;
+	int sx = ex > cx ? 1 : -1;
+	int sy = ey > cy ? 1 : -1;
+	int err = dx - dy, e2, n;
+
+	for (n = 0; n < cells; n++) {
+		if ((cx == ex) && (cy == ey)) {
+			add(cx, cy, hit ? GRID_HIT : -GRID_MISS);
+			return;
+		}
+		add(cx, cy, -GRID_MISS);
+		e2 = 2 * err;
+		if (e2 > -dy) {
+			err -= dy;
+			cx += sx;
+		}
+		if (e2 < dx) {
+			err += dx;
+			cy += sy;
+		}
+	}
+}
+
+/*
+ * Fold one tick's sensors into the map, with the robot at x, y, theta. Bumps & cliffs
+ * are certain, so their cells go straight to occupied; the sonar clears the cells its
+ * ping passed through & marks the one it echoed from
+ */
+void OccupancyGrid::update(double x, double y, double theta, bool lBump, bool rBump, int cliff,
+		int sonarRange, int sonarQuality)
+{
+	unsigned long before = updates;
+	double sx, sy, range;
+	int i;
+
+	ticks++;
+	add(toCell(x), toCell(y), -GRID_MISS);		// we're standing on it
+
+	if (lBump)
+		addAhead(x, y, theta, rBump ? 0.0 : BUMP_LEFT_BEARING, GRID_ROBOT_RADIUS + GRID_CELL / 2, GRID_MAX - GRID_MIN);
+	if (rBump && !lBump)
+		addAhead(x, y, theta, BUMP_RIGHT_BEARING, GRID_ROBOT_RADIUS + GRID_CELL / 2, GRID_MAX - GRID_MIN);
+	for (i = 0; i < 4; i++) {
+		if (cliff & (1 << i))
+			addAhead(x, y, theta, cliffBearing[i], GRID_ROBOT_RADIUS, GRID_MAX - GRID_MIN);
+	}
+
+	if ((sonarQuality > 0) && (sonarRange > 0)) {
+		sx = x + GRID_ROBOT_RADIUS * sin(theta);
+		sy = y + GRID_ROBOT_RADIUS * cos(theta);
+		range = sonarRange;
+		if (range > GRID_MAX_RAY * GRID_CELL)
+			ray(sx, sy, sx + range * sin(theta), sy + range * cos(theta), GRID_MAX_RAY, false);
+		else
+			ray(sx, sy, sx + range * sin(theta), sy + range * cos(theta), GRID_MAX_RAY + 1, true);
+	}
+
+	if (updates - before > maxUpdates)
+		maxUpdates = updates - before;
+}
+
+void OccupancyGrid::printData()
+{
+	int i, j, n = 0;
+
+	for (i = 0; i < GRID_SLOTS; i++) {
+		for (j = 0; j < GRID_SLOTS; j++) {
+			if (tiles[i][j].used)
+				n++;
+		}
+	}
+	printf("occupancy grid: %d tiles in use, %lu recycled, %0.1f cell updates/tick, max %lu\n",
+			n, recycled, ticks ? (double)updates / ticks : 0.0, maxUpdates);
+}
+
+/*
+ * Print the map radius cells around x, y, +Y up: # occupied, . seen free, R the robot
+ */
+void OccupancyGrid::printMap(double x, double y, int radius)
+{
+	int rx = toCell(x), ry = toCell(y);
+	int cx, cy, v;
+
+	for (cy = ry + radius; cy >= ry - radius; cy--) {
+		for (cx = rx - radius; cx <= rx + radius; cx++) {
+			v = cell(cx, cy);
+			if ((cx == rx) && (cy == ry))
+				putchar('R');
+			else if (v >= GRID_OCCUPIED)
+				putchar('#');
+			else if (v < 0)
+				putchar('.');
+			else
+				putchar(' ');
+		}
+		putchar('\n');
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ * OccupancyGrid.h
+ *
+ *  Created on: Dec 19, 2012
+ *      Author: bouchier
+ */
+
+#ifndef OCCUPANCYGRID_H_
+#define OCCUPANCYGRID_H_
+
+#include <stdio.h>
+
+#define GRID_CELL 3.0			// inches per cell side
+#define GRID_TILE_SHIFT 4		// tiles are 16 x 16 cells
+#define GRID_SLOT_SHIFT 3		// 8 x 8 tiles kept, 32' square around the robot
+#define GRID_TILE_CELLS (1 << GRID_TILE_SHIFT)
+#define GRID_SLOTS (1 << GRID_SLOT_SHIFT)
+#define GRID_TILE_BYTES (GRID_TILE_CELLS * GRID_TILE_CELLS / 2)
+
+// log-odds, 4 bits per cell
+#define GRID_MIN -8
+#define GRID_MAX 7
+#define GRID_HIT 2				// sonar echo
+#define GRID_MISS 1				// sonar passed through, or the robot is on the cell
+#define GRID_OCCUPIED 4			// at or above this a cell is treated as an obstacle
+
+#define GRID_ROBOT_RADIUS 6.5	// inches, bumpers & cliff sensors are on the rim
+#define GRID_MAX_RAY 24			// most cells a sonar ray clears, 6'
+#define GRID_MAX_CHANGES 32		// cells which became or stopped being obstacles, kept until taken
+
+typedef struct {
+	int cx, cy;
+} GridCell;
+
+/*
+ * A log-odds occupancy map of the floor, built from bumps, cliffs & sonar echoes so
+ * layers can steer around obstacles the robot has already found.
+ *
+ * The map is 4 bits per cell, in 16 x 16 cell tiles. An 8 x 8 ring of tile slots
+ * is kept: a tile's slot is its coordinates modulo 8, so the map rolls with the robot
+ * & a tile more than 32' away is recycled when its slot is needed. That's 8K in all,
+ * wherever the robot goes.
+ *
+ * update() touches at most 1 + 1 + 4 + GRID_MAX_RAY + 1 cells: the robot's own cell,
+ * the bumper, the cliff sensors & the sonar ray.
+ *
+ * Cells which cross GRID_OCCUPIED either way are remembered until takeChanges(), so a
+ * planner can repair its search rather than starting again.
+ */
+class OccupancyGrid {
+public:
+	OccupancyGrid();
+	void update(double x, double y, double theta, bool lBump, bool rBump, int cliff,
+			int sonarRange, int sonarQuality);
+	int get(double x, double y);
+	int getAhead(double x, double y, double theta, double bearing, double distance);
+	bool occupied(double x, double y) {return(get(x, y) >= GRID_OCCUPIED);}
+	void setOccupied(double x, double y);
+	int cell(int cx, int cy);
+	int takeChanges(GridCell *changes);
+	static int toCell(double v);
+	void printData();
+	void printMap(double x, double y, int radius);
+
+private:
+	struct Tile {
+		int tx, ty;				// tile coordinates, in tiles
+		bool used;
+		unsigned char cells[GRID_TILE_BYTES];	// 2 cells a byte, log-odds + 8
+	} tiles[GRID_SLOTS][GRID_SLOTS];
+	unsigned long recycled;		// tiles dropped to make room
+	unsigned long updates;		// cell updates
+	unsigned long maxUpdates;	// most cell updates in one update()
+	unsigned long ticks;
+	GridCell changed[GRID_MAX_CHANGES];
+	int numChanged;
+	bool changesLost;		// more changed than were kept, or an obstacle tile was recycled
+
+	Tile *tile(int cx, int cy, bool create);
+	void add(int cx, int cy, int delta);
+	void addAhead(double x, double y, double theta, double bearing, double distance, int delta);
+	void ray(double x0, double y0, double x1, double y1, int cells, bool hit);
+};
+
+#endif /* OCCUPANCYGRID_H_ */
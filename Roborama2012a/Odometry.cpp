@@ -0,0 +1,334 @@
+/*
+ * Odometry.cpp
+ *
+ *  Created on: Dec 10, 2012
+ *      Author: bouchier
+ *
+ *  The UMBmark calibration is described in J. Borenstein & L. Feng, "UMBmark: A Benchmark
+ *  Test for Measuring Odometry Errors in Mobile Robots", SPIE 1995.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "Odometry.h"
+
+Odometry::Odometry() {
+	params.leftClicksPerInch = LEFT_CLICKS_PER_INCH;
+	params.rightClicksPerInch = RIGHT_CLICKS_PER_INCH;
+	params.wheelBase = WHEEL_BASE;
+	glitches = 0;
+	reset();
+}
+
+Odometry::~Odometry() {
+}
+
+void Odometry::reset(double xIn, double yIn, double thetaIn)
+{
+	x = xIn;
+	y = yIn;
+	theta = thetaIn;
+	deltaTheta = 0.0;
+	memset(cov, 0, sizeof(cov));
+}
+
+void Odometry::setParams(const OdometryParams &p)
+{
+	params = p;
+}
+
+/*
+ * Move a pose along the arc described by the left & right wheel travel. The robot ends
+ * up on the chord of the arc, in the direction of the mean heading
+ */
+static void arcStep(double &x, double &y, double &theta, double left, double right, double wheelBase)
+{
+	double ds = (left + right) / 2.0;
+	double dTheta = (left - right) / wheelBase;
+	double chord = ds;
+	double phi = theta + dTheta / 2.0;
+
+	if (fabs(dTheta) > 1e-9)
+		chord = ds * sin(dTheta / 2.0) / (dTheta / 2.0);
+	x += chord * sin(phi);
+	y += chord * cos(phi);
+	theta += dTheta;
+}
+
+/*
+ * Integrate one pair of encoder changes. Returns false, leaving the pose alone, if the
+ * change is too big to be real (e.g. the Roomba reset its encoders)
+ */
+bool Odometry::update(short lTicks, short rTicks)
+{
+	double left, right;
+
+	if ((lTicks > ODOMETRY_MAX_TICKS) || (lTicks < -ODOMETRY_MAX_TICKS) ||
+			(rTicks > ODOMETRY_MAX_TICKS) || (rTicks < -ODOMETRY_MAX_TICKS)) {
+		glitches++;
+		printf("Odometry: ignoring unreasonable encoder change L_ticks: %d R_ticks: %d\n", lTicks, rTicks);
+		deltaTheta = 0.0;
+		return false;
+	}
+
+	left = lTicks / params.leftClicksPerInch;
+	right = rTicks / params.rightClicksPerInch;
+	propagate(left, right);
+	deltaTheta = (left - right) / params.wheelBase;
+	arcStep(x, y, theta, left, right, params.wheelBase);
+
+	// clip the rotation to plus or minus 360 degrees
+	theta = fmod(theta, TWOPI);
+	return true;
+}
+
+/*
+ * Grow the covariance for a move of left & right inches: P = Fp P Fp' + Fu Q Fu', where
+ * Q holds the independent wheel errors
+ */
+void Odometry::propagate(double left, double right)
+{
+	double ds = (left + right) / 2.0;
+	double b = params.wheelBase;
+	double phi = theta + (left - right) / (2.0 * b);
+	double s = sin(phi), c = cos(phi);
+	double fp[3][3] = { { 1, 0, ds * c }, { 0, 1, -ds * s }, { 0, 0, 1 } };
+	double fu[3][2] = {
+		{ s / 2 + ds * c / (2 * b), s / 2 - ds * c / (2 * b) },
+		{ c / 2 - ds * s / (2 * b), c / 2 + ds * s / (2 * b) },
+		{ 1 / b, -1 / b } };
+	double q[2] = { ODOMETRY_WHEEL_VAR * fabs(left), ODOMETRY_WHEEL_VAR * fabs(right) };
+	double tmp[3][3], out[3][3];
+	int i, j, k;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			tmp[i][j] = 0.0;
+			for (k = 0; k < 3; k++)
+				tmp[i][j] += fp[i][k] * cov[k][j];
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			out[i][j] = 0.0;
+			for (k = 0; k < 3; k++)
+				out[i][j] += tmp[i][k] * fp[j][k];
+			for (k = 0; k < 2; k++)
+				out[i][j] += fu[i][k] * q[k] * fu[j][k];
+		}
+	}
+	memcpy(cov, out, sizeof(cov));
+}
+
+void Odometry::printData()
+{
+	printf("X: %0.2f Y: %0.2f theta: %0.1f deg sd x/y/theta: %0.2f %0.2f %0.2f deg, %lu glitches\n",
+			x, y, theta * RADS, sqrt(cov[0][0]), sqrt(cov[1][1]), sqrt(cov[2][2]) * RADS, glitches);
+}
+
+/*
+ * Read a calibration file of "name value" lines. Missing names keep their current value.
+ * Returns false if the file can't be read
+ */
+bool Odometry::loadCalibration(const char *path)
+{
+	FILE *fp;
+	char line[128], name[64];
+	double value;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return false;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if ((line[0] == '#') || (sscanf(line, "%63s %lf", name, &value) != 2))
+			continue;
+		if (!strcmp(name, "leftClicksPerInch"))
+			params.leftClicksPerInch = value;
+		else if (!strcmp(name, "rightClicksPerInch"))
+			params.rightClicksPerInch = value;
+		else if (!strcmp(name, "wheelBase"))
+			params.wheelBase = value;
+		else
+			printf("Odometry: unknown calibration parameter %s in %s\n", name, path);
+	}
+	fclose(fp);
+	printf("Odometry: loaded %s, clicks/inch L %0.3f R %0.3f, wheel base %0.3f\n", path,
+			params.leftClicksPerInch, params.rightClicksPerInch, params.wheelBase);
+	return true;
+}
+
+bool Odometry::saveCalibration(const char *path)
+{
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		perror("Odometry: can't write calibration");
+		return false;
+	}
+	fprintf(fp, "# odometry calibration, see Odometry::umbmark()\n");
+	fprintf(fp, "leftClicksPerInch %0.4f\n", params.leftClicksPerInch);
+	fprintf(fp, "rightClicksPerInch %0.4f\n", params.rightClicksPerInch);
+	fprintf(fp, "wheelBase %0.4f\n", params.wheelBase);
+	fclose(fp);
+	return true;
+}
+
+/*
+ * Where a robot really ends up after a UMBmark square which odometry says was perfect.
+ * The real left & right wheel travel is kL & kR times what odometry thinks & the real
+ * wheel base is kB times the calibrated one. The square has sides of side inches & the
+ * turns are on the spot, to the right if cw is true
+ */
+static void umbmarkSquare(double kL, double kR, double kB, double side, double wheelBase,
+		bool cw, double *xEnd, double *yEnd)
+{
+	double x = 0.0, y = 0.0, theta = 0.0;
+	double turn = (cw ? 1.0 : -1.0) * wheelBase * M_PI / 4.0;	// wheel travel for 90 degrees
+	int leg;
+
+	for (leg = 0; leg < 4; leg++) {
+		arcStep(x, y, theta, kL * side, kR * side, kB * wheelBase);
+		if (leg < 3)
+			arcStep(x, y, theta, kL * turn, -kR * turn, kB * wheelBase);
+	}
+	*xEnd = x;
+	*yEnd = y;
+}
+
+/*
+ * Fit the calibration from UMBmark runs. Drive waypoint list 3 (the 6' clockwise square,
+ * -a3 -E1) & list 4 (the counter-clockwise one, -a4 -E1) about 5 times each, starting from
+ * a marked spot facing the same way. Both lists set stopAtWaypoints, so the sides are
+ * straight & the turns on the spot, as umbmarkSquare() models them. After each run
+ * measure where the robot's center stopped relative to the start: X to the right & Y
+ * forward of the starting heading, in inches. Write them to runFile as
+ *
+ *   side 72
+ *   cw <x> <y>
+ *   ccw <x> <y>
+ *   line <odometer inches> <tape measured inches>		(optional)
+ *
+ * The return errors don't depend on the overall scale, so the square runs give the ratio
+ * of the wheel scales & the effective wheel base. A "line" run, e.g. waypoint list 2,
+ * fixes the overall scale. The fit matches the centroids of the cw & ccw errors with a
+ * model of the square by Gauss-Newton, so it handles both error types together rather
+ * than using the small angle formulas.
+ */
+bool Odometry::umbmark(const char *runFile)
+{
+	FILE *fp;
+	char line[128], kind[16];
+	double a, b, side = 72.0;
+	double cwX = 0.0, cwY = 0.0, ccwX = 0.0, ccwY = 0.0;
+	double lineOdo = 0.0, lineTrue = 0.0;
+	int nCw = 0, nCcw = 0;
+	double ed = 1.0, eb = 1.0;		// right/left wheel scale ratio & wheel base scale
+	double r[4], j[4][2], m[4], h, det, d0, d1;
+	double kL, kR, scale;
+	int iter, i;
+
+	if ((fp = fopen(runFile, "r")) == NULL) {
+		perror("Odometry: can't read UMBmark runs");
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#')
+			continue;
+		i = sscanf(line, "%15s %lf %lf", kind, &a, &b);
+		if ((i == 2) && !strcmp(kind, "side"))
+			side = a;
+		else if ((i == 3) && !strcmp(kind, "cw")) {
+			cwX += a; cwY += b; nCw++;
+		} else if ((i == 3) && !strcmp(kind, "ccw")) {
+			ccwX += a; ccwY += b; nCcw++;
+		} else if ((i == 3) && !strcmp(kind, "line")) {
+			lineOdo += a; lineTrue += b;
+		}
+	}
+	fclose(fp);
+	if ((nCw == 0) || (nCcw == 0)) {
+		printf("Odometry: UMBmark needs at least one cw & one ccw run\n");
+		return false;
+	}
+	m[0] = cwX / nCw; m[1] = cwY / nCw;
+	m[2] = ccwX / nCcw; m[3] = ccwY / nCcw;
+	printf("UMBmark: %d cw runs, error centroid (%0.2f, %0.2f); %d ccw runs, error centroid (%0.2f, %0.2f)\n",
+			nCw, m[0], m[1], nCcw, m[2], m[3]);
+
+	// least squares fit of (ed, eb) to the centroids
+	for (iter = 0; iter < 20; iter++) {
+		double u[2] = { ed, eb };
+		double base[4], pert[4];
+		int k;
+
+		kL = 2.0 / (ed + 1.0);
+		kR = 2.0 * ed / (ed + 1.0);
+		umbmarkSquare(kL, kR, eb, side, params.wheelBase, true, &base[0], &base[1]);
+		umbmarkSquare(kL, kR, eb, side, params.wheelBase, false, &base[2], &base[3]);
+		for (i = 0; i < 4; i++)
+			r[i] = base[i] - m[i];
+		for (k = 0; k < 2; k++) {		// numerical Jacobian
+			double v[2] = { u[0], u[1] };
+			h = 1e-6;
+			v[k] += h;
+			umbmarkSquare(2.0 / (v[0] + 1.0), 2.0 * v[0] / (v[0] + 1.0), v[1], side,
+					params.wheelBase, true, &pert[0], &pert[1]);
+			umbmarkSquare(2.0 / (v[0] + 1.0), 2.0 * v[0] / (v[0] + 1.0), v[1], side,
+					params.wheelBase, false, &pert[2], &pert[3]);
+			for (i = 0; i < 4; i++)
+				j[i][k] = (pert[i] - base[i]) / h;
+		}
+		// solve (J'J) d = -J'r
+		double a00 = 0, a01 = 0, a11 = 0, g0 = 0, g1 = 0;
+		for (i = 0; i < 4; i++) {
+			a00 += j[i][0] * j[i][0];
+			a01 += j[i][0] * j[i][1];
+			a11 += j[i][1] * j[i][1];
+			g0 += j[i][0] * r[i];
+			g1 += j[i][1] * r[i];
+		}
+		det = a00 * a11 - a01 * a01;
+		if (fabs(det) < 1e-12) {
+			printf("Odometry: UMBmark fit is singular\n");
+			return false;
+		}
+		d0 = -(a11 * g0 - a01 * g1) / det;
+		d1 = -(a00 * g1 - a01 * g0) / det;
+		ed += d0;
+		eb += d1;
+		if ((fabs(d0) < 1e-10) && (fabs(d1) < 1e-10))
+			break;
+	}
+	if ((ed < 0.8) || (ed > 1.25) || (eb < 0.8) || (eb > 1.25)) {
+		printf("Odometry: UMBmark fit Ed %0.4f Eb %0.4f is implausible, calibration unchanged\n", ed, eb);
+		return false;
+	}
+
+	kL = 2.0 / (ed + 1.0);
+	kR = 2.0 * ed / (ed + 1.0);
+	scale = ((lineOdo > 0.0) && (lineTrue > 0.0)) ? lineTrue / lineOdo : 1.0;
+	params.leftClicksPerInch /= kL * scale;
+	params.rightClicksPerInch /= kR * scale;
+	params.wheelBase *= eb;
+	printf("UMBmark: Ed (right/left) %0.4f Eb %0.4f scale %0.4f residual %0.2f inches\n",
+			ed, eb, scale, sqrt((r[0]*r[0] + r[1]*r[1] + r[2]*r[2] + r[3]*r[3]) / 4.0));
+	printf("UMBmark: clicks/inch L %0.3f R %0.3f, wheel base %0.3f\n",
+			params.leftClicksPerInch, params.rightClicksPerInch, params.wheelBase);
+	return true;
+}
+
+/*
+ * Command line entry: fit odometry.cal from the UMBmark runs in runFile
+ */
+int calibrateOdometry(const char *runFile)
+{
+	Odometry odometry;
+
+	odometry.loadCalibration(ODOMETRY_CAL_FILE);
+	if (!odometry.umbmark(runFile))
+		return -1;
+	if (!odometry.saveCalibration(ODOMETRY_CAL_FILE))
+		return -1;
+	printf("wrote %s\n", ODOMETRY_CAL_FILE);
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Odometry.h
+ *
+ *  Created on: Dec 10, 2012
+ *      Author: bouchier
+ *
+ *  Dead reckoning from the Roomba's wheel encoders. The pose frame is the one the rest of
+ *  Roborama2012a uses: X to the right, Y forward at the start, theta clockwise from +Y.
+ */
+
+#ifndef ODOMETRY_H_
+#define ODOMETRY_H_
+
+// defaults, overridden by odometry.cal
+#define WHEEL_BASE 9.13
+// clicks/inch calibrated on concrete at DMS 1/31/12
+#define LEFT_CLICKS_PER_INCH 58.5
+#define RIGHT_CLICKS_PER_INCH 58.5
+
+#define TWOPI 6.2831853070		/* nice to have float precision */
+#define RADS 57.2958			/* radians to degrees conversion */
+
+#define ODOMETRY_CAL_FILE "odometry.cal"	// calibration written by calibrateOdometry()
+#define ODOMETRY_MAX_TICKS 1000		// larger encoder changes between samples are glitches
+
+// per-wheel random error: variance of each wheel's travel is ODOMETRY_WHEEL_VAR * |travel|
+#define ODOMETRY_WHEEL_VAR 0.01		// inches^2 per inch
+
+typedef struct {
+	double leftClicksPerInch;
+	double rightClicksPerInch;
+	double wheelBase;				// effective distance between the wheels' contact points, inches
+} OdometryParams;
+
+/*
+ * Integrates encoder ticks into a pose. Each sample moves the robot along the exact arc
+ * the two wheel distances describe, rather than a straight line in the new heading, and
+ * propagates a pose covariance from the per-wheel error model.
+ *
+ * update() is virtual so another estimator (e.g. one which fuses a compass) can be plugged
+ * into RoombaSensors in its place.
+ */
+class Odometry {
+public:
+	Odometry();
+	virtual ~Odometry();
+	virtual bool update(short lTicks, short rTicks);
+	virtual void reset(double x = 0.0, double y = 0.0, double theta = 0.0);
+
+	void setParams(const OdometryParams &p);
+	const OdometryParams &getParams() const { return params; }
+	bool loadCalibration(const char *path);
+	bool saveCalibration(const char *path);
+
+	double getX() const { return x; }
+	double getY() const { return y; }
+	double getTheta() const { return theta; }
+	double getDeltaTheta() const { return deltaTheta; }
+	double getCov(int row, int col) const { return cov[row][col]; }
+	unsigned long getGlitches() const { return glitches; }
+	virtual void printData();
+
+	// fit the parameters from UMBmark square runs, see Odometry.cpp
+	bool umbmark(const char *runFile);
+
+protected:
+	OdometryParams params;
+	double x, y;			// inches
+	double theta;			// radians, clipped to +/- 2 pi
+	double deltaTheta;		// change in theta at the last update
+	double cov[3][3];		// covariance of x, y, theta
+	unsigned long glitches;	// samples rejected as impossible
+
+	void propagate(double left, double right);
+};
+
+// roombaVEXPro -U: fit ODOMETRY_CAL_FILE from UMBmark runs. Called from main.c
+extern "C" int calibrateOdometry(const char *runFile);
+
+#endif /* ODOMETRY_H_ */
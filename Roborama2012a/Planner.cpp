@@ -0,0 +1,492 @@
+/*
+ * Planner.cpp
+ *
+ *  Created on: Dec 21, 2012
+ *      Author: bouchier
+ *  The search is D* Lite, from Koenig & Likhachev, "D* Lite", AAAI 2002
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <sys/time.h>
+#include "Planner.h"
+
+#define PLAN_INF 0x3fffffff
+#define COST_STRAIGHT 10		// 3" cell side
+#define COST_DIAGONAL 14
+
+Planner::Planner(OccupancyGrid *gridIn) {
+	grid = gridIn;
+	g = new int[PLAN_CELLS];
+	rhs = new int[PLAN_CELLS];
+	key1 = new int[PLAN_CELLS];
+	key2 = new int[PLAN_CELLS];
+	heapPos = new int[PLAN_CELLS];
+	open = new int[PLAN_CELLS];
+	near = new unsigned char[PLAN_CELLS];
+	occ = new unsigned char[PLAN_CELLS];
+	haveGoal = done = havePath = pathStale = false;
+	originX = originY = goalX = goalY = 0;
+	goal = start = last = 0;
+	km = openSize = 0;
+	path[0] = 0;
+	updates = searches = windows = expansions = maxExpansions = repairs = 0;
+	totalUsec = maxUsec = 0;
+}
+
+Planner::~Planner() {
+	delete[] g;
+	delete[] rhs;
+	delete[] key1;
+	delete[] key2;
+	delete[] heapPos;
+	delete[] open;
+	delete[] near;
+	delete[] occ;
+}
+
+bool Planner::inWindow(int cx, int cy)
+{
+	return (cx >= originX) && (cx < originX + PLAN_SIZE) && (cy >= originY) && (cy < originY + PLAN_SIZE);
+}
+
+// the robot's centre can't be on s. It's always allowed where it is, even if that's too close to something
+bool Planner::blocked(int s)
+{
+	return (near[s] != 0) && (s != start);
+}
+
+// cost of the step between neighbours a & b. A diagonal step can't cut a blocked corner
+int Planner::cost(int a, int b)
+{
+	int ax = a & (PLAN_SIZE - 1), ay = a >> PLAN_SHIFT;
+	int bx = b & (PLAN_SIZE - 1), by = b >> PLAN_SHIFT;
+
+	if (blocked(a) || blocked(b))
+		return PLAN_INF;
+	if ((ax == bx) || (ay == by))
+		return COST_STRAIGHT;
+	if (blocked((ay << PLAN_SHIFT) | bx) || blocked((by << PLAN_SHIFT) | ax))
+		return PLAN_INF;
+	return COST_DIAGONAL;
+}
+
+// octile distance, never more than the real cost
+int Planner::heuristic(int a, int b)
+{
+	int dx = (a & (PLAN_SIZE - 1)) - (b & (PLAN_SIZE - 1));
+	int dy = (a >> PLAN_SHIFT) - (b >> PLAN_SHIFT);
+
+	if (dx < 0)
+		dx = -dx;
+	if (dy < 0)
+		dy = -dy;
+	return (dx > dy) ? COST_STRAIGHT * dx + (COST_DIAGONAL - COST_STRAIGHT) * dy
+			: COST_STRAIGHT * dy + (COST_DIAGONAL - COST_STRAIGHT) * dx;
+}
+
+void Planner::calcKey(int s, int *k1, int *k2)
+{
+	int m = (g[s] < rhs[s]) ? g[s] : rhs[s];
+
+	*k1 = (m >= PLAN_INF) ? PLAN_INF : m + heuristic(start, s) + km;
+	*k2 = m;
+}
+
+bool Planner::keyLess(int a1, int a2, int b1, int b2)
+{
+	return (a1 < b1) || ((a1 == b1) && (a2 < b2));
+}
+
+/*
+ * open is a binary heap of cells ordered by key; heapPos says where each cell is in it
+ */
+void Planner::heapSwap(int i, int j)
+{
+	int t = open[i];
+
+	open[i] = open[j];
+	open[j] = t;
+	heapPos[open[i]] = i;
+	heapPos[open[j]] = j;
+}
+
+void Planner::heapUp(int i)
+{
+	int p;
+
+	while (i > 0) {
+		p = (i - 1) / 2;
+		if (!keyLess(key1[open[i]], key2[open[i]], key1[open[p]], key2[open[p]]))
+			break;
+		heapSwap(i, p);
+		i = p;
+	}
+}
+
+void Planner::heapDown(int i)
+{
+	int c;
+
+	while ((c = 2 * i + 1) < openSize) {
+		if ((c + 1 < openSize) && keyLess(key1[open[c + 1]], key2[open[c + 1]], key1[open[c]], key2[open[c]]))
+			c++;
+		if (!keyLess(key1[open[c]], key2[open[c]], key1[open[i]], key2[open[i]]))
+			break;
+		heapSwap(i, c);
+		i = c;
+	}
+}
+
+// add s to open, or move it if it's there, with its current key
+void Planner::openPush(int s)
+{
+	int i = heapPos[s];
+
+	calcKey(s, &key1[s], &key2[s]);
+	if (i < 0) {
+		i = openSize++;
+		open[i] = s;
+		heapPos[s] = i;
+	}
+	heapUp(i);
+	heapDown(heapPos[s]);
+}
+
+void Planner::openRemove(int s)
+{
+	int i = heapPos[s];
+
+	if (i < 0)
+		return;
+	heapPos[s] = -1;
+	if (i == --openSize)
+		return;
+	open[i] = open[openSize];
+	heapPos[open[i]] = i;
+	heapUp(i);
+	heapDown(heapPos[open[i]]);
+}
+
+// recompute s's lookahead from its neighbours, & put it in open if that makes it inconsistent
+void Planner::updateVertex(int s)
+{
+	int x = s & (PLAN_SIZE - 1), y = s >> PLAN_SHIFT;
+	int dx, dy, n, c, best;
+
+	if (s != goal) {
+		best = PLAN_INF;
+		for (dy = -1; dy <= 1; dy++) {
+			for (dx = -1; dx <= 1; dx++) {
+				if ((!dx && !dy) || (x + dx < 0) || (x + dx >= PLAN_SIZE) || (y + dy < 0) || (y + dy >= PLAN_SIZE))
+					continue;
+				n = s + dy * PLAN_SIZE + dx;
+				if ((g[n] >= PLAN_INF) || ((c = cost(s, n)) >= PLAN_INF))
+					continue;
+				if (c + g[n] < best)
+					best = c + g[n];
+			}
+		}
+		rhs[s] = best;
+	}
+	if (g[s] != rhs[s])
+		openPush(s);
+	else
+		openRemove(s);
+}
+
+// s & its neighbours, after a change to s's cost
+void Planner::updateAround(int s)
+{
+	int x = s & (PLAN_SIZE - 1), y = s >> PLAN_SHIFT;
+	int dx, dy;
+
+	for (dy = -1; dy <= 1; dy++) {
+		for (dx = -1; dx <= 1; dx++) {
+			if ((x + dx >= 0) && (x + dx < PLAN_SIZE) && (y + dy >= 0) && (y + dy < PLAN_SIZE))
+				updateVertex(s + dy * PLAN_SIZE + dx);
+		}
+	}
+	repairs++;
+}
+
+/*
+ * Add delta to the obstacle count of the cells within clearance of window cell cx, cy.
+ * If repair is true, the search is repaired around the cells which open or close
+ */
+void Planner::markObstacle(int cx, int cy, int delta, bool repair)
+{
+	int dx, dy, s, before;
+
+	for (dy = -2; dy <= 2; dy++) {
+		for (dx = -2; dx <= 2; dx++) {
+			if ((dx * dx + dy * dy > PLAN_CLEARANCE) || (cx + dx < 0) || (cx + dx >= PLAN_SIZE) ||
+					(cy + dy < 0) || (cy + dy >= PLAN_SIZE))
+				continue;
+			s = ((cy + dy) << PLAN_SHIFT) | (cx + dx);
+			before = near[s];
+			near[s] += delta;
+			if (repair && ((before == 0) != (near[s] == 0)))
+				updateAround(s);
+		}
+	}
+}
+
+/*
+ * Copy the window's obstacles from the grid & start the search again from the goal
+ */
+void Planner::loadWindow()
+{
+	int s;
+
+	openSize = 0;
+	done = false;
+	for (s = 0; s < PLAN_CELLS; s++) {
+		g[s] = rhs[s] = PLAN_INF;
+		heapPos[s] = -1;
+		near[s] = 0;
+	}
+	for (s = 0; s < PLAN_CELLS; s++) {
+		occ[s] = grid->cell(originX + (s & (PLAN_SIZE - 1)), originY + (s >> PLAN_SHIFT)) >= GRID_OCCUPIED;
+		if (occ[s])
+			markObstacle(s & (PLAN_SIZE - 1), s >> PLAN_SHIFT, 1, false);
+	}
+	grid->takeChanges(changes);		// all in what we just read
+	km = 0;
+	last = start;
+	rhs[goal] = 0;
+	openPush(goal);
+	pathStale = true;
+}
+
+/*
+ * Plan from the robot at x, y to goal gx, gy, all in inches. The search window is
+ * centred between them, so they must be less than 16' apart. Returns false if they aren't
+ */
+bool Planner::setGoal(double x, double y, double gx, double gy)
+{
+	int sx = OccupancyGrid::toCell(x), sy = OccupancyGrid::toCell(y);
+	int ex = OccupancyGrid::toCell(gx), ey = OccupancyGrid::toCell(gy);
+
+	originX = (sx + ex) / 2 - PLAN_SIZE / 2;
+	originY = (sy + ey) / 2 - PLAN_SIZE / 2;
+	if (!inWindow(sx, sy) || !inWindow(ex, ey)) {
+		printf("Planner: goal X: %0.1f Y: %0.1f is too far away to plan to\n", gx, gy);
+		haveGoal = havePath = false;
+		return false;
+	}
+	goalX = (int)floor(gx + 0.5);
+	goalY = (int)floor(gy + 0.5);
+	start = ((sy - originY) << PLAN_SHIFT) | (sx - originX);
+	goal = ((ey - originY) << PLAN_SHIFT) | (ex - originX);
+	haveGoal = true;
+	havePath = false;
+	searches++;
+	loadWindow();
+	return true;
+}
+
+void Planner::clearGoal()
+{
+	haveGoal = havePath = done = false;
+}
+
+/*
+ * Expand at most budget cells. Returns true when the search is done: the robot's cell
+ * is consistent & nothing in open could make it cheaper
+ */
+bool Planner::computeShortestPath(int budget)
+{
+	int u, s, x, y, dx, dy, k1, k2, n = 0;
+
+	while (openSize > 0) {
+		calcKey(start, &k1, &k2);
+		u = open[0];
+		if (!keyLess(key1[u], key2[u], k1, k2) && (rhs[start] == g[start]))
+			break;
+		if (n == budget) {
+			expansions += n;
+			if ((unsigned long)n > maxExpansions)
+				maxExpansions = n;
+			return false;
+		}
+		n++;
+		calcKey(u, &k1, &k2);
+		if (keyLess(key1[u], key2[u], k1, k2)) {
+			openPush(u);		// the robot moved since u was queued; requeue it
+			continue;
+		}
+		x = u & (PLAN_SIZE - 1);
+		y = u >> PLAN_SHIFT;
+		if (g[u] > rhs[u]) {
+			g[u] = rhs[u];
+			openRemove(u);
+		} else {
+			g[u] = PLAN_INF;
+			updateVertex(u);
+		}
+		for (dy = -1; dy <= 1; dy++) {
+			for (dx = -1; dx <= 1; dx++) {
+				if ((!dx && !dy) || (x + dx < 0) || (x + dx >= PLAN_SIZE) || (y + dy < 0) || (y + dy >= PLAN_SIZE))
+					continue;
+				s = u + dy * PLAN_SIZE + dx;
+				updateVertex(s);
+			}
+		}
+	}
+	expansions += n;
+	if ((unsigned long)n > maxExpansions)
+		maxExpansions = n;
+	return true;
+}
+
+// true if the straight line between cells a & b only crosses usable cells
+bool Planner::lineOfSight(int a, int b)
+{
+	int cx = a & (PLAN_SIZE - 1), cy = a >> PLAN_SHIFT;
+	int ex = b & (PLAN_SIZE - 1), ey = b >> PLAN_SHIFT;
+	int dx = ex > cx ? ex - cx : cx - ex;
+	int dy = ey > cy ? ey - cy : cy - ey;
+	int sx = ex > cx ? 1 : -1;
+	int sy = ey > cy ? 1 : -1;
+	int err = dx - dy, e2;
+
+	while ((cx != ex) || (cy != ey)) {
+		if (blocked((cy << PLAN_SHIFT) | cx))
+			return false;
+		e2 = 2 * err;
+		if (e2 > -dy) {
+			err -= dy;
+			cx += sx;
+		}
+		if (e2 < dx) {
+			err += dx;
+			cy += sy;
+		}
+	}
+	return !blocked(b);
+}
+
+/*
+ * Follow the cheapest neighbours from the robot's cell to the goal, & pull the path
+ * tight: a waypoint is only added where the straight line from the one before would
+ * cross a cell the robot can't use. The last waypoint is the goal itself
+ */
+void Planner::extractPath()
+{
+	int s = start, anchor = start, prev = start, best, bestCost, n, c, dx, dy, x, y, steps;
+
+	path[0] = 0;
+	havePath = false;
+	if (g[start] >= PLAN_INF)
+		return;			// no way to the goal
+	for (steps = 0; (s != goal) && (steps < PLAN_CELLS); steps++) {
+		x = s & (PLAN_SIZE - 1);
+		y = s >> PLAN_SHIFT;
+		best = -1;
+		bestCost = PLAN_INF;
+		for (dy = -1; dy <= 1; dy++) {
+			for (dx = -1; dx <= 1; dx++) {
+				if ((!dx && !dy) || (x + dx < 0) || (x + dx >= PLAN_SIZE) || (y + dy < 0) || (y + dy >= PLAN_SIZE))
+					continue;
+				n = s + dy * PLAN_SIZE + dx;
+				if ((g[n] >= PLAN_INF) || ((c = cost(s, n)) >= PLAN_INF))
+					continue;
+				if (c + g[n] < bestCost) {
+					bestCost = c + g[n];
+					best = n;
+				}
+			}
+		}
+		if (best < 0)
+			return;
+		s = best;
+		if (!lineOfSight(anchor, s)) {
+			if (path[0] == PLAN_MAX_WAYPOINTS - 1)
+				break;		// Target will have a new path by the time it gets here
+			path[1 + 2 * path[0]] = (int)floor((originX + (prev & (PLAN_SIZE - 1)) + 0.5) * GRID_CELL + 0.5);
+			path[2 + 2 * path[0]] = (int)floor((originY + (prev >> PLAN_SHIFT) + 0.5) * GRID_CELL + 0.5);
+			path[0]++;
+			anchor = prev;
+		}
+		prev = s;
+	}
+	if (s != goal)
+		return;
+	path[1 + 2 * path[0]] = goalX;
+	path[2 + 2 * path[0]] = goalY;
+	path[0]++;
+	havePath = true;
+}
+
+/*
+ * Move the start to the robot at x, y, take in the grid's new & vanished obstacles, &
+ * continue the search for up to PLAN_MAX_EXPANSIONS cells. Call it once a tick
+ */
+void Planner::update(double x, double y)
+{
+	struct timeval begin, end;
+	int cx = OccupancyGrid::toCell(x), cy = OccupancyGrid::toCell(y);
+	int i, n, s, old;
+	unsigned long usec;
+
+	if (!haveGoal)
+		return;
+	gettimeofday(&begin, NULL);
+	updates++;
+
+	if (!inWindow(cx, cy)) {
+		windows++;			// wandered off the edge, e.g. pushed by bump
+		if (!setGoal(x, y, goalX, goalY))
+			return;
+	}
+	s = ((cy - originY) << PLAN_SHIFT) | (cx - originX);
+	if (s != start) {
+		old = start;
+		start = s;
+		km += heuristic(last, start);
+		last = start;
+		pathStale = true;
+		if (near[old] != 0)
+			updateAround(old);	// it's closed now we've left it
+		if (near[start] != 0)
+			updateAround(start);
+	}
+
+	n = grid->takeChanges(changes);
+	if (n < 0) {
+		loadWindow();		// lost track of the map, start again
+	} else {
+		for (i = 0; i < n; i++) {
+			cx = changes[i].cx;
+			cy = changes[i].cy;
+			if (!inWindow(cx, cy))
+				continue;
+			s = ((cy - originY) << PLAN_SHIFT) | (cx - originX);
+			if (occ[s] == (grid->cell(cx, cy) >= GRID_OCCUPIED))
+				continue;		// it changed back again
+			occ[s] = !occ[s];
+			markObstacle(cx - originX, cy - originY, occ[s] ? 1 : -1, true);
+			pathStale = true;
+		}
+	}
+
+	done = computeShortestPath(PLAN_MAX_EXPANSIONS);
+	if (done && pathStale) {
+		extractPath();
+		pathStale = false;
+	}
+
+	gettimeofday(&end, NULL);
+	usec = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_usec - begin.tv_usec);
+	totalUsec += usec;
+	if (usec > maxUsec)
+		maxUsec = usec;
+}
+
+void Planner::printData()
+{
+	printf("planner: %lu searches, %lu moved windows, %lu updates, %lu repairs, %lu cells expanded, max %lu/update\n",
+			searches, windows, updates, repairs, expansions, maxExpansions);
+	printf("planner: %0.1f us/update, max %lu us\n", updates ? (double)totalUsec / updates : 0.0, maxUsec);
+}
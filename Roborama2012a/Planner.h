@@ -0,0 +1,89 @@
+/*
+ * Planner.h
+ *
+ *  Created on: Dec 21, 2012
+ *      Author: bouchier
+ */
+
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include "OccupancyGrid.h"
+
+#define PLAN_SHIFT 6				// the search covers 64 x 64 cells, 16' square
+#define PLAN_SIZE (1 << PLAN_SHIFT)
+#define PLAN_CELLS (PLAN_SIZE * PLAN_SIZE)
+#define PLAN_MAX_WAYPOINTS 32
+#define PLAN_MAX_EXPANSIONS 300		// search work per update(), see PlannerBench
+#define PLAN_CLEARANCE 6			// cells within sqrt(this) of an obstacle are closed to the robot's centre
+
+/*
+ * D* Lite path planner over the occupancy grid, for Target.
+ *
+ * setGoal() starts a search of a window of the grid holding the robot & the goal. The
+ * search runs from the goal back to the robot, so when the robot moves or the grid
+ * reports an obstacle appearing or going away, only the part of the search it affects is
+ * repaired. The robot's centre is kept PLAN_CLEARANCE away from obstacles; unknown
+ * cells are assumed to be clear.
+ *
+ * update() does at most PLAN_MAX_EXPANSIONS of search, so a replan is spread over
+ * several ticks rather than stalling one. The budget is counted in cells not time, so a
+ * replayed run plans the same as the recording did. Once the search is done the path is
+ * smoothed into the fewest straight legs which keep clear of obstacles, in Target's
+ * waypoint format.
+ */
+class Planner {
+public:
+	Planner(OccupancyGrid *gridIn);
+	~Planner();
+	bool setGoal(double x, double y, double goalX, double goalY);
+	void clearGoal();
+	void update(double x, double y);
+	int *getPath()	{return(havePath ? path : NULL);}	// count, then x, y pairs; NULL if no path
+	bool isBusy()	{return(haveGoal && !done);}	// the search needs more updates
+	bool isBlocked()	{return(haveGoal && done && !havePath);}	// there's no way to the goal
+	unsigned long getMaxUsec()	{return(maxUsec);}
+	void printData();
+
+private:
+	OccupancyGrid *grid;
+	int originX, originY;		// grid cell of the window's corner
+	int goalX, goalY;			// inches, the exact goal
+	int goal, start, last;		// cells in the window
+	bool haveGoal, done, havePath, pathStale;
+	int km;						// key modifier, the heuristic distance the robot moved between repairs
+
+	int *g, *rhs;				// cost to the goal, & its one-step lookahead
+	int *key1, *key2;			// a cell's key while it's open
+	int *heapPos;				// its place in open, -1 if it isn't
+	int *open;					// priority queue of cells to expand, a binary heap
+	int openSize;
+	unsigned char *occ;			// the grid's obstacles, as last seen
+	unsigned char *near;		// obstacle cells within clearance; 0 if the cell is usable
+	GridCell changes[GRID_MAX_CHANGES];
+	int path[1 + 2 * PLAN_MAX_WAYPOINTS];
+
+	unsigned long updates, searches, windows, expansions, maxExpansions, repairs;
+	unsigned long totalUsec, maxUsec;
+
+	bool inWindow(int cx, int cy);
+	bool blocked(int s);
+	int cost(int a, int b);
+	int heuristic(int a, int b);
+	void calcKey(int s, int *k1, int *k2);
+	bool keyLess(int a1, int a2, int b1, int b2);
+	void heapSwap(int i, int j);
+	void heapUp(int i);
+	void heapDown(int i);
+	void openPush(int s);
+	void openRemove(int s);
+	void updateVertex(int s);
+	void updateAround(int s);
+	void markObstacle(int cx, int cy, int delta, bool repair);
+	void loadWindow();
+	bool computeShortestPath(int budget);
+	bool lineOfSight(int a, int b);
+	void extractPath();
+};
+
+#endif /* PLANNER_H_ */
@@ -13,6 +13,7 @@
 #include "Spin.h"
 #include "RoombaSensors.h"
 #include "rrclient.h"
+#include "InputLog.h"
 
 // shared memory defines
 #define KEY (key_t)6060
@@ -45,6 +46,8 @@ Point2VisTarget::Point2VisTarget(RoombaSensors *rsIn, Spin *sIn)
  */
 void Point2VisTarget::shmInit()
 {
+	if (inputReplaying())
+		return;		// shape data comes from the log
 	fprintf(stderr, "attaching shared memory for shape data requests\n");
 	int shmid;
 
@@ -80,6 +83,7 @@ void Point2VisTarget::shmInit()
 void Point2VisTarget::activate()
 {
 	state = 1;		// kick off the state machine to seek to pointing at the visual target
+	touch();
 }
 void Point2VisTarget::eval()
 {
@@ -97,13 +101,17 @@ void Point2VisTarget::eval()
 	case 2:
 		if (!stateTimer--) { // wait for robot to stop, & image to stabilize
 			rrc.getShapeParams = 1;		// ask for the x coord of shape
-			memcpy(shm_p, &rrc, sizeof(rrClientStruct));	// set request in shared mem struct
+			if (shm_p != NULL)
+				memcpy(shm_p, &rrc, sizeof(rrClientStruct));	// set request in shared mem struct
 			stateTimer = 200;	// give it a 10 second to find the object & return params
 			state = 3;
 		}
 		break;
 	case 3:
-		memcpy(&rrc, shm_p, sizeof(rrClientStruct));	// get shared mem struct which may have target params
+		if (!inputReplaying())
+			memcpy(&rrc, shm_p, sizeof(rrClientStruct));	// get shared mem struct which may have target params
+		if (inputLog != NULL)
+			inputLog->vision(&rrc);
 		rs->setVisTargetValid(false);
 		if (stateTimer-- == 0) {
 			flag = 0;
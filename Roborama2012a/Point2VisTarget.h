@@ -19,6 +19,7 @@ class Point2VisTarget: public Layer {
 public:
 	Point2VisTarget(RoombaSensors *rs, Spin *s);
 	void eval();
+	unsigned int getInputs() {return((state == 0) ? 0 : IN_TICK);}	// idle until activate()
 	void activate();
 	void shmInit();
 	void spin();
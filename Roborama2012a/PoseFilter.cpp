@@ -0,0 +1,189 @@
+/*
+ * PoseFilter.cpp
+ *
+ *  Created on: Dec 12, 2012
+ *      Author: bouchier
+ */
+
+#include <math.h>
+#include "PoseFilter.h"
+
+// wrap an angle into -pi .. pi
+static double wrap(double a)
+{
+	a = fmod(a, TWOPI);
+	if (a > M_PI)
+		a -= TWOPI;
+	else if (a < -M_PI)
+		a += TWOPI;
+	return a;
+}
+
+static bool before(const struct timeval &a, const struct timeval &b)
+{
+	return (a.tv_sec < b.tv_sec) || ((a.tv_sec == b.tv_sec) && (a.tv_usec <= b.tv_usec));
+}
+
+PoseFilter::PoseFilter() {
+	historyHead = historyCount = 0;
+	offsetValid = false;
+	offsetCount = 0;
+	offset = 0.0;
+	setCompassSd(POSE_COMPASS_SD);
+	gate = POSE_GATE_SIGMAS;
+	log = NULL;
+	compassAccepted = compassRejected = 0;
+	lastInnovation = 0.0;
+}
+
+void PoseFilter::reset(double xIn, double yIn, double thetaIn)
+{
+	Odometry::reset(xIn, yIn, thetaIn);
+	historyHead = historyCount = 0;
+	offsetValid = false;
+	offsetCount = 0;
+}
+
+void PoseFilter::setCompassSd(double deg)
+{
+	compassVar = (deg / RADS) * (deg / RADS);
+}
+
+void PoseFilter::setGate(double sigmas)
+{
+	gate = sigmas;
+}
+
+void PoseFilter::setLog(FILE *fp)
+{
+	log = fp;
+}
+
+bool PoseFilter::update(short lTicks, short rTicks)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return updateOdometry(lTicks, rTicks, now);
+}
+
+/*
+ * Predict: integrate the encoder ticks read at stamp & remember the heading
+ */
+bool PoseFilter::updateOdometry(short lTicks, short rTicks, const struct timeval &stamp)
+{
+	bool rv;
+
+	if (log != NULL)
+		fprintf(log, "odo %ld.%06ld %d %d\n", (long)stamp.tv_sec, (long)stamp.tv_usec, lTicks, rTicks);
+	rv = Odometry::update(lTicks, rTicks);
+	history[historyHead].stamp = stamp;
+	history[historyHead].theta = theta;
+	historyHead = (historyHead + 1) % POSE_HISTORY;
+	if (historyCount < POSE_HISTORY)
+		historyCount++;
+	return rv;
+}
+
+/*
+ * The odometry heading at stamp: the last one recorded at or before it, or the oldest
+ * we have
+ */
+double PoseFilter::thetaAt(const struct timeval &stamp)
+{
+	int i, n;
+
+	for (n = 1; n <= historyCount; n++) {
+		i = (historyHead - n + POSE_HISTORY) % POSE_HISTORY;
+		if (before(history[i].stamp, stamp))
+			return history[i].theta;
+	}
+	if (historyCount == 0)
+		return theta;
+	return history[(historyHead - historyCount + POSE_HISTORY) % POSE_HISTORY].theta;
+}
+
+/*
+ * Correct: fuse a compass heading (degrees clockwise from north) read at stamp. Returns
+ * false if the reading was rejected by the innovation gate
+ */
+bool PoseFilter::updateCompass(double headingDeg, const struct timeval &stamp)
+{
+	double z = headingDeg / RADS;
+	double nu, s, k[3], p2[3], correction;
+	int i, j;
+
+	if (log != NULL)
+		fprintf(log, "compass %ld.%06ld %0.1f\n", (long)stamp.tv_sec, (long)stamp.tv_usec, headingDeg);
+
+	if (!offsetValid) {
+		offsetSamples[offsetCount++] = wrap(z - thetaAt(stamp));
+		if (offsetCount == POSE_OFFSET_READINGS)
+			estimateOffset();
+		return true;
+	}
+
+	nu = wrap(z - offset - thetaAt(stamp));
+	s = cov[2][2] + compassVar;
+	lastInnovation = nu;
+	if (nu * nu > gate * gate * s) {
+		compassRejected++;
+		return false;
+	}
+
+	// K = P H' / S with H = [0 0 1]
+	for (i = 0; i < 3; i++) {
+		k[i] = cov[i][2] / s;
+		p2[i] = cov[2][i];
+	}
+	x += k[0] * nu;
+	y += k[1] * nu;
+	correction = k[2] * nu;
+	theta = fmod(theta + correction, TWOPI);
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++)
+			cov[i][j] -= k[i] * p2[j];
+	}
+
+	// keep the recorded headings consistent with the corrected one
+	for (i = 0; i < historyCount; i++)
+		history[(historyHead - 1 - i + POSE_HISTORY) % POSE_HISTORY].theta += correction;
+	compassAccepted++;
+	return true;
+}
+
+/*
+ * Set the offset from the first readings: their circular mean, then the mean of those
+ * within the gate of it
+ */
+void PoseFilter::estimateOffset()
+{
+	double sinSum = 0.0, cosSum = 0.0, mean;
+	int i, used = 0;
+
+	for (i = 0; i < offsetCount; i++) {
+		sinSum += sin(offsetSamples[i]);
+		cosSum += cos(offsetSamples[i]);
+	}
+	mean = atan2(sinSum, cosSum);
+
+	sinSum = cosSum = 0.0;
+	for (i = 0; i < offsetCount; i++) {
+		if (fabs(wrap(offsetSamples[i] - mean)) <= gate * sqrt(compassVar)) {
+			sinSum += sin(offsetSamples[i]);
+			cosSum += cos(offsetSamples[i]);
+			used++;
+		}
+	}
+	offset = used ? atan2(sinSum, cosSum) : mean;
+	compassAccepted += used;
+	compassRejected += offsetCount - used;
+	offsetValid = true;
+}
+
+void PoseFilter::printData()
+{
+	Odometry::printData();
+	printf("compass: %lu accepted, %lu rejected, offset %0.1f deg, last innovation %0.1f deg\n",
+			compassAccepted, compassRejected, offset * RADS, lastInnovation * RADS);
+}
@@ -0,0 +1,73 @@
+/*
+ * PoseFilter.h
+ *
+ *  Created on: Dec 12, 2012
+ *      Author: bouchier
+ */
+
+#ifndef POSEFILTER_H_
+#define POSEFILTER_H_
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "Odometry.h"
+
+#define POSE_COMPASS_SD 3.0		// degrees, HM6352 heading noise
+#define POSE_GATE_SIGMAS 3.0	// reject compass readings further than this from the prediction
+#define POSE_HISTORY 32			// odometry headings kept to match late compass readings
+#define POSE_OFFSET_READINGS 10	// compass readings the offset is estimated from before any are fused
+
+/*
+ * An extended Kalman filter on the odometry pose which corrects the heading with a
+ * compass. Odometry drives the prediction (Odometry::update() grows the covariance); each
+ * compass reading is an observation of theta plus a fixed offset between the robot's
+ * starting heading & magnetic north. The offset is the mean of the first
+ * POSE_OFFSET_READINGS readings, leaving out any outside the gate, so one disturbed
+ * reading at the start doesn't bias the rest of the run.
+ *
+ * Compass readings are compared with the odometry heading at the time they were taken,
+ * not the latest one, so a late reading during a spin isn't mistaken for an error.
+ * Readings whose innovation is more than POSE_GATE_SIGMAS standard deviations out, e.g.
+ * near a motor or steel table leg, are rejected; the gate widens by itself as odometry
+ * uncertainty grows.
+ *
+ * Install with RoombaSensors::setOdometry(). setLog() records the inputs in the format
+ * the PoseReplay host tool reads back.
+ */
+class PoseFilter: public Odometry {
+public:
+	PoseFilter();
+	bool update(short lTicks, short rTicks);
+	void reset(double x = 0.0, double y = 0.0, double theta = 0.0);
+	bool updateOdometry(short lTicks, short rTicks, const struct timeval &stamp);
+	bool updateCompass(double headingDeg, const struct timeval &stamp);
+
+	void setCompassSd(double deg);
+	void setGate(double sigmas);
+	void setLog(FILE *fp);
+	unsigned long getCompassAccepted() const { return compassAccepted; }
+	unsigned long getCompassRejected() const { return compassRejected; }
+	void printData();
+
+private:
+	double thetaAt(const struct timeval &stamp);
+	void estimateOffset();
+
+	struct {
+		struct timeval stamp;
+		double theta;
+	} history[POSE_HISTORY];
+	int historyHead, historyCount;
+
+	bool offsetValid;
+	double offsetSamples[POSE_OFFSET_READINGS];	// compass heading - theta, radians
+	int offsetCount;
+	double offset;				// compass heading - theta, radians
+	double compassVar;			// radians^2
+	double gate;				// sigmas
+	FILE *log;
+	unsigned long compassAccepted, compassRejected;
+	double lastInnovation;		// radians
+};
+
+#endif /* POSEFILTER_H_ */
@@ -14,42 +14,102 @@
 #include <sys/shm.h>
 #include <errno.h>
 #include "RoombaSensors.h"
+#include "PoseFilter.h"
+#include "SonarShm.h"
+#include "libI2C.h"
+#include "readHM6352Compass.h"
+#include "InputLog.h"
+#include "OccupancyGrid.h"
 
-// Sonar defines
-#define USPI 150
-#define BIAS 300
-
-#define KEY2 (key_t)6061
-#define SHM_SZ 1024
 #define SHMFLAGS 0666
-volatile int *sonar_p;
+sonarShmStruct *sonar_p;
+int useCompass = 0;
+const char *poseLogPath = NULL;
 
 
 RoombaSensors::RoombaSensors(Roomba *roombaIn) {
 	roomba = roombaIn;
 	first = true;		// initialize first-time encoder position flag
-	X_pos = 0.0;
-	Y_pos = 0.0;
-	theta = 0.0;
+	odometry = new Odometry();
+	odometry->loadCalibration(ODOMETRY_CAL_FILE);
+	poseFilter = NULL;
+	grid = NULL;
+	visTargetValid = false;
+	visTargetBearing = 0;
+	changed = IN_ALL;	// nothing has been seen yet
 	initSonar();
+	if (useCompass)
+		initCompass();
 }
 
 void RoombaSensors::readSensors( char *timestampString)
 {
-
-	// Read sensors
-	roomba_read_sensors(roomba);
-	roomba_read_encoders(roomba);
+	gettimeofday(&readStamp, NULL);
+	if (inputLog != NULL)
+		inputLog->tick(&readStamp);
+
+	// Read sensors. When streaming this is just a copy of the latest frame. When
+	// replaying they come from the log
+	if (inputReplaying()) {
+	} else if (roomba->streaming) {
+		roomba_stream_read(roomba, NULL);
+	} else {
+		roomba_read_sensors(roomba);
+		roomba_read_encoders(roomba);
+	}
+	if (inputLog != NULL)
+		inputLog->roombaInputs(roomba);
 	odometers();
-	sonarRange = *sonar_p;
+	if (poseFilter != NULL)
+		readCompass();
+	readSonar();
 	//printf("Sonar read %d\n", sonarRange);
+	if (grid != NULL)
+		grid->update(odometry->getX(), odometry->getY(), odometry->getTheta(), getLBumper(),
+				getRBumper(), getCliff(), sonarRange, sonarQuality);
+	findChanges();
+}
+
+/*
+ * Note which inputs differ from the last read, so layers which don't depend on them
+ * needn't be evaluated
+ */
+void RoombaSensors::findChanges()
+{
+	unsigned char bumps = roomba->sensor_bytes[0];
+	int cliff = getCliff();
+
+	if (bumps != lastBumps)
+		changed |= IN_BUMP;
+	if (cliff != lastCliff)
+		changed |= IN_CLIFF;
+	if ((odometry->getX() != lastX) || (odometry->getY() != lastY) || (odometry->getTheta() != lastTheta))
+		changed |= IN_POSE;
+	if ((sonarRange != lastSonarRange) || (sonarQuality != lastSonarQuality))
+		changed |= IN_SONAR;
+	lastBumps = bumps;
+	lastCliff = cliff;
+	lastX = odometry->getX();
+	lastY = odometry->getY();
+	lastTheta = odometry->getTheta();
+	lastSonarRange = sonarRange;
+	lastSonarQuality = sonarQuality;
+}
+
+// the inputs which have changed since the last call
+unsigned int RoombaSensors::takeChanged()
+{
+	unsigned int rv = changed;
 
+	changed = 0;
+	return rv;
 }
 
 void RoombaSensors::printData()
 {
 	//printf("%s bump: %d %d\n", timestampString, bump_left(roomba->sensor_bytes[0]), bump_right(roomba->sensor_bytes[0]));
-	printf("X_pos: %0.1f Y_pos: %0.1f theta %3.0f deg", X_pos, Y_pos, theta*RADS);
+	printf("X_pos: %0.1f Y_pos: %0.1f theta %3.0f deg", odometry->getX(), odometry->getY(),
+			odometry->getTheta()*RADS);
 }
 
 bool RoombaSensors::healthCheck()
@@ -80,7 +140,6 @@ void RoombaSensors::odometers()
 {
 
     /* sample the left and right encoder counts */
-	// FIXME handle rollover/under
     lsamp = roomba->lEncoder;
     rsamp = roomba->rEncoder;
 
@@ -90,7 +149,8 @@ void RoombaSensors::odometers()
         last_right = rsamp;
     	first = false;
     }
-    /* determine how many ticks since our last sampling? */
+    /* determine how many ticks since our last sampling? 16 bit rollover is
+       handled by difference() */
     L_ticks = difference(lsamp, last_left);
     R_ticks = difference(rsamp, last_right);
 
@@ -98,49 +158,109 @@ void RoombaSensors::odometers()
     last_left = lsamp;
     last_right = rsamp;
 
-    /* convert longs to floats and ticks to inches */
-    left_inches = (float)L_ticks/LEFT_CLICKS_PER_INCH;
-    right_inches = (float)R_ticks/RIGHT_CLICKS_PER_INCH;
-
-    /* calculate distance we have traveled since last sampling */
-    inches = (left_inches + right_inches) / 2.0;
-
-    /* accumulate total rotation around our center */
-    deltaTheta = (left_inches - right_inches) / WHEEL_BASE;
-    theta += deltaTheta;
-
-    /* and clip the rotation to plus or minus 360 degrees */
-    theta -= (float)((int)(theta/TWOPI))*TWOPI;
-
-    /* now calculate and accumulate our position in inches */
-    Y_pos += inches * cos(theta);
-    X_pos += inches * sin(theta);
-
-    if ( L_ticks > 1000 || R_ticks > 1000) {
-    	printf("ERROR: *** ticks has an unreasonable value **** L_ticks: %d R_ticks: %d X_pos: %0.1f Y_pos: %0.1f\n",
-    			L_ticks, R_ticks, X_pos, Y_pos);
-    }
+    if (poseFilter != NULL)
+    	poseFilter->updateOdometry(L_ticks, R_ticks, readStamp);
+    else
+    	odometry->update(L_ticks, R_ticks);
 }
 
 void RoombaSensors::initSonar()
 {
 
-		fprintf(stderr, "attaching shared memory for sonar data\n");
 		int shmid;
 
-		if ((shmid = shmget(KEY2, SHM_SZ, SHMFLAGS)) == -1) {
+		sonarRange = 0;
+		sonarQuality = 0;
+		sonarStamp.tv_sec = sonarStamp.tv_usec = 0;
+		if (inputReplaying())
+			return;		// readings come from the log
+		fprintf(stderr, "attaching shared memory for sonar data\n");
+		if ((shmid = shmget(SONAR_SHM_KEY, sizeof(sonarShmStruct), SHMFLAGS)) == -1) {
 			perror("shmget");
 			exit(errno);
 		}
 
-		if ((sonar_p = (int *)shmat(shmid, (void*)0, 0)) == (void*)-1) {
+		if ((sonar_p = (sonarShmStruct *)shmat(shmid, (void*)0, 0)) == (void*)-1) {
 			perror("shmat");
 			exit(errno);
 		}
 		fprintf(stderr, "attached shared memory at address 0x%x\n", (int)sonar_p);
+		if (sonar_p->magic != SONAR_SHM_MAGIC)
+			fprintf(stderr, "sonar shared memory is not initialized yet - is SonarRanger running?\n");
 
 }
 
+/*
+ * Put the HM6352 in 20Hz continuous mode & switch to odometry corrected by it. Returns
+ * false, leaving plain odometry, if the compass doesn't respond
+ */
+bool RoombaSensors::initCompass()
+{
+	FILE *log;
+
+	if (!inputReplaying()) {
+		I2CInit();
+		WakeHM6352();
+		if (!SetHM6352Mode(MODE_CONTINUOUS)) {
+			fprintf(stderr, "HM6352 compass not responding, using odometry heading only\n");
+			return false;
+		}
+	}
+	poseFilter = new PoseFilter();
+	setOdometry(poseFilter);
+	if (poseLogPath != NULL) {
+		if ((log = fopen(poseLogPath, "w")) == NULL)
+			perror("can't open pose log");
+		else
+			poseFilter->setLog(log);
+	}
+	fprintf(stderr, "HM6352 compass correcting the heading\n");
+	return true;
+}
+
+/*
+ * Fuse the compass's latest heading. In continuous mode it's on average half a sample old
+ */
+void RoombaSensors::readCompass()
+{
+	unsigned short heading = inputReplaying() ? 0xffff : ReadHM6352();
+	struct timeval stamp = readStamp;
+
+	if (inputLog != NULL)
+		inputLog->compassHeading(&heading);
+	if (heading >= 3600)
+		return;			// read failed
+	stamp.tv_usec -= COMPASS_LATENCY_MS * 1000;
+	if (stamp.tv_usec < 0) {
+		stamp.tv_usec += 1000000;
+		stamp.tv_sec--;
+	}
+	poseFilter->updateCompass(heading / 10.0, stamp);
+}
+
+/*
+ * Copy the latest reading of sonar 0 out of shared memory. If SonarRanger hasn't
+ * initialized the segment the reading is reported with quality 0
+ */
+void RoombaSensors::readSonar()
+{
+	long tvSec, tvUsec;
+
+	if (inputReplaying()) {
+		inputLog->sonar(&sonarRange, &sonarQuality);
+		return;
+	}
+	if ((sonar_p->magic != SONAR_SHM_MAGIC) || (sonar_p->numSonars == 0)) {
+		sonarQuality = 0;
+	} else {
+		sonarShmRead(&sonar_p->sonar[0], &sonarRange, &sonarQuality, &tvSec, &tvUsec);
+		sonarStamp.tv_sec = tvSec;
+		sonarStamp.tv_usec = tvUsec;
+	}
+	if (inputLog != NULL)
+		inputLog->sonar(&sonarRange, &sonarQuality);
+}
+
 
 
 // getters/setters
@@ -166,22 +286,50 @@ bool RoombaSensors::getWheelDrop()
 
 float RoombaSensors::getTheta()
 {
-    return theta;
+    return odometry->getTheta();
 }
 
 float RoombaSensors::getDeltaTheta()
 {
-    return deltaTheta;
+    return odometry->getDeltaTheta();
 }
 
 float RoombaSensors::getX_pos()
 {
-    return X_pos;
+    return odometry->getX();
 }
 
 float RoombaSensors::getY_pos()
 {
-    return Y_pos;
+    return odometry->getY();
+}
+
+// true if the compass is correcting the heading
+bool RoombaSensors::getCompassInUse()
+{
+    return poseFilter != NULL;
+}
+
+// the obstacle map, which is kept up to date from the first time it's asked for
+OccupancyGrid *RoombaSensors::getGrid()
+{
+    if (grid == NULL)
+        grid = new OccupancyGrid();
+    return grid;
+}
+
+Odometry *RoombaSensors::getOdometry()
+{
+    return odometry;
+}
+
+// replace the odometry with another estimator, which takes over the current pose
+void RoombaSensors::setOdometry(Odometry *odometryIn)
+{
+    odometryIn->setParams(odometry->getParams());
+    odometryIn->reset(odometry->getX(), odometry->getY(), odometry->getTheta());
+    delete odometry;
+    odometry = odometryIn;
 }
 
 int RoombaSensors::getSonarRange()
@@ -189,3 +337,20 @@ int RoombaSensors::getSonarRange()
     return sonarRange;
 }
 
+// 0 if the sonar range is invalid, else 1 - 100 confidence in the range
+int RoombaSensors::getSonarQuality()
+{
+    return sonarQuality;
+}
+
+// milliseconds since the echo that produced the sonar range
+unsigned long RoombaSensors::getSonarAge()
+{
+	struct timeval now;
+
+	if (sonarStamp.tv_sec == 0)
+		return 0xffffffff;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - sonarStamp.tv_sec) * 1000 + (now.tv_usec - sonarStamp.tv_usec) / 1000;
+}
+
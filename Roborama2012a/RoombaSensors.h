@@ -8,16 +8,20 @@
 #ifndef ROOMBASENSORS_H_
 #define ROOMBASENSORS_H_
 
+#include <sys/time.h>
 #include "qegpioint.h"
 #include "roombalib.h"
+#include "Odometry.h"
+#include "Layer.h"
 
-#define WHEEL_BASE 9.13
-// clicks/inch calibrated on concrete at DMS 1/31/12
-#define LEFT_CLICKS_PER_INCH 58.5
-#define RIGHT_CLICKS_PER_INCH 58.5
+#define COMPASS_LATENCY_MS 25	// mean age of an HM6352 reading in 20Hz continuous mode
 
-#define TWOPI 6.2831853070		/* nice to have float precision */
-#define RADS 57.2958			/* radians to degrees conversion */
+class PoseFilter;
+class OccupancyGrid;
+
+// set from the command line before RoombaSensors is constructed
+extern int useCompass;				// correct the heading with the HM6352 compass
+extern const char *poseLogPath;		// record odometry & compass to this file for PoseReplay
 
 class RoombaSensors {
 public:
@@ -35,7 +39,15 @@ public:
 	void printData();
 	//void readRange();
 	void initSonar();
+	bool initCompass();
     int getSonarRange();
+    int getSonarQuality();
+    unsigned long getSonarAge();
+    bool getCompassInUse();
+    OccupancyGrid *getGrid();
+    Odometry *getOdometry();
+    void setOdometry(Odometry *odometryIn);
+    unsigned int takeChanged();
 
     // getters & setters
     bool getGrabberOpen() const
@@ -56,6 +68,8 @@ public:
 
     void setVisTargetValid(bool visTargetValid)
     {
+        if (visTargetValid != this->visTargetValid)
+            changed |= IN_VISION;
         this->visTargetValid = visTargetValid;
     }
 
@@ -66,28 +80,40 @@ public:
 
     void setVisTargetBearing(int visTargetBearing)
     {
+        if (visTargetBearing != this->visTargetBearing)
+            changed |= IN_VISION;
         this->visTargetBearing = visTargetBearing;
     }
 
 private:
     Roomba *roomba;
-    /* odometer maintains these global variables: */
-    float theta; /* bot heading */
-    float deltaTheta; /* how much we span since last iteration */
-    float X_pos; /* bot X position in inches */
-    float Y_pos; /* bot Y position in inches */
+    Odometry *odometry; /* maintains the bot's X, Y & heading */
+    PoseFilter *poseFilter; /* the odometry, if the compass is in use, else NULL */
+    OccupancyGrid *grid; /* map of obstacles found, NULL until a layer asks for it */
     int sonarRange; /* sonar reading range */
+    int sonarQuality; /* 0: sonarRange invalid, else 1 - 100 confidence */
+    struct timeval sonarStamp; /* time of the echo that produced sonarRange */
+    struct timeval readStamp; /* when readSensors() read the inputs */
     bool grabberOpen;	// grabber state
 
     // variables used to calculate X, Y, theta
     unsigned short lsamp, rsamp, last_left, last_right;
     short L_ticks, R_ticks;
-    float left_inches, right_inches, inches;
     bool first; // first time through the position tracking loop when true
     void odometers();
+    void readSonar();
+    void readCompass();
     short difference(unsigned short  val, unsigned short  lastval);
     bool visTargetValid; // true if the visual target bearing is valid
     int visTargetBearing;
+
+    // Layer IN_* inputs which have changed since takeChanged(), & what they were
+    unsigned int changed;
+    unsigned char lastBumps;
+    int lastCliff;
+    double lastX, lastY, lastTheta;
+    int lastSonarRange, lastSonarQuality;
+    void findChanges();
 };
 
 #endif /* ROOMBASENSORS_H_ */
@@ -0,0 +1,79 @@
+/*
+ * SonarShm.h
+ *
+ *  Created on: Dec 2, 2012
+ *      Author: bouchier
+ */
+/*! \file SonarShm.h
+ * \brief Shared memory layout used to publish sonar ranges between processes
+ *
+ * The sonar ranging process (SonarRanger) creates a SysV shared memory segment with key
+ * SONAR_SHM_KEY and publishes one sonarShmReading per sonar into it. Readers (e.g.
+ * RoombaSensors) attach the segment & call sonarShmRead() to get a consistent copy.
+ *
+ * Each reading is protected by a sequence lock: the writer makes seq odd while it updates the
+ * reading and even when it's done, so a reader that sees seq change (or sees it odd) just
+ * retries. The writer never waits for a reader. The EP9302 is a single-core CPU, so a compiler
+ * barrier is sufficient to order the accesses.
+ *
+ * This file is shared by the SonarRanger and Roborama2012a projects - keep the copies identical.
+ */
+
+#ifndef SONARSHM_H_
+#define SONARSHM_H_
+
+#include <sched.h>
+#include <sys/ipc.h>
+
+#define SONAR_SHM_KEY (key_t)6061
+#define SONAR_SHM_MAGIC 0x534f4e52		// "SONR" - set once the writer has initialized the segment
+#define SONAR_SHM_MAX 4					// most sonars that can be published
+
+#define SONAR_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/*! A single published sonar reading */
+typedef struct {
+	volatile unsigned int seq;		// sequence lock: odd while the writer is updating
+	volatile int range;				// filtered range in inches
+	volatile int quality;			// 0: no echo/invalid, 1 - 100: confidence in range
+	volatile long tvSec;			// timestamp of the echo that produced range
+	volatile long tvUsec;
+} sonarShmReading;
+
+typedef struct {
+	volatile unsigned int magic;		// SONAR_SHM_MAGIC when the writer has initialized the segment
+	volatile unsigned int numSonars;	// number of valid entries in sonar[]
+	sonarShmReading sonar[SONAR_SHM_MAX];
+} sonarShmStruct;
+
+/*! Publish a reading. Only one process may write a given reading. */
+static inline void sonarShmWrite(sonarShmReading *r, int range, int quality, long tvSec, long tvUsec)
+{
+	r->seq++;					// odd: update in progress
+	SONAR_BARRIER();
+	r->range = range;
+	r->quality = quality;
+	r->tvSec = tvSec;
+	r->tvUsec = tvUsec;
+	SONAR_BARRIER();
+	r->seq++;					// even: update complete
+}
+
+/*! Get a consistent copy of a reading without blocking the writer */
+static inline void sonarShmRead(sonarShmReading *r, int *range, int *quality, long *tvSec, long *tvUsec)
+{
+	unsigned int seq;
+
+	do {
+		while ((seq = r->seq) & 1)
+			sched_yield();		// writer is mid-update, let it finish
+		SONAR_BARRIER();
+		*range = r->range;
+		*quality = r->quality;
+		*tvSec = r->tvSec;
+		*tvUsec = r->tvUsec;
+		SONAR_BARRIER();
+	} while (seq != r->seq);
+}
+
+#endif /* SONARSHM_H_ */
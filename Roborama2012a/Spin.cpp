@@ -29,6 +29,7 @@ void Spin::setSpin(int degIn)
 {
 	degreesToSpin = (float)degIn;
 	flag = 1;
+	touch();
 }
 
 void Spin::spinTo(int degIn)
@@ -36,6 +37,7 @@ void Spin::spinTo(int degIn)
 	degreesToSpin = this->headingChange(degIn, (roombaSensors->getTheta() * RADS));
 	printf("spinTo set target of %d, spinning %f\n", degIn, degreesToSpin);
 	flag = 1;
+	touch();
 }
 
 void Spin::eval()
@@ -16,6 +16,7 @@ class Spin: public Layer {
 public:
 	Spin(RoombaSensors *rs);
 	void eval();
+	unsigned int getInputs() {return(IN_POSE);}
 	void setSpin(int degIn);
 	void spinTo(int degIn);
 	int headingChange(int target, int heading);
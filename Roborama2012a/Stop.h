@@ -16,6 +16,7 @@ class StopBot : public Layer {
 public:
 	StopBot(RoombaSensors *rs);
 	void eval();
+	unsigned int getInputs() {return(IN_POSE);}
 private:
 	RoombaSensors *roombaSensors;
 };
@@ -6,10 +6,14 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
 #include <keypad.h>
 #include <textlcd.h>
 #include "roombalib.h"
 #include "Subsumption.h"
+#include "Behaviour.h"
 #include "Metro.h"
 #include "Layer.h"
 #include "WheelDrop.h"
@@ -22,8 +26,11 @@
 #include "Point2VisTarget.h"
 #include "MissionControl.h"
 #include "Stop.h"
+#include "Avoid.h"
+#include "Planner.h"
 #include "MotorCmd.h"
 #include "RoombaSensors.h"
+#include "InputLog.h"
 
 
 #define RUNTIME 0
@@ -31,151 +38,331 @@
 CKeypad &keypad = CKeypad::GetRef();
 CTextLcd &lcd = CTextLcd::GetRef();
 Subsumption *sub_p;
+const char *tracePath = NULL;
+const char *recordPath = NULL;
 
-// Explore a space using bump-turn & other algorithms
-void startSubsumption(int algorithm, int arg, int *waypointList, Roomba *roomba) {
+/*
+ * The layer registry. Each layer is made by its factory the first time it's used, either
+ * by the behaviour's layer stack or by another layer which drives it. A layer whose flag
+ * is always set hides everything below it
+ */
+typedef Layer *(*LayerFactory)(Subsumption *sub);
+
+static Layer *makeWheelDrop(Subsumption *sub)
+{
+	return new WheelDrop(sub->getRoombaSensors());
+}
+
+static Layer *makeBump(Subsumption *sub)
+{
+	return new Bump(sub->getRoombaSensors(), sub->getRoomba()->velocity);
+}
+
+static Layer *makeCruise(Subsumption *sub)
+{
+	return new Cruise(sub->getRoomba()->velocity);
+}
+
+static Layer *makeStop(Subsumption *sub)
+{
+	return new StopBot(sub->getRoombaSensors());
+}
+
+static Layer *makeTarget(Subsumption *sub)
+{
+	Target *target = new Target(sub->getRoombaSensors());
+
+	target->setStopAtWaypoints(sub->getConfig()->stopAtWaypoints);
+	if (sub->getConfig()->haveWaypoints)
+		target->setTargets(sub->getConfig()->waypoints);
+	if (sub->getConfig()->plan)
+		target->setPlanner(new Planner(sub->getRoombaSensors()->getGrid()));
+	return target;
+}
+
+static Layer *makeSpin(Subsumption *sub)
+{
+	Spin *spin = new Spin(sub->getRoombaSensors());
+
+	if (sub->getConfig()->haveSpin)
+		spin->setSpin(sub->getConfig()->spin);
+	return spin;
+}
+
+static Layer *makeVirtualCage(Subsumption *sub)
+{
+	BehaviourConfig *cfg = sub->getConfig();
+
+	return new VirtualCage(sub->getRoombaSensors(), sub->getRoomba()->velocity,
+			cfg->haveCage ? cfg->cageX : 40, cfg->haveCage ? cfg->cageY : 40);
+}
+
+static Layer *makeGrab(Subsumption *sub)
+{
+	return new Grab(sub->getRoombaSensors());
+}
+
+static Layer *makeAvoid(Subsumption *sub)
+{
+	return new Avoid(sub->getRoombaSensors(), sub->getRoomba()->velocity);
+}
+
+static Layer *makePoint2VisTarget(Subsumption *sub)
+{
+	Point2VisTarget *pv = new Point2VisTarget(sub->getRoombaSensors(),
+			(Spin *)sub->getLayer("spin", "point2VisTarget"));
+
+	pv->shmInit();
+	return pv;
+}
+
+// missionControl only needs the layers its state machine drives
+static Layer *makeMissionControl(Subsumption *sub)
+{
+	BehaviourConfig *cfg = sub->getConfig();
+	Target *t = NULL;
+	Point2VisTarget *pv = NULL;
+	Spin *s = NULL;
+	Bump *b = NULL;
+	Cruise *c = NULL;
+	MissionControl *mc;
+
+	pv = (Point2VisTarget *)sub->getLayer("point2VisTarget", "missionControl");
+	if ((cfg->mission == MISSION_ROBOCOLUMBUS) || (cfg->mission == MISSION_TABLEBOT))
+		t = (Target *)sub->getLayer("target", "missionControl");
+	if (cfg->mission == MISSION_ROBOCOLUMBUS)
+		b = (Bump *)sub->getLayer("bump", "missionControl");
+	if (cfg->mission == MISSION_TABLEBOT) {
+		s = (Spin *)sub->getLayer("spin", "missionControl");
+		c = (Cruise *)sub->getLayer("cruise", "missionControl");
+	}
+	mc = new MissionControl(sub->getRoombaSensors(), t, pv, s, b, c);
+	mc->setMission(cfg->mission, cfg->param);
+	return mc;
+}
+
+static const struct {
+	const char *name;
+	LayerFactory create;
+	bool alwaysRuns;
+} layerRegistry[NUM_LAYER_TYPES] = {
+	{ "wheeldrop", makeWheelDrop, false },
+	{ "bump", makeBump, false },
+	{ "cruise", makeCruise, false },
+	{ "stop", makeStop, true },
+	{ "target", makeTarget, false },
+	{ "spin", makeSpin, false },
+	{ "virtualCage", makeVirtualCage, false },
+	{ "grab", makeGrab, false },
+	{ "point2VisTarget", makePoint2VisTarget, false },
+	{ "missionControl", makeMissionControl, false },
+	{ "avoid", makeAvoid, false },
+};
+
+static int layerIndex(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NUM_LAYER_TYPES; i++) {
+		if (!strcmp(name, layerRegistry[i].name))
+			return i;
+	}
+	return -1;
+}
+
+// Run a behaviour: the built-in one for algorithm & arg, or the one in behaviourFile if it isn't NULL
+void startSubsumption(int algorithm, int arg, const char *behaviourFile, Roomba *roomba) {
+	BehaviourConfig cfg;
 	int rv;
 
-	sub_p = new Subsumption(algorithm, arg, waypointList, roomba);
+	if (behaviourFile != NULL) {
+		if (!behaviourLoad(behaviourFile, &cfg))
+			return;
+	} else if (!behaviourBuiltin(algorithm, arg, &cfg)) {
+		return;
+	}
+	sub_p = new Subsumption(cfg, roomba);
+	if (!sub_p->isValid()) {
+		printf("behaviour %s is invalid, not running it\n", cfg.name);
+		return;
+	}
 	rv = sub_p->go();
 	printf("Subsumption.go ended with status %d\n", rv);
 	return;
 }
+
+// Replay an input log recorded with -I through the behaviour it recorded, without a Roomba
+int startReplay(const char *path) {
+	Roomba *roomba;
+	int fd, rv;
+
+	if ((inputLog = InputLog::replay(path)) == NULL)
+		return -1;
+	if ((fd = open("/dev/null", O_WRONLY)) < 0) {
+		perror("/dev/null");
+		return -1;
+	}
+	roomba = roomba_init_fd(fd, "replay");		// motor commands go nowhere
+	roomba->velocity = inputLog->getVelocity();
+	useCompass = inputLog->getCompass();
+	sub_p = new Subsumption(inputLog->getConfig(), roomba);
+	if (!sub_p->isValid()) {
+		printf("behaviour %s is invalid, not replaying it\n", inputLog->getConfig().name);
+		rv = -1;
+	} else {
+		sub_p->getRoombaSensors()->getOdometry()->setParams(inputLog->getParams());
+		rv = sub_p->replay();
+	}
+	delete inputLog;
+	inputLog = NULL;
+	roomba_free(roomba);
+	return rv;
+}
+
 /**
- * Constructor is responsible for understanding the requested algorithm & setting up the layers properly.
- * Each run only uses one algorithm.
+ * Constructor builds the layer stack the behaviour describes. Each run only uses one behaviour.
  */
-Subsumption::Subsumption(int algorithmIn, int paramIn, int *wpl, Roomba *roombaIn) {
+Subsumption::Subsumption(const BehaviourConfig &cfgIn, Roomba *roombaIn) {
+	int i;
+
 	// initialize subsumption object
-	algorithm = algorithmIn;
-	param = paramIn;
-	printf("Starting subsumption with algorithm %d\n", algorithm);
+	cfg = cfgIn;
+	behaviourPrint(&cfg);
 	roomba = roombaIn;
 	endMillis = millis() + RUNTIME;	// set endtime
 	heartMetro = new Metro(50);		// metronome ticks every 50ms
-	wayPointList = wpl;
 
-	// create other robot objects, & layer objects
+	// create other robot objects; layers are created as the stack needs them
 	roombaSensors = new RoombaSensors(roomba);
 	motorCmd = new MotorCmd(roomba);
-	grab = new Grab(roombaSensors);
-	bump = new Bump(roombaSensors, roomba->velocity);
-	virtualCage = new VirtualCage(roombaSensors,roomba->velocity, 40, 40);
-	spin = new Spin(roombaSensors);
-	target = new Target(roombaSensors);
-	wheeldrop = new WheelDrop(roombaSensors);
-	cruise = new Cruise(roomba->velocity);
-	point2VisTarget = new Point2VisTarget(roombaSensors, spin);
-	missionControl = new MissionControl(roombaSensors, target, point2VisTarget, spin, bump, cruise);
-	stopBot = new StopBot(roombaSensors);
-
-
-	// initialize subsumption algorithms
-	switch (algorithm) {
-	case 0:
-		// algorithm 0: just wanders around a space bouncing off walls & cliffs.
-		// cruise layer runs forever
-		alg0Layers[0] = wheeldrop;
-		alg0Layers[1] = bump;
-		alg0Layers[2] = cruise;
-		alg0Layers[3] = stopBot;
-		job = &alg0Layers[0];
-		job_size = 4;		// default, stopped
-		break;
-	case 1:			// algorithm 1 seeks to a list of waypoints passed in with waypointLIst
-		// algorithm 1 takes a list of targets
-		// target layer replaces cruise layer in wander algorithm, & drives through a list of waypoints
-		alg1Layers[0] = wheeldrop;
-		alg1Layers[1] = bump;
-		alg1Layers[2] = target;
-		target->setTargets(wayPointList);
-		alg1Layers[3] = stopBot;
-		job = &alg1Layers[0];
-		job_size = 4;
-		break;
-	case 2:
-		// algorithm 2 spins in place a number of degrees
-		alg2Layers[0] = spin;
-		spin->setSpin(param);
-		job = alg2Layers;
-		job_size = 1;
-		break;
-	case 3:
-		// algorithm 3 bounces around inside a virtual cage
-		// cruise layer runs forever
-		algLayers[0] = wheeldrop;
-		algLayers[1] = bump;
-		algLayers[2] = virtualCage;
-		algLayers[3] = cruise;
-		algLayers[4] = stopBot;
-		job = &algLayers[0];
-		job_size = 5;
-		break;
-	case 4:
-		// algorithm 4 drives a distance and grabs a can if one comes in range. Grabber is active
-		algLayers[0] = wheeldrop;
-		algLayers[1] = bump;
-		algLayers[2] = grab;
-		algLayers[3] = target;
-		target->setTargets(wayPointList);
-		algLayers[4] = stopBot;
-		job = &algLayers[0];
-		job_size = 5;
-		break;
-	case 5:
-		// algorithm 5 spins back and forth to find the visual target and end up pointing to it
-		algLayers[0] = spin;
-		algLayers[1] = target;
-		algLayers[2] = point2VisTarget;
-		point2VisTarget->shmInit();
-		algLayers[3] = missionControl;
-		algLayers[4] = stopBot;
-		job = &algLayers[0];
-		job_size = 5;
-		break;
-	case 6:
-		// algorithm 6 runs Robocolumbus
-		algLayers[0] = bump;
-		algLayers[1] = spin;
-		algLayers[2] = target;
-		algLayers[3] = point2VisTarget;
-		point2VisTarget->shmInit();
-		algLayers[4] = missionControl;
-		algLayers[5] = stopBot;
-		job = &algLayers[0];
-		job_size = 6;		// default, stopped
-		break;
-	case 7:
-		// algorithm 6 runs TableBot
-		algLayers[0] = grab;
-		algLayers[1] = bump;
-		algLayers[2] = spin;
-		algLayers[3] = target;
-		algLayers[4] = cruise;
-		algLayers[5] = point2VisTarget;
-		point2VisTarget->shmInit();
-		algLayers[6] = missionControl;
-		algLayers[7] = stopBot;
-		job = &algLayers[0];
-		job_size = 8;		// default, stopped
-		break;
-	default:
-		// invalid algorithm
-		fprintf(stderr, "invalid algorithm %d, exiting\n", algorithm);
-		exit(-1);
-	}
-	this_layer = job[0];	// start with first layer in current job
+	for (i = 0; i < NUM_LAYER_TYPES; i++) {
+		layers[i] = NULL;
+		layerUser[i] = NULL;
+	}
+	job_size = 0;
+	loopCnt = 0;
+	ticks = 0;
+	for (i = 0; i < BEH_MAX_LAYERS; i++) {
+		pending[i] = IN_ALL;
+		evals[i] = cached[i] = wins[i] = 0;
+		evalUsecs[i] = evalMaxUsec[i] = 0;
+	}
+	trace = NULL;
+	if ((tracePath != NULL) && ((trace = fopen(tracePath, "w")) == NULL))
+		perror("can't open arbitration trace");
+
+	valid = buildStack() && validate();
+	grab = (Grab *)layers[layerIndex("grab")];
+	missionControl = (MissionControl *)layers[layerIndex("missionControl")];
+	this_layer = job_size ? job[0] : NULL;	// start with first layer in current job
 	arbitrateEnable = 1;
 	halt = 0;
+}
 
-	// initialize subsumption layers for this algorithm
+/*
+ * The registered layer called name, made on first use. user is the layer which needs it,
+ * or NULL for the layer stack. Returns NULL if there's no such layer
+ */
+Layer *Subsumption::getLayer(const char *name, const char *user)
+{
+	int i = layerIndex(name);
+
+	if (i < 0)
+		return NULL;
+	if (layers[i] == NULL) {
+		layerUser[i] = user;
+		layers[i] = layerRegistry[i].create(this);
+	}
+	return layers[i];
+}
+
+/*
+ * Make the layers in the stack. Returns false if a layer is unknown or listed twice
+ */
+bool Subsumption::buildStack()
+{
+	bool ok = true;
+	int i, j;
+
+	if (cfg.numLayers == 0) {
+		printf("behaviour %s: no layers\n", cfg.name);
+		return false;
+	}
+	for (i = 0; i < cfg.numLayers; i++) {
+		if (layerIndex(cfg.layers[i]) < 0) {
+			printf("behaviour %s: error: unknown layer %s\n", cfg.name, cfg.layers[i]);
+			ok = false;
+		}
+		for (j = 0; j < i; j++) {
+			if (!strcmp(cfg.layers[i], cfg.layers[j])) {
+				printf("behaviour %s: error: conflict, layer %s is listed twice\n", cfg.name, cfg.layers[i]);
+				ok = false;
+			}
+		}
+	}
+	if (!ok)
+		return false;
 
+	for (i = 0; i < cfg.numLayers; i++) {
+		job[i] = getLayer(cfg.layers[i], NULL);
+		layerUser[layerIndex(cfg.layers[i])] = NULL;	// in the stack, whoever made it
+	}
+	job_size = cfg.numLayers;
+	return true;
+}
+
+/*
+ * Report layers & parameters that will never be used, & parameters which are missing.
+ * Returns false if the behaviour can't run
+ */
+bool Subsumption::validate()
+{
+	const char *hiddenBy = NULL;
+	bool ok = true;
+	int i, idx;
+
+	for (i = 0; i < job_size; i++) {
+		idx = layerIndex(cfg.layers[i]);
+		if (hiddenBy != NULL)
+			printf("behaviour %s: warning: unused layer %s, it's below %s which always runs\n",
+					cfg.name, cfg.layers[i], hiddenBy);
+		else if (layerRegistry[idx].alwaysRuns)
+			hiddenBy = cfg.layers[i];
+	}
+	if (hiddenBy == NULL)
+		printf("behaviour %s: note: no default layer at the bottom, the run ends when no layer wants control\n",
+				cfg.name);
+
+	for (i = 0; i < NUM_LAYER_TYPES; i++) {
+		if ((layers[i] != NULL) && (layerUser[i] != NULL))
+			printf("behaviour %s: warning: %s drives %s, which isn't in the layer stack so its motor requests are never used\n",
+					cfg.name, layerUser[i], layerRegistry[i].name);
+	}
+
+	if (cfg.haveWaypoints && (layers[layerIndex("target")] == NULL))
+		printf("behaviour %s: warning: unused waypoints, there's no target layer\n", cfg.name);
+	if (cfg.plan && (layers[layerIndex("target")] == NULL))
+		printf("behaviour %s: warning: plan, but there's no target layer to follow it\n", cfg.name);
+	if (cfg.haveSpin && (layers[layerIndex("spin")] == NULL))
+		printf("behaviour %s: warning: unused spin, there's no spin layer\n", cfg.name);
+	if (cfg.haveCage && (layers[layerIndex("virtualCage")] == NULL))
+		printf("behaviour %s: warning: unused cage, there's no virtualCage layer\n", cfg.name);
+	if (layers[layerIndex("missionControl")] == NULL) {
+		if (cfg.mission != MISSION_NONE)
+			printf("behaviour %s: warning: unused mission, there's no missionControl layer\n", cfg.name);
+		if (cfg.haveParam)
+			printf("behaviour %s: warning: unused param, there's no missionControl layer\n", cfg.name);
+	} else if (cfg.mission == MISSION_NONE) {
+		printf("behaviour %s: error: missionControl needs a mission\n", cfg.name);
+		ok = false;
+	}
+	return ok;
 }
 
 int Subsumption::go() {
-	int loopCnt = 0;
 	int rv;
-	missionControl->setSubPtr(sub_p);	// set pointer to Subsumption object in missionControl
+	if (missionControl != NULL)
+		missionControl->setSubPtr(sub_p);	// set pointer to Subsumption object in missionControl
 
 	// main run loop for exploring
 	if (!roombaSensors->healthCheck()) {
@@ -184,67 +371,202 @@ int Subsumption::go() {
 		return -1;
 	}
 
+	// have the Roomba stream its sensors so the loop doesn't wait on the serial port.
+	// Fall back to polling if it won't
+	if (roomba_stream_start(roomba, NULL, 0) < 0)
+		printf("Sensor streaming failed to start, polling sensors\n");
+
+	// layers re-send their speed every tick; hold motor commands & send the net result
+	// once per tick, so unchanged commands don't compete with sensor traffic
+	roomba_tx_defer(roomba, 1);
+	roomba_reset_tx_stats(roomba);
+
+	if (recordPath != NULL)
+		inputLog = InputLog::record(recordPath, cfg, roomba->velocity,
+				roombaSensors->getCompassInUse(), roombaSensors->getOdometry()->getParams());
+
 	lcd.Clear();
 	lcd.printf("Press X to exit");
 
-	while (((millis() < endMillis) || (RUNTIME == 0)) && !keypad.KeyCancel()) {
+	while ((millis() < endMillis) || (RUNTIME == 0)) {
 		if (heartMetro->check()) {
 			// metronome has ticked, time to run the algorithm
-			now = millis();
-			sprintf(timestampString, "%d.%03d:", now/1000, now%1000);
-
-			// read sensor data
-			roombaSensors->readSensors(timestampString);	// read sensors from Roomba
+			rv = tick();
 
-			// evaluate each layer & choose the active one & pass its output to the motors
-			rv = arbitrate();		// do the subsumption layer evaluation & arbitration
-
-			// quit if no layers want to control robot
-			if (rv < 0)
+			// quit if X was pressed or no layers want to control robot
+			if (rv != 0)
 				break;				// quit running subsumption & go do something more interesting
-
-			// periodically print debug data
-			if (!((loopCnt++)%10)) {
-				printf("%s: ", timestampString);
-				roombaSensors->printData();
-				//target->printData();
-				//motorCmd->printData();
-			}
 		}
 	}
 
 	// finished this run, return & maybe get asked to do another run
+	roomba_tx_defer(roomba, 0);
+	roomba_stream_stop(roomba);
 	roomba_stop(roomba);
-	grab->openGrabber();
+	roomba_print_tx_stats(roomba);
+	roomba_print_rx_stats(roomba);
+	printArbitrationStats();
+	if (trace != NULL) {
+		fclose(trace);
+		trace = NULL;
+	}
+	if (inputLog != NULL) {
+		inputLog->printData();
+		delete inputLog;
+		inputLog = NULL;
+	}
+	if (layers[layerIndex("avoid")] != NULL)
+		((Avoid *)layers[layerIndex("avoid")])->printData();
+	if ((layers[layerIndex("target")] != NULL) && (((Target *)layers[layerIndex("target")])->getPlanner() != NULL))
+		((Target *)layers[layerIndex("target")])->getPlanner()->printData();
+	if (grab != NULL)
+		grab->openGrabber();
+	return 0;
+}
+
+/*
+ * Run the stack on inputLog's inputs as fast as it will go, checking its motor commands
+ * against the recording & timing each tick. The time includes the stack's printfs.
+ * Returns 0 if the output matched the recording
+ */
+int Subsumption::replay()
+{
+	struct timeval start, end, first;
+	unsigned long usec, totalUsec = 0, maxUsec = 0, n = 0;
+	double recorded;
+	int rv = 0;
+
+	if (missionControl != NULL)
+		missionControl->setSubPtr(sub_p);
+	roomba_tx_defer(roomba, 1);
+	gettimeofday(&first, NULL);
+	while (!inputLog->atEnd()) {
+		gettimeofday(&start, NULL);
+		rv = tick();
+		gettimeofday(&end, NULL);
+		usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+		totalUsec += usec;
+		if (usec > maxUsec)
+			maxUsec = usec;
+		n++;
+		if (rv != 0)
+			break;
+	}
+	roomba_tx_defer(roomba, 0);
+	if (!inputLog->atEnd())
+		inputLog->stoppedEarly();
+
+	printArbitrationStats();
+	if (trace != NULL) {
+		fclose(trace);
+		trace = NULL;
+	}
+	inputLog->printData();
+	recorded = (inputLog->getStamp().tv_sec - inputLog->getFirstStamp().tv_sec) +
+			(inputLog->getStamp().tv_usec - inputLog->getFirstStamp().tv_usec) / 1e6;
+	usec = (end.tv_sec - first.tv_sec) * 1000000 + (end.tv_usec - first.tv_usec);
+	printf("replay: stack cost per tick mean %0.1f us, max %lu us; %0.1f s of run replayed in %0.1f ms\n",
+			n ? (double)totalUsec / n : 0.0, maxUsec, recorded, usec / 1e3);
+	return (inputLog->getMismatches() || inputLog->getDesyncs()) ? -1 : 0;
+}
+
+/*
+ * One tick: read the sensors, evaluate the layers & send the winner's request to the
+ * motors. Returns 0 to carry on, 1 if X was pressed, -1 if no layers want to run
+ */
+int Subsumption::tick()
+{
+	bool cancel = inputReplaying() ? false : keypad.KeyCancel();
+	int rv;
+
+	// read sensor data
+	roombaSensors->readSensors(timestampString);	// read sensors from Roomba
+	now = inputReplaying() ? inputLog->getRunMillis() : millis();
+	sprintf(timestampString, "%d.%03d:", now/1000, now%1000);
+	if (inputLog != NULL)
+		inputLog->keys(&cancel);
+	if (cancel)
+		return 1;
+
+	// evaluate each layer & choose the active one & pass its output to the motors
+	rv = arbitrate();		// do the subsumption layer evaluation & arbitration
+	roomba_tx_flush(roomba);
+	if (rv < 0)
+		return -1;
+
+	// periodically print debug data
+	if (!((loopCnt++)%10)) {
+		printf("%s: ", timestampString);
+		roombaSensors->printData();
+		//target->printData();
+		//motorCmd->printData();
+	}
 	return 0;
 }
 
 /**
+ * Layers are evaluated in priority order until one wants control. A layer is only
+ * evaluated if one of the inputs it declares has changed since its last eval, or it has
+ * been touch()ed; otherwise it would decide the same again, so its flag & request are
+ * used as they stand. Layers with a state timer running declare IN_TICK & run every tick.
  * @return 0 for normal return, -1 if no layers want to run. This is a way to stop processing.
  */
 int Subsumption::arbitrate()
 {
+    struct timeval start, end;
+    unsigned int changed, inputs;
+    bool dirty;
+    long usec;
     int i = 0;
 
     if (arbitrateEnable) {
-    	// step through all Layer objects running the eval method, so any side-effects always happen
-//        for (i = 0; i < job_size; i++) {
-//            job[i]->eval();
-//        }
+    	changed = roombaSensors->takeChanged() | IN_TICK;
+    	for (i = 0; i < job_size; i++)
+    		pending[i] |= changed;		// layers below the winner catch up when next reached
+    	ticks++;
+    	if (trace != NULL)
+    		fprintf(trace, "%s", timestampString);
 
         // step through Layer objects in priority order until we find the first one that wants to take control
         for (i = 0; i < job_size; i++) { // step through tasks
-        	job[i]->eval();				// evaluate whether this layer wants to run
+        	inputs = job[i]->getInputs();
+        	dirty = job[i]->takeDirty();
+        	if (dirty || (pending[i] & inputs)) {
+        		if (trace != NULL)
+        			gettimeofday(&start, NULL);
+        		job[i]->eval();				// evaluate whether this layer wants to run
+        		pending[i] = 0;
+        		evals[i]++;
+        		if (job[i]->getInputs() != inputs)
+        			job[i]->touch();		// it changed state; see what it makes of the inputs next tick
+        		if (trace != NULL) {
+        			gettimeofday(&end, NULL);
+        			usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+        			evalUsecs[i] += usec;
+        			if ((unsigned long)usec > evalMaxUsec[i])
+        				evalMaxUsec[i] = usec;
+        			fprintf(trace, " %s:%ld", job[i]->getLayerName(), usec);
+        		}
+        	} else {
+        		cached[i]++;
+        		if (trace != NULL)
+        			fprintf(trace, " %s:-", job[i]->getLayerName());
+        	}
             if (job[i]->getFlag()) break;       // if yes, subsume lower priority layers by breaking to run its motor request
         }
 
         if ((i == job_size) && (!(job[i-1]->getFlag()))) {	// iterated through last layer & its flag is clear
+        	if (trace != NULL)
+        		fprintf(trace, " -> none\n");
         	printf("arbitrate: no layers want to run\n");
         	return -1;					// no layers want to run
         }
         else {
         	this_layer = job[i];        // highest priority layer is winner
         	activeLayerName = this_layer->getLayerName();
+        	wins[i]++;
+        	if (trace != NULL)
+        		fprintf(trace, " -> %s\n", activeLayerName);
         }
         motorCmd->setSpeed(this_layer);             // send command to motors
         return 0;
@@ -252,4 +574,20 @@ int Subsumption::arbitrate()
     return 0;
 }
 
+/*
+ * How often each layer won, was evaluated & was skipped because its inputs hadn't
+ * changed. Eval times are only measured when tracing
+ */
+void Subsumption::printArbitrationStats()
+{
+	int i;
 
+	printf("arbitration: %lu ticks\n", ticks);
+	for (i = 0; i < job_size; i++) {
+		printf("  %-16s won %6lu evaluated %6lu cached %6lu", job[i]->getLayerName(),
+				wins[i], evals[i], cached[i]);
+		if ((trace != NULL) && evals[i])
+			printf(" eval mean %lu max %lu us", evalUsecs[i] / evals[i], evalMaxUsec[i]);
+		printf("\n");
+	}
+}
@@ -8,68 +8,76 @@
 #ifndef SUBSUMPTION_H_
 #define SUBSUMPTION_H_
 
-class WheelDrop;
-class Cruise;
-class Bump;
-class Target;
-class Point2VisTarget;
-class MissionControl;
-class StopBot;
+#include <stdio.h>
+#include "Behaviour.h"
+
 class Layer;
+class Grab;
+class MissionControl;
 class Metro;
 class RoombaSensors;
 class MotorCmd;
-class CTextLcd;
-class Spin;
-class VirtualCage;
-class Grab;
 
+#define NUM_LAYER_TYPES 11		// entries in the layer registry, see Subsumption.cpp
+
+// set from the command line before Subsumption is constructed
+extern const char *tracePath;		// record each tick's arbitration to this file
+extern const char *recordPath;		// record every input the stack reads to this file
 
 class Subsumption {
 public:
-	Subsumption(int algorithm, int arg, int *waypointList, Roomba *roomba);
+	Subsumption(const BehaviourConfig &cfgIn, Roomba *roomba);
 	int go();
+	int replay();
+	bool isValid() 		{return(valid);}
 	char *getActiveLayerName() 	{return(activeLayerName);}
-	int getAlgorithm() 	{return(algorithm);}
-	int getParam() 		{return(param);}
+	const char *getBehaviourName() 	{return(cfg.name);}
+
+	// for the layer factories
+	Layer *getLayer(const char *name, const char *user);
+	RoombaSensors *getRoombaSensors() 	{return(roombaSensors);}
+	Roomba *getRoomba() 	{return(roomba);}
+	BehaviourConfig *getConfig() 	{return(&cfg);}
 
 private:
 	unsigned int endMillis;	// when to end the program & exit
 	char timestampString[30];	// printable string for timestamp
 	int now;
+	int loopCnt;
 	Metro *heartMetro;
 	Roomba *roomba;
 	RoombaSensors *roombaSensors;
 	MotorCmd *motorCmd;
-	int *wayPointList;
 	char *activeLayerName;
-	int algorithm;
-	int param;
+	BehaviourConfig cfg;
+	bool valid;
 
-	WheelDrop *wheeldrop;
+	Layer *layers[NUM_LAYER_TYPES];		// instances, by registry index; NULL until used
+	const char *layerUser[NUM_LAYER_TYPES];	// the first layer which needed it, or NULL if the stack did
 	Grab *grab;
-	Bump *bump;
-	Target *target;
-	Spin *spin;
-	VirtualCage *virtualCage;
-	Cruise *cruise;
-	Point2VisTarget *point2VisTarget;
 	MissionControl *missionControl;
-	StopBot *stopBot;                     // the default layer
 	Layer *this_layer;      // output, layer chosen by arbitrator()
-	Layer *algLayers[16];				// allow up to 16 layers
-	Layer *alg0Layers[16];				// allow up to 16 layers
-	Layer *alg1Layers[16];
-	Layer *alg2Layers[16];
+	Layer *job[BEH_MAX_LAYERS];			// the layer stack, highest priority first
 
-	Layer **job;                    // pointer to job priority list
 	int job_size;                   // number of tasks in priority list
 	int arbitrateEnable;              // global flag to enable subsumption
 	int halt;                   // global flag to halt robot
 
+	// arbitration: inputs changed since each layer's last eval, & what it cost
+	unsigned int pending[BEH_MAX_LAYERS];
+	unsigned long evals[BEH_MAX_LAYERS], cached[BEH_MAX_LAYERS], wins[BEH_MAX_LAYERS];
+	unsigned long evalUsecs[BEH_MAX_LAYERS], evalMaxUsec[BEH_MAX_LAYERS];
+	unsigned long ticks;
+	FILE *trace;
+
+	bool buildStack();
+	bool validate();
+	int tick();
 	int arbitrate();
+	void printArbitrationStats();
 };
 
-extern "C" void startSubsumption(int algorithm, int arg, int *waypointList, Roomba *roomba);
+extern "C" void startSubsumption(int algorithm, int arg, const char *behaviourFile, Roomba *roomba);
+extern "C" int startReplay(const char *path);
 
 #endif /* SUBSUMPTION_H_ */
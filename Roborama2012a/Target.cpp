@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include "Target.h"
 #include "RoombaSensors.h"
+#include "Planner.h"
 
 #define RADS 57.2958			/* radians to degrees conversion */
 #define APPROACH_RADIUS 5
@@ -25,6 +26,12 @@ Target::Target(RoombaSensors *rs) : Layer() {
 	defaultTarget[1] = 0;
 	defaultTarget[2] = 0;
 
+	planner = NULL;
+	planFailed = false;
+	stopAtWaypoints = false;
+	turning = false;
+	legX = legY = 0;
+
 	targets = defaultTarget;
 	targetCnt = defaultTarget[0];
 	targetIndex = 0;	// first target location
@@ -32,73 +39,251 @@ Target::Target(RoombaSensors *rs) : Layer() {
 	Y_target = targets[2*targetIndex + 2];
 }
 
-#define LOOP_GAIN 3
+/*
+ * Pure pursuit: the waypoints are joined into a path & the robot steers on the arc
+ * through a point on it a lookahead distance away, so it rounds each waypoint in one
+ * smooth turn instead of stopping to spin at it. The lookahead grows with speed, which
+ * trades tracking for smoothness. Speed comes down for tight arcs & to stop at the last
+ * waypoint.
+ *
+ * With stopAtWaypoints the route ends at the current waypoint, so the robot drives
+ * straight legs, stops at each waypoint & spins on the spot to face the next one, as the
+ * UMBmark squares need
+ */
+#define PP_MIN_LOOKAHEAD 8.0		// inches
+#define PP_LOOKAHEAD_TIME 1.5		// seconds of travel at the requested speed
+#define PP_SPIN_ANGLE 90.0			// degrees; spin in place to a lookahead point further off the nose than this
+#define PP_MAX_RADIUS 2000			// mm, the Roomba's largest turn radius; straighter arcs drive straight
+#define PP_LATERAL_ACCEL 150.0		// mm/s/s allowed round an arc
+#define PP_DECEL 50.0				// mm/s/s when stopping at the last waypoint
+#define PP_MIN_SPEED 50
+#define PP_ALIGN_ANGLE 2.0			// degrees; stopAtWaypoints spins until the next leg is this close
 
 void Target::eval()
 {
+	float route[2 * PP_ROUTE_POINTS];
+	float lookahead, gx, gy;
+	int n;
+
 	if (flag == 0)
 		return;		// already arrived
 
+	lookahead = PP_LOOKAHEAD_TIME * velRqst / TO_MM;
+	if (lookahead < PP_MIN_LOOKAHEAD)
+		lookahead = PP_MIN_LOOKAHEAD;
+
 	// compute target location from where we are now
-	locate_target();
+	locate_target(X_target, Y_target);
 
-	if (target_distance < TARGET_RADIUS) {		// reached the current target
-		if (targetIndex == targetCnt-1) {
+	if (targetIndex == targetCnt-1) {
+		if (arrived()) {
 			flag = 0;		// finished course. Let stop layer take over
 			printf("Target layer finished mission, reached target at X_target: %0.1f Y_target: %0.1f with X_pos: %0.1f Y_pos: %0.1f, theta: %0.1f",
 					X_target, Y_target, roombaSensors->getX_pos(), roombaSensors->getY_pos(),
 					roombaSensors->getTheta());
 			return;
-		} else {			// there's another target in the list - make it active & calculate a course to it
-			printf("reached waypoint %d at X_target: %0.1f Y_target: %0.1f with X_pos: %0.1f Y_pos: %0.1f, theta: %0.1f\n",
-					targetIndex, X_target, Y_target, roombaSensors->getX_pos(), roombaSensors->getY_pos(),
-					roombaSensors->getTheta());
-			targetIndex++;
-			X_target = targets[2*targetIndex + 1];
-			Y_target = targets[2*targetIndex + 2];
-			locate_target();
-			printf("seeking to next target at X: %0.1f Y: %0.1f\n", X_target, Y_target);
+		}
+	} else if (stopAtWaypoints ? arrived() : (target_distance < lookahead)) {
+		// we're steering past this one to the next leg - make it active & calculate a course to it
+		printf("reached waypoint %d at X_target: %0.1f Y_target: %0.1f with X_pos: %0.1f Y_pos: %0.1f, theta: %0.1f\n",
+				targetIndex, X_target, Y_target, roombaSensors->getX_pos(), roombaSensors->getY_pos(),
+				roombaSensors->getTheta());
+		legX = X_target;
+		legY = Y_target;
+		targetIndex++;
+		X_target = targets[2*targetIndex + 1];
+		Y_target = targets[2*targetIndex + 2];
+		locate_target(X_target, Y_target);
+		turning = stopAtWaypoints;
+		touch();		// check the next target next tick, even if we don't move
+		printf("seeking to next target at X: %0.1f Y: %0.1f\n", X_target, Y_target);
+		if (planner != NULL) {
+			planFailed = false;
+			planner->setGoal(roombaSensors->getX_pos(), roombaSensors->getY_pos(), X_target, Y_target);
 		}
 	}
-	// run at full speed until within 5" of target, then slow to half-speed
-	if (target_distance < APPROACH_RADIUS) {
-		velRqst = 50;
+
+	if (turning) {		// spin on the spot to face the leg to the next waypoint
+		if (fabs(heading_error) > PP_ALIGN_ANGLE) {
+			rotRqst = (heading_error > 0) ? -1 : 1;
+			velRqst = PP_MIN_SPEED;
+			touch();
+			return;
+		}
+		turning = false;
+	}
+
+	n = buildRoute(route);
+	lookaheadPoint(route, n, lookahead, &gx, &gy);
+	steerTo(gx, gy);
+}
+
+// at the current target, or just gone past it
+bool Target::arrived()
+{
+	return (target_distance < TARGET_RADIUS) ||
+			((target_distance < APPROACH_RADIUS) && (fabs(heading_error) > PP_SPIN_ANGLE));
+}
+
+/*
+ * The path ahead, as x, y pairs from the start of the leg we're on: the planner's path
+ * if there is one, else the current target, then the targets after it unless we're
+ * stopping at each one. Returns the number of points
+ */
+int Target::buildRoute(float *route)
+{
+	int *path = NULL;
+	int n = 0, i;
+
+	if (planner != NULL)
+		path = followPlan();
+	if (path != NULL) {
+		route[0] = roombaSensors->getX_pos();	// the plan starts where we are
+		route[1] = roombaSensors->getY_pos();
+		for (n = 1, i = 0; (i < path[0]) && (n < PP_ROUTE_POINTS); i++, n++) {
+			route[2*n] = path[1 + 2*i];
+			route[2*n + 1] = path[2 + 2*i];
+		}
 	} else {
-		velRqst = seekSpeed;
+		route[0] = legX;
+		route[1] = legY;
+		route[2] = X_target;
+		route[3] = Y_target;
+		n = 2;
 	}
+	for (i = targetIndex + 1; !stopAtWaypoints && (i < targetCnt) && (n < PP_ROUTE_POINTS); i++, n++) {
+		route[2*n] = targets[2*i + 1];
+		route[2*n + 1] = targets[2*i + 2];
+	}
+	return n;
+}
 
-	// if heading error is greater than 30 degrees, spin in place until it's less than,
-	// else set radius to 1/4 of distance to target
-	if (heading_error > 45)
-		rotRqst = -1;
-	else if (heading_error < -45)
-		rotRqst = 1;
-	else if (heading_error > 2)	// deadband
-		rotRqst = -1 - (int)((TO_MM * target_distance)/LOOP_GAIN);	// radius in mm is 1/4 of distance to target
-	else if (heading_error < -2)
-		rotRqst = 1 + (int)((TO_MM * target_distance)/LOOP_GAIN);
-	else
+/*
+ * The furthest point along the route which is lookahead inches from the robot, or the
+ * end of the route if it's all closer than that. If the robot is more than lookahead
+ * off the route, e.g. after a bump, head for the end of the leg it's off
+ */
+void Target::lookaheadPoint(float *route, int n, float lookahead, float *gx, float *gy)
+{
+	float x = roombaSensors->getX_pos(), y = roombaSensors->getY_pos();
+	float ax, ay, dx, dy, fx, fy, a, b, c, disc, t;
+	int i;
+
+	for (i = 0; i < n - 1; i++) {
+		ax = route[2*i];
+		ay = route[2*i + 1];
+		dx = route[2*i + 2] - ax;
+		dy = route[2*i + 3] - ay;
+		fx = route[2*i + 2] - x;
+		fy = route[2*i + 3] - y;
+		if ((i < n - 2) && ((fx*fx + fy*fy) < lookahead*lookahead))
+			continue;		// the lookahead point is on a later leg
+
+		// solve |a + t(b - a) - robot| = lookahead for the larger t
+		fx = ax - x;
+		fy = ay - y;
+		a = dx*dx + dy*dy;
+		b = 2 * (fx*dx + fy*dy);
+		c = fx*fx + fy*fy - lookahead*lookahead;
+		disc = b*b - 4*a*c;
+		if ((a < 0.0001) || (disc < 0)) {
+			t = 1;
+		} else {
+			t = (-b + sqrt(disc)) / (2*a);
+			if (t > 1)
+				t = 1;
+			else if (t < 0)
+				t = 0;
+		}
+		*gx = ax + t*dx;
+		*gy = ay + t*dy;
+		return;
+	}
+	*gx = route[2*(n - 1)];
+	*gy = route[2*(n - 1) + 1];
+}
+
+/*
+ * Drive the arc from the robot's pose through gx, gy: curvature is 2 sin(alpha) / distance,
+ * alpha the angle between the heading & the point, which goes straight to the DRIVE radius
+ */
+void Target::steerTo(float gx, float gy)
+{
+	float dx = gx - roombaSensors->getX_pos(), dy = gy - roombaSensors->getY_pos();
+	float d = sqrt((dx*dx) + (dy*dy));
+	float alpha, curvature, radius, speed = seekSpeed, limit;
+
+	alpha = atan2(dx, dy) - roombaSensors->getTheta();	// clockwise, like theta
+	while (alpha > M_PI)
+		alpha -= 2 * M_PI;
+	while (alpha < -M_PI)
+		alpha += 2 * M_PI;
+	heading_error = alpha * RADS;
+
+	if ((targetIndex == targetCnt-1) || stopAtWaypoints) {
+		limit = sqrt(2 * PP_DECEL * TO_MM * target_distance);
+		if (limit < speed)
+			speed = limit;
+	}
+
+	curvature = (d > 0.001) ? 2 * sin(alpha) / d : 0;	// per inch, +ve turns right
+	radius = (fabs(curvature) > 0.000001) ? TO_MM / fabs(curvature) : PP_MAX_RADIUS + 1;
+	if (fabs(heading_error) > PP_SPIN_ANGLE) {
+		rotRqst = (alpha > 0) ? -1 : 1;		// it's behind us
+	} else if (radius > PP_MAX_RADIUS) {
 		rotRqst = 0;
+	} else {
+		limit = sqrt(PP_LATERAL_ACCEL * radius);
+		if (limit < speed)
+			speed = limit;
+		if (radius < 2)
+			rotRqst = (alpha > 0) ? -1 : 1;		// 1 & -1 mean spin
+		else
+			rotRqst = (alpha > 0) ? -(int)radius : (int)radius;
+	}
+	velRqst = (speed < PP_MIN_SPEED) ? PP_MIN_SPEED : (int)speed;
+}
+
+/*
+ * Update the planner, & return its path to follow, or NULL to head straight for the
+ * target as before & leave obstacles to bump: while it's still searching, or if it
+ * can't find a way
+ */
+int *Target::followPlan()
+{
+	planner->update(roombaSensors->getX_pos(), roombaSensors->getY_pos());
+	if (planner->isBusy())
+		touch();		// keep searching, even if we don't move
+	if (planner->isBlocked() && !planFailed)
+		printf("Target: no known way to X: %0.1f Y: %0.1f, heading straight for it\n", X_target, Y_target);
+	planFailed = planner->isBlocked();
+	return planner->getPath();
+}
+
+// the map changes with bumps, cliffs & sonar, & the plan with it
+unsigned int Target::getInputs()
+{
+	if (planner != NULL)
+		return(IN_POSE | IN_BUMP | IN_CLIFF | IN_SONAR);
+	return(IN_POSE);
 }
 
 /**
  * calculate distance and bearing to target.
- * inputs are:  X_target, X_pos, and Y_target, Y_pos
+ * inputs are:  X, X_pos, and Y, Y_pos
  * outputs are: target_distance, heading_error
 */
 
-void Target::locate_target()
+void Target::locate_target(float X, float Y)
 {
 	float x,y;
 
-	x = X_target - roombaSensors->getX_pos();
-	y = Y_target - roombaSensors->getY_pos();
+	x = X - roombaSensors->getX_pos();
+	y = Y - roombaSensors->getY_pos();
 
 	target_distance = sqrt((x*x)+(y*y));
 
-	/* no divide-by-zero allowed! */
-	if (x > 0.00001) target_bearing = 90.0 - (atan(y/x) * RADS);
-	else if (x < -0.00001) target_bearing = -90.0 - (atan(y/x) * RADS);
+	target_bearing = atan2(x, y) * RADS;		// clockwise from +Y, like theta
 
 	heading_error = target_bearing - (roombaSensors->getTheta()*RADS);
 	if (heading_error > 180.0) heading_error -= 360.0;
@@ -118,6 +303,22 @@ void Target::setTargets(int *targetsListIn)
 	targetIndex = 0;	// first target location
 	X_target = targets[2*targetIndex + 1];
 	Y_target = targets[2*targetIndex + 2];
+	legX = roombaSensors->getX_pos();	// the first leg starts where we are
+	legY = roombaSensors->getY_pos();
 	flag = 1;
+	turning = stopAtWaypoints;
+	touch();
 	printf("Setting first target to X: %0.1f Y: %0.1f\n", X_target, Y_target);
+	if (planner != NULL) {
+		planFailed = false;
+		planner->setGoal(roombaSensors->getX_pos(), roombaSensors->getY_pos(), X_target, Y_target);
+	}
+}
+
+void Target::setPlanner(Planner *plannerIn)
+{
+	planner = plannerIn;
+	planFailed = false;
+	planner->setGoal(roombaSensors->getX_pos(), roombaSensors->getY_pos(), X_target, Y_target);
+	touch();
 }
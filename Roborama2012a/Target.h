@@ -13,17 +13,25 @@
 #include "Layer.h"
 
 class RoombaSensors;
+class Planner;
+
+#define PP_ROUTE_POINTS 16		// most points of the path ahead the follower looks at
 
 class Target: public Layer {
 public:
 	Target(RoombaSensors *rs);
 	void eval();
+	unsigned int getInputs();
 	void setTargets(int *targetListIn);
+	void setPlanner(Planner *plannerIn);
+	void setStopAtWaypoints(bool stop) {stopAtWaypoints = stop;}
+	Planner *getPlanner() {return(planner);}
 	void printData();
 
     void setSeekSpeed(int seekSpeed)
     {
         this->seekSpeed = seekSpeed;
+        touch();
     }
 
 private:
@@ -33,14 +41,24 @@ private:
 	int targetIndex;
 	int defaultTarget[3];		// array of [#_of_waypoints, wp1_x, wp1_y}
 
+	float legX, legY;				/* where the leg to the current target started */
 	float X_target;                 /* X lateral target position */
 	float Y_target;                 /* Y vertical target position */
 	float target_bearing;           /* bearing in radians from current position */
 	float target_distance;         	/* current distance in inches from position (computed by locate_target() ) */
-	float heading_error;            /* current heading error in degrees */
+	float heading_error;            /* current heading error to the lookahead point, in degrees */
 	int seekSpeed;
+	Planner *planner;				// plans a way round known obstacles to each target, or NULL
+	bool planFailed;
+	bool stopAtWaypoints;			// drive straight legs & turn on the spot at each waypoint
+	bool turning;					// stopAtWaypoints: spinning to face the next leg
 
-	void locate_target();
+	void locate_target(float X, float Y);
+	int buildRoute(float *route);
+	void lookaheadPoint(float *route, int n, float lookahead, float *gx, float *gy);
+	void steerTo(float gx, float gy);
+	bool arrived();
+	int *followPlan();
 };
 
 #endif /* TARGET_H_ */
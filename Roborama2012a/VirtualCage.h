@@ -16,6 +16,7 @@ class VirtualCage: public Layer {
 public:
 	VirtualCage(RoombaSensors *rs, int speed, int cageXIn, int cageYIn);
 	void eval();
+	unsigned int getInputs() {return((state == 0) ? IN_POSE : IN_TICK);}
 private:
 	RoombaSensors *roombaSensors;
 	int state;			// state variable for FSM used to manage ballistic behavior to escape from bump
@@ -16,6 +16,7 @@ class WheelDrop : public Layer {
 public:
 	WheelDrop(RoombaSensors* rsIn);
 	void eval();
+	unsigned int getInputs() {return((state == 2) ? IN_TICK : IN_BUMP);}
 private:
 	RoombaSensors* rs;
 	int state;
@@ -19,7 +19,13 @@
 #include "rrClient.h"
 
 void roomba_set_velocity( Roomba* roomba, int velocity );
-void startSubsumption(int algorithm, int arg, int *waypointList, Roomba *roomba);
+void startSubsumption(int algorithm, int arg, const char *behaviourFile, Roomba *roomba);
+int calibrateOdometry(const char *runFile);
+int startReplay(const char *path);
+extern int useCompass;
+extern const char *poseLogPath;
+extern const char *tracePath;
+extern const char *recordPath;
 
 rrClientStruct rrc;
 
@@ -61,9 +67,17 @@ void usage()
     "  -S, --sensors                Read Roomba sensors,display nicely\n"
     "  -R, --sensors-raw            Read Roomba sensors,display in hex\n"
     "  -e, --encoders               Read Roomba encoder counts, display in dec and inches\n"
+    "  -M, --mission=file           Run the behaviour described in file (see Behaviour.h)\n"
     "  -a, --arg                    Numeric argument. algorithm 1: waypoint pattern. 2: spin amount.\n"
     "  -a, --arg                    Use numeric argument provided"
     "  -L  --loop                   Loop on behavior N times\n"
+    "  -C, --compass                Correct the odometry heading with the HM6352 compass\n"
+    "  -P, --poselog=file           Record odometry & compass readings for PoseReplay (with -C)\n"
+    "  -I, --record=file            Record every input the behaviour reads, for --replay\n"
+    "  -X, --replay=file            Replay a recording through its behaviour, without a Roomba;\n"
+    "                               checks the motor commands match & times each tick\n"
+    "  -T, --trace=file             Record which layer won each tick & how long each eval took\n"
+    "  -U, --umbmark=file           Fit odometry.cal from UMBmark square runs in file (see Odometry.cpp)\n"
     "      --debug                  Print out boring details\n"
     "\n"
     "Examples:\n"
@@ -91,24 +105,7 @@ int main(int argc, char *argv[])
     int loopCnt = 1;
     int i;
     int algorithm;
-    int arg;
-    int numWaypointLists = 7;
-    int waypointList0[] = {2, 0, 24, 0, 0};	// seek 12" foward, then return to 0,0
-    int waypointList1[] = {16, 0, 24, 24, 24, 24, 0, 0, 0,
-    		0, 24, 24, 24, 24, 0, 0, 0,
-    		0, 24, 24, 24, 24, 0, 0, 0,
-    		0, 24, 24, 24, 24, 0, 0, 0,
-    		}; // 2 foot square
-    int waypointList2[] = {1, 0, 20};	// 20" line
-    int waypointList3[] = {4, 0, 72, 72, 72, 72, 0, 0, 0};	// 6' square
-    int waypointList4[] = {4, 0, 72, -72, 72, -72, 0, 0, 0};	// 6' square
-    int waypointList5[] = {4, 0, 24, -24, 24, -24, 0, 0, 0};	// 2' square
-    int waypointList6[] = {20, 0, 60, 0, 0, 0, 60, 0, 0, 0, 60, 0, 0, 0, 60, 0, 0, 0, 60, 0, 0,
-    		0, 60, 0, 0, 0, 60, 0, 0, 0, 60, 0, 0, 0, 60, 0, 0, 0, 60, 0, 0};	// out & back many times
-    int *waypointList = waypointList0;		// default waypoint list
-    int *waypointLists[] = {waypointList0, waypointList1, waypointList2, waypointList3,
-							waypointList4, waypointList5, waypointList6};
-
+    int arg = 0;
     Roomba* roomba = NULL;
     
     if (!strncmp(argv[0], "roombaVEXProd", 13)) {
@@ -149,13 +146,19 @@ int main(int argc, char *argv[])
         {"debug",      no_argument,       0, 'D'},
         {"encoders",   no_argument,       0, 'e'},
         {"explore",    optional_argument, 0, 'E'},
-        {"waypointlist", required_argument, 0, 'W'},
+        {"mission",    required_argument, 0, 'M'},
         {"loop",       required_argument, 0, 'L'},
+        {"umbmark",    required_argument, 0, 'U'},
+        {"compass",    no_argument,       0, 'C'},
+        {"poselog",    required_argument, 0, 'P'},
+        {"trace",      required_argument, 0, 'T'},
+        {"record",     required_argument, 0, 'I'},
+        {"replay",     required_argument, 0, 'X'},
         {0,0,0,0}
     };
 
     while(1) {
-        opt = getopt_long (argc, argv, "hp:B:d:fblrsw:V:SRDeE:a:",
+        opt = getopt_long (argc, argv, "hp:B:d:fblrsw:V:SRDeE:a:M:U:CP:T:I:X:",
                            loptions, &option_index);
         if (opt==-1) break;
         
@@ -204,15 +207,13 @@ int main(int argc, char *argv[])
         	break;
         case 'a':
         	arg = strtol(optarg, NULL, 10);
-        	if (arg < numWaypointLists) {
-        		waypointList = waypointLists[arg];
-        	} else {
-            	waypointList = waypointLists[0];
-        	}
         	break;
         case 'E':
         	algorithm = strtol(optarg, NULL, 10);
-        	if (roomba) startSubsumption(algorithm, arg, waypointList, roomba);
+        	if (roomba) startSubsumption(algorithm, arg, NULL, roomba);
+        	break;
+        case 'M':
+        	if (roomba) startSubsumption(0, arg, optarg, roomba);
         	break;
         case 'w':
             waitmillis = strtol(optarg,NULL,10);
@@ -244,6 +245,24 @@ int main(int argc, char *argv[])
                 		(float)(roomba->rEncoder)/ROOMBA_COUNTS_PER_INCH);
             }
             break;
+        case 'C':
+            useCompass = 1;
+            break;
+        case 'P':
+            poseLogPath = optarg;
+            break;
+        case 'T':
+            tracePath = optarg;
+            break;
+        case 'I':
+            recordPath = optarg;
+            break;
+        case 'X':
+            startReplay(optarg);
+            break;
+        case 'U':
+            calibrateOdometry(optarg);
+            break;
         case 'D':
             roombadebug++;
         case '?':
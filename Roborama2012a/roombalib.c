@@ -8,6 +8,7 @@
  * Updates:
  * 14 Dec 2006 - added more functions to roombalib
  * 1 Jan 2012 - PHB: ported to VEXPro
+ * 3 Dec 2012 - PHB: added sensor streaming (opcode 148)
  */
 
 
@@ -22,11 +23,25 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #include "roombalib.h"
 
 int roombadebug = 0;
 
+#define RX_MASK (ROOMBA_RX_BUF - 1)
+
+// size of each sensor packet, by packet id. 0 = not supported
+static const uint8_t packet_size[59] = {
+    26, 10, 6, 10, 14, 12, 52,                          // 0 - 6: groups
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 1, 2,     // 7 - 22
+    2, 1, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1,     // 23 - 38
+    2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1, 1, 2,     // 39 - 54
+    2, 2, 2, 1                                          // 55 - 58
+};
+// offset of each group packet in sensor_bytes; single packets follow on from 6
+static const uint8_t group_offset[7] = { 0, 0, 10, 16, 26, 40, 0 };
+
 // internal use only
 int roomba_init_serialport( const char* serialport, speed_t baud );
 
@@ -53,10 +68,16 @@ Roomba* roomba_init( const char* portpath, speed_t baud )
     }
     roomba_delay(COMMANDPAUSE_MILLIS);
 
+    return roomba_init_fd( fd, portpath );
+}
+
+Roomba* roomba_init_fd( int fd, const char* name )
+{
     Roomba* roomba = calloc( 1, sizeof(Roomba) );
     roomba->fd = fd;
-    strcpy(roomba->portpath, portpath);
+    strncpy(roomba->portpath, name, sizeof(roomba->portpath) - 1);
     roomba->velocity = DEFAULT_VELOCITY;
+    gettimeofday( &roomba->tx_stats_stamp, NULL );
 
     return roomba;
 }
@@ -91,6 +112,7 @@ const char* roomba_get_portpath( Roomba* roomba )
 
 void roomba_close( Roomba* roomba )
 {
+    if( roomba->streaming ) roomba_stream_stop( roomba );
     close( roomba->fd );
     roomba->fd = 0;
 }
@@ -111,13 +133,123 @@ int roomba_get_velocity( Roomba* roomba )
     return roomba->velocity;
 }
 
+// coalescing class of an opcode, or -1 if it must always be sent
+static int tx_class( uint8_t opcode )
+{
+    switch( opcode ) {
+    case 137: case 145: case 146: return 0;     // DRIVE, DRIVE DIRECT, DRIVE PWM
+    case 138: case 144: return 1;               // MOTORS, PWM MOTORS
+    case 139: return 2;                         // LEDS
+    }
+    return -1;
+}
+
+static long ms_since( const struct timeval* then )
+{
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    return (now.tv_sec - then->tv_sec) * 1000 + (now.tv_usec - then->tv_usec) / 1000;
+}
+
+// write the held commands that need sending, then cmd (if any), in one write()
+static int tx_write( Roomba* roomba, const uint8_t* cmd, int len )
+{
+    uint8_t buf[ROOMBA_TX_BUF];
+    RoombaTxSlot* slot;
+    int i, n = 0, rv;
+
+    for( i=0; i<ROOMBA_TX_CLASSES; i++ ) {
+        slot = &roomba->tx_slot[i];
+        if( !slot->pending ) continue;
+        slot->pending = 0;
+        if( slot->len == slot->sent_len && !memcmp( slot->cmd, slot->sent, slot->len ) &&
+            ms_since( &slot->sent_stamp ) < ROOMBA_TX_REFRESH_MS ) {
+            roomba->tx_suppressed++;
+            continue;
+        }
+        memcpy( buf + n, slot->cmd, slot->len );
+        n += slot->len;
+        memcpy( slot->sent, slot->cmd, slot->len );
+        slot->sent_len = slot->len;
+        gettimeofday( &slot->sent_stamp, NULL );
+    }
+    if( n + len > ROOMBA_TX_BUF ) {     // too big to pack, write the held commands first
+        if( n && write( roomba->fd, buf, n ) != n ) {
+            perror("roomba_send: couldn't write to roomba");
+            return 1;
+        }
+        roomba->tx_written += n;
+        roomba->tx_writes++;
+        n = 0;
+    }
+    if( len > ROOMBA_TX_BUF ) {
+        rv = write( roomba->fd, cmd, len );
+        n = len;
+    } else {
+        if( len ) memcpy( buf + n, cmd, len );
+        n += len;
+        rv = n ? write( roomba->fd, buf, n ) : 0;
+    }
+    if( rv != n ) {
+        perror("roomba_send: couldn't write to roomba");
+        return 1;
+    }
+    roomba->tx_written += n;
+    if( n ) roomba->tx_writes++;
+
+    // a mode change can stop the motors, so the next drive etc must go out
+    if( len && cmd[0] >= 128 && cmd[0] <= 133 ) {
+        for( i=0; i<ROOMBA_TX_CLASSES; i++ )
+            roomba->tx_slot[i].sent_len = 0;
+    }
+    return 0;
+}
+
 // send an arbitrary length roomba command
 int roomba_send( Roomba* roomba, const uint8_t* cmd, int len )
 {
-    int n = write( roomba->fd, cmd, len);
-    if( n!=len )
-        perror("roomba_send: couldn't write to roomba");
-    return (n!=len); // indicate error, can usually ignore
+    int cls = tx_class( cmd[0] );
+    RoombaTxSlot* slot;
+
+    roomba->tx_requested += len;
+    if( cls < 0 || len > (int)sizeof(slot->cmd) )
+        return tx_write( roomba, cmd, len );
+
+    slot = &roomba->tx_slot[cls];
+    if( slot->pending ) roomba->tx_coalesced++;
+    memcpy( slot->cmd, cmd, len );
+    slot->len = len;
+    slot->pending = 1;
+    if( roomba->tx_defer ) return 0;
+    return tx_write( roomba, NULL, 0 );
+}
+
+void roomba_tx_defer( Roomba* roomba, int defer )
+{
+    roomba->tx_defer = defer;
+    if( !defer ) roomba_tx_flush( roomba );
+}
+
+int roomba_tx_flush( Roomba* roomba )
+{
+    return tx_write( roomba, NULL, 0 );
+}
+
+void roomba_print_tx_stats( Roomba* roomba )
+{
+    double secs = ms_since( &roomba->tx_stats_stamp ) / 1000.0;
+    unsigned long saved = roomba->tx_requested - roomba->tx_written;
+    if( secs <= 0.0 ) secs = 0.001;
+    printf("roomba tx: %.0f bytes/s asked, %.0f bytes/s written, %.0f bytes/s saved (%lu coalesced, %lu repeats), %.1f writes/s\n",
+           roomba->tx_requested / secs, roomba->tx_written / secs, saved / secs,
+           roomba->tx_coalesced, roomba->tx_suppressed, roomba->tx_writes / secs);
+}
+
+void roomba_reset_tx_stats( Roomba* roomba )
+{
+    roomba->tx_requested = roomba->tx_written = roomba->tx_writes = 0;
+    roomba->tx_coalesced = roomba->tx_suppressed = 0;
+    gettimeofday( &roomba->tx_stats_stamp, NULL );
 }
 
 // Move Roomba with low-level DRIVE command
@@ -131,14 +263,13 @@ void roomba_drive( Roomba* roomba, int velocity, int radius )
         fprintf(stderr,"roomba_drive: %.2hhx %.2hhx %.2hhx %.2hhx\n",
                 vhi,vlo,rhi,rlo);
     uint8_t cmd[] = { 137, vhi,vlo, rhi,rlo };  // DRIVE
-    int n = write(roomba->fd, cmd, 5);
-    if( n!=5 )
-        perror("roomba_drive: couldn't write to roomba");
+    roomba_send( roomba, cmd, 5 );
 }
 
 void roomba_stop( Roomba* roomba )
 {
     roomba_drive( roomba, 0, 0 );
+    roomba_tx_flush( roomba );          // never hold a stop
 }
 
 void roomba_forward( Roomba* roomba )
@@ -181,9 +312,7 @@ void roomba_play_note( Roomba* roomba, uint8_t note, uint8_t duration )
 {
     uint8_t cmd[] = { 140, 15, 1, note, duration, // SONG, then
                       141, 15 };                  // PLAY
-    int n = write( roomba->fd, cmd, 7);
-    if( n!=7 )
-        perror("roomba_play_note: couldn't write to roomba");
+    roomba_send( roomba, cmd, 7 );
 }
 
 // Turns on/off the non-drive motors (main brush, vacuum, sidebrush).
@@ -191,9 +320,7 @@ void roomba_set_motors( Roomba* roomba, uint8_t mainbrush, uint8_t vacuum, uint8
 {
     uint8_t cmd[] = { 138,                        // MOTORS
                       ((mainbrush?0x04:0)|(vacuum?0x02:0)|(sidebrush?0x01:0))};
-    int n = write( roomba->fd, cmd, 2);
-    if( n!=2 )
-        perror("roomba_set_motors: couldn't write to roomba");
+    roomba_send( roomba, cmd, 2 );
 }
 
 // Turns on/off the various LEDs.
@@ -204,9 +331,7 @@ void roomba_set_leds( Roomba* roomba, uint8_t status_green, uint8_t status_red,
     uint8_t v = (status_green?0x20:0) | (status_red?0x10:0) |
                 (spot?0x08:0) | (clean?0x04:0) | (max?0x02:0) | (dirt?0x01:0);
     uint8_t cmd[] = { 139, v, power_color, power_intensity }; // LEDS
-    int n = write( roomba->fd, cmd, 4);
-    if( n!=4 )
-        perror("roomba_set_leds: couldn't write to roomba");
+    roomba_send( roomba, cmd, 4 );
 }
 
 // Turn all vacuum motors on or off according to state
@@ -216,9 +341,14 @@ void roomba_vacuum( Roomba* roomba, uint8_t state ) {
 
 int roomba_read_sensors( Roomba* roomba )
 {
+    // while streaming, a polled reply would be mixed into the stream
+    if( roomba->streaming )
+        return (roomba_stream_read( roomba, NULL ) < 0) ? -1 : 0;
+
     uint8_t cmd[] = { 142, 0 };          // SENSOR, get all sensor data
-    int n = write( roomba->fd, cmd, 2);
-    n = input_timeout( roomba->fd, roomba->sensor_bytes, 26);
+    roomba_rx_flush( roomba );
+    if( roomba_send( roomba, cmd, 2 ) ) return -1;
+    int n = roomba_read_reply( roomba, roomba->sensor_bytes, 26, ROOMBA_REPLY_MS );
     if( n!=26 ) {
         printf("roomba_read_sensors: not enough read (n=%d)\n",n);
         return -1;
@@ -230,9 +360,12 @@ int roomba_read_encoders( Roomba* roomba )
 {
 	uint8_t encoder_bytes[4];
     uint8_t cmd[] = { 149, 2, 43, 44 };          // SENSOR, get all sensor data
-    int n = write( roomba->fd, cmd, 4);
+    if( roomba->streaming )
+        return (roomba_stream_read( roomba, NULL ) < 0) ? -1 : 0;
 
-    n = input_timeout( roomba->fd, encoder_bytes, 4);
+    roomba_rx_flush( roomba );
+    if( roomba_send( roomba, cmd, 4 ) ) return -1;
+    int n = roomba_read_reply( roomba, encoder_bytes, 4, ROOMBA_REPLY_MS );
     if( n!=4 ) {
         if(roombadebug)
             printf("roomba_read_encoders: not enough read (n=%d)\n",n);
@@ -245,6 +378,210 @@ int roomba_read_encoders( Roomba* roomba )
     return 0;
 }
 
+// offset in sensor_bytes of a packet, or -1 if it isn't supported
+static int packet_offset( uint8_t id )
+{
+    int i, off = 52;                    // packet 6 covers 7 - 42
+    if( id <= 6 ) return group_offset[id];
+    if( id > 58 ) return -1;
+    if( id <= 42 ) {
+        for( off=0, i=7; i<id; i++ ) off += packet_size[i];
+        return off;
+    }
+    for( i=43; i<id; i++ ) off += packet_size[i];
+    return off;
+}
+
+// unpack a checksummed frame's payload of {id, data...} pairs into stream_bytes
+// returns 0 if the payload isn't a frame we asked for
+static int stream_frame( Roomba* roomba, const uint8_t* p, int len )
+{
+    uint8_t frame[ROOMBA_SENSOR_BYTES];
+    const uint8_t* end = p + len;
+    int off, size;
+
+    pthread_mutex_lock( &roomba->stream_lock );
+    memcpy( frame, roomba->stream_bytes, sizeof(frame) );
+    pthread_mutex_unlock( &roomba->stream_lock );
+
+    while( p < end ) {
+        off = packet_offset( *p );
+        size = (*p <= 58) ? packet_size[*p] : 0;
+        if( off < 0 || size == 0 || p + 1 + size > end )
+            return 0;
+        memcpy( frame + off, p + 1, size );
+        p += 1 + size;
+    }
+
+    pthread_mutex_lock( &roomba->stream_lock );
+    memcpy( roomba->stream_bytes, frame, sizeof(frame) );
+    gettimeofday( &roomba->stream_stamp, NULL );
+    roomba->stream_frames++;
+    pthread_mutex_unlock( &roomba->stream_lock );
+    return 1;
+}
+
+// receive ring helpers; head & tail run freely & wrap together
+static int rx_count( Roomba* roomba )
+{
+    return roomba->rx_head - roomba->rx_tail;
+}
+
+static uint8_t rx_peek( Roomba* roomba, int i )
+{
+    return roomba->rx_buf[(roomba->rx_tail + i) & RX_MASK];
+}
+
+static void rx_consume( Roomba* roomba, int n )
+{
+    roomba->rx_tail += n;
+}
+
+// drop one byte that isn't part of a frame; if we were in sync, we've lost it
+static void stream_skip( Roomba* roomba )
+{
+    rx_consume( roomba, 1 );
+    roomba->rx_discarded++;
+    if( roomba->stream_synced ) {
+        roomba->stream_synced = 0;
+        roomba->rx_resyncs++;
+    }
+}
+
+// find & unpack the frames in the receive ring
+// frame is: 19, n, n bytes of {packet id, data...}, checksum; all bytes sum to 0
+// A header is only believed if its length matches the packets we asked for & the
+// checksum & packet ids check out. Otherwise just the 19 is dropped & the search
+// starts again at the next byte, so a lost or corrupted byte costs one frame
+static void stream_parse( Roomba* roomba )
+{
+    uint8_t payload[256];
+    uint8_t sum;
+    int len = roomba->stream_frame_len;
+    int avail, i;
+
+    while( (avail = rx_count( roomba )) > 0 ) {
+        if( rx_peek( roomba, 0 ) != 19 ) {
+            stream_skip( roomba );
+            continue;
+        }
+        if( avail < 2 ) return;
+        if( rx_peek( roomba, 1 ) != len ) {
+            stream_skip( roomba );
+            continue;
+        }
+        if( avail < len + 3 ) return;   // wait for the rest of the frame
+
+        sum = 0;
+        for( i=0; i<len+3; i++ ) sum += rx_peek( roomba, i );
+        for( i=0; i<len; i++ ) payload[i] = rx_peek( roomba, 2 + i );
+        if( sum != 0 || !stream_frame( roomba, payload, len ) ) {
+            roomba->stream_bad++;
+            stream_skip( roomba );
+            continue;
+        }
+        rx_consume( roomba, len + 3 );
+        roomba->stream_synced = 1;
+    }
+}
+
+// background reader: parse the stream as bytes arrive
+static void* stream_reader( void* arg )
+{
+    Roomba* roomba = (Roomba*)arg;
+
+    while( roomba->streaming ) {
+        if( roomba_rx_fill( roomba, 100 ) < 0 )    // check for stop every 100ms
+            break;
+        stream_parse( roomba );
+    }
+    return NULL;
+}
+
+int roomba_stream_start( Roomba* roomba, const uint8_t* packet_ids, int num_ids )
+{
+    static const uint8_t default_ids[] = { 0, 43, 44 };
+    uint8_t cmd[2 + ROOMBA_STREAM_MAX_IDS];
+    int i;
+
+    if( roomba->streaming ) return 0;
+    if( packet_ids == NULL ) {
+        packet_ids = default_ids;
+        num_ids = sizeof(default_ids);
+    }
+    if( num_ids < 1 || num_ids > ROOMBA_STREAM_MAX_IDS ) return -1;
+
+    cmd[0] = 148;                       // STREAM
+    cmd[1] = num_ids;
+    for( i=0; i<num_ids; i++ ) {
+        if( packet_offset( packet_ids[i] ) < 0 ) {
+            printf("roomba_stream_start: unsupported packet id %d\n", packet_ids[i]);
+            return -1;
+        }
+        roomba->stream_ids[i] = cmd[2+i] = packet_ids[i];
+    }
+    roomba->stream_num_ids = num_ids;
+    roomba->stream_frame_len = 0;
+    for( i=0; i<num_ids; i++ )
+        roomba->stream_frame_len += 1 + packet_size[packet_ids[i]];
+    if( roomba->stream_frame_len > 255 ) {
+        printf("roomba_stream_start: too many packets for one frame\n");
+        return -1;
+    }
+    roomba->stream_synced = 0;
+    roomba->stream_frames = roomba->stream_frames_read = 0;
+    roomba->stream_bad = 0;
+    memcpy( roomba->stream_bytes, roomba->sensor_bytes, ROOMBA_SENSOR_BYTES );
+    pthread_mutex_init( &roomba->stream_lock, NULL );
+
+    roomba_rx_flush( roomba );          // drop any stale polled replies
+    if( roomba_send( roomba, cmd, 2 + num_ids ) ) return -1;
+    roomba->streaming = 1;
+    if( pthread_create( &roomba->stream_thread, NULL, stream_reader, roomba ) ) {
+        perror("roomba_stream_start: couldn't start reader");
+        roomba->streaming = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void roomba_stream_stop( Roomba* roomba )
+{
+    uint8_t cmd[] = { 150, 0 };         // PAUSE/RESUME STREAM, pause
+    if( !roomba->streaming ) return;
+    roomba_send( roomba, cmd, 2 );
+    roomba->streaming = 0;
+    pthread_join( roomba->stream_thread, NULL );
+    pthread_mutex_destroy( &roomba->stream_lock );
+    roomba_delay( 20 );                 // let the last frame drain
+    roomba_rx_flush( roomba );
+}
+
+int roomba_stream_read( Roomba* roomba, struct timeval* stamp )
+{
+    int fresh, i;
+
+    if( !roomba->streaming ) return -1;
+    pthread_mutex_lock( &roomba->stream_lock );
+    if( roomba->stream_frames == 0 ) {
+        pthread_mutex_unlock( &roomba->stream_lock );
+        return -1;
+    }
+    memcpy( roomba->sensor_bytes, roomba->stream_bytes, ROOMBA_SENSOR_BYTES );
+    if( stamp ) *stamp = roomba->stream_stamp;
+    fresh = roomba->stream_frames - roomba->stream_frames_read;
+    roomba->stream_frames_read = roomba->stream_frames;
+    pthread_mutex_unlock( &roomba->stream_lock );
+
+    for( i=0; i<roomba->stream_num_ids; i++ ) {
+        if( roomba->stream_ids[i] == 43 )
+            roomba->lEncoder = 256 * roomba->sensor_bytes[52] + roomba->sensor_bytes[53];
+        if( roomba->stream_ids[i] == 44 )
+            roomba->rEncoder = 256 * roomba->sensor_bytes[54] + roomba->sensor_bytes[55];
+    }
+    return fresh;
+}
+
 void roomba_print_raw_sensors( Roomba* roomba )
 {
     uint8_t* sb = roomba->sensor_bytes;
@@ -326,8 +663,9 @@ int roomba_init_serialport( const char* serialport, speed_t baud )
     toptions.c_lflag    &= ~(ICANON | ECHO | ECHOE | ISIG); // make raw
     toptions.c_oflag    &= ~OPOST; // make raw
 
-    toptions.c_cc[VMIN]  = 26;
-    toptions.c_cc[VTIME] = 2;           // FIXME: not sure about this
+    // never block in read(); roomba_rx_fill() waits in select() instead
+    toptions.c_cc[VMIN]  = 0;
+    toptions.c_cc[VTIME] = 0;
     
     if( tcsetattr(fd, TCSANOW, &toptions) < 0) {
         perror("roomba_init_serialport: Couldn't set term attributes");
@@ -337,63 +675,105 @@ int roomba_init_serialport( const char* serialport, speed_t baud )
     return fd;
 }
 
-// def from __USE_GNU in unistd.h
-# define TEMP_FAILURE_RETRY(expression) \
-  (__extension__                                                              \
-    ({ long int __result;                                                     \
-       do __result = (long int) (expression);                                 \
-       while (__result == -1L && errno == EINTR);                             \
-       __result; }))
-
-// read requested size of input from Roomba into buffer
-// returns # of bytes read, 0 if timeout, -1 if select error
-int input_timeout (int fd, uint8_t *buf, int read_size)
-{
-	fd_set set;
-	struct timeval timeout;
-	int bytes_read = 0;
-	int rv;
-
-
-	/* Initialize the file descriptor set. */
-	FD_ZERO (&set);
-	FD_SET (fd, &set);
-
-	// read until we get enough bytes or timeout
-	while(1) {
-		/* Initialize the timeout data structure. */
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
-
-		// wait for input to become available
-		/* select returns 0 if timeout, 1 if input available, -1 if error. */
-		rv = TEMP_FAILURE_RETRY (select (FD_SETSIZE,
-				&set, NULL, NULL,
-				&timeout));
-		if (rv < 0) {
-			perror("input_timout select error: ");
-			return rv;
-		} else if (rv < 1) {
-			printf("select timout\n");
-			return rv;
-		}
-
-		// read whatever's available
-	    rv = read(fd, buf+bytes_read, read_size - bytes_read);
-	    if (rv <= 0) {
-	        if(roombadebug)
-	            fprintf(stderr,"input_timeout: not enough read (rv=%d)\n",rv);
-		    if( rv < 0 ) {
-		    	perror("Error reading from roomba: ");
-		    }
-	        return -2;
-	    }
-
-		// we successfully read some data
-		bytes_read += rv;
-		if (bytes_read == read_size)
-			return (bytes_read);		// else wait for more data to arrive
-		//printf(".");
-	}
-	return -3;	// should never get here
+// ms from now until deadline; negative once it has passed
+static long ms_until( const struct timeval* deadline )
+{
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    return (deadline->tv_sec - now.tv_sec) * 1000 +
+           (deadline->tv_usec - now.tv_usec) / 1000;
+}
+
+int roomba_rx_fill( Roomba* roomba, int timeout_ms )
+{
+    fd_set set;
+    struct timeval timeout;
+    int n, space, total = 0;
+
+    FD_ZERO( &set );
+    FD_SET( roomba->fd, &set );
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    n = select( roomba->fd + 1, &set, NULL, NULL, &timeout );
+    if( n < 0 ) {
+        if( errno == EINTR ) return 0;
+        perror("roomba_rx_fill: select error");
+        return -1;
+    }
+    if( n == 0 ) return 0;
+
+    // read until the tty is empty; at most two reads if the free space wraps
+    while( 1 ) {
+        if( rx_count( roomba ) == ROOMBA_RX_BUF ) {
+            // nobody is consuming: keep the newest bytes
+            roomba->rx_discarded += ROOMBA_RX_BUF / 2;
+            rx_consume( roomba, ROOMBA_RX_BUF / 2 );
+        }
+        space = ROOMBA_RX_BUF - rx_count( roomba );
+        if( space > ROOMBA_RX_BUF - (int)(roomba->rx_head & RX_MASK) )
+            space = ROOMBA_RX_BUF - (roomba->rx_head & RX_MASK);
+        n = read( roomba->fd, roomba->rx_buf + (roomba->rx_head & RX_MASK), space );
+        if( n < 0 ) {
+            if( errno == EAGAIN || errno == EINTR ) break;
+            perror("roomba_rx_fill: error reading from roomba");
+            return -1;
+        }
+        if( n == 0 ) break;
+        roomba->rx_head += n;
+        total += n;
+        if( n < space ) break;
+    }
+    return total;
+}
+
+void roomba_rx_flush( Roomba* roomba )
+{
+    do {
+        roomba->rx_discarded += rx_count( roomba );
+        rx_consume( roomba, rx_count( roomba ) );
+    } while( roomba_rx_fill( roomba, 0 ) > 0 );
+}
+
+int roomba_read_reply( Roomba* roomba, uint8_t* buf, int len, int timeout_ms )
+{
+    struct timeval deadline;
+    long remaining;
+    int i;
+
+    gettimeofday( &deadline, NULL );
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_usec += (timeout_ms % 1000) * 1000;
+    if( deadline.tv_usec >= 1000000 ) {
+        deadline.tv_sec++;
+        deadline.tv_usec -= 1000000;
+    }
+
+    while( rx_count( roomba ) < len ) {
+        remaining = ms_until( &deadline );
+        if( remaining <= 0 ) {
+            // a partial reply is useless; whatever is still coming gets flushed
+            // before the next request
+            if(roombadebug)
+                fprintf(stderr,"roomba_read_reply: timeout with %d of %d bytes\n",
+                        rx_count( roomba ), len);
+            roomba->rx_timeouts++;
+            roomba->rx_discarded += rx_count( roomba );
+            rx_consume( roomba, rx_count( roomba ) );
+            return 0;
+        }
+        if( roomba_rx_fill( roomba, remaining ) < 0 )
+            return -1;
+    }
+
+    for( i=0; i<len; i++ )
+        buf[i] = rx_peek( roomba, i );
+    rx_consume( roomba, len );
+    return len;
+}
+
+void roomba_print_rx_stats( Roomba* roomba )
+{
+    printf("roomba rx: %lu bytes discarded, %lu resyncs, %lu timeouts, %lu bad frames\n",
+           roomba->rx_discarded, roomba->rx_resyncs, roomba->rx_timeouts,
+           roomba->stream_bad);
 }
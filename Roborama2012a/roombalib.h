@@ -14,6 +14,8 @@
 
 #include <stdint.h>   /* Standard types */
 #include <termios.h>  /* POSIX terminal control definitions */
+#include <pthread.h>
+#include <sys/time.h>
 
  #ifdef __cplusplus
  extern "C" {
@@ -22,15 +24,63 @@
 #define DEFAULT_VELOCITY 200
 #define COMMANDPAUSE_MILLIS 100
 #define ROOMBA_COUNTS_PER_INCH 57.0
+#define ROOMBA_SENSOR_BYTES 80      // packets 7 - 58, in packet id order
+#define ROOMBA_STREAM_MAX_IDS 16
+#define ROOMBA_RX_BUF 512           // receive ring size, must be a power of 2
+#define ROOMBA_REPLY_MS 40          // deadline for a polled sensor reply
+#define ROOMBA_TX_CLASSES 3         // commands which supersede each other: drive, motors, leds
+#define ROOMBA_TX_REFRESH_MS 500    // resend an unchanged command this often as a keep-alive
+#define ROOMBA_TX_BUF 64
+
+// latest command of one class, see roomba_send()
+typedef struct {
+    uint8_t cmd[8];
+    int len;
+    int pending;                    // cmd hasn't been written yet
+    uint8_t sent[8];                // last cmd written, for suppressing repeats
+    int sent_len;
+    struct timeval sent_stamp;
+} RoombaTxSlot;
 
 // holds all the per-roomba info
 // consider it an opaque blob, please
 typedef struct Roomba_struct {
     int fd;
     char portpath[80];
-    uint8_t sensor_bytes[80];
+    uint8_t sensor_bytes[ROOMBA_SENSOR_BYTES];
     unsigned short lEncoder, rEncoder;
     int velocity;
+
+    // sensor streaming (opcode 148) state, see roomba_stream_start()
+    int streaming;
+    pthread_t stream_thread;
+    pthread_mutex_t stream_lock;
+    uint8_t stream_ids[ROOMBA_STREAM_MAX_IDS];  // packet ids requested
+    int stream_num_ids;
+    uint8_t stream_bytes[ROOMBA_SENSOR_BYTES];  // latest good frame, laid out like sensor_bytes
+    struct timeval stream_stamp;                // when the latest good frame arrived
+    unsigned long stream_frames;                // good frames received
+    unsigned long stream_bad;                   // frames dropped for bad checksum or contents
+    unsigned long stream_frames_read;           // stream_frames at the last roomba_stream_read
+    int stream_frame_len;                       // expected frame payload length
+    int stream_synced;                          // parser is locked onto frame boundaries
+
+    // receive ring, filled without blocking by roomba_rx_fill()
+    uint8_t rx_buf[ROOMBA_RX_BUF];
+    unsigned int rx_head, rx_tail;              // free-running; index with & (ROOMBA_RX_BUF-1)
+    unsigned long rx_discarded;                 // bytes thrown away: stale, unframed or partial
+    unsigned long rx_resyncs;                   // times the stream parser lost frame sync
+    unsigned long rx_timeouts;                  // polled replies which missed their deadline
+
+    // transmit coalescing, see roomba_send()
+    RoombaTxSlot tx_slot[ROOMBA_TX_CLASSES];
+    int tx_defer;                               // hold drive/motor/led commands until roomba_tx_flush()
+    struct timeval tx_stats_stamp;              // when the tx statistics started
+    unsigned long tx_requested;                 // bytes of commands asked for
+    unsigned long tx_written;                   // bytes actually written
+    unsigned long tx_writes;                    // write() calls
+    unsigned long tx_coalesced;                 // commands replaced by a later one before being sent
+    unsigned long tx_suppressed;                // commands not sent because they repeated the last one
 } Roomba;
 
 // set to non-zero to see debugging output
@@ -41,6 +91,10 @@ extern int roombadebug;
 // if baud is 0, default to standard baudrate (57600)
 Roomba* roomba_init( const char* portname, speed_t baud );
 
+// create a Roomba object on an already open fd, without sending START & CONTROL,
+// e.g. on /dev/null to replay an input log without a Roomba
+Roomba* roomba_init_fd( int fd, const char* name );
+
 // frees the memory of the Roomba object created with roomba_init
 // will close the serial port if it's open
 void roomba_free( Roomba* roomba );
@@ -59,8 +113,24 @@ int roomba_valid( Roomba* roomba );
 const char* roomba_get_portpath( Roomba* roomba );
 
 // send an arbitrary length roomba command
+// DRIVE/DRIVE DIRECT/DRIVE PWM, MOTORS/PWM MOTORS & LEDS commands only keep the latest
+// of each kind, & one identical to the last sent is skipped unless ROOMBA_TX_REFRESH_MS has
+// passed. Anything else is written at once, packed into one write with any held commands.
+// cmd must hold one command if it's a drive, motor or led command
+// returns non-zero on error
 int roomba_send( Roomba* roomba, const uint8_t* cmd, int len );
 
+// If defer is non-zero, hold drive, motor & led commands until roomba_tx_flush() so a
+// control loop sends at most one of each per tick. Turning defer off flushes
+void roomba_tx_defer( Roomba* roomba, int defer );
+
+// write any held commands in a single write(). returns non-zero on error
+int roomba_tx_flush( Roomba* roomba );
+
+// print the transmit statistics
+void roomba_print_tx_stats( Roomba* roomba );
+void roomba_reset_tx_stats( Roomba* roomba );
+
 // Move Roomba with low-level DRIVE command
 void roomba_drive( Roomba* roomba, int velocity, int radius );
 
@@ -110,6 +180,21 @@ int roomba_read_sensors( Roomba* roomba );
 // Get the raw encoder counts
 int roomba_read_encoders( Roomba* roomba );
 
+// Start the Roomba streaming the given sensor packets every 15ms. A background
+// thread parses the stream & keeps the latest frame. If packet_ids is NULL
+// the default packets 0 (sensors 7-26, as read by roomba_read_sensors) and
+// 43 & 44 (encoders) are streamed. Returns -1 on failure
+int roomba_stream_start( Roomba* roomba, const uint8_t* packet_ids, int num_ids );
+
+// Stop streaming & the background reader
+void roomba_stream_stop( Roomba* roomba );
+
+// Copy the latest streamed frame into sensor_bytes & the encoder counts.
+// If stamp is non-NULL it gets the time the frame arrived.
+// Returns the number of frames received since the last call (0 if the data
+// is unchanged) or -1 if no frame has arrived yet
+int roomba_stream_read( Roomba* roomba, struct timeval* stamp );
+
 // print existing sensor data nicely
 void roomba_print_sensors( Roomba* roomba );
 
@@ -120,9 +205,20 @@ void roomba_print_raw_sensors( Roomba* roomba );
 void roomba_delay( int millisecs );
 #define roomba_wait roomba_delay
 
-// read requested size of input from Roomba into buffer
-// returns # of bytes read, 0 if timeout, -1 if select error, -2 if wrong data size read
-int input_timeout (int fd, uint8_t *buf, int read_size);
+// Move whatever the Roomba has sent into the receive ring, waiting up to
+// timeout_ms for the first byte. Returns # of bytes added, 0 if timeout, -1 on error
+int roomba_rx_fill( Roomba* roomba, int timeout_ms );
+
+// Throw away everything in the receive ring & the tty, e.g. a late reply to an
+// earlier request. The bytes are counted in rx_discarded
+void roomba_rx_flush( Roomba* roomba );
+
+// Wait up to timeout_ms for len bytes of reply & copy them into buf.
+// Returns len, 0 if the deadline passed (the partial reply is discarded), -1 on error
+int roomba_read_reply( Roomba* roomba, uint8_t* buf, int len, int timeout_ms );
+
+// print the receive error counters
+void roomba_print_rx_stats( Roomba* roomba );
 
 // some simple macros of bit manipulations
 #define bump_right(b)           ((b & 0x01)!=0)
@@ -0,0 +1,579 @@
+/*
+ * RoombaEmulator.cpp
+ *
+ *  Created on: Dec 4, 2012
+ *      Author: bouchier
+ */
+/*!
+ * \file RoombaEmulator.cpp
+ * \brief Source code for the RoombaEmulator class
+ */
+
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <termios.h>
+#include "RoombaEmulator.h"
+
+// size of each sensor packet, by packet id. Same table as roombalib
+static const uint8_t packetSize[59] = {
+	26, 10, 6, 10, 14, 12, 52,							// 0 - 6: groups
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 1, 2,		// 7 - 22
+	2, 1, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1,		// 23 - 38
+	2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1, 1, 2,		// 39 - 54
+	2, 2, 2, 1											// 55 - 58
+};
+static const uint8_t groupOffset[7] = { 0, 0, 10, 16, 26, 40, 0 };
+
+// offsets in sensors[] of the packets the emulator fills in
+#define OFF_BUMPS 0			// 7
+#define OFF_CLIFF 2			// 9 - 12
+#define OFF_DISTANCE 12		// 19
+#define OFF_ANGLE 14		// 20
+#define OFF_CHARGING 16		// 21
+#define OFF_VOLTAGE 17		// 22
+#define OFF_CURRENT 19		// 23
+#define OFF_TEMP 21			// 24
+#define OFF_CHARGE 22		// 25
+#define OFF_CAPACITY 24		// 26
+#define OFF_OIMODE 40		// 35
+#define OFF_VELOCITY 44		// 39
+#define OFF_RADIUS 46		// 40
+#define OFF_RIGHTVEL 48		// 41
+#define OFF_LEFTVEL 50		// 42
+#define OFF_LENCODER 52		// 43
+#define OFF_RENCODER 54		// 44
+
+RoombaEmulator::RoombaEmulator(long baudIn) {
+	baud = baudIn;
+	masterFd = -1;
+	slaveFd = -1;
+	slaveName[0] = 0;
+	running = false;
+	pthread_mutex_init(&lock, NULL);
+
+	cmdLen = 0;
+	mode = OI_OFF;
+	velocity = radius = 0;
+	leftVel = rightVel = 0;
+	streaming = streamPaused = false;
+	numStreamIds = 0;
+	streamTimer = 0.0;
+	memset(sensors, 0, sizeof(sensors));
+
+	arenaW = arenaH = 3000.0;
+	x = arenaW / 2;
+	y = arenaH / 2;
+	theta = M_PI / 2;
+	leftCounts = rightCounts = 0.0;
+	distanceMm = angleDeg = 0.0;
+	bumps = cliffMask = wheelDropMask = 0;
+
+	txHead = txTail = 0;
+	txCredit = 0.0;
+	latencyTimer = 0.0;
+
+	dropRate = corruptRate = 0.0;
+	latencyMs = 0;
+
+	rxBytes = txBytes = commands = badOpcodes = 0;
+	framesSent = bytesDropped = bytesCorrupted = txOverflows = 0;
+}
+
+RoombaEmulator::~RoombaEmulator() {
+	stop();
+	if (slaveFd >= 0)
+		close(slaveFd);
+	if (masterFd >= 0)
+		close(masterFd);
+	pthread_mutex_destroy(&lock);
+}
+
+//! Create the pseudo-tty
+/*!
+ * \return the path of the slave side, to pass to roomba_init(), or NULL on failure
+ */
+const char *RoombaEmulator::open()
+{
+	struct termios t;
+
+	if ((masterFd = posix_openpt(O_RDWR | O_NOCTTY)) < 0) {
+		perror("RoombaEmulator: posix_openpt");
+		return NULL;
+	}
+	if ((grantpt(masterFd) < 0) || (unlockpt(masterFd) < 0)) {
+		perror("RoombaEmulator: grantpt/unlockpt");
+		return NULL;
+	}
+	strncpy(slaveName, ptsname(masterFd), sizeof(slaveName) - 1);
+	fcntl(masterFd, F_SETFL, O_NONBLOCK);
+
+	// hold the slave open so the master doesn't see a hangup between clients, & make it
+	// raw so the line discipline doesn't echo our replies back to us
+	if ((slaveFd = ::open(slaveName, O_RDWR | O_NOCTTY)) < 0) {
+		perror("RoombaEmulator: open slave");
+		return NULL;
+	}
+	tcgetattr(slaveFd, &t);
+	cfmakeraw(&t);
+	tcsetattr(slaveFd, TCSANOW, &t);
+	return slaveName;
+}
+
+//! Start the emulator thread
+bool RoombaEmulator::start()
+{
+	if (running || (masterFd < 0))
+		return false;
+	running = true;
+	if (pthread_create(&thread, NULL, &RoombaEmulator::threadEntry, (void *)this) != 0) {
+		perror("RoombaEmulator: pthread_create");
+		running = false;
+		return false;
+	}
+	return true;
+}
+
+//! Stop the emulator thread
+void RoombaEmulator::stop()
+{
+	if (!running)
+		return;
+	running = false;
+	pthread_join(thread, NULL);
+}
+
+//! Set the size of the walled arena the robot drives in. The origin is the bottom left corner
+void RoombaEmulator::setArena(double widthMm, double heightMm)
+{
+	pthread_mutex_lock(&lock);
+	arenaW = widthMm;
+	arenaH = heightMm;
+	pthread_mutex_unlock(&lock);
+}
+
+//! Put the robot somewhere. theta is CCW from the +x axis
+void RoombaEmulator::setPose(double xMm, double yMm, double thetaRad)
+{
+	pthread_mutex_lock(&lock);
+	x = xMm;
+	y = yMm;
+	theta = thetaRad;
+	pthread_mutex_unlock(&lock);
+}
+
+//! Set the faults injected into the replies
+/*!
+ * \param dropRateIn Probability (0 - 1) that each reply byte is lost
+ * \param corruptRateIn Probability (0 - 1) that each reply byte is changed
+ * \param latencyMsIn Extra delay before each reply starts to go out
+ */
+void RoombaEmulator::setFaults(double dropRateIn, double corruptRateIn, unsigned long latencyMsIn)
+{
+	pthread_mutex_lock(&lock);
+	dropRate = dropRateIn;
+	corruptRate = corruptRateIn;
+	latencyMs = latencyMsIn;
+	pthread_mutex_unlock(&lock);
+}
+
+void RoombaEmulator::forceCliff(uint8_t mask)
+{
+	pthread_mutex_lock(&lock);
+	cliffMask = mask;
+	pthread_mutex_unlock(&lock);
+}
+
+void RoombaEmulator::forceWheelDrop(uint8_t mask)
+{
+	pthread_mutex_lock(&lock);
+	wheelDropMask = mask;
+	pthread_mutex_unlock(&lock);
+}
+
+void RoombaEmulator::getPose(double *xMm, double *yMm, double *thetaRad)
+{
+	pthread_mutex_lock(&lock);
+	*xMm = x;
+	*yMm = y;
+	*thetaRad = theta;
+	pthread_mutex_unlock(&lock);
+}
+
+RoombaEmulator::OIMode RoombaEmulator::getMode()
+{
+	return mode;
+}
+
+void RoombaEmulator::printStats()
+{
+	pthread_mutex_lock(&lock);
+	printf("emulator: mode %d pose (%.0f, %.0f) %.0f deg, rx %lu tx %lu bytes, %lu cmds, %lu bad opcodes, "
+			"%lu frames, %lu dropped %lu corrupted %lu overflowed bytes\n",
+			mode, x, y, theta * 180.0 / M_PI, rxBytes, txBytes, commands, badOpcodes,
+			framesSent, bytesDropped, bytesCorrupted, txOverflows);
+	pthread_mutex_unlock(&lock);
+}
+
+void *RoombaEmulator::threadEntry(void *arg)
+{
+	((RoombaEmulator *)arg)->run();
+	return NULL;
+}
+
+void RoombaEmulator::run()
+{
+	struct timespec last, now;
+	uint8_t buf[256];
+	double dt;
+	int i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	while (running) {
+		usleep(EMU_TICK_US);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		dt = (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9;
+		last = now;
+
+		pthread_mutex_lock(&lock);
+		while ((n = read(masterFd, buf, sizeof(buf))) > 0) {
+			rxBytes += n;
+			for (i=0; i<n; i++)
+				handleByte(buf[i]);
+		}
+		tick(dt);
+		drain(dt);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+/*
+ * Total length of a command, or 0 if more bytes are needed to tell
+ */
+int RoombaEmulator::commandLength(uint8_t opcode, int have)
+{
+	switch (opcode) {
+	case 128: case 130: case 131: case 132: case 133:
+	case 134: case 135: case 136: case 143:
+		return 1;
+	case 129: case 138: case 141: case 142: case 147: case 150:
+		return 2;
+	case 139: case 144:
+		return 4;
+	case 137: case 145: case 146:
+		return 5;
+	case 140:				// SONG: opcode, song number, length, length note/duration pairs
+		return (have < 3) ? 0 : 3 + 2 * cmd[2];
+	case 148: case 149:		// STREAM, QUERY LIST: opcode, count, ids
+		return (have < 2) ? 0 : 2 + cmd[1];
+	default:
+		return -1;
+	}
+}
+
+void RoombaEmulator::handleByte(uint8_t c)
+{
+	int len;
+
+	cmd[cmdLen++] = c;
+	len = commandLength(cmd[0], cmdLen);
+	if (len < 0) {				// not an opcode we know; resync on the next byte
+		badOpcodes++;
+		cmdLen = 0;
+		return;
+	}
+	if ((len == 0) || (cmdLen < len)) {
+		if (cmdLen == sizeof(cmd))		// can't happen with valid lengths, but be safe
+			cmdLen = 0;
+		return;
+	}
+	execute();
+	cmdLen = 0;
+}
+
+void RoombaEmulator::execute()
+{
+	int r;
+
+	commands++;
+	if ((mode == OI_OFF) && (cmd[0] != 128))
+		return;				// OI ignores everything until START
+
+	switch (cmd[0]) {
+	case 128:				// START
+		mode = OI_PASSIVE;
+		break;
+	case 130:				// CONTROL
+	case 131:				// SAFE
+		mode = OI_SAFE;
+		break;
+	case 132:				// FULL
+		mode = OI_FULL;
+		break;
+	case 133:				// POWER
+		mode = OI_PASSIVE;
+		velocity = radius = leftVel = rightVel = 0;
+		break;
+	case 137:				// DRIVE velocity, radius
+		if (mode < OI_SAFE)
+			break;
+		velocity = (int16_t)((cmd[1] << 8) | cmd[2]);
+		radius = (int16_t)((cmd[3] << 8) | cmd[4]);
+		r = radius;
+		if ((r == (int16_t)0x8000) || (r == 0x7fff)) {		// straight
+			leftVel = rightVel = velocity;
+		} else if (r == 1) {				// spin counter-clockwise
+			leftVel = -velocity;
+			rightVel = velocity;
+		} else if (r == -1) {				// spin clockwise
+			leftVel = velocity;
+			rightVel = -velocity;
+		} else if (r == 0) {
+			leftVel = rightVel = 0;
+		} else {
+			leftVel = (int)(velocity * (r - EMU_WHEEL_BASE / 2) / r);
+			rightVel = (int)(velocity * (r + EMU_WHEEL_BASE / 2) / r);
+		}
+		break;
+	case 145:				// DRIVE DIRECT right, left
+		if (mode < OI_SAFE)
+			break;
+		rightVel = (int16_t)((cmd[1] << 8) | cmd[2]);
+		leftVel = (int16_t)((cmd[3] << 8) | cmd[4]);
+		velocity = (leftVel + rightVel) / 2;
+		radius = 0x7fff;
+		break;
+	case 142:				// SENSORS packet
+		sendPackets(&cmd[1], 1, false);
+		break;
+	case 149:				// QUERY LIST
+		sendPackets(&cmd[2], cmd[1], false);
+		break;
+	case 148:				// STREAM
+		numStreamIds = (cmd[1] > EMU_MAX_STREAM_IDS) ? EMU_MAX_STREAM_IDS : cmd[1];
+		memcpy(streamIds, &cmd[2], numStreamIds);
+		streaming = (numStreamIds > 0);
+		streamPaused = false;
+		streamTimer = 0.0;
+		break;
+	case 150:				// PAUSE/RESUME STREAM
+		streamPaused = (cmd[1] == 0);
+		break;
+	default:				// LEDs, motors, songs etc. are accepted & ignored
+		break;
+	}
+}
+
+int RoombaEmulator::packetOffset(uint8_t id)
+{
+	int i, off;
+
+	if (id <= 6)
+		return groupOffset[id];
+	if (id > 58)
+		return -1;
+	off = (id <= 42) ? 0 : 52;
+	for (i = (id <= 42) ? 7 : 43; i < id; i++)
+		off += packetSize[i];
+	return off;
+}
+
+void RoombaEmulator::put16(int offset, int value)
+{
+	sensors[offset] = (value >> 8) & 0xff;
+	sensors[offset + 1] = value & 0xff;
+}
+
+/*
+ * Refresh sensors[] from the model
+ */
+void RoombaEmulator::updateSensors()
+{
+	sensors[OFF_BUMPS] = bumps | (wheelDropMask << 2);
+	sensors[OFF_CLIFF] = (cliffMask & 1) ? 1 : 0;
+	sensors[OFF_CLIFF + 1] = (cliffMask & 2) ? 1 : 0;
+	sensors[OFF_CLIFF + 2] = (cliffMask & 4) ? 1 : 0;
+	sensors[OFF_CLIFF + 3] = (cliffMask & 8) ? 1 : 0;
+	put16(OFF_DISTANCE, (int)distanceMm);
+	put16(OFF_ANGLE, (int)angleDeg);
+	sensors[OFF_CHARGING] = 0;
+	put16(OFF_VOLTAGE, 16000);
+	put16(OFF_CURRENT, -((abs(leftVel) + abs(rightVel)) + 200));
+	sensors[OFF_TEMP] = 25;
+	put16(OFF_CHARGE, 2500);
+	put16(OFF_CAPACITY, 3000);
+	sensors[OFF_OIMODE] = mode;
+	put16(OFF_VELOCITY, velocity);
+	put16(OFF_RADIUS, radius);
+	put16(OFF_RIGHTVEL, rightVel);
+	put16(OFF_LEFTVEL, leftVel);
+	put16(OFF_LENCODER, (uint16_t)(long)floor(leftCounts));
+	put16(OFF_RENCODER, (uint16_t)(long)floor(rightCounts));
+}
+
+/*
+ * Queue the data for a list of packets, as a checksummed stream frame if frame is true
+ */
+void RoombaEmulator::sendPackets(const uint8_t *ids, int numIds, bool frame)
+{
+	uint8_t buf[2 + EMU_MAX_STREAM_IDS * (1 + EMU_SENSOR_BYTES) + 1];
+	uint8_t sum = 0;
+	int len = frame ? 2 : 0;
+	int i, off, size;
+
+	updateSensors();
+	for (i=0; i<numIds; i++) {
+		off = packetOffset(ids[i]);
+		if (off < 0)
+			continue;		// a real Roomba would misbehave; we just skip it
+		size = packetSize[ids[i]];
+		if (frame)
+			buf[len++] = ids[i];
+		memcpy(&buf[len], &sensors[off], size);
+		len += size;
+
+		// distance & angle are reset each time they are reported
+		if ((ids[i] == 0) || (ids[i] == 2) || (ids[i] == 6) || (ids[i] == 19))
+			distanceMm -= (int)distanceMm;
+		if ((ids[i] == 0) || (ids[i] == 2) || (ids[i] == 6) || (ids[i] == 20))
+			angleDeg -= (int)angleDeg;
+	}
+	if (frame) {
+		buf[0] = 19;
+		buf[1] = len - 2;
+		for (i=0; i<len; i++)
+			sum += buf[i];
+		buf[len++] = (uint8_t)(0 - sum);
+		framesSent++;
+	}
+	queue(buf, len);
+}
+
+void RoombaEmulator::queue(const uint8_t *buf, int len)
+{
+	int i, next;
+
+	if ((txHead == txTail) && (latencyMs > 0))
+		latencyTimer = latencyMs / 1000.0;
+	for (i=0; i<len; i++) {
+		next = (txHead + 1) % EMU_TXQ_SIZE;
+		if (next == txTail) {		// the client isn't reading fast enough
+			txOverflows += len - i;
+			return;
+		}
+		txq[txHead] = buf[i];
+		txHead = next;
+	}
+}
+
+/*
+ * Send as many queued bytes as the baud rate allows in dt, injecting faults
+ */
+void RoombaEmulator::drain(double dt)
+{
+	uint8_t buf[EMU_TXQ_SIZE];
+	int n = 0;
+	uint8_t c;
+
+	if (latencyTimer > 0.0) {
+		latencyTimer -= dt;
+		return;
+	}
+	txCredit += dt * baud / 10.0;
+	if (txHead == txTail) {
+		txCredit = 0.0;				// idle line doesn't bank time
+		return;
+	}
+	while ((txCredit >= 1.0) && (txHead != txTail)) {
+		c = txq[txTail];
+		txTail = (txTail + 1) % EMU_TXQ_SIZE;
+		txCredit -= 1.0;
+		if ((dropRate > 0.0) && (drand48() < dropRate)) {
+			bytesDropped++;
+			continue;
+		}
+		if ((corruptRate > 0.0) && (drand48() < corruptRate)) {
+			c ^= 1 << (lrand48() & 7);
+			bytesCorrupted++;
+		}
+		buf[n++] = c;
+	}
+	if (n > 0) {
+		if (write(masterFd, buf, n) == n)
+			txBytes += n;
+	}
+}
+
+/*
+ * Integrate the differential-drive model over dt seconds
+ */
+void RoombaEmulator::tick(double dt)
+{
+	double dl, dr, ds, dth, nx, ny, bearing;
+	double wallDist[4], wallAngle[4];
+	int i;
+
+	// safe mode stops the robot & drops to passive on a cliff or wheel drop
+	if ((mode == OI_SAFE) && (cliffMask || wheelDropMask)) {
+		mode = OI_PASSIVE;
+		velocity = radius = leftVel = rightVel = 0;
+	}
+	if (mode < OI_SAFE)
+		leftVel = rightVel = 0;
+
+	dl = leftVel * dt;
+	dr = rightVel * dt;
+	ds = (dl + dr) / 2.0;
+	dth = (dr - dl) / EMU_WHEEL_BASE;
+
+	// the wheels turn (and the encoders count) even if a wall stops the robot
+	leftCounts += dl * EMU_COUNTS_PER_MM;
+	rightCounts += dr * EMU_COUNTS_PER_MM;
+	distanceMm += ds;
+	angleDeg += dth * 180.0 / M_PI;
+
+	nx = x + ds * cos(theta + dth / 2.0);
+	ny = y + ds * sin(theta + dth / 2.0);
+	theta = fmod(theta + dth, 2.0 * M_PI);
+	if (theta < 0.0)
+		theta += 2.0 * M_PI;
+	if ((nx > EMU_ROBOT_RADIUS) && (nx < arenaW - EMU_ROBOT_RADIUS) &&
+			(ny > EMU_ROBOT_RADIUS) && (ny < arenaH - EMU_ROBOT_RADIUS)) {
+		x = nx;
+		y = ny;
+	}
+
+	// bumpers: a wall within reach in front of the robot trips the bumper on that side
+	wallDist[0] = x;			wallAngle[0] = M_PI;
+	wallDist[1] = arenaW - x;	wallAngle[1] = 0.0;
+	wallDist[2] = y;			wallAngle[2] = -M_PI / 2;
+	wallDist[3] = arenaH - y;	wallAngle[3] = M_PI / 2;
+	bumps = 0;
+	for (i=0; i<4; i++) {
+		if (wallDist[i] > EMU_ROBOT_RADIUS + 5.0)
+			continue;
+		bearing = remainder(wallAngle[i] - theta, 2.0 * M_PI);
+		if (fabs(bearing) > M_PI / 2)
+			continue;			// wall is behind us
+		if (bearing > 0.35)
+			bumps |= 0x02;		// left
+		else if (bearing < -0.35)
+			bumps |= 0x01;		// right
+		else
+			bumps |= 0x03;		// head on
+	}
+
+	if (streaming && !streamPaused) {
+		streamTimer += dt;
+		if (streamTimer >= EMU_STREAM_MS / 1000.0) {
+			streamTimer -= EMU_STREAM_MS / 1000.0;
+			sendPackets(streamIds, numStreamIds, true);
+		}
+	}
+}
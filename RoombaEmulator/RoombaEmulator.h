@@ -0,0 +1,128 @@
+/*
+ * RoombaEmulator.h
+ *
+ *  Created on: Dec 4, 2012
+ *      Author: bouchier
+ */
+/*! \file RoombaEmulator.h
+ * \brief Header file for RoombaEmulator - a simulated Roomba on a pseudo-tty
+ *
+ * This project runs on the development host, not the VEXPro. It lets roombalib & the
+ * Roborama2012a subsumption code be exercised without a Roomba: point roomba_init() at the
+ * slave side of the emulator's pty instead of /dev/ttyAM1.
+ */
+
+#ifndef ROOMBAEMULATOR_H_
+#define ROOMBAEMULATOR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define EMU_SENSOR_BYTES 80			//!< packets 7 - 58, in packet id order, as in roombalib
+#define EMU_TICK_US 1000			//!< emulator loop period
+#define EMU_STREAM_MS 15			//!< stream frame period, as on a real Roomba
+#define EMU_WHEEL_BASE 235.0		//!< mm between the wheels
+#define EMU_COUNTS_PER_MM (508.8 / (72.0 * 3.14159265))	//!< encoder counts per mm of wheel travel
+#define EMU_ROBOT_RADIUS 170.0		//!< mm, for bumping into the arena walls
+#define EMU_MAX_STREAM_IDS 16
+#define EMU_TXQ_SIZE 4096
+
+/*! \class RoombaEmulator
+ * \brief Emulate a Roomba's Open Interface on a pseudo-tty
+ *
+ * The emulator implements the opcodes roombalib uses: START (128), CONTROL (130), SAFE (131),
+ * FULL (132), POWER (133), DRIVE (137), DRIVE DIRECT (145), MOTORS (138), LEDS (139), SONG (140),
+ * PLAY (141), SENSORS (142), QUERY LIST (149), STREAM (148) & PAUSE/RESUME STREAM (150).
+ *
+ * A differential-drive model integrates the commanded wheel speeds into a pose & encoder
+ * counts. The robot drives in a rectangular arena whose walls trip the bumpers. Cliffs &
+ * wheel drops can be forced on. In SAFE mode a cliff or wheel drop stops the robot &
+ * drops to PASSIVE, as the real OI does.
+ *
+ * Replies are paced at the configured baud rate (10 bit times per byte). Faults can be
+ * injected: dropped bytes, corrupted bytes & extra reply latency.
+ */
+class RoombaEmulator {
+public:
+	enum OIMode { OI_OFF = 0, OI_PASSIVE = 1, OI_SAFE = 2, OI_FULL = 3 };
+
+	RoombaEmulator(long baudIn = 115200);
+	virtual ~RoombaEmulator();
+	const char *open();				// returns the slave pty path, or NULL
+	bool start();
+	void stop();
+
+	// world & fault configuration
+	void setArena(double widthMm, double heightMm);
+	void setPose(double xMm, double yMm, double thetaRad);
+	void setFaults(double dropRate, double corruptRate, unsigned long latencyMs);
+	void forceCliff(uint8_t mask);		// bit 0: left, 1: front left, 2: front right, 3: right
+	void forceWheelDrop(uint8_t mask);	// bit 0: right, 1: left, 2: caster
+
+	// state
+	void getPose(double *xMm, double *yMm, double *thetaRad);
+	OIMode getMode();
+	void printStats();
+
+private:
+	static void *threadEntry(void *arg);
+	void run();
+	void tick(double dt);
+	void handleByte(uint8_t c);
+	void execute();
+	void updateSensors();
+	void sendPackets(const uint8_t *ids, int numIds, bool frame);
+	void queue(const uint8_t *buf, int len);
+	void drain(double dt);
+	int packetOffset(uint8_t id);
+	int commandLength(uint8_t opcode, int have);
+	void put16(int offset, int value);
+
+	long baud;
+	int masterFd;
+	int slaveFd;					// held open so the master never sees a hangup
+	char slaveName[64];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	volatile bool running;
+
+	// command parser
+	uint8_t cmd[64];
+	int cmdLen;
+
+	// OI state
+	OIMode mode;
+	int velocity, radius;			// last DRIVE
+	int leftVel, rightVel;			// mm/s of each wheel
+	bool streaming;
+	bool streamPaused;
+	uint8_t streamIds[EMU_MAX_STREAM_IDS];
+	int numStreamIds;
+	double streamTimer;
+	uint8_t sensors[EMU_SENSOR_BYTES];
+
+	// kinematic state
+	double x, y, theta;
+	double leftCounts, rightCounts;
+	double distanceMm, angleDeg;	// accumulated since last reported
+	double arenaW, arenaH;
+	uint8_t bumps;
+	uint8_t cliffMask, wheelDropMask;
+
+	// transmit queue, paced at baud/10 bytes per second
+	uint8_t txq[EMU_TXQ_SIZE];
+	int txHead, txTail;
+	double txCredit;
+	double latencyTimer;
+
+	// faults
+	double dropRate, corruptRate;
+	unsigned long latencyMs;
+
+	// statistics
+	unsigned long rxBytes, txBytes, commands, badOpcodes;
+	unsigned long framesSent, bytesDropped, bytesCorrupted, txOverflows;
+};
+
+#endif /* ROOMBAEMULATOR_H_ */
@@ -0,0 +1,171 @@
+/*
+ * main.cpp
+ *
+ *  Created on: Dec 4, 2012
+ *      Author: bouchier
+ *
+ *  Run a Roomba emulator on a pseudo-tty, or benchmark roombalib against one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "RoombaEmulator.h"
+#include "roombalib.h"
+
+void usage()
+{
+	printf("Usage: RoombaEmulator [options]\n"
+	"Options:\n"
+	"  -B baud        Pace replies at this baud rate (default 115200)\n"
+	"  -d rate        Drop each reply byte with probability rate (0 - 1)\n"
+	"  -c rate        Corrupt each reply byte with probability rate (0 - 1)\n"
+	"  -l ms          Delay the start of each reply by ms\n"
+	"  -C mask        Force cliff sensors on: 1 left, 2 front left, 4 front right, 8 right\n"
+	"  -W mask        Force wheel drops on: 1 right, 2 left, 4 caster\n"
+	"  -b seconds     Benchmark roombalib against the emulator for seconds per test, then exit\n"
+	"Without -b the emulator prints its pty & runs until killed; pass the pty to\n"
+	"roombaVEXPro with -p\n");
+}
+
+static void resetRxStats(Roomba *roomba)
+{
+	roomba->rx_discarded = roomba->rx_resyncs = roomba->rx_timeouts = 0;
+	roomba_reset_tx_stats(roomba);
+}
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Drive the robot with the polled sensor requests Subsumption made before streaming:
+ * a SENSORS + QUERY LIST round trip & a DRIVE per loop, as fast as possible
+ */
+static void benchPolled(Roomba *roomba, int seconds)
+{
+	double start = now(), end = start + seconds;
+	unsigned long loops = 0, failures = 0;
+
+	resetRxStats(roomba);
+	while (now() < end) {
+		if (roomba_read_sensors(roomba) < 0)
+			failures++;
+		if (roomba_read_encoders(roomba) < 0)
+			failures++;
+		roomba_forward_at(roomba, (loops & 0x40) ? 200 : -200);
+		loops++;
+	}
+	printf("polled:   %7.1f loops/s (%5.2f ms per sensor round trip), %lu failed reads\n",
+			loops / (now() - start), (now() - start) * 1000.0 / loops, failures);
+	printf("          ");
+	roomba_print_rx_stats(roomba);
+	printf("          ");
+	roomba_print_tx_stats(roomba);
+	roomba_stop(roomba);
+}
+
+/*
+ * Drive the robot from the sensor stream as Subsumption does: a DRIVE for every new frame,
+ * held & flushed once per loop
+ */
+static void benchStream(Roomba *roomba, int seconds)
+{
+	double start, end;
+	double ageSum = 0.0;
+	struct timeval stamp;
+	unsigned long frames = 0, loops = 0;
+	int fresh;
+
+	if (roomba_stream_start(roomba, NULL, 0) < 0) {
+		printf("stream:   failed to start\n");
+		return;
+	}
+	resetRxStats(roomba);
+	roomba_tx_defer(roomba, 1);
+	start = now();
+	end = start + seconds;
+	while (now() < end) {
+		fresh = roomba_stream_read(roomba, &stamp);
+		if (fresh <= 0) {
+			usleep(500);
+			continue;
+		}
+		frames += fresh;
+		ageSum += now() - (stamp.tv_sec + stamp.tv_usec / 1e6);
+		roomba_forward_at(roomba, (loops & 0x10) ? 200 : -200);
+		roomba_tx_flush(roomba);
+		loops++;
+	}
+	printf("stream:   %7.1f frames/s, %7.1f control loops/s, mean frame age %.2f ms\n",
+			frames / (now() - start), loops / (now() - start),
+			loops ? ageSum * 1000.0 / loops : 0.0);
+	printf("          ");
+	roomba_print_rx_stats(roomba);
+	printf("          ");
+	roomba_print_tx_stats(roomba);
+	roomba_tx_defer(roomba, 0);
+	roomba_stream_stop(roomba);
+	roomba_stop(roomba);
+}
+
+int main(int argc, char **argv)
+{
+	long baud = 115200;
+	double dropRate = 0.0, corruptRate = 0.0;
+	unsigned long latencyMs = 0;
+	int cliffMask = 0, wheelDropMask = 0;
+	int benchSeconds = 0;
+	const char *pty;
+	Roomba *roomba;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hB:d:c:l:C:W:b:")) != -1) {
+		switch (opt) {
+		case 'B': baud = strtol(optarg, NULL, 10); break;
+		case 'd': dropRate = atof(optarg); break;
+		case 'c': corruptRate = atof(optarg); break;
+		case 'l': latencyMs = strtoul(optarg, NULL, 10); break;
+		case 'C': cliffMask = strtol(optarg, NULL, 0); break;
+		case 'W': wheelDropMask = strtol(optarg, NULL, 0); break;
+		case 'b': benchSeconds = strtol(optarg, NULL, 10); break;
+		default:
+			usage();
+			exit(1);
+		}
+	}
+
+	RoombaEmulator emu(baud);
+	if ((pty = emu.open()) == NULL)
+		exit(1);
+	emu.setFaults(dropRate, corruptRate, latencyMs);
+	emu.forceCliff(cliffMask);
+	emu.forceWheelDrop(wheelDropMask);
+	emu.start();
+
+	if (benchSeconds == 0) {
+		printf("Roomba emulator on %s at %ld baud\n", pty, baud);
+		while (1) {
+			sleep(5);
+			emu.printStats();
+		}
+	}
+
+	// the emulator's baud rate is the real limit; the pty itself has no speed
+	if ((roomba = roomba_init(pty, B115200)) == NULL)
+		exit(1);
+	roomba_mode(roomba, 3);
+	printf("benchmarking roombalib against the emulator at %ld baud, drop %.4f corrupt %.4f latency %lums\n",
+			baud, dropRate, corruptRate, latencyMs);
+	benchPolled(roomba, benchSeconds);
+	benchStream(roomba, benchSeconds);
+	emu.printStats();
+	roomba_free(roomba);
+	emu.stop();
+	return 0;
+}
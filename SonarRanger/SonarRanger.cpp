@@ -0,0 +1,296 @@
+/*
+ * SonarRanger.cpp
+ *
+ *  Created on: Dec 2, 2012
+ *      Author: bouchier
+ */
+/*!
+ * \file SonarRanger.cpp
+ * \brief Source code for the SonarRanger class
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "qegpioint.h"
+#include "qetime.h"
+#include "SonarRanger.h"
+
+//! Instantiate a SonarRanger with no sonars
+/*!
+ * \param gpioIn The GPIO interrupt singleton
+ */
+SonarRanger::SonarRanger(CQEGpioInt& gpioIn) : gpio(gpioIn) {
+	numSonars = 0;
+	running = false;
+	shm = NULL;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&echoCond, NULL);
+}
+
+SonarRanger::~SonarRanger() {
+	int i;
+
+	stop();
+	for (i=0; i<numSonars; i++) {
+		gpio.SetInterruptMode(sonars[i].triggerIndex, QEG_INTERRUPT_NONE);
+		gpio.SetInterruptMode(sonars[i].echoIndex, QEG_INTERRUPT_NONE);
+		gpio.UnregisterCallback(sonars[i].triggerIndex);
+		gpio.UnregisterCallback(sonars[i].echoIndex);
+	}
+	pthread_cond_destroy(&echoCond);
+	pthread_mutex_destroy(&lock);
+}
+
+//! Add a sonar to the round-robin. Must be called before start()
+/*!
+ * \param triggerDio The Digital I/O number (1 - 16) wired to the sensor's "INPUT" connector
+ * \param echoDio The Digital I/O number (1 - 16) wired to the sensor's "OUTPUT" connector
+ * \return The index of the sonar, for use with getRange(), or -1 if there's no room
+ */
+int SonarRanger::addSonar(int triggerDio, int echoDio)
+{
+	SonarState *s;
+	int i;
+
+	if (running || (numSonars >= SONAR_MAX))
+		return -1;
+	s = &sonars[numSonars];
+	s->ranger = this;
+	s->triggerIndex = triggerDio - 1;
+	s->echoIndex = echoDio - 1;
+	s->gotTrigger = s->gotEcho = false;
+	for (i=0; i<SONAR_FILTER_LEN; i++)
+		s->history[i] = -1;
+	s->historyIndex = 0;
+	s->range = 0;
+	s->quality = 0;
+	s->stamp.tv_sec = s->stamp.tv_usec = 0;
+	s->pings = s->timeouts = 0;
+
+	// trigger is an output, idle low. Echo is an input
+	gpio.ResetDataBit(s->triggerIndex);
+	gpio.SetDataDirection((gpio.GetDataDirection() | (1 << s->triggerIndex)) & ~(1 << s->echoIndex));
+
+	// timestamp the falling edges of both the trigger & the echo
+	gpio.RegisterCallback(s->triggerIndex, (void *)s, &SonarRanger::callback);
+	gpio.RegisterCallback(s->echoIndex, (void *)s, &SonarRanger::callback);
+	gpio.SetInterruptMode(s->triggerIndex, QEG_INTERRUPT_NEGEDGE);
+	gpio.SetInterruptMode(s->echoIndex, QEG_INTERRUPT_NEGEDGE);
+
+	return numSonars++;
+}
+
+//! Publish each new reading to the given shared memory segment
+void SonarRanger::setShm(sonarShmStruct *shmIn)
+{
+	int i;
+
+	shm = shmIn;
+	if (shm == NULL)
+		return;
+	for (i=0; i<SONAR_MAX; i++)
+		sonarShmWrite(&shm->sonar[i], 0, 0, 0, 0);
+	shm->numSonars = numSonars;
+	SONAR_BARRIER();
+	shm->magic = SONAR_SHM_MAGIC;
+}
+
+//! Start the ranging thread
+/*!
+ * \return true if the thread was started
+ */
+bool SonarRanger::start()
+{
+	if (running || (numSonars == 0))
+		return false;
+	if (shm != NULL)
+		shm->numSonars = numSonars;
+	running = true;
+	if (pthread_create(&thread, NULL, &SonarRanger::threadEntry, (void *)this) != 0) {
+		perror("SonarRanger: pthread_create");
+		running = false;
+		return false;
+	}
+	return true;
+}
+
+//! Stop the ranging thread & wait for it to exit
+void SonarRanger::stop()
+{
+	if (!running)
+		return;
+	running = false;
+	pthread_join(thread, NULL);
+}
+
+void *SonarRanger::threadEntry(void *arg)
+{
+	((SonarRanger *)arg)->rangeLoop();
+	return NULL;
+}
+
+/*
+ * Called at interrupt level on the falling edge of a trigger or echo
+ */
+void SonarRanger::callback(unsigned int io, struct timeval *ptv, void *userdata)
+{
+	SonarState *s = (SonarState *)userdata;
+	SonarRanger *r = s->ranger;
+
+	pthread_mutex_lock(&r->lock);
+	if (io == s->triggerIndex) {
+		s->tvTrigger = *ptv;
+		s->gotTrigger = true;
+	} else if ((io == s->echoIndex) && s->gotTrigger && !s->gotEcho) {
+		s->tvEcho = *ptv;
+		s->gotEcho = true;
+		pthread_cond_signal(&r->echoCond);
+	}
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * Fire each sonar in turn, forever
+ */
+void SonarRanger::rangeLoop()
+{
+	int i = 0;
+
+	while (running) {
+		ping(&sonars[i]);
+		usleep(SONAR_SETTLE_MS * 1000);		// let this ping's echoes die out before the next
+		i = (i + 1) % numSonars;
+	}
+}
+
+/*
+ * Fire one sonar & sleep until its echo arrives or it times out
+ */
+void SonarRanger::ping(SonarState *s)
+{
+	struct timeval now;
+	struct timespec deadline;
+	long raw = -1;
+	int rv = 0;
+
+	pthread_mutex_lock(&lock);
+	s->gotTrigger = s->gotEcho = false;
+	pthread_mutex_unlock(&lock);
+
+	// precisely timed trigger pulse. The trigger falling edge interrupt timestamps the ping
+	gpio.SetDataBit(s->triggerIndex);
+	CQETime::usleep(SONAR_TRIGGER_US);
+	gpio.ResetDataBit(s->triggerIndex);
+
+	gettimeofday(&now, NULL);
+	deadline.tv_sec = now.tv_sec;
+	deadline.tv_nsec = (now.tv_usec + SONAR_TIMEOUT_MS * 1000) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&lock);
+	while (!s->gotEcho && (rv != ETIMEDOUT))
+		rv = pthread_cond_timedwait(&echoCond, &lock, &deadline);
+	s->pings++;
+	if (s->gotEcho) {
+		raw = diff(&s->tvTrigger, &s->tvEcho);
+		if (raw > SONAR_BIAS)
+			raw = (raw - SONAR_BIAS) / SONAR_USPI;
+		else
+			raw = 0;
+		s->stamp = s->tvEcho;
+	} else {
+		s->timeouts++;
+	}
+	filter(s, (int)raw);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Median filter the recent readings & compute quality. Caller holds lock.
+ */
+void SonarRanger::filter(SonarState *s, int raw)
+{
+	int valid[SONAR_FILTER_LEN];
+	int nValid = 0;
+	int i, j, t;
+
+	s->history[s->historyIndex] = raw;
+	s->historyIndex = (s->historyIndex + 1) % SONAR_FILTER_LEN;
+
+	// insertion sort the valid readings
+	for (i=0; i<SONAR_FILTER_LEN; i++) {
+		if (s->history[i] < 0)
+			continue;
+		t = s->history[i];
+		for (j=nValid; (j > 0) && (valid[j-1] > t); j--)
+			valid[j] = valid[j-1];
+		valid[j] = t;
+		nValid++;
+	}
+
+	if (nValid == 0) {
+		s->quality = 0;			// nothing in range; keep reporting the last range
+	} else {
+		s->range = valid[nValid/2];
+		s->quality = (100 * nValid) / SONAR_FILTER_LEN;
+		if ((valid[nValid-1] - valid[0]) > SONAR_SPREAD_TOL)
+			s->quality /= 2;
+	}
+
+	if (shm != NULL)
+		sonarShmWrite(&shm->sonar[s - sonars], s->range, s->quality,
+				s->stamp.tv_sec, s->stamp.tv_usec);
+}
+
+long SonarRanger::diff(struct timeval *ptv0, struct timeval *ptv1)
+{
+	long val;
+
+	val = ptv1->tv_usec - ptv0->tv_usec;
+	val += (ptv1->tv_sec - ptv0->tv_sec)*1000000;
+
+	return val;
+}
+
+//! Get the latest filtered range from a sonar
+/*!
+ * \param sonar Sonar index returned by addSonar()
+ * \param quality If not NULL, receives the quality of the reading (0 - 100)
+ * \param stamp If not NULL, receives the time of the echo that produced the range
+ * \return Range in inches
+ */
+int SonarRanger::getRange(int sonar, int *quality, struct timeval *stamp)
+{
+	int range;
+
+	if ((sonar < 0) || (sonar >= numSonars))
+		return 0;
+	pthread_mutex_lock(&lock);
+	range = sonars[sonar].range;
+	if (quality != NULL)
+		*quality = sonars[sonar].quality;
+	if (stamp != NULL)
+		*stamp = sonars[sonar].stamp;
+	pthread_mutex_unlock(&lock);
+	return range;
+}
+
+//! Get the number of times a sonar has been fired
+unsigned long SonarRanger::getPingCount(int sonar)
+{
+	if ((sonar < 0) || (sonar >= numSonars))
+		return 0;
+	return sonars[sonar].pings;
+}
+
+//! Get the number of pings which got no echo
+unsigned long SonarRanger::getTimeoutCount(int sonar)
+{
+	if ((sonar < 0) || (sonar >= numSonars))
+		return 0;
+	return sonars[sonar].timeouts;
+}
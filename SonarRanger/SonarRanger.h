@@ -0,0 +1,112 @@
+/*
+ * SonarRanger.h
+ *
+ *  Created on: Dec 2, 2012
+ *      Author: bouchier
+ */
+/*! \file SonarRanger.h
+ * \brief Header file for SonarRanger - the class which runs one or more VEX ultrasonic sensors
+ *
+ * <H1>
+ * Build Configuration
+ * </H1>
+ *
+ * This project depends on the following peer projects being at the same directory level:
+ * - qetime
+ *
+ * Under C/C++ Build -> Settings, Tool Settings tab, TerkOS C++ Compiler group, Directories settings
+ * add ../../qetime to the include path.
+ *
+ * Under C/C++ Build -> Settings, Tool Settings tab, TerkOS C++ Linker group, Miscellaneous settings, add
+ * ../../qetime/Debug/qetime.o as an "other object", and -lpthread to the linker flags.
+ */
+
+#ifndef SONARRANGER_H_
+#define SONARRANGER_H_
+
+#include <sys/time.h>
+#include <pthread.h>
+#include "SonarShm.h"
+
+class CQEGpioInt;
+
+#define SONAR_MAX SONAR_SHM_MAX	//!< most sonars one SonarRanger can run
+#define SONAR_USPI 150			//!< round-trip microseconds per inch
+#define SONAR_BIAS 300			//!< fixed delay (us) between trigger & ping
+#define SONAR_TRIGGER_US 50		//!< trigger pulse width in microseconds
+#define SONAR_TIMEOUT_MS 30		//!< give up waiting for an echo after this long (~200")
+#define SONAR_SETTLE_MS 10		//!< quiet time after each ping so its echoes can die out
+#define SONAR_FILTER_LEN 3		//!< number of readings in each sonar's median filter
+#define SONAR_SPREAD_TOL 3		//!< readings within this many inches of each other are consistent
+
+/*! \class SonarRanger
+ * \brief Run one or more VEX ultrasonic sensors in round-robin & publish filtered ranges
+ *
+ * Each sonar is wired with its trigger ("INPUT" on the sensor) to one digital I/O and its
+ * echo ("OUTPUT" on the sensor) to another. SonarRanger runs a thread that fires one sonar
+ * at a time with a precise CQETime-timed trigger pulse, then sleeps until the echo interrupt
+ * arrives or SONAR_TIMEOUT_MS elapses. After a short settle time it fires the next sonar,
+ * so sonars never hear each other's pings and the cycle runs as fast as the ranges allow.
+ *
+ * Range is measured between the kernel timestamps of the trigger's falling edge & the echo's
+ * falling edge, so it is not affected by scheduling latency of the ranging thread.
+ *
+ * Each sonar's last SONAR_FILTER_LEN readings are median filtered. Quality is 0 if the sonar
+ * has no valid readings, otherwise it is the percentage of the recent readings that were valid,
+ * halved if they disagree by more than SONAR_SPREAD_TOL inches.
+ *
+ * If a sonarShmStruct is supplied with setShm(), each new reading is also published there.
+ */
+class SonarRanger {
+public:
+	SonarRanger(CQEGpioInt& gpioIn);
+	virtual ~SonarRanger();
+	int addSonar(int triggerDio, int echoDio);	// returns sonar index or -1
+	void setShm(sonarShmStruct *shmIn);
+	bool start();
+	void stop();
+	int getRange(int sonar, int *quality=NULL, struct timeval *stamp=NULL);
+	unsigned long getPingCount(int sonar);
+	unsigned long getTimeoutCount(int sonar);
+
+	int getNumSonars() const
+	{
+		return numSonars;
+	}
+
+private:
+	struct SonarState {
+		SonarRanger *ranger;			// owner, so the static callback can find it
+		unsigned int triggerIndex;		// io index of the trigger DIO
+		unsigned int echoIndex;			// io index of the echo DIO
+		timeval tvTrigger;				// timestamp of the end of the trigger pulse
+		timeval tvEcho;					// timestamp of the echo
+		bool gotTrigger;				// trigger edge seen for the current ping
+		bool gotEcho;					// echo edge seen for the current ping
+		int history[SONAR_FILTER_LEN];	// recent raw ranges, -1 if no echo
+		int historyIndex;
+		int range;						// filtered range in inches
+		int quality;					// 0 - 100
+		timeval stamp;					// time of the echo that produced range
+		unsigned long pings;
+		unsigned long timeouts;
+	};
+
+	static void *threadEntry(void *arg);
+	static void callback(unsigned int io, struct timeval *ptv, void *userdata);
+	void rangeLoop();
+	void ping(SonarState *s);
+	void filter(SonarState *s, int raw);
+	long diff(struct timeval *ptv0, struct timeval *ptv1);
+
+	CQEGpioInt &gpio;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t echoCond;			// signalled by the callback when an echo arrives
+	volatile bool running;
+	int numSonars;
+	SonarState sonars[SONAR_MAX];
+	sonarShmStruct *shm;
+};
+
+#endif /* SONARRANGER_H_ */
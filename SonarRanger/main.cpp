@@ -0,0 +1,88 @@
+/*
+ * main.cpp
+ *
+ *  Created on: Dec 2, 2012
+ *      Author: bouchier
+ *
+ *  Run the sonars given on the command line and publish their ranges in shared memory
+ *  for other processes (e.g. Roborama2012a) to read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "qegpioint.h"
+#include "SonarRanger.h"
+
+CQEGpioInt &gpio = CQEGpioInt::GetRef();
+
+void usage()
+{
+	printf("Usage: SonarRanger [-q] trig:echo [trig:echo ...]\n");
+	printf("Each trig:echo pair gives the DIO numbers (1 - 16) wired to a sonar's INPUT & OUTPUT\n");
+	printf("connectors. Up to %d sonars are fired in turn & their ranges published in shared\n", SONAR_MAX);
+	printf("memory key %d. Ranges are printed once a second unless -q is given\n", (int)SONAR_SHM_KEY);
+}
+
+int main(int argc, char **argv)
+{
+	int shmid;
+	sonarShmStruct *shm;
+	int trig, echo;
+	int range, quality;
+	int i;
+	bool quiet = false;
+
+	SonarRanger ranger(gpio);
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			quiet = true;
+			continue;
+		}
+		if ((sscanf(argv[i], "%d:%d", &trig, &echo) != 2) ||
+				(trig < 1) || (trig > 16) || (echo < 1) || (echo > 16) || (trig == echo)) {
+			usage();
+			exit(1);
+		}
+		if (ranger.addSonar(trig, echo) < 0) {
+			printf("Too many sonars, max is %d\n", SONAR_MAX);
+			exit(1);
+		}
+	}
+	if (ranger.getNumSonars() == 0) {
+		usage();
+		exit(1);
+	}
+
+	// create the shared memory segment the ranges are published in
+	if ((shmid = shmget(SONAR_SHM_KEY, sizeof(sonarShmStruct), IPC_CREAT | 0666)) < 0) {
+		perror("shmget");
+		exit(1);
+	}
+	if ((shm = (sonarShmStruct *)shmat(shmid, NULL, 0)) == (sonarShmStruct *) -1) {
+		perror("shmat");
+		exit(1);
+	}
+	ranger.setShm(shm);
+
+	if (!ranger.start()) {
+		printf("Failed to start the sonar ranging thread\n");
+		exit(1);
+	}
+
+	while (1) {
+		sleep(1);
+		if (quiet)
+			continue;
+		for (i=0; i<ranger.getNumSonars(); i++) {
+			range = ranger.getRange(i, &quality);
+			printf("%3d\" (q%3d, %lu/%lu) ", range, quality,
+					ranger.getTimeoutCount(i), ranger.getPingCount(i));
+		}
+		printf("\n");
+	}
+}
@@ -13,6 +13,10 @@
  * Note: connector labeled "INPUT" on sonar sensor goes to
  * digital 1 (bit 0), and connector labeled "OUTPUT" goes to
  * digital 2 (bit 1).
+ *
+ * This project depends on the SonarRanger & qetime peer projects being at the same
+ * directory level. Add ../../SonarRanger and ../../qetime to the include path, and
+ * ../../SonarRanger/Debug/SonarRanger.o and ../../qetime/Debug/qetime.o as "other objects"
  */
 
 
@@ -23,6 +27,7 @@
 #include <qegpioint.h>
 #include <qemotoruser.h>
 #include <qeservo.h>
+#include "SonarRanger.h"
 
 ros::NodeHandle  nh;
 std_msgs::Int32 range;
@@ -33,9 +38,6 @@ CQEServo &servo = CQEServo::GetRef();			// servo singleton
 
 char *rosSrvrIpDefault = "192.168.15.149";
 
-#define USPI 150
-#define BIAS 300
-
 /*
  * Motor callback - called when new motor speed is published
  */
@@ -56,48 +58,9 @@ void servoCb(const std_msgs::Int32& servo1_msg){
 }
 ros::Subscriber<std_msgs::Int32> servoSub("servo1", servoCb );
 
-/*
- * Calculate difference in usec between sonar start & end timevals
- */
-unsigned long diff(struct timeval *ptv0, struct timeval *ptv1)
-{
-	long val;
-
-	val = ptv1->tv_usec - ptv0->tv_usec;
-	val += (ptv1->tv_sec - ptv0->tv_sec)*1000000;
-
-	return val;
-}
-
-/*
- * Sonar callback. Called at interrupt level when sonar output transitions,
- * indicating end of range measurement
- */
-void callback(unsigned int io, struct timeval *ptv, void *userdata)
-{
-	static struct timeval tv0;
-	static int flag = 0;
-	int sonarVal;
-
-	if (io==0)
-	{
-		flag = 1;
-		tv0 = *ptv;
-	}
-
-	if (io==1 && flag)
-	{
-		sonarVal = diff(&tv0, ptv);
-		if (sonarVal>BIAS)
-			sonarVal = (sonarVal-BIAS)/USPI;
-		range.data = sonarVal;
-		printf("%d\n", sonarVal);
-	}
-}
-
 int main(int argc, char **argv)
 {
-	volatile unsigned int d;
+	SonarRanger ranger(gpio);
 
 	// set IP of rosserial server first from cmd line, then env, then default
 	char *rosSrvrIp = getenv("ROSSERIAL_SRVR");	//See if we have an env variable set
@@ -113,28 +76,19 @@ int main(int argc, char **argv)
 	nh.subscribe(motorSub);		// subscribe to motor speed topic
 	nh.subscribe(servoSub);		// subscribe to servo position
 
-	// reset bit 0, set as output for sonar trigger
-	gpio.SetData(0x0000);
-	gpio.SetDataDirection(0x0001);
-
-	// set callbacks on negative edge for both bits 0 (trigger)
-	// and 1 (echo)
-	gpio.RegisterCallback(0, NULL, callback);
-	gpio.RegisterCallback(1, NULL, callback);
-	gpio.SetInterruptMode(0, QEG_INTERRUPT_NEGEDGE);
-	gpio.SetInterruptMode(1, QEG_INTERRUPT_NEGEDGE);
+	// sonar trigger on digital 1, echo on digital 2. SonarRanger fires it in the
+	// background as fast as the echoes allow
+	if ((ranger.addSonar(1, 2) < 0) || !ranger.start()) {
+		printf("Failed to start the sonar\n");
+		return -1;
+	}
 
-	// trigger sonar by toggling bit 0
 	while(1)
 	{
-		gpio.SetData(0x0001);
-		for (d=0; d<120000; d++);
-		gpio.SetData(0x0000);
-		usleep(100000);		// the interrupt breaks us out of this sleep
-		usleep(500000);		// now really sleep
+		range.data = ranger.getRange(0);
+		printf("%d\n", range.data);
 		sonar1.publish( &range );
 		nh.spinOnce();
+		usleep(100000);
 	}
 }
-
-
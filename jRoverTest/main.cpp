@@ -17,7 +17,7 @@
  * - CQEIMEncoder
  * - qetime
  * - PID
- * - RCTest
+ * - RCRx
  * - ControlledMotor
  *
  * Edit the project properties as follows to reference them as includes, link objects, and referenced projects.
@@ -30,7 +30,7 @@
  * - ../../CQEIMEncoder
  * - ../../qetime
  * - ../../PID
- * - ../../RCTest
+ * - ../../RCRx
  * - ../../ControlledMotor
  *
  * Under C/C++ Build -> Settings, Tool Settings tab, TerkOS C++ Linker group, Miscellaneous settings, add
@@ -40,7 +40,7 @@
  * - ../../CQEIMEncoder/Debug/CQEIMEncoder.o
  * - ../../qetime/Debug/qetime.o
  * - ../../PID/Debug/pid.o
- * - ../../RCTest/Debug/RCTest.o
+ * - ../../RCRx/Debug/RCRx.o
  * - ../../ControlledMotor/Debug/ControlledMotor.o
  *
  * In the Project References group, check the following projects. This builds them before the current project.
@@ -49,6 +49,7 @@
  * CQEIMEncoder
  * qetime
  * PID
+ * RCRx
  * ControlledMotor
  *
  */
@@ -65,7 +66,7 @@ int default_argc = 1;
 #include <string.h>   /* String function definitions */
 #include <unistd.h>
 #include "qegpioint.h"
-#include "RCTest.h"
+#include "RCRx.h"
 #include "Metro.h"
 #include "CQEI2C.h"
 #include "ControlledMotor.h"
@@ -131,8 +132,9 @@ ros::Publisher motorTelemetry("motorTelemetry", &range);
 char *rosSrvrIp = "192.168.15.149";
 bool rosFlag = false;	// true to enable connection to ROS
 
-struct RCChannel dirRcc;
-struct RCChannel speedRcc;
+// R/C receiver channels, in the order their DIOs are given to RCRx
+#define RC_DIR 0
+#define RC_SPEED 1
 
 int printRate = PRINT_RATE;
 
@@ -325,34 +327,28 @@ void jRoverTest6()
 
 	initMotors();					// always start with this
 
-	// initialize the R/C steering struct & start interrupt monitoring
-	dirRcc.flag = 1;
-	dirRcc.dioIndex = 0;
-	initRCTest(gpio, &dirRcc);
+	// start interrupt monitoring of the R/C steering (DIO 1) & speed (DIO 2) channels.
+	// Calibrate so the stick values map onto the old pulse-width scaling
+	int rcDios[] = {1, 2};
+	RCRx rcrx(gpio, 2, rcDios);
+	rcrx.setCalibration(RC_DIR, 1500, 500);
+	rcrx.setCalibration(RC_SPEED, 1460, 500);
 
-	// initialize the R/C speed struct & start interrupt monitoring
-	speedRcc.flag = 1;
-	speedRcc.dioIndex = 1;
-	initRCTest(gpio, &speedRcc);
-
-
-	// check motors every 50ms, and R/C every 250ms
+	// read R/C & update motors every 50ms
 	Metro metro = Metro(50);
-	Metro metro250 = Metro(250);
 
 	driveRover(0.0, 0.0);		// start off stopped
 	while (1){
-		if (metro250.check()) {
-			// convert R/C values to desired speed range -20 - +20 ips & angle range +/-90
-			if ((speedRcc.pulseWidth == 0) || (dirRcc.pulseWidth == 0)) {
+		if (metro.check()) {		// if 50ms have passed & it's time to do the control loop
+			// convert R/C values to desired speed range -20 - +20 ips & angle range +/-0.5.
+			// Stop if either channel has lost signal
+			if (rcrx.signalLost()) {
 				linear = angularVelocity = 0.0;
 			} else {
-				linear = 0.0 - (float)(speedRcc.pulseWidth-1460)/25.0;
-				angularVelocity = 0.0 - (float)(dirRcc.pulseWidth-1500)/1000.0;
+				linear = 0.0 - rcrx.getStick(RC_SPEED) * 20.0;
+				angularVelocity = 0.0 - rcrx.getStick(RC_DIR) * 0.5;
 			}
 			driveRover(linear, angularVelocity);
-		}
-		if (metro.check()) {		// if 50ms have passed & it's time to do the control loop
 			updateAllMotors();			// run the PID loop
 			range.data = rfSteer.getDegrees();
 			if (rosFlag)
@@ -18,6 +18,13 @@ uint16_t makeWord(byte h, byte l);
 #define word(...) makeWord(__VA_ARGS__)
 
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+int getPulseInErrorCode();
+
+typedef void (*pulseInCallback_t)(uint8_t pin, unsigned long width, void *userdata);
+int pulseInAsync(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L,
+		pulseInCallback_t cb = NULL, void *userdata = NULL);
+int pulseInAsyncResult(uint8_t pin, unsigned long *width);
+void pulseInAsyncCancel(uint8_t pin);
 
 void tone(uint8_t _pin, unsigned int frequency, unsigned long duration = 0);
 void noTone(uint8_t _pin);
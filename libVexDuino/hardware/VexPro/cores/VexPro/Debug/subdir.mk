@@ -5,6 +5,7 @@ CPP_SRCS += \
 ../main.cpp \
 ../vexpro_analog.cpp \
 ../vexpro_digital.cpp \
+../vexpro_pwm.cpp \
 ../qetime.cpp \
 ../wiring_pulse.cpp \
 ../vexpro_time.cpp 
@@ -25,6 +26,7 @@ OBJS += \
 ./main.o \
 ./vexpro_analog.o \
 ./vexpro_digital.o \
+./vexpro_pwm.o \
 ./wiring.o \
 ./xtoa.o  \
 ./wiring_pulse.o \
@@ -57,6 +59,7 @@ CPP_DEPS += \
 ./main.d \
 ./vexpro_analog.d \
 ./vexpro_digital.d \
+./vexpro_pwm.d \
 ./qetime.d \
 ./wiring_pulse.d \
 ./vexpro_time.d 
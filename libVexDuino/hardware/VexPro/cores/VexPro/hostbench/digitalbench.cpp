@@ -0,0 +1,108 @@
+/**
+ * @file digitalbench.cpp
+ * @brief Host benchmark of the per-pin vs. port-wide digital I/O functions
+ *
+ * Runs each access pattern against the simulated GPIO in qegpioint.h and reports the
+ * register reads & writes and the time per operation.
+ *
+ * Usage: digitalbench [accessNs [iterations]]
+ * accessNs is the simulated cost of one register access (default 500)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <qegpioint.h>
+#include "Arduino.h"
+
+extern CQEGpioInt &io;
+
+static unsigned long iterations = 10000;
+
+/*
+ * The shiftOut() implementation from before the port-wide functions were added
+ */
+static void shiftOutPerPin(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val)
+{
+	uint8_t i;
+
+	for (i = 0; i < 8; i++)  {
+		if (bitOrder == LSBFIRST)
+			digitalWrite(dataPin, !!(val & (1 << i)));
+		else
+			digitalWrite(dataPin, !!(val & (1 << (7 - i))));
+
+		digitalWrite(clockPin, HIGH);
+		digitalWrite(clockPin, LOW);
+	}
+}
+
+static void eightPinsPerPin(unsigned long n)
+{
+	uint8_t pin;
+
+	for (pin = 1; pin <= 8; pin++)
+		digitalWrite(pin, (n >> pin) & 1);
+}
+
+static void eightPinsMask(unsigned long n)
+{
+	digitalWriteMask(0x00ff, (uint16_t)(n << 1));
+}
+
+static void eightPinsShadow(unsigned long n)
+{
+	uint8_t pin;
+
+	for (pin = 1; pin <= 8; pin++)
+		digitalWrite(pin, (n >> pin) & 1);
+	digitalShadowFlush();
+}
+
+static void shiftOldStyle(unsigned long n)
+{
+	shiftOutPerPin(9, 10, MSBFIRST, (uint8_t)n);
+}
+
+static void shiftNewStyle(unsigned long n)
+{
+	shiftOut(9, 10, MSBFIRST, (uint8_t)n);
+}
+
+static void run(const char *name, void (*op)(unsigned long))
+{
+	struct timespec start, end;
+	unsigned long i;
+	double us;
+
+	io.resetCounts();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++)
+		op(i);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+	printf("%-28s %6.2f reads %6.2f writes %9.2f us/op\n", name,
+			(double)io.reads / iterations, (double)io.writes / iterations, us / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	io.accessNs = 500;
+	if (argc > 1)
+		io.accessNs = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		iterations = strtoul(argv[2], NULL, 0);
+
+	printf("simulated register access %lu ns, %lu iterations\n", io.accessNs, iterations);
+	pinModePort(0xffff);
+
+	run("8 pins, digitalWrite", eightPinsPerPin);
+	run("8 pins, digitalWriteMask", eightPinsMask);
+	digitalShadowBegin();
+	run("8 pins, shadow + flush", eightPinsShadow);
+	digitalShadowEnd();
+	run("shiftOut, per-pin writes", shiftOldStyle);
+	run("shiftOut, masked writes", shiftNewStyle);
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file qegpioint.h
+ * @brief Simulated CQEGpioInt for running the libVexDuino digital I/O code on a host PC
+ *
+ * This stands in for the libqwerk header when building the host benchmark. The data &
+ * direction registers are plain variables, every register access is counted, and each
+ * access spins for accessNs nanoseconds to model the cost of a bus access to the FPGA.
+ * SetDataBit() & ResetDataBit() are read-modify-writes, as they are on the VEXpro.
+ */
+
+#ifndef QEGPIOINT_H_
+#define QEGPIOINT_H_
+
+#include <time.h>
+#include <sys/time.h>
+
+#define QEG_INTERRUPT_NONE 0
+#define QEG_INTERRUPT_NEGEDGE 1
+#define QEG_INTERRUPT_POSEDGE 2
+
+class CQEGpioInt {
+public:
+	static CQEGpioInt &GetRef()
+	{
+		static CQEGpioInt gpio;
+		return gpio;
+	}
+
+	unsigned int GetData()
+	{
+		access(false);
+		return data;
+	}
+
+	void SetData(unsigned int value)
+	{
+		access(true);
+		data = value;
+	}
+
+	unsigned int GetDataDirection()
+	{
+		access(false);
+		return direction;
+	}
+
+	void SetDataDirection(unsigned int value)
+	{
+		access(true);
+		direction = value;
+	}
+
+	void SetDataBit(unsigned int bit)
+	{
+		SetData(GetData() | (1 << bit));
+	}
+
+	void ResetDataBit(unsigned int bit)
+	{
+		SetData(GetData() & ~(1 << bit));
+	}
+
+	int RegisterCallback(unsigned int io, void *userdata, void (*callback)(unsigned int, struct timeval *, void *))
+	{
+		return 0;
+	}
+
+	int UnregisterCallback(unsigned int io)
+	{
+		return 0;
+	}
+
+	void SetInterruptMode(unsigned int io, unsigned int mode)
+	{
+	}
+
+	void resetCounts()
+	{
+		reads = writes = 0;
+	}
+
+	unsigned long reads;		//!< register reads since resetCounts()
+	unsigned long writes;		//!< register writes since resetCounts()
+	unsigned long accessNs;		//!< simulated cost of one register access
+
+private:
+	CQEGpioInt() : reads(0), writes(0), accessNs(0), data(0), direction(0) {}
+
+	void access(bool write)
+	{
+		struct timespec start, now;
+
+		if (write)
+			writes++;
+		else
+			reads++;
+		if (accessNs == 0)
+			return;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while ((unsigned long)((now.tv_sec - start.tv_sec) * 1000000000L +
+				(now.tv_nsec - start.tv_nsec)) < accessNs);
+	}
+
+	unsigned int data;
+	unsigned int direction;
+};
+
+#endif /* QEGPIOINT_H_ */
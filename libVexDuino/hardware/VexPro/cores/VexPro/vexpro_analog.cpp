@@ -39,11 +39,4 @@ int analogRead(uint8_t pin)
 return 0;
 }
 
-// Right now, PWM output only works on the pins with
-// hardware support.  These are defined in the appropriate
-// pins_*.c file.  For the rest of the pins, we default
-// to digital output.
-void analogWrite(uint8_t pin, int val)
-{
-
-}
+// analogWrite() is software PWM, in vexpro_pwm.cpp
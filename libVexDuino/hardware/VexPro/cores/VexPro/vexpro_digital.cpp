@@ -1,6 +1,15 @@
 /**
   @file vexpro_digital.cpp
   @brief digital input and output functions
+
+  Besides the per-pin Arduino functions, this file provides port-wide functions which read
+  or write all 16 digital I/Os in one register access. In all of them bit 0 of the mask is
+  D1 and bit 15 is D16.
+
+  Shadow mode (digitalShadowBegin()) batches writes: digitalWrite() and the port-wide write
+  functions update a copy of the data register, and nothing reaches the pins until
+  digitalShadowFlush() writes the copy out in a single access. PWM pins (analogWrite())
+  are the exception: the PWM engine writes them straight to the port.
 */
 /*
   Compatible with Arduino, built on top of libqwerk
@@ -25,11 +34,19 @@
 */
 
 #include "wiring.h"
+#include <pthread.h>
 #include <qegpioint.h>
 CQEGpioInt &io = CQEGpioInt::GetRef();
 
 // number of digital I/Os on VexPro controller
 #define NUM_DIOS 16
+#define PORT_MASK 0xffff
+
+// serializes the read-modify-write port functions & the shadow register
+static pthread_mutex_t portLock = PTHREAD_MUTEX_INITIALIZER;
+static bool shadowMode = false;
+static uint16_t shadowData;		// data register contents to write at the next flush
+static uint16_t shadowDirty;	// pins written since the last flush
 
 /**
  * Configures the specified pin to behave either as an input or an output.
@@ -72,11 +89,18 @@ void digitalWrite(uint8_t pin, uint8_t value)
 		return;
 
 	bitNum = pin - 1; // Digital I/Os are 1-based, but the get/set DataDirection methods are 0-based
+	if (shadowMode) {
+		digitalWriteMask(1 << bitNum, (value == HIGH) ? PORT_MASK : 0);
+		return;
+	}
+	// Set/ResetDataBit read & write the whole register too, so they take the port lock
+	pthread_mutex_lock(&portLock);
 	if (value == HIGH) {
 		io.SetDataBit(bitNum);
 	} else {
 		io.ResetDataBit(bitNum);
 	}
+	pthread_mutex_unlock(&portLock);
 }
 
 /**
@@ -98,6 +122,11 @@ int digitalRead(uint8_t pin)
 	bitNum = pin - 1; // Digital I/Os are 1-based, but the get/set DataDirection methods are 0-based
 
 	data = io.GetData();
+	if (shadowMode) {			// report pins written but not yet flushed as written
+		pthread_mutex_lock(&portLock);
+		data = (data & ~shadowDirty) | (shadowData & shadowDirty);
+		pthread_mutex_unlock(&portLock);
+	}
 
 	if (data & (1<<bitNum)) {
 		rv = HIGH;
@@ -106,3 +135,163 @@ int digitalRead(uint8_t pin)
 	}
 	return rv;
 }
+
+/**
+ * Reads the value of all the digital I/Os in one register access
+ *
+ * @return Bit n is the value of digital I/O D(n+1). In shadow mode, pins written since
+ * the last flush read back as written
+ */
+uint16_t digitalReadPort(void)
+{
+	uint16_t data;
+
+	data = io.GetData() & PORT_MASK;
+	if (shadowMode) {
+		pthread_mutex_lock(&portLock);
+		data = (data & ~shadowDirty) | (shadowData & shadowDirty);
+		pthread_mutex_unlock(&portLock);
+	}
+	return data;
+}
+
+/**
+ * Writes all the digital I/Os in one register access, with no read of the current value.
+ * Bits for pins configured as inputs are ignored by the hardware.
+ *
+ * @param value Bit n is written to digital I/O D(n+1)
+ */
+void digitalWritePort(uint16_t value)
+{
+	pthread_mutex_lock(&portLock);
+	if (shadowMode) {
+		shadowData = value;
+		shadowDirty = PORT_MASK;
+	} else {
+		io.SetData(value);
+	}
+	pthread_mutex_unlock(&portLock);
+}
+
+/**
+ * Writes a group of digital I/Os at once, leaving the others unchanged. This costs one
+ * register read & one write no matter how many pins change.
+ *
+ * @param mask Bit n set means digital I/O D(n+1) is written
+ * @param value Bit n is the value written to D(n+1) if it is in mask
+ */
+void digitalWriteMask(uint16_t mask, uint16_t value)
+{
+	uint16_t data;
+
+	pthread_mutex_lock(&portLock);
+	if (shadowMode) {
+		shadowData = (shadowData & ~mask) | (value & mask);
+		shadowDirty |= mask;
+	} else {
+		data = io.GetData();
+		io.SetData((data & ~mask) | (value & mask));
+	}
+	pthread_mutex_unlock(&portLock);
+}
+
+/**
+ * Sets a group of digital I/Os HIGH at once. Safe against other threads using the
+ * libVexDuino digital functions, but not against direct use of CQEGpioInt.
+ *
+ * @param mask Bit n set means digital I/O D(n+1) is set HIGH
+ */
+void digitalSetMask(uint16_t mask)
+{
+	digitalWriteMask(mask, PORT_MASK);
+}
+
+/**
+ * Sets a group of digital I/Os LOW at once
+ *
+ * @param mask Bit n set means digital I/O D(n+1) is set LOW
+ */
+void digitalClearMask(uint16_t mask)
+{
+	digitalWriteMask(mask, 0);
+}
+
+/*
+ * For the PWM engine: writes a group of pins to the hardware now, even in shadow mode,
+ * where the shadow takes the new value too so a flush doesn't undo it
+ */
+void digitalWriteMaskNow(uint16_t mask, uint16_t value)
+{
+	uint16_t data;
+
+	pthread_mutex_lock(&portLock);
+	data = io.GetData();
+	io.SetData((data & ~mask) | (value & mask));
+	if (shadowMode) {
+		shadowData = (shadowData & ~mask) | (value & mask);
+		shadowDirty &= ~mask;
+	}
+	pthread_mutex_unlock(&portLock);
+}
+
+/**
+ * Sets the direction of all the digital I/Os in one register access
+ *
+ * @param outputMask Bit n set makes digital I/O D(n+1) an OUTPUT, clear makes it an INPUT
+ */
+void pinModePort(uint16_t outputMask)
+{
+	uint32_t direction;
+
+	pthread_mutex_lock(&portLock);
+	direction = io.GetDataDirection();
+	io.SetDataDirection((direction & ~PORT_MASK) | outputMask);
+	pthread_mutex_unlock(&portLock);
+}
+
+/**
+ * Enter shadow mode: writes are held in a shadow of the data register until
+ * digitalShadowFlush() is called
+ */
+void digitalShadowBegin(void)
+{
+	pthread_mutex_lock(&portLock);
+	if (!shadowMode) {
+		shadowData = io.GetData() & PORT_MASK;
+		shadowDirty = 0;
+		shadowMode = true;
+	}
+	pthread_mutex_unlock(&portLock);
+}
+
+/**
+ * Write the pins changed in shadow mode out to the hardware in one read-modify-write.
+ * Pins not written since the last flush keep their current hardware value.
+ */
+void digitalShadowFlush(void)
+{
+	uint16_t data;
+
+	pthread_mutex_lock(&portLock);
+	if (shadowMode && shadowDirty) {
+		if (shadowDirty == PORT_MASK) {
+			io.SetData(shadowData);
+		} else {
+			data = io.GetData();
+			io.SetData((data & ~shadowDirty) | (shadowData & shadowDirty));
+		}
+		shadowDirty = 0;
+	}
+	pthread_mutex_unlock(&portLock);
+}
+
+/**
+ * Flush any pending writes and leave shadow mode
+ */
+void digitalShadowEnd(void)
+{
+	digitalShadowFlush();
+	pthread_mutex_lock(&portLock);
+	shadowMode = false;
+	pthread_mutex_unlock(&portLock);
+}
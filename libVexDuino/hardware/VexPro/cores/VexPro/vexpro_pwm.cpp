@@ -0,0 +1,344 @@
+/**
+  @file vexpro_pwm.cpp - software PWM on the digital I/Os
+
+  analogWrite() for the VEXpro. The VEXpro has no PWM hardware on its digital I/Os, so
+  this file runs a PWM engine thread which drives up to 16 PWM channels on D1 - D16 with
+  CQETime.
+
+  Every channel shares one period. At the start of each period the engine sets all the
+  active pins HIGH with one port write, then walks a list of the distinct falling-edge
+  times, clearing all the pins that end at that time with one port write. Edges closer
+  together than PWM_MERGE_US are merged. So the work per period depends on the number of
+  distinct pulse widths, not the number of channels. The engine sleeps through the
+  long gaps and busy-waits on Timer4 for the last PWM_SPIN_US before each edge.
+
+  The engine writes the port directly, so PWM keeps running in shadow mode, & under its
+  lock, so once analogWriteStop() returns the engine won't touch the pin again.
+
+  The engine records how late each edge actually happened; see analogWriteStats().
+*/
+/*
+  Copyright (c) 2012 Paul H Bouchier
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+
+*/
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "wiring.h"
+#include "qetime.h"
+
+#define NUM_DIOS 16
+#define PORT_ALL 0xffff
+#define PWM_DEFAULT_HZ 50		// suits servos, ESCs, LEDs & motor drivers
+#define PWM_MIN_HZ 10
+#define PWM_MAX_HZ 1000
+#define PWM_MIN_BITS 8
+#define PWM_MAX_BITS 10
+#define PWM_MERGE_US 4			// edges closer than this are done in one write
+#define PWM_SPIN_US 1500		// busy-wait this long before an edge instead of sleeping
+
+// microseconds to Timer4 ticks, the same as T4USEC in qetime.cpp (Timer4 runs at 983040Hz)
+#define PWM_TICKS(us) (((us) < 60) ? (us) : ((us) - ((us) >> 6) - ((us) >> 10)))
+
+// in vexpro_digital.cpp
+void digitalWriteMaskNow(uint16_t mask, uint16_t value);
+
+typedef struct {
+	bool active;		// pin is under PWM control
+	bool micros;		// value is a pulse width in us rather than a duty cycle
+	int value;
+} PwmChannel;
+
+typedef struct {
+	unsigned long us;	// edge time from the start of the period
+	uint16_t mask;		// pins which go LOW at this time
+} PwmEdge;
+
+typedef struct {
+	unsigned long periodUs;
+	uint16_t onMask;	// pins set HIGH at the start of each period
+	int numEdges;
+	PwmEdge edges[NUM_DIOS];
+} PwmSchedule;
+
+static pthread_mutex_t pwmLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pwmCond = PTHREAD_COND_INITIALIZER;
+static pthread_t pwmThreadId;
+static bool pwmRunning = false;
+static bool pwmDirty = true;		// schedule needs rebuilding
+static PwmChannel channels[NUM_DIOS];
+static PwmSchedule schedule;
+static uint16_t pwmPins;			// pins the engine may drive, changed at once by pwmSet() & analogWriteStop()
+static unsigned long periodUs = 1000000 / PWM_DEFAULT_HZ;
+static uint8_t resolution = PWM_MIN_BITS;
+
+// timing statistics
+static unsigned long statEdges;
+static unsigned long long statErrSum;
+static unsigned long statErrMax;
+static unsigned long statOverruns;
+
+/*
+ * Rebuild the edge list from the channel settings. Caller holds pwmLock
+ */
+static void pwmBuildSchedule(void)
+{
+	unsigned long maxVal = (1UL << resolution) - 1;
+	unsigned long width;
+	int pin, i, j;
+
+	schedule.periodUs = periodUs;
+	schedule.onMask = 0;
+	schedule.numEdges = 0;
+	for (pin = 0; pin < NUM_DIOS; pin++) {
+		if (!channels[pin].active || (channels[pin].value <= 0))
+			continue;
+		if (channels[pin].micros)
+			width = channels[pin].value;
+		else
+			width = (unsigned long)channels[pin].value * periodUs / maxVal;
+		schedule.onMask |= 1 << pin;
+		if (width >= periodUs)
+			continue;			// always on, no falling edge
+
+		// insert into the sorted edge list, merging with any edge within PWM_MERGE_US
+		for (i = 0; i < schedule.numEdges; i++) {
+			if (width < schedule.edges[i].us + PWM_MERGE_US)
+				break;
+		}
+		if ((i < schedule.numEdges) && (width + PWM_MERGE_US > schedule.edges[i].us)) {
+			schedule.edges[i].mask |= 1 << pin;
+			continue;
+		}
+		for (j = schedule.numEdges; j > i; j--)
+			schedule.edges[j] = schedule.edges[j-1];
+		schedule.edges[i].us = width;
+		schedule.edges[i].mask = 1 << pin;
+		schedule.numEdges++;
+	}
+	pwmDirty = false;
+}
+
+/*
+ * Wait until us microseconds after start; sleep for most of it if it's far off
+ */
+static void pwmWaitUntil(CQETime::tick_t start, unsigned long us)
+{
+	unsigned long elapsed = CQETime::uelapsed(start);
+
+	if (elapsed + PWM_SPIN_US < us)
+		::usleep(us - elapsed - PWM_SPIN_US);
+	CQETime::usleep(us, start);
+}
+
+static void pwmRecordEdge(CQETime::tick_t start, unsigned long us)
+{
+	long err = (long)CQETime::uelapsed(start) - (long)us;
+
+	if (err < 0)		// rounding between us & ticks can make an edge a us early
+		err = 0;
+	statEdges++;
+	statErrSum += err;
+	if ((unsigned long)err > statErrMax)
+		statErrMax = err;
+}
+
+static void *pwmThread(void *arg)
+{
+	struct sched_param param;
+	PwmSchedule s;
+	CQETime::tick_t periodStart;
+	int i;
+
+	// run ahead of normal threads if we're allowed to; carry on regardless if not
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+	periodStart = CQETime::ticks();
+	for (;;) {
+		pthread_mutex_lock(&pwmLock);
+		if (pwmDirty)
+			pwmBuildSchedule();
+		while (schedule.onMask == 0) {		// nothing to do until a channel is turned on
+			pthread_cond_wait(&pwmCond, &pwmLock);
+			if (pwmDirty)
+				pwmBuildSchedule();
+			periodStart = CQETime::ticks();
+		}
+		s = schedule;
+		pthread_mutex_unlock(&pwmLock);
+
+		// s may be out of date, so only drive the pins still under PWM
+		pthread_mutex_lock(&pwmLock);
+		digitalWriteMaskNow(s.onMask & pwmPins, PORT_ALL);
+		pthread_mutex_unlock(&pwmLock);
+		pwmRecordEdge(periodStart, 0);
+		for (i = 0; i < s.numEdges; i++) {
+			pwmWaitUntil(periodStart, s.edges[i].us);
+			pthread_mutex_lock(&pwmLock);
+			digitalWriteMaskNow(s.edges[i].mask & pwmPins, 0);
+			pthread_mutex_unlock(&pwmLock);
+			pwmRecordEdge(periodStart, s.edges[i].us);
+		}
+
+		pwmWaitUntil(periodStart, s.periodUs);
+		periodStart += PWM_TICKS(s.periodUs);
+		if (CQETime::uelapsed(periodStart) > s.periodUs) {	// fell a whole period behind
+			statOverruns++;
+			periodStart = CQETime::ticks();
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put a pin under PWM control, starting the engine if necessary
+ */
+static void pwmSet(uint8_t pin, int value, bool micros)
+{
+	if ((pin < 1) || (pin > NUM_DIOS))
+		return;
+
+	pinMode(pin, OUTPUT);
+	pthread_mutex_lock(&pwmLock);
+	channels[pin-1].active = true;
+	channels[pin-1].micros = micros;
+	channels[pin-1].value = value;
+	pwmDirty = true;
+	if (value > 0) {
+		pwmPins |= 1 << (pin-1);
+	} else {		// the engine won't touch a pin with no pulse
+		pwmPins &= ~(1 << (pin-1));
+		digitalWriteMaskNow(1 << (pin-1), 0);
+	}
+	if (!pwmRunning) {
+		if (pthread_create(&pwmThreadId, NULL, pwmThread, NULL) == 0)
+			pwmRunning = true;
+	}
+	pthread_cond_signal(&pwmCond);
+	pthread_mutex_unlock(&pwmLock);
+}
+
+/**
+ * Writes a PWM wave to a digital I/O pin. The pin is made an OUTPUT. All the PWM pins
+ * share the frequency set by analogWriteFrequency(), default 50Hz.
+ *
+ * @param pin the number of the digital I/O, 1 - 16
+ * @param val the duty cycle, from 0 (always off) to 255 (always on). If the resolution
+ * has been raised with analogWriteResolution() the range is correspondingly larger
+ */
+void analogWrite(uint8_t pin, int val)
+{
+	int maxVal = (1 << resolution) - 1;
+
+	pwmSet(pin, constrain(val, 0, maxVal), false);
+}
+
+/**
+ * Writes pulses of a fixed width, e.g. for a servo, at the PWM frequency. The pin is made
+ * an OUTPUT. For servos leave the frequency at the default 50Hz.
+ *
+ * @param pin the number of the digital I/O, 1 - 16
+ * @param us the pulse width in microseconds, e.g. 1000 - 2000 for a servo
+ */
+void analogWriteMicroseconds(uint8_t pin, int us)
+{
+	pwmSet(pin, max(us, 0), true);
+}
+
+/**
+ * Stops PWM on a pin and leaves it LOW. digitalWrite() can be used on the pin after this.
+ *
+ * @param pin the number of the digital I/O, 1 - 16
+ */
+void analogWriteStop(uint8_t pin)
+{
+	if ((pin < 1) || (pin > NUM_DIOS))
+		return;
+	pthread_mutex_lock(&pwmLock);
+	channels[pin-1].active = false;
+	pwmDirty = true;
+	pwmPins &= ~(1 << (pin-1));
+	digitalWriteMaskNow(1 << (pin-1), 0);
+	pthread_mutex_unlock(&pwmLock);
+}
+
+/**
+ * Sets the PWM frequency of all the PWM pins
+ *
+ * @param hz frequency in Hz, 10 - 1000. Higher frequencies use more CPU time
+ */
+void analogWriteFrequency(unsigned long hz)
+{
+	hz = constrain(hz, PWM_MIN_HZ, PWM_MAX_HZ);
+	pthread_mutex_lock(&pwmLock);
+	periodUs = 1000000 / hz;
+	pwmDirty = true;
+	pthread_mutex_unlock(&pwmLock);
+}
+
+/**
+ * Sets the number of bits of duty cycle analogWrite() takes
+ *
+ * @param bits 8 (the default, 0 - 255) to 10 (0 - 1023)
+ */
+void analogWriteResolution(uint8_t bits)
+{
+	int pin;
+	int shift;
+
+	bits = constrain(bits, PWM_MIN_BITS, PWM_MAX_BITS);
+	pthread_mutex_lock(&pwmLock);
+	shift = bits - resolution;
+	for (pin = 0; pin < NUM_DIOS; pin++) {		// keep existing duty cycles the same
+		if (channels[pin].active && !channels[pin].micros)
+			channels[pin].value = (shift > 0) ? (channels[pin].value << shift) : (channels[pin].value >> -shift);
+	}
+	resolution = bits;
+	pwmDirty = true;
+	pthread_mutex_unlock(&pwmLock);
+}
+
+/**
+ * Reports how accurately the PWM engine is hitting its edges since the last reset
+ *
+ * @param meanErrUs if not NULL, receives the mean lateness of an edge in microseconds
+ * @param maxErrUs if not NULL, receives the worst lateness of an edge in microseconds
+ * @param overruns if not NULL, receives the number of times the engine fell a whole period behind
+ */
+void analogWriteStats(unsigned long *meanErrUs, unsigned long *maxErrUs, unsigned long *overruns)
+{
+	if (meanErrUs != NULL)
+		*meanErrUs = statEdges ? (unsigned long)(statErrSum / statEdges) : 0;
+	if (maxErrUs != NULL)
+		*maxErrUs = statErrMax;
+	if (overruns != NULL)
+		*overruns = statOverruns;
+}
+
+/**
+ * Resets the statistics reported by analogWriteStats()
+ */
+void analogWriteStatsReset(void)
+{
+	statEdges = 0;
+	statErrSum = 0;
+	statErrMax = 0;
+	statOverruns = 0;
+}
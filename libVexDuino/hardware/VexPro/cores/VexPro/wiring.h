@@ -100,9 +100,24 @@ void init(void);
 void pinMode(uint8_t, uint8_t);
 void digitalWrite(uint8_t, uint8_t);
 int digitalRead(uint8_t);
+uint16_t digitalReadPort(void);
+void digitalWritePort(uint16_t value);
+void digitalWriteMask(uint16_t mask, uint16_t value);
+void digitalSetMask(uint16_t mask);
+void digitalClearMask(uint16_t mask);
+void pinModePort(uint16_t outputMask);
+void digitalShadowBegin(void);
+void digitalShadowFlush(void);
+void digitalShadowEnd(void);
 int analogRead(uint8_t);
 void analogReference(uint8_t mode);
 void analogWrite(uint8_t, int);
+void analogWriteMicroseconds(uint8_t pin, int us);
+void analogWriteStop(uint8_t pin);
+void analogWriteFrequency(unsigned long hz);
+void analogWriteResolution(uint8_t bits);
+void analogWriteStats(unsigned long *meanErrUs, unsigned long *maxErrUs, unsigned long *overruns);
+void analogWriteStatsReset(void);
 
 unsigned long millis(void);
 unsigned long micros(void);
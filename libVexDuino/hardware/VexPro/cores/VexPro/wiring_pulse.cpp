@@ -1,4 +1,8 @@
-/** @file wiring_pulse.cpp  pulseIn() function
+/** @file wiring_pulse.cpp  pulseIn() and pulseInAsync() functions
+ *
+ * Pulses are timed with GPIO edge interrupts rather than by polling the pin, so the
+ * measurement uses the kernel's timestamp of each edge and is not disturbed if the
+ * calling thread is preempted. pulseIn() sleeps on a condition variable while it waits.
  */
 /*
   Copyright (c) 2011 Paul H. Bouchier
@@ -20,87 +24,256 @@
 
 */
 
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <qegpioint.h>
 #include "Arduino.h"
-#include "qetime.h"
 
-/**
- * Reads a pulse (either HIGH or LOW) on a pin. For example, if value is HIGH,
- * pulseIn() waits for the pin to go HIGH, starts timing, then waits for the pin to go LOW and stops timing.
- * Returns the length of the pulse in microseconds.
- * Gives up and returns 0 if no pulse starts within a specified time out or if an inaccurate measurement is detected.
- *
- * @param pin The digital I/O pin number on which you want to read the pulse
- * @param value The type of pulse to read: either HIGH or LOW
- * @param timeout The number of microseconds to wait for the pulse to start; default is one second. This parameter is optional
- * @return pulse width in microseconds, or 0 if error (e.g. invalid pin, inaccurate measurement due to context
- * switch. errorCode can be retrieved with getPulseInErrorCode(); Values are: -1: invalid pin; -2: timeout;
- * -3: inaccurate measurement detected
+#define NUM_DIOS 16
+
+extern CQEGpioInt &io;		// GPIO singleton, in vexpro_digital.cpp
+
+/*
+ * State of the measurement on one pin. Protected by pulseLock; the edge callbacks
+ * run on the gpio interrupt thread
  */
+typedef struct {
+	bool armed;					// a measurement is in progress
+	bool waitTrailing;			// leading edge seen, waiting for the trailing edge
+	uint8_t state;				// HIGH or LOW pulse
+	unsigned long timeout;		// usec to wait for the pulse to start
+	struct timeval tvArmed;		// when the measurement was started
+	struct timeval tvLeading;	// timestamp of the leading edge
+	unsigned long width;		// measured width once done
+	int result;					// 1: pending, 0: done, <0: error code
+	pulseInCallback_t cb;
+	void *userdata;
+} PulseState;
 
-#define EDGE_JITTER 20
+static PulseState pulses[NUM_DIOS];
+static pthread_mutex_t pulseLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pulseCond = PTHREAD_COND_INITIALIZER;
+static int errorCode;		// flag telling why pulseIn exited with 0
 
-static int errorCode;		// flag telling why we exited with 0
+static long tvDiff(struct timeval *ptv0, struct timeval *ptv1)
+{
+	return (ptv1->tv_sec - ptv0->tv_sec)*1000000 + (ptv1->tv_usec - ptv0->tv_usec);
+}
 
-unsigned long pulseIn(int pin, int value, unsigned long timeout)
+/*
+ * Called at interrupt level on the leading & then the trailing edge of the pulse
+ */
+static void pulseEdge(unsigned int ioNum, struct timeval *ptv, void *userdata)
 {
-	CQETime::tick_t start;	// start time from which timeout is measured
-	CQETime::tick_t currentTick;
-	CQETime::tick_t lastTick;	// time we did the last measurement; used to detect latency of transition detection
-	unsigned long pulseStartTime, pulseEndTime, pulseWidth;
-
-	errorCode = 0;
-	start = CQETime::ticks();
-	
-	if ((pin < 1) || (pin > 16)) {// check for valid pin
-		errorCode = -1;
-		return 0;
-	}
+	PulseState *p = (PulseState *)userdata;
+	pulseInCallback_t cb = NULL;
+	void *cbUserdata = NULL;
+	unsigned long width = 0;
 
-	// wait for any previous pulse to end
-	while (digitalRead(pin) == value) {
-		if (CQETime::utimeout(timeout, start)) {	// exit if we timed out
-			errorCode = -2;
-			return 0;
-		}
+	pthread_mutex_lock(&pulseLock);
+	if (!p->armed) {
+		pthread_mutex_unlock(&pulseLock);
+		return;
 	}
-	
-	// wait for the pulse to start
-	lastTick = CQETime::ticks();
-	while (digitalRead(pin) != value) {
-		lastTick = CQETime::ticks();	// record the last time the pin was not equal to the search value
-		if (CQETime::utimeout(timeout, start)) {	// exit if we timed out
-			errorCode = -2;
-			return 0;
+	if (!p->waitTrailing) {
+		if ((unsigned long)tvDiff(&p->tvArmed, ptv) > p->timeout) {	// started too late
+			p->result = -2;
+		} else {
+			p->tvLeading = *ptv;
+			p->waitTrailing = true;
+			io.SetInterruptMode(ioNum, (p->state == HIGH) ? QEG_INTERRUPT_NEGEDGE : QEG_INTERRUPT_POSEDGE);
+			pthread_mutex_unlock(&pulseLock);
+			return;
 		}
+	} else {
+		p->width = width = tvDiff(&p->tvLeading, ptv);
+		p->result = 0;
 	}
 
-	pulseStartTime = CQETime::uelapsed(0);
-	// check to see if we took a context switch or something else that would make the measurement inaccurate
-	currentTick = CQETime::ticks();
-	if (((long)(currentTick - lastTick)) > EDGE_JITTER) {
-		errorCode = -3;
-		return 0;
+	// measurement is over
+	p->armed = false;
+	io.SetInterruptMode(ioNum, QEG_INTERRUPT_NONE);
+	if (p->result == 0) {
+		cb = p->cb;
+		cbUserdata = p->userdata;
 	}
+	pthread_cond_broadcast(&pulseCond);
+	pthread_mutex_unlock(&pulseLock);
 
-	
-	// wait for the pulse to stop
-	while (digitalRead(pin) == value) {
-		lastTick = CQETime::ticks();	// record the last time the pin was equal to the search value
-		if (CQETime::utimeout(timeout, start)) {	// exit if we timed out
-			errorCode = -2;
-			return 0;
-		}
+	if (cb != NULL)
+		cb(ioNum + 1, width, cbUserdata);
+}
+
+/*
+ * Stop a measurement & record why. Caller holds pulseLock
+ */
+static void pulseDisarm(uint8_t pin, int result)
+{
+	PulseState *p = &pulses[pin - 1];
+
+	if (!p->armed)
+		return;
+	p->armed = false;
+	p->result = result;
+	io.SetInterruptMode(pin - 1, QEG_INTERRUPT_NONE);
+}
+
+/*
+ * Report a timeout if the pulse should have started by now. Caller holds pulseLock
+ */
+static void pulseCheckTimeout(uint8_t pin)
+{
+	PulseState *p = &pulses[pin - 1];
+	struct timeval now;
+
+	if (!p->armed || p->waitTrailing)
+		return;
+	gettimeofday(&now, NULL);
+	if ((unsigned long)tvDiff(&p->tvArmed, &now) > p->timeout)
+		pulseDisarm(pin, -2);
+}
+
+/**
+ * Start measuring a pulse (either HIGH or LOW) on a pin, and return immediately. The measurement
+ * is made by GPIO interrupts on the leading & trailing edges of the pulse, using the kernel's
+ * timestamps of the edges.
+ *
+ * When the pulse ends the optional callback is called from the GPIO interrupt thread with the
+ * pulse width; it must not call the pulseInAsync functions for the same pin. The result can
+ * also be polled with pulseInAsyncResult(), which is the only way a timeout is reported.
+ *
+ * @param pin The digital I/O pin number (1 - 16) on which you want to read the pulse
+ * @param state The type of pulse to read: either HIGH or LOW
+ * @param timeout The number of microseconds to wait for the pulse to start
+ * @param cb Function to call with the pulse width when the pulse ends, or NULL
+ * @param userdata Passed to cb
+ * @return 0 if the measurement was started, -1 for an invalid pin, -4 if a measurement is
+ * already in progress on the pin
+ */
+int pulseInAsync(uint8_t pin, uint8_t state, unsigned long timeout, pulseInCallback_t cb, void *userdata)
+{
+	PulseState *p;
+
+	if ((pin < 1) || (pin > NUM_DIOS))
+		return -1;
+	p = &pulses[pin - 1];
+
+	pthread_mutex_lock(&pulseLock);
+	if (p->armed) {
+		pthread_mutex_unlock(&pulseLock);
+		return -4;
 	}
+	p->armed = true;
+	p->waitTrailing = false;
+	p->state = state;
+	p->timeout = timeout;
+	p->width = 0;
+	p->result = 1;
+	p->cb = cb;
+	p->userdata = userdata;
+	gettimeofday(&p->tvArmed, NULL);
+	io.RegisterCallback(pin - 1, (void *)p, pulseEdge);
+	io.SetInterruptMode(pin - 1, (state == HIGH) ? QEG_INTERRUPT_POSEDGE : QEG_INTERRUPT_NEGEDGE);
+	pthread_mutex_unlock(&pulseLock);
+	return 0;
+}
+
+/**
+ * Get the result of the measurement started by pulseInAsync()
+ *
+ * @param pin The digital I/O pin number (1 - 16)
+ * @param width Receives the pulse width in microseconds when the return value is 0
+ * @return 0: done, 1: still waiting for the pulse, -1: invalid pin, -2: timeout
+ */
+int pulseInAsyncResult(uint8_t pin, unsigned long *width)
+{
+	int result;
+
+	if ((pin < 1) || (pin > NUM_DIOS))
+		return -1;
+	pthread_mutex_lock(&pulseLock);
+	pulseCheckTimeout(pin);
+	result = pulses[pin - 1].result;
+	if ((result == 0) && (width != NULL))
+		*width = pulses[pin - 1].width;
+	pthread_mutex_unlock(&pulseLock);
+	return result;
+}
+
+/**
+ * Abandon the measurement started by pulseInAsync(). The callback will not be called.
+ *
+ * @param pin The digital I/O pin number (1 - 16)
+ */
+void pulseInAsyncCancel(uint8_t pin)
+{
+	if ((pin < 1) || (pin > NUM_DIOS))
+		return;
+	pthread_mutex_lock(&pulseLock);
+	pulseDisarm(pin, -2);
+	pthread_mutex_unlock(&pulseLock);
+}
+
+/**
+ * Reads a pulse (either HIGH or LOW) on a pin. For example, if value is HIGH,
+ * pulseIn() waits for the pin to go HIGH, starts timing, then waits for the pin to go LOW and stops timing.
+ * Returns the length of the pulse in microseconds.
+ * Gives up and returns 0 if no pulse starts within a specified time out.
+ *
+ * The caller sleeps while it waits for the pulse, and the pulse is timed from the GPIO interrupt
+ * timestamps, so the measurement is accurate even if the caller is preempted.
+ *
+ * @param pin The digital I/O pin number on which you want to read the pulse
+ * @param value The type of pulse to read: either HIGH or LOW
+ * @param timeout The number of microseconds to wait for the pulse to start; default is one second. This parameter is optional
+ * @return pulse width in microseconds, or 0 if error. errorCode can be retrieved with
+ * getPulseInErrorCode(); Values are: -1: invalid pin; -2: timeout; -4: pin busy with pulseInAsync()
+ */
+unsigned long pulseIn(uint8_t pin, uint8_t value, unsigned long timeout)
+{
+	PulseState *p;
+	struct timespec deadline;
+	unsigned long width = 0;
+	int rv;
 
-	pulseEndTime = CQETime::uelapsed(0);
-	// check to see if we took a context switch or something else that would make the measurement inaccurate
-	currentTick = CQETime::ticks();
-	if (((long)(currentTick - lastTick)) > EDGE_JITTER) {
-		errorCode = -3;
+	errorCode = pulseInAsync(pin, value, timeout, NULL, NULL);
+	if (errorCode != 0)
 		return 0;
+	p = &pulses[pin - 1];
+
+	pthread_mutex_lock(&pulseLock);
+	while (p->armed) {
+		// sleep until the pulse should have started, then until it should have ended
+		deadline.tv_sec = p->tvArmed.tv_sec + timeout / 1000000;
+		deadline.tv_nsec = (p->tvArmed.tv_usec + timeout % 1000000) * 1000;
+		if (p->waitTrailing) {
+			deadline.tv_sec = p->tvLeading.tv_sec + timeout / 1000000;
+			deadline.tv_nsec = (p->tvLeading.tv_usec + timeout % 1000000) * 1000;
+		}
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		rv = pthread_cond_timedwait(&pulseCond, &pulseLock, &deadline);
+		if ((rv == ETIMEDOUT) && p->armed)
+			pulseDisarm(pin, -2);
 	}
+	if (p->result == 0)
+		width = p->width;
+	else
+		errorCode = p->result;
+	pthread_mutex_unlock(&pulseLock);
 
-	pulseWidth = (pulseEndTime - pulseStartTime);
+	return width;
+}
 
-	return pulseWidth;
+/**
+ * Get the reason the last call to pulseIn() returned 0
+ *
+ * @return 0: no error; -1: invalid pin; -2: timeout; -4: pin busy with pulseInAsync()
+ */
+int getPulseInErrorCode()
+{
+	return errorCode;
 }
@@ -27,14 +27,18 @@
 uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder) {
 	uint8_t value = 0;
 	uint8_t i;
+	uint16_t clockMask;
 
+	if ((clockPin < 1) || (clockPin > 16))
+		return 0;
+	clockMask = 1 << (clockPin - 1);
 	for (i = 0; i < 8; ++i) {
-		digitalWrite(clockPin, HIGH);
+		digitalWriteMask(clockMask, clockMask);
 		if (bitOrder == LSBFIRST)
 			value |= digitalRead(dataPin) << i;
 		else
 			value |= digitalRead(dataPin) << (7 - i);
-		digitalWrite(clockPin, LOW);
+		digitalWriteMask(clockMask, 0);
 	}
 	return value;
 }
@@ -42,14 +46,22 @@ uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder) {
 void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val)
 {
 	uint8_t i;
+	uint16_t data;
+	uint16_t dataMask;
+	uint16_t clockMask;
 
+	if ((dataPin < 1) || (dataPin > 16) || (clockPin < 1) || (clockPin > 16))
+		return;
+	dataMask = 1 << (dataPin - 1);
+	clockMask = 1 << (clockPin - 1);
 	for (i = 0; i < 8; i++)  {
-		if (bitOrder == LSBFIRST)
-			digitalWrite(dataPin, !!(val & (1 << i)));
-		else	
-			digitalWrite(dataPin, !!(val & (1 << (7 - i))));
-			
-		digitalWrite(clockPin, HIGH);
-		digitalWrite(clockPin, LOW);		
+		if (bitOrder == LSBFIRST ? (val & (1 << i)) : (val & (1 << (7 - i))))
+			data = dataMask;
+		else
+			data = 0;
+
+		digitalWriteMask(dataMask | clockMask, data);
+		digitalWriteMask(clockMask, clockMask);
+		digitalWriteMask(clockMask, 0);
 	}
 }
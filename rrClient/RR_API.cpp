@@ -7,6 +7,9 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/time.h>
 
 #include "RR_API.h"
 
@@ -15,20 +18,80 @@ RR_API rr;
 extern "C" int rrConnect(char *s, int p);
 extern "C" int rrSetImage(unsigned char *i, int w, int h);
 extern "C" int *rrGetShapeProperties();
+extern "C" int rrSubmitImage(unsigned char *i, int w, int h);
+extern "C" int rrSubmitCompressedImage(unsigned char *i, int size);
+extern "C" int rrCollectShapeProperties(int *properties);
+extern "C" int rrPending();
 extern "C" void rrDisconnect();
 
 int rv;
 char rrString[256];
 int shapeProperties[9];
 
+// where Roborealm is, & the state of reconnecting to it
+#define RR_TIMEOUT 5000			// ms to wait for a response before giving up on the connection
+#define RR_MIN_BACKOFF 100		// ms before the first reconnect attempt, doubling after each failure
+#define RR_MAX_BACKOFF 5000
+static char rrHost[64];
+static int rrPort;
+static int backoff = 0;
+static struct timeval nextAttempt;
+static int pending = 0;			// frames submitted whose responses haven't been read
+
+/*
+ * Connect if we're not connected & it's time to try again. Each failure doubles the wait
+ * before the next attempt, up to RR_MAX_BACKOFF
+ */
+static bool rrEnsureConnected()
+{
+	struct timeval now;
+
+	if (rr.connected)
+		return true;
+	gettimeofday(&now, NULL);
+	if (timercmp(&now, &nextAttempt, <))
+		return false;
+	if (rr.connect(rrHost, rrPort)) {
+		if (backoff != 0)
+			fprintf(stderr, "reconnected to Roborealm\n");
+		backoff = 0;
+		pending = 0;
+		return true;
+	}
+	backoff = (backoff == 0) ? RR_MIN_BACKOFF : ((2 * backoff > RR_MAX_BACKOFF) ? RR_MAX_BACKOFF : 2 * backoff);
+	nextAttempt.tv_sec = now.tv_sec + backoff / 1000;
+	nextAttempt.tv_usec = now.tv_usec + (backoff % 1000) * 1000;
+	if (nextAttempt.tv_usec >= 1000000) {
+		nextAttempt.tv_sec++;
+		nextAttempt.tv_usec -= 1000000;
+	}
+	fprintf(stderr, "can't connect to Roborealm on %s:%d, retrying in %d ms\n", rrHost, rrPort, backoff);
+	return false;
+}
+
+// the connection failed: drop it & whatever was in flight, & reconnect after a backoff
+static void rrDrop()
+{
+	rr.disconnect();
+	pending = 0;
+	if (backoff == 0)
+		backoff = RR_MIN_BACKOFF / 2;	// so rrEnsureConnected() waits RR_MIN_BACKOFF at first
+	gettimeofday(&nextAttempt, NULL);
+}
+
+/*
+ * Remember where Roborealm is & try to connect. If it isn't there, the pipelined calls
+ * keep trying, so this only returns -1 to say it isn't there yet
+ */
 int rrConnect(char *rrIp, int port)
 {
-	// connect to the RoboRealm application given the default port number ... or a different one
-	// but it should be the same one as used above in the open command.
-	if (!rr.connect(rrIp, port))
+	strncpy(rrHost, rrIp, sizeof(rrHost) - 1);
+	rrPort = port;
+	rr.setTimeout(RR_TIMEOUT);
+	if (!rrEnsureConnected())
 	{
-		printf("Unable to connect to Roborealm.\nPlease ensure RoboRealm is running and try again.");
-		exit(-1);
+		printf("Unable to connect to Roborealm.\nPlease ensure RoboRealm is running.\n");
+		return -1;
 	}
 	return 0;
 }
@@ -36,14 +99,16 @@ int rrConnect(char *rrIp, int port)
 void rrDisconnect()
 {
 	rr.disconnect();
+	pending = 0;
 }
 
 int rrSetImage(unsigned char * i, int w, int h)
 {
 	bool rv;
 
-	// send image to Roborealm & get it to tell us where the blob centroid is
-	rv = rr.setImage(i, w, h);
+	// send image to Roborealm & wait for it to run the program on it, so the
+	// shape data read next is for this image
+	rv = rr.setImage(i, w, h, true);
 	if (!rv) {
 		fprintf (stderr, "failed to send image to Roborealm\n");
 		return -1;
@@ -51,10 +116,26 @@ int rrSetImage(unsigned char * i, int w, int h)
 	return 0;
 }
 
+// split the SHAPES string into parameters
+static void parseShapes(char *s, int *properties)
+{
+	int pIndex = 0;
+	char *pch;
+
+	memset(properties, 0, 9 * sizeof(int));
+	pch = strtok(s, ",");
+	while((pch != NULL) && (pIndex < 9)) {
+		properties[pIndex] = atoi(pch);
+		//printf("%s: %d\n", pch, properties[pIndex]);
+		pIndex++;
+		pch = strtok(NULL, ",");
+	}
+	properties[0] /= 1000;		// convert to % from kilo-%
+}
+
 int *rrGetShapeProperties()
 {
 	bool rv;
-	char *pch;
 
 	rv = rr.getVariable("SHAPES", rrString, 255);
 	if (!rv) {
@@ -63,25 +144,87 @@ int *rrGetShapeProperties()
 	} else {
 		//printf("%s\n", rrString);
 	}
+	parseShapes(rrString, shapeProperties);
+	return shapeProperties;
+}
 
-	// split return string into parameters
-	int pIndex = 0;
-	pch = strtok(rrString, ",");
-	while((pch != NULL) && (pIndex < 9)) {
-		shapeProperties[pIndex] = atoi(pch);
-		//printf("%s: %d\n", pch, shapeProperties[pIndex]);
-		pIndex++;
-		pch = strtok(NULL, ",");
+/*
+ * Pipelined frames: rrSubmitImage() sends the image & the request for its shapes without
+ * waiting for either response, so Roborealm can work on one frame while the next is
+ * being captured & sent. rrCollectShapeProperties() reads the responses for the oldest
+ * frame submitted. Roborealm answers requests in order, so several frames can be in
+ * flight. A failed connection is dropped along with the frames in flight, & the next
+ * rrSubmitImage() reconnects after a backoff. Returns -1 if the frame wasn't sent
+ */
+int rrSubmitImage(unsigned char *i, int w, int h)
+{
+	if (!rrEnsureConnected())
+		return -1;
+	if (!rr.requestImage(NULL, i, w, h, true) || !rr.requestVariable("SHAPES")) {
+		fprintf(stderr, "failed to send image to Roborealm, reconnecting\n");
+		rrDrop();
+		return -1;
 	}
-	shapeProperties[0] /= 1000;		// convert to % from kilo-%
-	return shapeProperties;
+	pending++;
+	return 0;
+}
+
+// as rrSubmitImage(), for a compressed image such as a JPEG of size bytes
+int rrSubmitCompressedImage(unsigned char *i, int size)
+{
+	if (!rrEnsureConnected())
+		return -1;
+	if (!rr.requestCompressedImage(NULL, i, size, true) || !rr.requestVariable("SHAPES")) {
+		fprintf(stderr, "failed to send image to Roborealm, reconnecting\n");
+		rrDrop();
+		return -1;
+	}
+	pending++;
+	return 0;
+}
+
+/*
+ * The shapes for the oldest frame in flight, into properties[9]. Returns 1 if there's a
+ * shape, 0 if Roborealm found none, & -1 if nothing came back
+ */
+int rrCollectShapeProperties(int *properties)
+{
+	int found;
+
+	if (pending == 0)
+		return -1;
+	if (!rr.readOk()) {
+		if (!rr.connected || rr.timedOut()) {
+			fprintf(stderr, "no response from Roborealm, reconnecting\n");
+			rrDrop();
+			return -1;
+		}
+		fprintf(stderr, "Roborealm didn't take the image\n");	// its shapes still follow
+	}
+	found = rr.readVariable(rrString, 255);
+	if (!found && (!rr.connected || rr.timedOut())) {
+		fprintf(stderr, "no shapes from Roborealm, reconnecting\n");
+		rrDrop();
+		return -1;
+	}
+	pending--;
+	if (!found)
+		return 0;
+	parseShapes(rrString, properties);
+	return 1;
+}
+
+int rrPending()
+{
+	return pending;
 }
 
 RR_API::RR_API()
 {
-	timeout=DEFAULT_TIMEOUT;
+	timeout=defaultTimeout=DEFAULT_TIMEOUT;
 	lastDataTop=0;
 	lastDataSize=0;
+	lastTimedOut=false;
 	connected=false;
 	initialized=false;
 }
@@ -333,18 +476,21 @@ bool RR_API::connect(char *hostname, int port)
   if ((setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (char *)&enable, sizeof(enable)))<0)
   {
 		strcpy(errorMsg, "Could not set socket option SO_REUSEADDR!");
+    ::close(handle);
     return false;
   }
 
   if ((setsockopt(handle, SOL_SOCKET, SO_KEEPALIVE, (char *)&enable, sizeof(enable)))<0)
   {
 	  strcpy(errorMsg, "Could not set socket option SO_KEEPALIVE!");
+    ::close(handle);
     return false;
   }
 
   if ((setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (char *)&enable, sizeof(enable)))<0)
   {
 	  strcpy(errorMsg, "Could not set socket option TCP_NODELAY!");
+    ::close(handle);
     return false;
   }
 
@@ -354,6 +500,7 @@ bool RR_API::connect(char *hostname, int port)
   if ((setsockopt(handle, SOL_SOCKET, SO_LINGER, (char *)&ling, sizeof(linger)))<0)
   {
 	  strcpy(errorMsg, "Could not set socket option SO_LINGER!");
+    ::close(handle);
     return false;
   }
 
@@ -365,6 +512,7 @@ bool RR_API::connect(char *hostname, int port)
   if ((remote_host=gethostbyname(hostname))==(struct hostent *)NULL)
   {
 	  snprintf(errorMsg, 64, "Could not lookup hostname '%s'!", hostname);
+    ::close(handle);
     return false;
   }
 
@@ -373,14 +521,30 @@ bool RR_API::connect(char *hostname, int port)
   if (::connect(handle,(struct sockaddr *)&sockaddr, sizeof(sockaddr))<0)
   {
 	  strcpy(errorMsg, "Could not connect to RoboRealm handle!");
+    ::close(handle);
     return false;
   }
 
 	connected=true;
+	lastDataSize=lastDataTop=0;		// nothing left over from an old connection
+	lastTimedOut=false;
 
 	return true;
 }
 
+/* Sets how many ms to wait for RoboRealm to respond before giving up */
+void RR_API::setTimeout(int ms)
+{
+	timeout=defaultTimeout=ms;
+}
+
+/* If the last message read failed because nothing came within the timeout, rather
+than because the connection failed */
+bool RR_API::timedOut()
+{
+	return lastTimedOut;
+}
+
 /* close the socket handle */
 void RR_API::disconnect()
 {
@@ -388,70 +552,84 @@ void RR_API::disconnect()
 	connected=false;
 }
 
-/* Timed read from a socket */
+/* Timed read from a socket. Returns -2 if nothing came within the timeout, & -1 if
+the connection failed or RoboRealm closed it */
 int RR_API::read(int hSocket, unsigned char *buffer, int len)
 {
-	struct timeval	tim;
-	fd_set fds;
+	struct pollfd pfd;
+	int res;
 
+	pfd.fd = hSocket;
+	pfd.events = POLLIN;
 	do
 	{
-		FD_ZERO(&fds);
-		FD_SET(hSocket, &fds);
+		res = poll(&pfd, 1, timeout);
+	}
+	while ((res < 0) && (errno == EINTR));
+	if (res == 0)
+	{
+		lastTimedOut = true;
+		return(-2);
+	}
+	if (res < 0)
+		return(-1);
 
-		tim.tv_sec = (timeout/1000);
-		tim.tv_usec = (timeout%1000)*10;
+	res = recv(hSocket, (char *)buffer, len, 0);
+	if (res <= 0)
+		return(-1);		// 0 means RoboRealm closed the connection
+	return res;
+}
+
+/* Send all of data, which a large image may take more than one send() for. Any failure
+drops the connection, & SIGPIPE is suppressed so a closed connection can't kill us */
+bool RR_API::sendAll(const char *data, int len)
+{
+	int res;
 
-		if (select(1024, &fds, NULL, NULL, &tim)<=0)
+	while (len > 0)
+	{
+		res = send(handle, data, len, MSG_NOSIGNAL);
+		if (res < 0)
 		{
-			return(-2);
+			if (errno == EINTR)
+				continue;
+			disconnect();
+			return false;
 		}
+		data += res;
+		len -= res;
 	}
-	while (!(FD_ISSET(hSocket, &fds)));
-
-  return recv(hSocket, (char *)buffer, len, NULL);
+	return true;
 }
 
 /*
-Buffered socket image read. Since we don't know how much data was read from a
-previous socket operation we have to add in any previously read information
-that may still be in our buffer. We detect the end of XML messages by the
-</response> tag but this may require reading in part of the image data that
-follows a message. Thus when reading the image data we have to move previously
-read data to the front of the buffer and continuing reading in the
-complete image size from that point.
+Buffered socket image read. readMessage() reads in blocks, so some of the image data
+that follows a message may already be in inBuf. Use that first, then read the rest
+straight into pixels.
 */
 int RR_API::readImageData(int hSocket, unsigned char *pixels, int len)
 {
-  int num;
+	int num = lastDataSize-lastDataTop;
 
 	// check if we have any information left from the previous read
-	num = lastDataSize-lastDataTop;
 	if (num>len)
-	{
-		memcpy(pixels, &buffer[lastDataTop], len);
-		lastDataTop+=num;
-		return num;
-	}
-	memcpy(pixels, &buffer[lastDataTop], num);
-	len-=num;
-	lastDataSize=lastDataTop=0;
+		num=len;
+	memcpy(pixels, &inBuf[lastDataTop], num);
+	lastDataTop+=num;
 
-	// then keep reading until we're read in the entire image length
-  do
-  {
-    int res = read(hSocket, (unsigned char *)&pixels[num], len);
+	// then keep reading until we've read in the entire image length
+	while (num<len)
+	{
+		int res = read(hSocket, &pixels[num], len-num);
 		if (res<0)
 		{
 			lastDataSize=lastDataTop=0;
 			return -1;
 		}
-    num+=res;
-    len-=res;
-  }
-  while (len>0);
+		num+=res;
+	}
 
-  return num;
+	return num;
 }
 
 /*
@@ -462,64 +640,96 @@ not work since a large binary buffer will be before any response can be read
 void RR_API::skipData(int hSocket, int len)
 {
 	int num = lastDataSize-lastDataTop;
+	if (num>=len)
+	{
+		lastDataTop+=len;
+		return;
+	}
 	lastDataSize=lastDataTop=0;
 	len-=num;
-	char skipBuffer[1024];
+	unsigned char skipBuffer[1024];
 	do
 	{
-		int res = read(hSocket, (unsigned char *)skipBuffer, len>1024?1024:len);
+		int res = read(hSocket, skipBuffer, len>1024?1024:len);
+		if (res<0)
+			return;
 		len-=res;
 	}
 	while (len>0);
 }
 
-/* Read's in an XML message from the RoboRealm Server. The message is always
-delimited by a </response> tag. We need to keep reading in information until
-this tag is seen. Sometimes this will accidentally read more than needed
-into the buffer such as when the message is followed by image data. We
-need to keep this information for the next readImage call.*/
+/* Reads in the next XML message from the RoboRealm Server into buffer, which gets at
+most len-1 bytes and a terminating 0. The socket is read in blocks into inBuf, and the
+bytes are tokenized as they're taken from it: the message is over when the tag which
+closes its root element does, whatever the root is called. Anything read past that,
+such as image data or the responses to later requests, stays in inBuf for the next
+read, so responses to requests sent back to back come out one at a time. Returns the
+length of the message, or -1 if the connection failed or timed out. */
+
+// where the tokenizer is within the markup
+#define XML_TEXT 0		// between tags
+#define XML_TAG_START 1	// just after a <
+#define XML_TAG 2		// in an element tag, up to its >
+#define XML_SKIP 3		// in a <?...?> or <!...> which doesn't nest
 
 int RR_API::readMessage(int hSocket, unsigned char *buffer, int len)
 {
-  int num=0;
-	char *delimiter = "</response>";
-	int top=0;
-	int i;
+	int num=0, depth=0, state=XML_TEXT;
+	bool closing=false;
+	unsigned char c, prev=0;
 
-	// read in blocks of data looking for the </response> delimiter
-  do
-  {
-    int res = read(hSocket, (unsigned char *)&buffer[num], len);
-		if (res<0)
+	lastTimedOut=false;
+	while (1)
+	{
+		if (lastDataTop==lastDataSize)
 		{
+			int res = read(hSocket, inBuf, MAX_BUFFER_SIZE);
 			lastDataSize=lastDataTop=0;
-			return -1;
+			if (res<0)
+			{
+				if (res==-1)
+					disconnect();
+				buffer[num]=0;
+				return -1;
+			}
+			lastDataSize=res;
 		}
-		lastDataSize=num+res;
-    for (i=num;i<num+res;i++)
+		c=inBuf[lastDataTop++];
+		if (num<len-1)
+			buffer[num++]=c;
+
+		switch (state)
 		{
-			if (buffer[i]==delimiter[top])
+		case XML_TEXT:
+			if (c=='<')
+				state=XML_TAG_START;
+			break;
+		case XML_TAG_START:
+			closing=(c=='/');
+			state=((c=='?')||(c=='!')) ? XML_SKIP : XML_TAG;
+			break;
+		case XML_TAG:
+			if (c=='>')
 			{
-				top++;
-				if (delimiter[top]==0)
+				if (closing)
+					depth--;
+				else if (prev!='/')
+					depth++;		// <empty/> opens & closes
+				state=XML_TEXT;
+				if (depth<=0)
 				{
-					num=i+1;
 					buffer[num]=0;
-			    lastDataTop=num;
 					return num;
 				}
 			}
-			else
-				top=0;
+			break;
+		case XML_SKIP:
+			if (c=='>')
+				state=XML_TEXT;
+			break;
 		}
-		num+=res;
-    len-=res;
-  }
-  while (len>0);
-
-	lastDataTop=num;
-	buffer[num]=0;
-  return num;
+		prev=c;
+	}
 }
 
 /******************************************************************************/
@@ -673,6 +883,15 @@ Sets the current source image.
 	height - input - contains image height
 */
 bool RR_API::setImage(char *name, unsigned char *pixels, int width, int height, bool wait, char *mode)
+{
+	return requestImage(name, pixels, width, height, wait, mode) && readOk();
+}
+
+/*
+Sends a set_image request without reading the response, so more requests can be sent
+before reading it with readOk().
+*/
+bool RR_API::requestImage(char *name, unsigned char *pixels, int width, int height, bool wait, char *mode)
 {
 	if (!connected) return false;
 	if (name==NULL) name="";
@@ -702,11 +921,16 @@ bool RR_API::setImage(char *name, unsigned char *pixels, int width, int height,
 
 	// setup the message request
 	snprintf(buffer, 256, "<request><set_image><source>%s</source><format>%s</format><width>%d</width><height>%d</height><wait>%s</wait></set_image></request>", ename, format, width, height, wait?"1":"");
-  send(handle, buffer, strlen(buffer), NULL);
+	if (!sendAll(buffer, strlen(buffer)))
+		return false;
 
   // send the RGB triplet pixels after message
-	send(handle, (char *)pixels, l, NULL);
+	return sendAll((char *)pixels, l);
+}
 
+/* Reads a response which should be ok, such as to set_image */
+bool RR_API::readOk()
+{
   // read message response
 	if (readMessage(handle, (unsigned char *)buffer, MAX_BUFFER_SIZE)>0)
 	{
@@ -731,6 +955,14 @@ Sets the current source image from compressed bytes.
 	size - input - specifies len of bytes contained in pixels
 */
 bool RR_API::setCompressedImage(char *name, unsigned char *pixels, int size, bool wait)
+{
+	return requestCompressedImage(name, pixels, size, wait) && readOk();
+}
+
+/*
+Sends a compressed set_image request without reading the response, as requestImage()
+*/
+bool RR_API::requestCompressedImage(char *name, unsigned char *pixels, int size, bool wait)
 {
 	if (!connected) return false;
 	if (name==NULL) name="";
@@ -741,21 +973,11 @@ bool RR_API::setCompressedImage(char *name, unsigned char *pixels, int size, boo
 
 	// setup the message request
 	snprintf(buffer, 256, "<request><set_image><compressed>1</compressed><source>%s</source><size>%d</size><wait>%s</wait></set_image></request>", ename, size, wait?"1":"");
-  send(handle, buffer, strlen(buffer), NULL);
-
-  // send the RGB triplet pixels after message
-	send(handle, (char *)pixels, size, NULL);
-
-  // read message response
-	if (readMessage(handle, (unsigned char *)buffer, MAX_BUFFER_SIZE)>0)
-	{
-		if (strcasecmp(buffer, "<response>ok</response>")!=0)
-			return false;
-		else
-			return true;
-	}
+	if (!sendAll(buffer, strlen(buffer)))
+		return false;
 
-	return false;
+  // send the compressed image, e.g. a JPEG, after message
+	return sendAll((char *)pixels, size);
 }
 
 /*
@@ -765,6 +987,12 @@ Returns the value of the specified variable.
 	max - input - the maximum size of what the result can hold
 */
 bool RR_API::getVariable(char *name, char *result, int max)
+{
+	return requestVariable(name) && readVariable(result, max);
+}
+
+/* Sends a get_variable request without reading the response */
+bool RR_API::requestVariable(char *name)
 {
 	if (!connected) return false;
 	if ((name==NULL)||(name[0]==0)) return false;
@@ -773,10 +1001,14 @@ bool RR_API::getVariable(char *name, char *result, int max)
 	// escape the name for use in an XML string
 	escape(name, ename, 64);
 
-	result[0]=0;
-
 	snprintf(buffer, 256, "<request><get_variable>%s</get_variable></request>", ename);
-  send(handle, buffer, strlen(buffer), NULL);
+	return sendAll(buffer, strlen(buffer));
+}
+
+/* Reads the response to a get_variable request */
+bool RR_API::readVariable(char *result, int max)
+{
+	result[0]=0;
 
   // read in variable length
   if (readMessage(handle, (unsigned char *)buffer, MAX_BUFFER_SIZE)>0)
@@ -1270,21 +1502,21 @@ bool RR_API::waitVariable(char *name, char *value, int timeout)
 	itoa(timeout, &buffer[strlen(buffer)], 10);
 	strcat(buffer, "</timeout></wait_variable></request>");
 
-	this->timeout=timeout;
 	if (timeout==0) timeout=100000000;
+	this->timeout=timeout;
 
   send(handle, buffer, strlen(buffer), NULL);
 
   if (readMessage(handle, (unsigned char *)buffer, MAX_BUFFER_SIZE)>0)
 	{
-		this->timeout=DEFAULT_TIMEOUT;
+		this->timeout=defaultTimeout;
 		if (strcasecmp(buffer, "<response>ok</response>")!=0)
 			return false;
 		else
 			return true;
 	}
 
-	this->timeout=DEFAULT_TIMEOUT;
+	this->timeout=defaultTimeout;
 	return false;
 }
 
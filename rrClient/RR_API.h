@@ -20,12 +20,18 @@ class RR_API
 	//WORD version_required; /* Version 1.1 */
 	int handle;
 
-	// holds the previously read data size
+	// where the unused data in inBuf starts
 	int lastDataTop;
-	// holds the previously read data buffer
+	// where the unused data in inBuf ends
 	int lastDataSize;
+	// data read from the socket but not yet used, e.g. the start of the next response
+	unsigned char inBuf[MAX_BUFFER_SIZE];
 	// contains the read/write socket timeouts
 	int timeout;
+	// the timeout to go back to after a request which sets its own
+	int defaultTimeout;
+	// signals that the last read failed by timing out
+	bool lastTimedOut;
 	// signals if socket level has been initialized
 	bool initialized;
 
@@ -33,6 +39,7 @@ class RR_API
 	char errorMsg[64];
 	int readMessage(int hSocket, unsigned char *buffer, int len);
 	int readImageData(int hSocket, unsigned char *buffer, int len);
+	bool sendAll(const char *data, int len);
 	void unescape(char *txt);
 	void escape(char *txt, char *dest, int max);
 
@@ -55,6 +62,13 @@ public:
 	bool deleteVariable(char *name);
 	bool setImage(unsigned char *image, int width, int height, bool wait=false, char *mode="RGB");
 	bool setImage(char *name, unsigned char *image, int width, int height, bool wait=false, char *mode="RGB");
+	bool requestImage(char *name, unsigned char *image, int width, int height, bool wait=false, char *mode="RGB");
+	bool requestCompressedImage(char *name, unsigned char *image, int size, bool wait=false);
+	bool requestVariable(char *name);
+	bool readOk();
+	bool readVariable(char *buffer, int max);
+	void setTimeout(int ms);
+	bool timedOut();
 	bool setCompressedImage(unsigned char *image, int size, bool wait=false);
 	bool setCompressedImage(char *name, unsigned char *image, int size, bool wait=false);
 	bool execute(char *source);
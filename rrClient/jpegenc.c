@@ -0,0 +1,202 @@
+/*
+ * jpegenc.c
+ *
+ *  Created on: Dec 31, 2012
+ *      Author: bouchier
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include "jpeglib.h"
+#include "jpegenc.h"
+
+// libjpeg writes the JPEG straight into the caller's buffer
+typedef struct {
+	struct jpeg_destination_mgr pub;
+	unsigned char *buffer;
+	int max;
+	int overflow;
+} memDest;
+
+// a libjpeg error comes back to jpegEncodeYuyv() instead of exiting
+typedef struct {
+	struct jpeg_error_mgr pub;
+	jmp_buf escape;
+} errorMgr;
+
+static struct jpeg_compress_struct cinfo;
+static errorMgr jerr;
+static memDest dest;
+static int ready = 0;
+static int encWidth, encHeight, encQuality, encSubsampling;
+
+// a band of rows of each component, as jpeg_write_raw_data() takes them, padded to whole MCUs
+static JSAMPLE *planes[3];
+static JSAMPROW rows[3][2 * DCTSIZE];
+static int planeWidth[3];
+
+static void initDest(j_compress_ptr c)
+{
+	dest.pub.next_output_byte = dest.buffer;
+	dest.pub.free_in_buffer = dest.max;
+	dest.overflow = 0;
+}
+
+// out of room: start again at the beginning so the encode can finish, & fail it after
+static boolean emptyDest(j_compress_ptr c)
+{
+	dest.overflow = 1;
+	dest.pub.next_output_byte = dest.buffer;
+	dest.pub.free_in_buffer = dest.max;
+	return TRUE;
+}
+
+static void termDest(j_compress_ptr c)
+{
+}
+
+static void errorExit(j_common_ptr c)
+{
+	(*c->err->output_message)(c);
+	longjmp(jerr.escape, 1);
+}
+
+static int setup(int width, int height, int quality, int subsampling)
+{
+	int c, r, hs, vs, mcuCols, bandRows;
+
+	if (!ready) {
+		cinfo.err = jpeg_std_error(&jerr.pub);
+		jerr.pub.error_exit = errorExit;
+		jpeg_create_compress(&cinfo);
+		dest.pub.init_destination = initDest;
+		dest.pub.empty_output_buffer = emptyDest;
+		dest.pub.term_destination = termDest;
+		cinfo.dest = &dest.pub;
+		ready = 1;
+	}
+
+	hs = (subsampling == 444) ? 1 : 2;
+	vs = (subsampling == 420) ? 2 : 1;
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_YCbCr;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	cinfo.raw_data_in = TRUE;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.comp_info[0].h_samp_factor = hs;
+	cinfo.comp_info[0].v_samp_factor = vs;
+	for (c = 1; c < 3; c++) {
+		cinfo.comp_info[c].h_samp_factor = 1;
+		cinfo.comp_info[c].v_samp_factor = 1;
+	}
+
+	mcuCols = (width + hs * DCTSIZE - 1) / (hs * DCTSIZE);
+	planeWidth[0] = mcuCols * hs * DCTSIZE;
+	planeWidth[1] = planeWidth[2] = mcuCols * DCTSIZE;
+	for (c = 0; c < 3; c++) {
+		bandRows = (c == 0) ? vs * DCTSIZE : DCTSIZE;
+		free(planes[c]);
+		if ((planes[c] = malloc(planeWidth[c] * bandRows)) == NULL)
+			return -1;
+		for (r = 0; r < bandRows; r++)
+			rows[c][r] = planes[c] + r * planeWidth[c];
+	}
+
+	encWidth = width;
+	encHeight = height;
+	encQuality = quality;
+	encSubsampling = subsampling;
+	return 0;
+}
+
+// pad a row out to the plane's width with its last pixel
+static void pad(JSAMPROW p, int n, int width)
+{
+	for (; n < width; n++)
+		p[n] = p[n - 1];
+}
+
+// the band of rows from top down, repeating the bottom row past the frame's end
+static void fillBand(const unsigned char *yuyv, int width, int height, int top)
+{
+	const unsigned char *line, *next;
+	int vs = cinfo.comp_info[0].v_samp_factor;
+	int hs = cinfo.comp_info[0].h_samp_factor;
+	JSAMPROW y, u, v;
+	int i, k, row, pairs = width / 2;
+
+	for (i = 0; i < vs * DCTSIZE; i++) {
+		row = (top + i < height) ? top + i : height - 1;
+		line = yuyv + 2 * width * row;
+		y = rows[0][i];
+		for (k = 0; k < width; k++)
+			y[k] = line[2 * k];
+		pad(y, width, planeWidth[0]);
+	}
+
+	for (i = 0; i < DCTSIZE; i++) {
+		row = (top + vs * i < height) ? top + vs * i : height - 1;
+		line = yuyv + 2 * width * row;
+		u = rows[1][i];
+		v = rows[2][i];
+		if (vs == 2) {
+			next = (row + 1 < height) ? line + 2 * width : line;
+			for (k = 0; k < pairs; k++) {
+				u[k] = (line[4 * k + 1] + next[4 * k + 1] + 1) >> 1;
+				v[k] = (line[4 * k + 3] + next[4 * k + 3] + 1) >> 1;
+			}
+		} else if (hs == 2) {
+			for (k = 0; k < pairs; k++) {
+				u[k] = line[4 * k + 1];
+				v[k] = line[4 * k + 3];
+			}
+		} else {
+			for (k = 0; k < pairs; k++) {
+				u[2 * k] = u[2 * k + 1] = line[4 * k + 1];
+				v[2 * k] = v[2 * k + 1] = line[4 * k + 3];
+			}
+		}
+		k = (hs == 2) ? pairs : 2 * pairs;
+		pad(u, k, planeWidth[1]);
+		pad(v, k, planeWidth[2]);
+	}
+}
+
+int jpegEncodeYuyv(const unsigned char *yuyv, int width, int height, int quality,
+		int subsampling, unsigned char *out, int max)
+{
+	JSAMPARRAY band[3];
+	int top, bandRows;
+
+	if (setjmp(jerr.escape)) {
+		jpeg_abort_compress(&cinfo);
+		return -1;
+	}
+	if (!ready || (width != encWidth) || (height != encHeight) || (quality != encQuality) ||
+			(subsampling != encSubsampling)) {
+		if (setup(width, height, quality, subsampling) < 0)
+			return -1;
+	}
+
+	dest.buffer = out;
+	dest.max = max;
+	band[0] = rows[0];
+	band[1] = rows[1];
+	band[2] = rows[2];
+	bandRows = cinfo.comp_info[0].v_samp_factor * DCTSIZE;
+
+	jpeg_start_compress(&cinfo, TRUE);
+	for (top = 0; top < height; top += bandRows) {
+		fillBand(yuyv, width, height, top);
+		jpeg_write_raw_data(&cinfo, band, bandRows);
+	}
+	jpeg_finish_compress(&cinfo);
+
+	if (dest.overflow)
+		return -1;
+	return max - dest.pub.free_in_buffer;
+}
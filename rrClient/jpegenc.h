@@ -0,0 +1,24 @@
+/*
+ * jpegenc.h
+ *
+ *  Created on: Dec 31, 2012
+ *      Author: bouchier
+ */
+
+#ifndef JPEGENC_H_
+#define JPEGENC_H_
+
+/*
+ * JPEG encoding of YUYV camera frames with libjpeg, to send Roborealm a frame a tenth
+ * the size of the RGB. The camera's Y, U & V go straight in as the JPEG's components
+ * (libjpeg's raw data input), so libjpeg does no colour conversion or resampling: YUYV
+ * is already 4:2:2, 4:2:0 averages each two rows' chroma & 4:4:4 repeats it. The DCT is
+ * libjpeg's fast integer one. Only one thread may encode: the encoder's kept between
+ * frames so it isn't set up each time.
+ */
+
+// subsampling: 444, 422 or 420. Returns the JPEG's length, or -1 if it needs more than max
+int jpegEncodeYuyv(const unsigned char *yuyv, int width, int height, int quality,
+		int subsampling, unsigned char *out, int max);
+
+#endif /* JPEGENC_H_ */
@@ -38,16 +38,26 @@
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <sys/time.h>
 
 #include "v4l2uvc.h"
+#include "colorconv.h"
+#include "vision.h"
+#include "jpegenc.h"
 #include "rrClient.h"
 
 int wait4client(int);
 int rrConnect(char *s, int p);
 int rrSetImage(unsigned char *i, int w, int h);
 int *rrGetShapeProperties();
+int rrSubmitImage(unsigned char *i, int w, int h);
+int rrSubmitCompressedImage(unsigned char *i, int size);
+int rrCollectShapeProperties(int *properties);
+int rrPending();
 int rrDisconnect();
 
+#define RR_PIPELINE 2		// frames in flight to Roborealm: one being processed while the next is sent
+
 // the port number to listen on ... needs to match that used in RR interface
 #define RRPORT 6060
 //#define RRSERVER "192.168.15.104"
@@ -64,21 +74,25 @@ void *shm_p;
 int run = 1;
 int logSocket = 0;
 int verbose = 0;
-volatile int doCapture = 0;
 
 char *videodevice = "/dev/video0";
 //int format = V4L2_PIX_FMT_MJPEG;
 int format = V4L2_PIX_FMT_YUYV;	// for DealExtreme camera
 int grabmethod = 1;
+int nbBuffers = 4;		// capture buffers; more rides out stalls, fewer means fresher frames
 int width = 160;
 int height = 120;
 int brightness = 0, contrast = 0, saturation = 0, gain = 0;
 int delay = 0;
 int quality = 95;
+int subsampling = 422;		// of the JPEGs encoded for Roborealm: 444, 422 or 420
 int post_capture_command_wait = 0;
 struct vdIn *videoIn;
 int port = 5005;
-int outputType = 0;
+int outputType = 1;		// output for Roborealm: 0 grey, 1 rgb, 2 JPEG
+int useRoborealm = 0;		// else find the target here, with vision.c
+char *templateDir = "can";
+yuvRange targetColor = { 30, 230, 0, 140, 160, 255 };	// red, like the can
 
 typedef struct {
 	unsigned char *imgArray;
@@ -87,67 +101,141 @@ typedef struct {
 	int imgHeight;
 	int videoSocket;
 	int pixelCnt;
+	int compressed;			// imgArray holds a JPEG of imgLength bytes
+	visionShape shape;		// what vision.c found, when not using Roborealm
 } ctrlStruct;
 
-void yuyv2Y (struct vdIn *vd,  ctrlStruct *ctrl)
+/*
+ * Triple-buffered store of converted frames. The capture thread converts every frame
+ * into a slot neither the newest frame nor the reader is in, then publishes it, so the
+ * reader always gets the latest frame without waiting for the next one & the capture
+ * thread never waits for the reader.
+ */
+#define FRAME_SLOTS 3
+typedef struct {
+	ctrlStruct slot[FRAME_SLOTS];
+	unsigned long seq[FRAME_SLOTS];		// frame number, from 1
+	struct timeval stamp[FRAME_SLOTS];	// when it was dequeued from the driver
+	unsigned long lastSeq;
+	int newest;			// slot of the newest frame, -1 until there is one
+	int reading;		// slot the reader has, -1 if none
+	pthread_mutex_t lock;
+	pthread_cond_t published;
+} frameStore;
+
+frameStore store;
+
+int frameStoreInit(frameStore *fs, int bytes)
 {
-	unsigned char *yuyv, *iA;
-	unsigned char *end;
+	int i;
 
-	iA = ctrl->imgArray;
-	ctrl->imgWidth = vd->width;
-	ctrl->imgHeight = vd->height;
-	yuyv = vd->framebuffer;
-	end = yuyv + 2*(ctrl->imgWidth * ctrl->imgHeight); // 2 bytes/pixel
-	for (; yuyv<end; yuyv+=2, iA++) {
-		*iA = *yuyv;
+	memset(fs, 0, sizeof(frameStore));
+	for (i = 0; i < FRAME_SLOTS; i++) {
+		if ((fs->slot[i].imgArray = malloc(bytes)) == NULL)
+			return -1;
 	}
-	ctrl->imgLength = (int)iA - (int)(ctrl->imgArray);
-	ctrl->pixelCnt = ctrl->imgLength;
+	fs->newest = -1;
+	fs->reading = -1;
+	pthread_mutex_init(&fs->lock, NULL);
+	pthread_cond_init(&fs->published, NULL);
+	return 0;
 }
 
-void yuyv2rgb (struct vdIn *vd, ctrlStruct *ctrl)
+// a slot for the capture thread to convert the next frame into
+ctrlStruct *frameFill(frameStore *fs, int *index)
 {
-	unsigned char *yuyv, *iA;
-	unsigned char *end;
-	int r, g, b;
-	int y0, y2, u, v;
-	int pixelCnt = 0;
-
-	iA = ctrl->imgArray;
-	ctrl->imgWidth = vd->width;
-	ctrl->imgHeight = vd->height;
-
-	yuyv = vd->framebuffer;
-	end = yuyv + 2*(ctrl->imgWidth * ctrl->imgHeight); // 2 bytes/pixel
+	int i;
+
+	pthread_mutex_lock(&fs->lock);
+	for (i = 0; (i == fs->newest) || (i == fs->reading); i++)
+		;
+	pthread_mutex_unlock(&fs->lock);
+	*index = i;
+	return &fs->slot[i];
+}
 
-	for (; yuyv<end; yuyv+=4) {
-		y0 = yuyv[0] << 8;
-		u = yuyv[1] - 128;
-		v = yuyv[3] - 128;
+// make the filled slot the newest frame & wake the reader
+void framePublish(frameStore *fs, int index, struct timeval *stamp)
+{
+	pthread_mutex_lock(&fs->lock);
+	fs->seq[index] = ++fs->lastSeq;
+	fs->stamp[index] = *stamp;
+	fs->newest = index;
+	pthread_cond_broadcast(&fs->published);
+	pthread_mutex_unlock(&fs->lock);
+}
 
-		r = (y0 + (359 * v)) >> 8;
-		g = (y0 - (88 * u) - (183 * v)) >> 8;
-		b = (y0 + (454 * u)) >> 8;
+// block until there's a frame newer than afterSeq, & hold its slot until frameDone().
+// Returns -1 if woken because run was cleared
+int frameWait(frameStore *fs, unsigned long afterSeq)
+{
+	int index = -1;
+
+	pthread_mutex_lock(&fs->lock);
+	while (run && ((fs->newest < 0) || (fs->seq[fs->newest] <= afterSeq)))
+		pthread_cond_wait(&fs->published, &fs->lock);
+	if (run) {
+		index = fs->newest;
+		fs->reading = index;
+	}
+	pthread_mutex_unlock(&fs->lock);
+	return index;
+}
 
-		*(iA++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
-		*(iA++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
-		*(iA++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
+void frameDone(frameStore *fs)
+{
+	pthread_mutex_lock(&fs->lock);
+	fs->reading = -1;
+	pthread_mutex_unlock(&fs->lock);
+}
 
-		y2 = yuyv[2] << 8;
+// frame is the driver's buffer, from uvcGrabRef()
+void yuyv2Y (struct vdIn *vd, unsigned char *frame, ctrlStruct *ctrl)
+{
+	ctrl->imgWidth = vd->width;
+	ctrl->imgHeight = vd->height;
+	ctrl->pixelCnt = ctrl->imgWidth * ctrl->imgHeight;
+	yuyvToY(frame, ctrl->imgArray, ctrl->pixelCnt);
+	ctrl->imgLength = ctrl->pixelCnt;
+}
 
-		r = (y2 + (359 * v)) >> 8;
-		g = (y2 - (88 * u) - (183 * v)) >> 8;
-		b = (y2 + (454 * u)) >> 8;
+void yuyv2rgb (struct vdIn *vd, unsigned char *frame, ctrlStruct *ctrl)
+{
+	ctrl->imgWidth = vd->width;
+	ctrl->imgHeight = vd->height;
+	ctrl->pixelCnt = ctrl->imgWidth * ctrl->imgHeight;
+	yuyvToRgb(frame, ctrl->imgArray, ctrl->pixelCnt);
+	ctrl->imgLength = 3 * ctrl->pixelCnt;
+	ctrl->compressed = 0;
+}
 
-		*(iA++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
-		*(iA++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
-		*(iA++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
+// send RGB if the JPEG won't fit in the slot, which only a tiny or very noisy frame would do
+void yuyv2jpeg (struct vdIn *vd, unsigned char *frame, ctrlStruct *ctrl)
+{
+	int bytes;
 
-		pixelCnt += 2;
+	bytes = jpegEncodeYuyv(frame, vd->width, vd->height, quality, subsampling,
+			ctrl->imgArray, 3 * vd->width * vd->height);
+	if (bytes < 0) {
+		yuyv2rgb(vd, frame, ctrl);
+		return;
 	}
-	ctrl->imgLength = (int)iA - (int)ctrl->imgArray;
-	ctrl->pixelCnt = pixelCnt;
+	ctrl->imgWidth = vd->width;
+	ctrl->imgHeight = vd->height;
+	ctrl->pixelCnt = ctrl->imgWidth * ctrl->imgHeight;
+	ctrl->imgLength = bytes;
+	ctrl->compressed = 1;
+}
+
+// the camera's own JPEG, as it is but for the Huffman tables; imgLength 0 if it's bad
+void mjpeg2jpeg (struct vdIn *vd, unsigned char *frame, int bytes, ctrlStruct *ctrl)
+{
+	ctrl->imgWidth = vd->width;
+	ctrl->imgHeight = vd->height;
+	ctrl->pixelCnt = ctrl->imgWidth * ctrl->imgHeight;
+	bytes = uvcCopyJpeg(vd, frame, bytes, ctrl->imgArray, 3 * ctrl->pixelCnt);
+	ctrl->imgLength = (bytes < 0) ? 0 : bytes;
+	ctrl->compressed = 1;
 }
 
 void
@@ -160,57 +248,107 @@ sigcatch (int sig)
 	exit(0);
 }
 
+/*
+ * Send the frame to Roborealm & get back the shape it found for the frame sent
+ * RR_PIPELINE - 1 frames earlier, so it works on one frame while we wait for & send the
+ * next. Returns 1 with the shape, 0 if Roborealm found none, & -1 if no answer's due
+ * yet or Roborealm's gone
+ */
+int roborealmShape(ctrlStruct *ctrl, int index, unsigned long seq, int *conf, int *xMin, int *xMax)
+{
+	int shapeProperties[9];
+	struct timeval now;
+
+	if (verbose >= 1) {
+		gettimeofday(&now, NULL);
+		fprintf (stderr, "sending frame %lu, %ld ms old, %dx%d, %d %s bytes, %d in flight\n", seq,
+				(now.tv_sec - store.stamp[index].tv_sec) * 1000 +
+				(now.tv_usec - store.stamp[index].tv_usec) / 1000,
+				ctrl->imgWidth, ctrl->imgHeight, ctrl->imgLength,
+				ctrl->compressed ? "JPEG" : "RGB", rrPending());
+	} else {
+		fprintf (stderr, "+");
+	}
+
+	if (verbose > 2) fprintf (stderr, "writing %d image bytes to socket, width %d height %d, pixelCnt %d\n", ctrl->imgLength, ctrl->imgWidth, ctrl->imgHeight, ctrl->pixelCnt);
+
+	// the image is in the socket once this returns, so the slot can go back to the capture thread.
+	// If Roborealm has gone this reconnects, after a backoff
+	if (ctrl->imgLength == 0)
+		fprintf (stderr, "bad frame from the camera, not sent\n");
+	else if (ctrl->compressed)
+		rrSubmitCompressedImage(ctrl->imgArray, ctrl->imgLength);
+	else
+		rrSubmitImage(ctrl->imgArray, ctrl->imgWidth, ctrl->imgHeight);
+	frameDone(&store);
+
+	// collect the oldest frame's shapes once the pipeline's full
+	if (rrPending() < RR_PIPELINE)
+		return -1;
+	switch (rrCollectShapeProperties(shapeProperties)) {
+	case -1:
+		return -1;
+	case 0:
+		fprintf (stderr, "failed to get shape data from Roborealm\n");
+		return 0;
+	}
+	//fprintf(stderr, "shape[3]: %d shape[4]: %d", shapeProperties[3], shapeProperties[4]);
+	*conf = shapeProperties[0];
+	*xMin = shapeProperties[3];
+	*xMax = shapeProperties[4];
+	return 1;
+}
+
 /* handle commands from RoombaComm client as long as the socket stays open */
 void
-cmdHandler(ctrlStruct * ctrl)
+cmdHandler(void *arg)
 {
-	int rv;
-	outputType = 1;		// rgb output
-	int *shapeProperties;
+	ctrlStruct *ctrl;
 	int conf;
 	int objectX;
 	int objectBearing;
 	rrClientStruct rrc;
 	float bearing;
+	unsigned long lastSeq = 0;
+	int index, found, xMin, xMax;
 #define CAMERA_FOV 32.0
 
 	while (run) {
-		doCapture = 1;	// tell startvideoserver() to capture a snapshot
-		if (verbose > 1) fprintf (stderr, "waiting for capture to complete");
-
-		while (doCapture == 1) {
-			fprintf (stderr, ".");
-			usleep(50000);
-		}
-
-		if (verbose > 2) fprintf (stderr, "writing %d image bytes to socket, width %d height %d, pixelCnt %d\n", ctrl->imgLength, ctrl->imgWidth, ctrl->imgHeight, ctrl->pixelCnt);
-
-		rv = rrSetImage(ctrl->imgArray, ctrl->imgWidth, ctrl->imgHeight);
-		if (rv < 0) {
-			fprintf (stderr, "failed to send image to Roborealm, exiting\n");
-			rrDisconnect();		// try disconnecting, to see if we can recover
-			exit (-1);
+		// take the newest frame, waiting only if we've already sent it
+		if ((index = frameWait(&store, lastSeq)) < 0)
+			break;
+		ctrl = &store.slot[index];
+		lastSeq = store.seq[index];
+
+		if (!useRoborealm) {
+			// the capture thread has already looked for the target
+			conf = ctrl->shape.confidence;
+			xMin = ctrl->shape.xMin;
+			xMax = ctrl->shape.xMax;
+			frameDone(&store);
+			found = 1;
+			if (verbose >= 2)
+				fprintf(stderr, "frame %lu: confidence %d, x %d - %d\n", lastSeq, conf, xMin, xMax);
+		} else {
+			found = roborealmShape(ctrl, index, lastSeq, &conf, &xMin, &xMax);
 		}
 
-		usleep(300000);
-
-		shapeProperties = rrGetShapeProperties();
-		if (shapeProperties == NULL) {
-			fprintf (stderr, "failed to get shape data from Roborealm\n");
-		} else {
-			objectX = (shapeProperties[3] + shapeProperties[4]) / 2;	// average Xmin & Xmax to get X coord of center of shape
+		if (found > 0) {
+			objectX = (xMin + xMax) / 2;	// average Xmin & Xmax to get X coord of center of shape
 			objectX -= width/2;		// center it around 0
 			bearing = ((float)objectX / (float)width) * CAMERA_FOV;	// camera sees 16 degrees either side of center
 			objectBearing = bearing;		// float to int conversion
-			conf = shapeProperties[0];
-			//fprintf(stderr, "shape[3]: %d shape[4]: %d objectX %d bearing %f", shapeProperties[3], shapeProperties[4], objectX, bearing);
-			fprintf(stderr, "\nbearing: %d, confidence: %d\n", objectBearing, conf);
+			if (useRoborealm)
+				fprintf(stderr, "\nbearing: %d, confidence: %d\n", objectBearing, conf);
 		}
 
+		// while Roborealm's answer is on its way, leave a request for it to answer
+		if ((found < 0) && (rrPending() > 0))
+			continue;
 
 		memcpy(&rrc, shm_p, sizeof(rrClientStruct));		// get shared mem to see if there's a request for params
 		if (rrc.getShapeParams == 1) {
-			if ((shapeProperties != NULL) && (conf > 70)) {
+			if ((found > 0) && (conf > 70)) {
 				rrc.shapeParams[0] = conf;
 				rrc.shapeParams[1] = objectBearing;
 			} else {
@@ -219,7 +357,8 @@ cmdHandler(ctrlStruct * ctrl)
 			rrc.getShapeParams = 0;
 			rrc.structInitialized = 6060;
 			memcpy(shm_p, &rrc, sizeof(rrClientStruct));	// send parameters back to requestor
-			fprintf(stderr, "sent parameters back to requester\n");
+			fprintf(stderr, "sent parameters back to requester, confidence: %d, bearing: %d\n",
+					rrc.shapeParams[0], rrc.shapeParams[1]);
 		}
 	}
 }
@@ -227,18 +366,20 @@ cmdHandler(ctrlStruct * ctrl)
 void startVideoSrvr()
 {
 	pthread_t videoSocketThread;
+	unsigned char *frame;
+	int index, bytes, slot;
+	ctrlStruct *ctrl;
 
 	/* alloc mameory for the videoIn struct & initialize */
 	videoIn = (struct vdIn *) calloc (1, sizeof (struct vdIn));
+	videoIn->nbBuffers = nbBuffers;
 	if (init_videoIn
 			(videoIn, (char *) videodevice, width, height, format, grabmethod) < 0)
 		exit (1);
 
-	/* alloc memory for the control struct & video out array & initialize */
-	ctrlStruct ctrl;
-	if ((ctrl.imgArray = malloc(3 * width * height)) < 0) // enough space for rgb
+	/* alloc memory for the converted frames & initialize */
+	if (frameStoreInit(&store, 3 * videoIn->width * videoIn->height) < 0) // enough space for rgb
 		exit(-1);
-	doCapture = 0;
 
 	//Reset all camera controls
 	if (verbose >= 1)
@@ -283,37 +424,53 @@ void startVideoSrvr()
 	}
 
 	// start the thread that handles the video client requests
-	pthread_create(&videoSocketThread, NULL, (void *)cmdHandler, (void *)&ctrl);
+	pthread_create(&videoSocketThread, NULL, (void *)cmdHandler, NULL);
 
 	while (run) {
 		if (verbose >= 2)
 			fprintf (stderr, "-");
 
-		if (uvcGrab (videoIn) < 0) {
+		if ((index = uvcGrabRef (videoIn, &frame, &bytes)) < 0) {
 			fprintf (stderr, "Error grabbing\n");
 			close_v4l2 (videoIn);
 			free (videoIn);
 			exit (1);
 		}
 
-		if (doCapture == 1) {
-
-			if (verbose >= 1) {
-				fprintf (stderr, "captured %d byte image at 0x%x %dx%d\n", videoIn->framesizeIn,
-						(int)videoIn->framebuffer, videoIn->width, videoIn->height);
-			} else {
-				fprintf (stderr, "+");
-			}
-
-			if (outputType == 0)
-				yuyv2Y(videoIn, &ctrl);
-			else
-				yuyv2rgb(videoIn, &ctrl);
+		if (verbose >= 3)
+			fprintf (stderr, "captured %d byte image at 0x%x %dx%d\n", bytes,
+					(int)frame, videoIn->width, videoIn->height);
+
+		// convert or search every frame, so the newest is always ready to use
+		ctrl = frameFill(&store, &slot);
+		if (!useRoborealm) {
+			ctrl->imgWidth = videoIn->width;
+			ctrl->imgHeight = videoIn->height;
+			visionFind(frame, videoIn->width, videoIn->height, &targetColor, &ctrl->shape);
+		} else if (format == V4L2_PIX_FMT_MJPEG)
+			mjpeg2jpeg(videoIn, frame, bytes, ctrl);
+		else if (outputType == 0)
+			yuyv2Y(videoIn, frame, ctrl);
+		else if (outputType == 2)
+			yuyv2jpeg(videoIn, frame, ctrl);
+		else
+			yuyv2rgb(videoIn, frame, ctrl);
+		framePublish(&store, slot, &videoIn->dequeued[index]);
 
-			videoIn->getPict = 0;
-			doCapture = 0;
+		if (uvcRelease (videoIn, index) < 0) {
+			close_v4l2 (videoIn);
+			free (videoIn);
+			exit (1);
+		}
+		if ((verbose >= 1) && ((videoIn->frames % 300) == 0)) {
+			uvcPrintStats (videoIn);
+			if (!useRoborealm)
+				visionPrintStats ();
 		}
 	}
+	pthread_mutex_lock(&store.lock);
+	pthread_cond_broadcast(&store.published);	// let cmdHandler see run is clear
+	pthread_mutex_unlock(&store.lock);
 	close_v4l2 (videoIn);
 	free (videoIn);
 
@@ -329,7 +486,12 @@ void usage (void)
 	fprintf (stderr, "-d<device>\tV4L2 Device(default: /dev/video0)\n");
 	fprintf (stderr, "-l<logging_port>\tLogging port (default: 5006)\n");
 	fprintf (stderr, "-p<port>\tServer port (default: 5005)\n");
+	fprintf (stderr, "-R\t\tSend frames to Roborealm to find the target, instead of finding it here\n");
 	fprintf (stderr, "-i<RoborealIp>\tRoborealm IP address\n");
+	fprintf (stderr, "-s<directory>\tShape templates, BMP silhouettes (default: can)\n");
+	fprintf (stderr, "-T<y,Y,u,U,v,V>\tTarget colour, min & max Y, U & V (default: 30,230,0,140,160,255)\n");
+	fprintf (stderr, "-Y<top,bottom>\tOnly search image rows top to bottom - 1 for the target (default: all)\n");
+	fprintf (stderr, "-F\t\tSearch every frame at full resolution, without the half resolution pass or tracking\n");
 	fprintf (stderr,
 			"-x<width>\tImage Width(must be supported by device)(>960 activates YUYV capture) (default: 160)\n");
 	fprintf (stderr,
@@ -338,12 +500,13 @@ void usage (void)
 			"-c<command>\tCommand to run after each image capture(executed as <command> <output_filename>)\n");
 	fprintf (stderr,
 			"-t<integer>\tTake continuous shots with <integer> seconds between them (0 for single shot)\n");
-	//  fprintf (stderr,
-	//	   "-q<percentage>\tJPEG Quality Compression Level (activates YUYV capture)\n");
+	fprintf (stderr,
+			"-q<percentage>[,<444|422|420>]\tSend Roborealm JPEGs of this quality & chroma subsampling (default: 422) (activates YUYV capture)\n");
 	fprintf (stderr, "-r\t\tUse read instead of mmap for image capture\n");
+	fprintf (stderr, "-b<count>\tCapture buffers (default: 4)\n");
 	fprintf (stderr,
 			"-w\t\tWait for capture command to finish before starting next capture\n");
-	fprintf (stderr, "-m\t\tToggles capture mode from YUYV to MJPEG capture\n");
+	fprintf (stderr, "-m\t\tToggles capture mode from YUYV to MJPEG capture, & sends Roborealm the camera's JPEGs\n");
 	fprintf (stderr, "Camera Settings:\n");
 	fprintf (stderr, "-B<integer>\tBrightness\n");
 	fprintf (stderr, "-C<integer>\tContrast\n");
@@ -359,6 +522,7 @@ int main (int argc, char *argv[])
 	int pchild;
 	int rrPort = RRPORT;
 	char *rrIp = RRSERVER;
+	int c[6];
 
 	(void) signal (SIGINT, sigcatch);
 	(void) signal (SIGQUIT, sigcatch);
@@ -384,6 +548,39 @@ int main (int argc, char *argv[])
 			rrIp = &argv[1][2];
 			break;
 
+		case 'R':
+			useRoborealm = 1;
+			break;
+
+		case 's':
+			templateDir = &argv[1][2];
+			break;
+
+		case 'T':
+			if (sscanf (&argv[1][2], "%d,%d,%d,%d,%d,%d", &c[0], &c[1], &c[2], &c[3], &c[4], &c[5]) != 6) {
+				fprintf (stderr, "-T needs six numbers\n");
+				usage ();
+			}
+			targetColor.yMin = c[0];
+			targetColor.yMax = c[1];
+			targetColor.uMin = c[2];
+			targetColor.uMax = c[3];
+			targetColor.vMin = c[4];
+			targetColor.vMax = c[5];
+			break;
+
+		case 'Y':
+			if (sscanf (&argv[1][2], "%d,%d", &c[0], &c[1]) != 2) {
+				fprintf (stderr, "-Y needs two rows\n");
+				usage ();
+			}
+			visionSetBand (c[0], c[1]);
+			break;
+
+		case 'F':
+			visionSetPyramid (0);
+			break;
+
 		case 'x':
 			width = atoi (&argv[1][2]);
 			break;
@@ -396,6 +593,10 @@ int main (int argc, char *argv[])
 			grabmethod = 0;
 			break;
 
+		case 'b':
+			nbBuffers = atoi (&argv[1][2]);
+			break;
+
 		case 'm':
 			format = V4L2_PIX_FMT_MJPEG;
 			break;
@@ -425,7 +626,12 @@ int main (int argc, char *argv[])
 			break;
 
 		case 'q':
-			quality = atoi (&argv[1][2]);
+			if ((sscanf (&argv[1][2], "%d,%d", &quality, &subsampling) < 1) ||
+					((subsampling != 444) && (subsampling != 422) && (subsampling != 420))) {
+				fprintf (stderr, "-q needs a quality & optionally 444, 422 or 420\n");
+				usage ();
+			}
+			outputType = 2;
 			break;
 
 		case 'h':
@@ -448,8 +654,12 @@ int main (int argc, char *argv[])
 		--argc;
 	}
 
-	if ((width > 960) || (height > 720) || (quality != 95))
+	if ((width > 960) || (height > 720) || (outputType == 2))
+		format = V4L2_PIX_FMT_YUYV;
+	if (!useRoborealm && (format == V4L2_PIX_FMT_MJPEG)) {
+		fprintf (stderr, "finding the target here needs YUYV, not MJPEG capture\n");
 		format = V4L2_PIX_FMT_YUYV;
+	}
 
 	if (verbose >= 1) {
 		fprintf (stderr, "Using videodevice: %s\n", videodevice);
@@ -462,12 +672,16 @@ int main (int argc, char *argv[])
 			fprintf (stderr, "Taking images using read\n");
 	}
 
-	fprintf(stderr, "trying to connect to Roborealm on %s:%d\n", rrIp, rrPort);
-	if (rrConnect(rrIp, rrPort)) {
-		fprintf(stderr, "error connecting to Roborealm\n");
-		exit(-1);
+	if (useRoborealm) {
+		fprintf(stderr, "trying to connect to Roborealm on %s:%d\n", rrIp, rrPort);
+		if (rrConnect(rrIp, rrPort)) {
+			fprintf(stderr, "error connecting to Roborealm, will keep trying\n");
+		} else {
+			fprintf(stderr, "connected to Roborealm\n");
+		}
 	} else {
-		fprintf(stderr, "connected to Roborealm\n");
+		fprintf(stderr, "finding the target here, %d shape templates from %s\n",
+				visionLoadTemplates(templateDir), templateDir);
 	}
 
 	fprintf(stderr, "attaching shared memory for shape data requests\n");
@@ -31,6 +31,8 @@
 #include <linux/videodev2.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
+#include <time.h>
 #include "v4l2uvc.h"
 
 static int debug = 0;
@@ -100,6 +102,7 @@ init_videoIn (struct vdIn *vd, char *device, int width, int height,
   vd->height = height;
   vd->formatIn = format;
   vd->grabmethod = grabmethod;
+  vd->jpegDht = -1;
   if (init_v4l2 (vd) < 0) {
     fprintf (stderr, " Init v4L2 failed !! exit fatal \n");
     goto error;;
@@ -191,8 +194,10 @@ init_v4l2 (struct vdIn *vd)
     //vd->formatIn = vd->fmt.fmt.pix.pixelformat;
   }
   /* request buffers */
+  if (vd->nbBuffers <= 0 || vd->nbBuffers > NB_BUFFER)
+    vd->nbBuffers = NB_BUFFER;
   memset (&vd->rb, 0, sizeof (struct v4l2_requestbuffers));
-  vd->rb.count = NB_BUFFER;
+  vd->rb.count = vd->nbBuffers;
   vd->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   vd->rb.memory = V4L2_MEMORY_MMAP;
 
@@ -201,8 +206,16 @@ init_v4l2 (struct vdIn *vd)
     fprintf (stderr, "Unable to allocate buffers: %d.\n", errno);
     goto fatal;
   }
+  /* the driver may give us fewer than we asked for */
+  if (vd->rb.count < 2 || vd->rb.count > NB_BUFFER) {
+    fprintf (stderr, "Unusable number of buffers (%d).\n", vd->rb.count);
+    goto fatal;
+  }
+  if (vd->rb.count != vd->nbBuffers)
+    fprintf (stderr, "asked for %d buffers, got %d\n", vd->nbBuffers, vd->rb.count);
+  vd->nbBuffers = vd->rb.count;
   /* map the buffers */
-  for (i = 0; i < NB_BUFFER; i++) {
+  for (i = 0; i < vd->nbBuffers; i++) {
     memset (&vd->buf, 0, sizeof (struct v4l2_buffer));
     vd->buf.index = i;
     vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -226,7 +239,7 @@ init_v4l2 (struct vdIn *vd)
       fprintf (stderr, "Buffer mapped at address %p.\n", vd->mem[i]);
   }
   /* Queue the buffers. */
-  for (i = 0; i < NB_BUFFER; ++i) {
+  for (i = 0; i < vd->nbBuffers; ++i) {
     memset (&vd->buf, 0, sizeof (struct v4l2_buffer));
     vd->buf.index = i;
     vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -273,56 +286,216 @@ video_disable (struct vdIn *vd)
   return 0;
 }
 
+static unsigned long
+usecBetween (struct timeval *from, struct timeval *to)
+{
+  if (to->tv_sec < from->tv_sec ||
+      (to->tv_sec == from->tv_sec && to->tv_usec < from->tv_usec))
+    return 0;
+  return (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_usec - from->tv_usec);
+}
+
+/* count dropped frames & the time from capture to dequeue, against the
+   driver's timestamp in whichever clock it says it used */
+static void
+frameStats (struct vdIn *vd, struct v4l2_buffer *buf, struct timeval *now)
+{
+  struct timeval ts;
+  unsigned long usec;
+  int haveClock = 1;
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+  struct timespec mono;
+
+  switch (buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) {
+  case V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC:
+    clock_gettime (CLOCK_MONOTONIC, &mono);
+    ts.tv_sec = mono.tv_sec;
+    ts.tv_usec = mono.tv_nsec / 1000;
+    break;
+  case V4L2_BUF_FLAG_TIMESTAMP_UNKNOWN:
+    ts = *now;			/* older drivers used gettimeofday() */
+    break;
+  default:
+    haveClock = 0;		/* copied from an output, no use here */
+    break;
+  }
+#else
+  ts = *now;
+#endif
+
+  if (vd->frames > 0 && buf->sequence > vd->lastSequence + 1)
+    vd->dropped += buf->sequence - vd->lastSequence - 1;
+  vd->lastSequence = buf->sequence;
+  vd->frames++;
+  if (haveClock && (buf->timestamp.tv_sec || buf->timestamp.tv_usec)) {
+    usec = usecBetween (&buf->timestamp, &ts);
+    vd->latencyUs += usec;
+    vd->latencyFrames++;
+    if (usec > vd->latencyMaxUs)
+      vd->latencyMaxUs = usec;
+  }
+}
+
 int
-uvcGrab (struct vdIn *vd)
+uvcGrabRef (struct vdIn *vd, unsigned char **frame, int *bytes)
 {
-#define HEADERFRAME1 0xaf
+  struct v4l2_buffer buf;
+  struct timeval now;
   int ret;
 
   if (!vd->isstreaming)
     if (video_enable (vd))
       goto err;
-  memset (&vd->buf, 0, sizeof (struct v4l2_buffer));
-  vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  vd->buf.memory = V4L2_MEMORY_MMAP;
-  ret = ioctl (vd->fd, VIDIOC_DQBUF, &vd->buf);
+  memset (&buf, 0, sizeof (struct v4l2_buffer));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  ret = ioctl (vd->fd, VIDIOC_DQBUF, &buf);
   if (ret < 0) {
     fprintf (stderr, "Unable to dequeue buffer (%d).\n", errno);
     goto err;
   }
+  gettimeofday (&now, NULL);
+  frameStats (vd, &buf, &now);
+  vd->dequeued[buf.index] = now;
+  vd->outstanding++;
+  vd->buf = buf;
+  *frame = vd->mem[buf.index];
+  *bytes = buf.bytesused;
+  return buf.index;
+err:
+  vd->signalquit = 0;
+  return -1;
+}
+
+int
+uvcRelease (struct vdIn *vd, int index)
+{
+  struct v4l2_buffer buf;
+  struct timeval now;
+  unsigned long usec;
+  int ret;
+
+  gettimeofday (&now, NULL);
+  usec = usecBetween (&vd->dequeued[index], &now);
+  vd->heldUs += usec;
+  if (usec > vd->heldMaxUs)
+    vd->heldMaxUs = usec;
+  vd->outstanding--;
+
+  memset (&buf, 0, sizeof (struct v4l2_buffer));
+  buf.index = index;
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  ret = ioctl (vd->fd, VIDIOC_QBUF, &buf);
+  if (ret < 0) {
+    fprintf (stderr, "Unable to requeue buffer (%d).\n", errno);
+    vd->signalquit = 0;
+    return -1;
+  }
+  return 0;
+}
+
+/* the offset of the start of scan marker in a JPEG frame, or -1 if it isn't one. *hasDht
+   is set if a Huffman table segment comes before it */
+static int
+jpegScanHeader (const unsigned char *frame, int bytes, int *hasDht)
+{
+  int i = 2;
+
+  *hasDht = 0;
+  if ((bytes < 4) || (frame[0] != 0xff) || (frame[1] != 0xd8))
+    return -1;
+  while (i + 4 <= bytes) {
+    if (frame[i] != 0xff)
+      return -1;
+    if (frame[i + 1] == 0xff) {	/* fill byte */
+      i++;
+      continue;
+    }
+    if (frame[i + 1] == 0xda)
+      return i;
+    if (frame[i + 1] == 0xc4)
+      *hasDht = 1;
+    i += 2 + ((frame[i + 2] << 8) | frame[i + 3]);
+  }
+  return -1;
+}
+
+/* copy an MJPEG frame into out, which holds max bytes, as a JPEG any decoder can read.
+   Most UVC cameras leave the Huffman tables out of their frames, as the standard ones
+   are implied; those are put back in just before the scan. Whether the camera needs
+   them is only worked out from its first frame. Returns the bytes in out, or -1 if the
+   frame isn't a JPEG or doesn't fit */
+int
+uvcCopyJpeg (struct vdIn *vd, const unsigned char *frame, int bytes,
+	     unsigned char *out, int max)
+{
+  int sos, hasDht;
+
+  if ((sos = jpegScanHeader (frame, bytes, &hasDht)) < 0)
+    return -1;
+  if (vd->jpegDht < 0) {
+    vd->jpegDht = !hasDht;
+    if (debug)
+      fprintf (stderr, "camera's frames %s Huffman tables\n",
+	       hasDht ? "have their" : "leave out the");
+  }
+  if (!vd->jpegDht) {
+    if (bytes > max)
+      return -1;
+    memcpy (out, frame, bytes);
+    return bytes;
+  }
+  if (bytes + DHT_SIZE > max)
+    return -1;
+  memcpy (out, frame, sos);
+  memcpy (out + sos, dht_data, DHT_SIZE);
+  memcpy (out + sos + DHT_SIZE, frame + sos, bytes - sos);
+  return bytes + DHT_SIZE;
+}
+
+/* copy the frame out of the driver's buffer, into framebuffer or, for MJPEG,
+   into tmpbuffer with the Huffman table the camera leaves out */
+int
+uvcGrab (struct vdIn *vd)
+{
+  unsigned char *frame;
+  int index, bytes;
+
+  if ((index = uvcGrabRef (vd, &frame, &bytes)) < 0)
+    return -1;
   switch (vd->formatIn) {
   case V4L2_PIX_FMT_MJPEG:
-
-    memcpy (vd->tmpbuffer, vd->mem[vd->buf.index], HEADERFRAME1);
-    memcpy (vd->tmpbuffer + HEADERFRAME1, dht_data, DHT_SIZE);
-    memcpy (vd->tmpbuffer + HEADERFRAME1 + DHT_SIZE,
-	    vd->mem[vd->buf.index] + HEADERFRAME1,
-	    (vd->buf.bytesused - HEADERFRAME1));
+    if (uvcCopyJpeg (vd, frame, bytes, vd->tmpbuffer, vd->framesizeIn) < 0)
+      fprintf (stderr, "bad MJPEG frame, %d bytes\n", bytes);
     if (debug)
-      fprintf (stderr, "bytes in used %d \n", vd->buf.bytesused);
+      fprintf (stderr, "bytes in used %d \n", bytes);
     break;
   case V4L2_PIX_FMT_YUYV:
-    if (vd->buf.bytesused > vd->framesizeIn)
-      memcpy (vd->framebuffer, vd->mem[vd->buf.index],
-	      (size_t) vd->framesizeIn);
+    if (bytes > vd->framesizeIn)
+      memcpy (vd->framebuffer, frame, (size_t) vd->framesizeIn);
     else
-      memcpy (vd->framebuffer, vd->mem[vd->buf.index],
-	      (size_t) vd->buf.bytesused);
+      memcpy (vd->framebuffer, frame, (size_t) bytes);
     break;
   default:
-    goto err;
-    break;
-  }
-  ret = ioctl (vd->fd, VIDIOC_QBUF, &vd->buf);
-  if (ret < 0) {
-    fprintf (stderr, "Unable to requeue buffer (%d).\n", errno);
-    goto err;
+    uvcRelease (vd, index);
+    vd->signalquit = 0;
+    return -1;
   }
+  return uvcRelease (vd, index);
+}
 
-  return 0;
-err:
-  vd->signalquit = 0;
-  return -1;
+void
+uvcPrintStats (struct vdIn *vd)
+{
+  fprintf (stderr, "capture: %u frames, %u dropped, %d of %d buffers held\n",
+	   vd->frames, vd->dropped, vd->outstanding, vd->nbBuffers);
+  if (vd->latencyFrames)
+    fprintf (stderr, "capture: latency to dequeue mean %llu us, max %lu us\n",
+	     vd->latencyUs / vd->latencyFrames, vd->latencyMaxUs);
+  if (vd->frames > (unsigned int) vd->outstanding)
+    fprintf (stderr, "capture: buffers held mean %llu us, max %lu us\n",
+	     vd->heldUs / (vd->frames - vd->outstanding), vd->heldMaxUs);
 }
 
 int
@@ -335,7 +508,7 @@ close_v4l2 (struct vdIn *vd)
 
   /* If the memory maps are not released the device will remain opened even
      after a call to close(); */
-  for (i = 0; i < NB_BUFFER; i++) {
+  for (i = 0; i < vd->nbBuffers; i++) {
     munmap (vd->mem[i], vd->buf.length);
   }
 
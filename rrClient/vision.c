@@ -0,0 +1,545 @@
+/*
+ * vision.c
+ *
+ *  Created on: Dec 29, 2012
+ *      Author: bouchier
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include "vision.h"
+
+#define GRID_CELLS (VIS_GRID * VIS_GRID)
+
+typedef struct {
+	short y, x0, x1;		// inclusive
+	short blob;				// index in blobs, at the root
+	int parent;				// union-find over runs
+} run;
+
+typedef struct {
+	int area;
+	int xMin, xMax, yMin, yMax;
+	int candidate;			// index in counts, -1 if it isn't shape matched
+} blob;
+
+typedef struct {
+	int width, height;		// of the silhouette's box
+	unsigned char fill[GRID_CELLS];	// 0-255, how much of each grid cell is filled
+} shapeTemplate;
+
+static unsigned char mask[VIS_MAX_WIDTH];
+static run runs[VIS_MAX_RUNS];
+static blob blobs[VIS_MAX_RUNS];
+static unsigned short counts[VIS_MAX_CANDIDATES][GRID_CELLS];
+static shapeTemplate templates[VIS_MAX_TEMPLATES];
+static int numTemplates = 0;
+
+// search band & mode, set from the command line
+static int bandTop = 0, bandBottom = 0;
+static int pyramid = 1;
+
+// tracking: the last shape found, & for how many frames running
+static visionShape last;
+static int lockFrames = 0;
+
+enum {
+	STAGE_TRACK_LABEL, STAGE_TRACK_MATCH,
+	STAGE_COARSE_LABEL, STAGE_COARSE_MATCH,
+	STAGE_FINE_LABEL, STAGE_FINE_MATCH,
+	STAGE_FRAME, NUM_STAGES
+};
+static struct {
+	const char *name;
+	unsigned long count, totalUsec, maxUsec;
+} stages[NUM_STAGES] = {
+	{ "track label" }, { "track match" },
+	{ "half res label" }, { "half res match" },
+	{ "full res label" }, { "full res match" },
+	{ "whole frame" },
+};
+static unsigned long trackedFrames = 0, pyramidFrames = 0, fullFrames = 0, lostLocks = 0;
+static unsigned long overflows = 0;
+
+static int findRoot(int r)
+{
+	int root = r, next;
+
+	while (runs[root].parent != root)
+		root = runs[root].parent;
+	while (runs[r].parent != root) {		// compress the path
+		next = runs[r].parent;
+		runs[r].parent = root;
+		r = next;
+	}
+	return root;
+}
+
+static void join(int a, int b)
+{
+	a = findRoot(a);
+	b = findRoot(b);
+	if (a < b)
+		runs[b].parent = a;
+	else if (b < a)
+		runs[a].parent = b;
+}
+
+/*
+ * The grid cell a pixel of a box size long falls in is (pos * step) >> 16. cells gets
+ * how many pixels fall in each cell
+ */
+static int gridStep(int size, int *cells)
+{
+	int step = (VIS_GRID << 16) / size;
+	int i;
+
+	memset(cells, 0, VIS_GRID * sizeof(int));
+	for (i = 0; i < size; i++)
+		cells[(i * step) >> 16]++;
+	return step;
+}
+
+// 0-255 from the count of filled pixels in each cell
+static void toFill(unsigned short *count, int *cols, int *rows, unsigned char *fill)
+{
+	int gx, gy, area;
+
+	for (gy = 0; gy < VIS_GRID; gy++) {
+		for (gx = 0; gx < VIS_GRID; gx++) {
+			area = cols[gx] * rows[gy];
+			fill[gy * VIS_GRID + gx] = (area == 0) ? 0 : (255 * count[gy * VIS_GRID + gx]) / area;
+		}
+	}
+}
+
+// a box twice as tall as it's wide, for when there are no templates
+static void boxTemplate()
+{
+	templates[0].width = VIS_GRID;
+	templates[0].height = 2 * VIS_GRID;
+	memset(templates[0].fill, 255, GRID_CELLS);
+	numTemplates = 1;
+}
+
+/*
+ * Read a 24 bit uncompressed BMP, as Paint saves them, & make a template of the box
+ * round its bright pixels
+ */
+static int loadBmp(const char *path, shapeTemplate *t)
+{
+	unsigned char header[54], *pixels;
+	unsigned short count[GRID_CELLS];
+	int cols[VIS_GRID], rows[VIS_GRID];
+	int w, h, offset, stride, x, y, xMin, xMax, yMin, yMax, xStep, yStep, rv = -1;
+	unsigned char *p;
+	FILE *fp;
+
+	if ((fp = fopen(path, "rb")) == NULL)
+		return -1;
+	if ((fread(header, 1, 54, fp) != 54) || (header[0] != 'B') || (header[1] != 'M') ||
+			(header[28] != 24) || (header[30] != 0)) {
+		fprintf(stderr, "%s isn't a 24 bit uncompressed BMP\n", path);
+		fclose(fp);
+		return -1;
+	}
+	offset = header[10] | (header[11] << 8) | (header[12] << 16) | (header[13] << 24);
+	w = header[18] | (header[19] << 8) | (header[20] << 16) | (header[21] << 24);
+	h = header[22] | (header[23] << 8) | (header[24] << 16) | (header[25] << 24);
+	stride = (3 * w + 3) & ~3;
+	if ((w <= 0) || (h <= 0) || (w > 4096) || (h > 4096)) {
+		fclose(fp);
+		return -1;
+	}
+	pixels = malloc(stride * h);
+	if ((pixels == NULL) || fseek(fp, offset, SEEK_SET) || (fread(pixels, 1, stride * h, fp) != (size_t)(stride * h)))
+		goto done;
+
+	// rows are stored bottom up, which doesn't matter for the box, but does for the fill
+#define BRIGHT(x, y) (p = pixels + (h - 1 - (y)) * stride + 3 * (x), (p[0] + p[1] + p[2]) > 384)
+	xMin = w;
+	yMin = h;
+	xMax = yMax = -1;
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			if (BRIGHT(x, y)) {
+				if (x < xMin) xMin = x;
+				if (x > xMax) xMax = x;
+				if (y < yMin) yMin = y;
+				if (y > yMax) yMax = y;
+			}
+		}
+	}
+	if (xMax < 0) {
+		fprintf(stderr, "%s has no white shape in it\n", path);
+		goto done;
+	}
+
+	t->width = xMax - xMin + 1;
+	t->height = yMax - yMin + 1;
+	xStep = gridStep(t->width, cols);
+	yStep = gridStep(t->height, rows);
+	memset(count, 0, sizeof(count));
+	for (y = yMin; y <= yMax; y++) {
+		for (x = xMin; x <= xMax; x++) {
+			if (BRIGHT(x, y))
+				count[(((y - yMin) * yStep) >> 16) * VIS_GRID + (((x - xMin) * xStep) >> 16)]++;
+		}
+	}
+	toFill(count, cols, rows, t->fill);
+	rv = 0;
+#undef BRIGHT
+
+done:
+	free(pixels);
+	fclose(fp);
+	return rv;
+}
+
+int visionLoadTemplates(const char *dir)
+{
+	char path[256];
+	struct dirent *de;
+	DIR *d;
+	int len;
+
+	numTemplates = 0;
+	if ((d = opendir(dir)) != NULL) {
+		while (((de = readdir(d)) != NULL) && (numTemplates < VIS_MAX_TEMPLATES)) {
+			len = strlen(de->d_name);
+			if ((len < 4) || (strcasecmp(de->d_name + len - 4, ".bmp") != 0))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+			if (loadBmp(path, &templates[numTemplates]) == 0)
+				numTemplates++;
+		}
+		closedir(d);
+	}
+	if (numTemplates == 0) {
+		fprintf(stderr, "no shape templates in %s, matching a box twice as tall as it's wide\n", dir);
+		boxTemplate();
+		return 0;
+	}
+	return numTemplates;
+}
+
+// a mask byte per pair of pixels, from the pair's first Y, for a half resolution search
+static void halfThreshold(const unsigned char *yuyv, unsigned char *half, int pairs,
+		const yuvRange *range)
+{
+	int yMin = range->yMin, yMax = range->yMax;
+	int uMin = range->uMin, uMax = range->uMax;
+	int vMin = range->vMin, vMax = range->vMax;
+	int i;
+
+	for (i = 0; i < pairs; i++, yuyv += 4)
+		half[i] = (yuyv[0] >= yMin) & (yuyv[0] <= yMax) & (yuyv[1] >= uMin) & (yuyv[1] <= uMax) &
+				(yuyv[3] >= vMin) & (yuyv[3] <= vMax);
+}
+
+/*
+ * Runs of in-range pixels in the box, joined to the runs they touch in the row above.
+ * With step 2 it uses every other pixel of every other row, & the runs are in half
+ * resolution pixels. left & right must be even. Returns how many
+ */
+static int findRuns(const unsigned char *yuyv, int width, visionBox *box, int step,
+		const yuvRange *range)
+{
+	int n = 0, prev = 0, prevEnd = 0, rowStart, x, y, p;
+	int cols = (box->right - box->left) / step, xOff = box->left / step;
+	const unsigned char *row;
+
+	for (y = box->top; y < box->bottom; y += step) {
+		row = yuyv + 2 * (y * width + box->left);
+		if (step == 1)
+			yuyvThreshold(row, mask, cols, range);
+		else
+			halfThreshold(row, mask, cols, range);
+		rowStart = n;
+		p = prev;
+		for (x = 0; x < cols; x++) {
+			if (mask[x] == 0)
+				continue;
+			if (n == VIS_MAX_RUNS) {
+				overflows++;
+				return n;
+			}
+			runs[n].y = y / step;
+			runs[n].x0 = xOff + x;
+			while ((x < cols) && mask[x])
+				x++;
+			runs[n].x1 = xOff + x - 1;
+			runs[n].parent = n;
+
+			// the runs above which overlap it; they're in order, so only look forwards
+			while ((p < prevEnd) && (runs[p].x1 < runs[n].x0))
+				p++;
+			while ((p < prevEnd) && (runs[p].x0 <= runs[n].x1)) {
+				join(p, n);
+				if (runs[p].x1 > runs[n].x1)
+					break;		// it may overlap the next run too
+				p++;
+			}
+			n++;
+		}
+		prev = rowStart;
+		prevEnd = n;
+	}
+	return n;
+}
+
+// the blobs' areas & boxes, from their runs. Returns how many blobs
+static int measureBlobs(int n)
+{
+	int numBlobs = 0, i, root;
+	blob *b;
+
+	for (i = 0; i < n; i++) {
+		root = findRoot(i);
+		if (root == i) {
+			b = &blobs[numBlobs];
+			runs[i].blob = numBlobs++;
+			b->area = 0;
+			b->xMin = runs[i].x0;
+			b->xMax = runs[i].x1;
+			b->yMin = b->yMax = runs[i].y;
+			b->candidate = -1;
+		}
+		b = &blobs[runs[root].blob];	// roots come before their other runs
+		b->area += runs[i].x1 - runs[i].x0 + 1;
+		if (runs[i].x0 < b->xMin) b->xMin = runs[i].x0;
+		if (runs[i].x1 > b->xMax) b->xMax = runs[i].x1;
+		if (runs[i].y > b->yMax) b->yMax = runs[i].y;
+	}
+	return numBlobs;
+}
+
+// 0-100, how well a blob's fill matches a template's
+static int score(blob *b, unsigned char *fill, shapeTemplate *t)
+{
+	int i, lo = 0, hi = 0, overlap, blobAspect, aspect;
+
+	for (i = 0; i < GRID_CELLS; i++) {
+		if (fill[i] < t->fill[i]) {
+			lo += fill[i];
+			hi += t->fill[i];
+		} else {
+			lo += t->fill[i];
+			hi += fill[i];
+		}
+	}
+	overlap = (hi == 0) ? 0 : (100 * lo) / hi;
+
+	// height / width, 8 bits of fraction
+	blobAspect = ((b->yMax - b->yMin + 1) << 8) / (b->xMax - b->xMin + 1);
+	aspect = (t->height << 8) / t->width;
+	if (blobAspect < aspect)
+		return (overlap * blobAspect) / aspect;
+	return (overlap * aspect) / blobAspect;
+}
+
+static unsigned long usecBetween(struct timeval *from, struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_usec - from->tv_usec);
+}
+
+static void addTime(int stage, struct timeval *from, struct timeval *to)
+{
+	unsigned long usec = usecBetween(from, to);
+
+	stages[stage].count++;
+	stages[stage].totalUsec += usec;
+	if (usec > stages[stage].maxUsec)
+		stages[stage].maxUsec = usec;
+}
+
+/*
+ * Label & shape match what's in the box, at full resolution (step 1) or half (step 2).
+ * The shape is in full resolution pixels. stage is the stage to time labelling as, &
+ * matching is the one after it. Returns the number of blobs
+ */
+static int search(const unsigned char *yuyv, int width, visionBox *box, int step,
+		const yuvRange *range, visionShape *shape, int stage)
+{
+	unsigned char fill[GRID_CELLS];
+	int cols[VIS_GRID], rows[VIS_GRID];
+	int xStep[VIS_MAX_CANDIDATES], yStep[VIS_MAX_CANDIDATES];
+	int order[VIS_MAX_CANDIDATES];
+	int n, numBlobs, numCandidates = 0, i, j, x, s, best = -1;
+	int minArea = VIS_MIN_AREA / (step * step);
+	struct timeval start, labelled, end;
+	unsigned short *count;
+	blob *b;
+	run *r;
+
+	memset(shape, 0, sizeof(visionShape));
+	gettimeofday(&start, NULL);
+	n = findRuns(yuyv, width, box, step, range);
+	gettimeofday(&labelled, NULL);
+	numBlobs = measureBlobs(n);
+
+	// the biggest blobs, biggest first
+	for (i = 0; i < numBlobs; i++) {
+		if (blobs[i].area < minArea)
+			continue;
+		for (j = numCandidates; (j > 0) && (blobs[order[j - 1]].area < blobs[i].area); j--) {
+			if (j < VIS_MAX_CANDIDATES)
+				order[j] = order[j - 1];
+		}
+		if (j < VIS_MAX_CANDIDATES) {
+			order[j] = i;
+			if (numCandidates < VIS_MAX_CANDIDATES)
+				numCandidates++;
+		}
+	}
+	for (i = 0; i < numCandidates; i++) {
+		b = &blobs[order[i]];
+		b->candidate = i;
+		xStep[i] = gridStep(b->xMax - b->xMin + 1, cols);
+		yStep[i] = gridStep(b->yMax - b->yMin + 1, rows);
+		memset(counts[i], 0, sizeof(counts[i]));
+	}
+
+	// the candidates' fills, from their runs
+	for (i = 0, r = runs; i < n; i++, r++) {
+		b = &blobs[runs[findRoot(i)].blob];
+		if (b->candidate < 0)
+			continue;
+		count = counts[b->candidate] + (((r->y - b->yMin) * yStep[b->candidate]) >> 16) * VIS_GRID;
+		for (x = r->x0; x <= r->x1; x++)
+			count[((x - b->xMin) * xStep[b->candidate]) >> 16]++;
+	}
+
+	for (i = 0; i < numCandidates; i++) {
+		b = &blobs[order[i]];
+		gridStep(b->xMax - b->xMin + 1, cols);
+		gridStep(b->yMax - b->yMin + 1, rows);
+		toFill(counts[i], cols, rows, fill);
+		for (j = 0; j < numTemplates; j++) {
+			s = score(b, fill, &templates[j]);
+			if (s > shape->confidence) {
+				shape->confidence = s;
+				best = order[i];
+			}
+		}
+	}
+	if (best >= 0) {
+		b = &blobs[best];
+		shape->xMin = b->xMin * step;
+		shape->xMax = b->xMax * step + step - 1;
+		shape->yMin = b->yMin * step;
+		shape->yMax = b->yMax * step + step - 1;
+		shape->area = b->area * step * step;
+	}
+
+	gettimeofday(&end, NULL);
+	addTime(stage, &start, &labelled);
+	addTime(stage + 1, &labelled, &end);
+	return numBlobs;
+}
+
+// the band, round the shape by margin, with left & right even for the YUYV pairs
+static void around(visionShape *shape, int margin, visionBox *band, visionBox *box)
+{
+	box->left = (shape->xMin - margin) & ~1;
+	box->right = (shape->xMax + 1 + margin + 1) & ~1;
+	box->top = shape->yMin - margin;
+	box->bottom = shape->yMax + 1 + margin;
+	if (box->left < band->left) box->left = band->left;
+	if (box->right > band->right) box->right = band->right;
+	if (box->top < band->top) box->top = band->top;
+	if (box->bottom > band->bottom) box->bottom = band->bottom;
+}
+
+int visionFind(const unsigned char *yuyv, int width, int height, const yuvRange *range,
+		visionShape *shape)
+{
+	visionShape coarse;
+	visionBox band, box;
+	struct timeval start, end;
+	int n = 0, size, margin;
+
+	gettimeofday(&start, NULL);
+	if (numTemplates == 0)
+		boxTemplate();
+	memset(shape, 0, sizeof(visionShape));
+	if ((width > VIS_MAX_WIDTH) || (width & 1))
+		return 0;
+
+	band.left = 0;
+	band.right = width;
+	band.top = (bandTop < height) ? bandTop : height;
+	band.bottom = ((bandBottom <= 0) || (bandBottom > height)) ? height : bandBottom;
+
+	// locked on: look round where it was, closer the longer we've had it
+	if (lockFrames > 0) {
+		size = (last.xMax - last.xMin > last.yMax - last.yMin) ? last.xMax - last.xMin + 1 : last.yMax - last.yMin + 1;
+		margin = size / lockFrames;
+		if (margin < VIS_TRACK_MARGIN)
+			margin = VIS_TRACK_MARGIN;
+		around(&last, margin, &band, &box);
+		n = search(yuyv, width, &box, 1, range, shape, STAGE_TRACK_LABEL);
+		if (shape->confidence >= VIS_LOCK_CONFIDENCE) {
+			lockFrames++;
+			last = *shape;
+			trackedFrames++;
+			goto done;
+		}
+		lockFrames = 0;
+		lostLocks++;
+	}
+
+	if (pyramid) {
+		// find it at half resolution, then look closer round what was found
+		n = search(yuyv, width, &band, 2, range, &coarse, STAGE_COARSE_LABEL);
+		if (coarse.area > 0) {
+			around(&coarse, VIS_REFINE_MARGIN, &band, &box);
+			n = search(yuyv, width, &box, 1, range, shape, STAGE_FINE_LABEL);
+		} else {
+			memset(shape, 0, sizeof(visionShape));
+		}
+		pyramidFrames++;
+	} else {
+		n = search(yuyv, width, &band, 1, range, shape, STAGE_FINE_LABEL);
+		fullFrames++;
+	}
+	if (pyramid && (shape->confidence >= VIS_LOCK_CONFIDENCE)) {
+		lockFrames = 1;
+		last = *shape;
+	}
+
+done:
+	gettimeofday(&end, NULL);
+	addTime(STAGE_FRAME, &start, &end);
+	return n;
+}
+
+void visionSetBand(int top, int bottom)
+{
+	bandTop = (top > 0) ? top : 0;
+	bandBottom = bottom;
+}
+
+void visionSetPyramid(int on)
+{
+	pyramid = on;
+	lockFrames = 0;
+}
+
+void visionPrintStats(void)
+{
+	int i;
+
+	fprintf(stderr, "vision: %lu frames tracked, %lu half resolution then refined, %lu full, %lu locks lost, %lu with too many runs, %d templates\n",
+			trackedFrames, pyramidFrames, fullFrames, lostLocks, overflows, numTemplates);
+	for (i = 0; i < NUM_STAGES; i++) {
+		if (stages[i].count == 0)
+			continue;
+		fprintf(stderr, "  %-16s %6lu times, %5lu us avg, max %5lu us\n", stages[i].name,
+				stages[i].count, stages[i].totalUsec / stages[i].count, stages[i].maxUsec);
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * vision.h
+ *
+ *  Created on: Dec 29, 2012
+ *      Author: bouchier
+ */
+
+#ifndef VISION_H_
+#define VISION_H_
+
+#include "colorconv.h"
+
+#define VIS_MAX_WIDTH 640
+#define VIS_MAX_RUNS 4096			// runs of target colour in a frame; a noisier frame is cut short
+#define VIS_MAX_CANDIDATES 8		// biggest blobs shape matched
+#define VIS_MAX_TEMPLATES 16
+#define VIS_GRID 16					// blobs & templates are compared on a 16 x 16 grid over their boxes
+#define VIS_MIN_AREA 10				// pixels, as Roborealm's Blob_Size in can.robo
+#define VIS_LOCK_CONFIDENCE 70		// a match this good is tracked, as rrclient's cut-off
+#define VIS_REFINE_MARGIN 4			// pixels round a half resolution find searched at full
+#define VIS_TRACK_MARGIN 8			// pixels, the least searched round a tracked target
+
+/*
+ * Finds the target in a YUYV frame without Roborealm: colour threshold, connected
+ * components, then a shape match of the biggest blobs against the templates.
+ *
+ * The pixels inside a YUV box are the target colour. They're labelled a run at a time:
+ * runs in one row which overlap runs in the row above are joined, so the cost goes
+ * with the number of runs, not pixels. Each blob over VIS_MIN_AREA is scored against
+ * each template on how much their fills on a VIS_GRID x VIS_GRID grid over their boxes
+ * overlap, times how alike their aspect ratios are. The templates are the silhouettes
+ * Roborealm's Shape_Match used, e.g. the .bmp files in can. The match is scale invariant
+ * but not rotation invariant: it's for upright cans & cones. Without templates, blobs
+ * are matched against a box twice as tall as it's wide. It's all integer arithmetic.
+ *
+ * Only rows in the band set by visionSetBand() are searched. The band is first searched
+ * at half resolution, a quarter of the pixels, then the box round the best match is
+ * searched again at full resolution for a true outline & score. Once the target's found
+ * with VIS_LOCK_CONFIDENCE, later frames only search round where it was last, in a box
+ * which shrinks towards VIS_TRACK_MARGIN the longer it stays locked; if it isn't found
+ * there, that frame gets a full search. visionSetPyramid(0) searches the whole band at
+ * full resolution each frame instead. visionPrintStats() times each stage.
+ */
+typedef struct {
+	int confidence;			// 0-100, as Roborealm's Shape_Match
+	int xMin, xMax, yMin, yMax;
+	int area;				// pixels
+} visionShape;
+
+typedef struct {
+	int left, top, right, bottom;	// right & bottom are exclusive
+} visionBox;
+
+// templates: BMP silhouettes, white on black, from dir; returns how many were read
+int visionLoadTemplates(const char *dir);
+
+// the best match in the frame; returns 0 if there's no blob, & confidence is 0
+int visionFind(const unsigned char *yuyv, int width, int height, const yuvRange *range,
+		visionShape *shape);
+
+// rows top to bottom - 1 are searched; bottom 0 means to the bottom of the frame
+void visionSetBand(int top, int bottom);
+void visionSetPyramid(int on);
+void visionPrintStats(void);
+
+#endif /* VISION_H_ */
@@ -0,0 +1,350 @@
+/*
+ * colorconv.c
+ *
+ *  Created on: Dec 27, 2012
+ *      Author: bouchier
+ */
+
+#include "colorconv.h"
+
+#if defined(__SSE2__) && !defined(COLORCONV_NO_SIMD)
+#include <emmintrin.h>
+#define COLORCONV_SSE2
+#endif
+
+#define CLAMP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
+
+/*
+ * The original conversion is r = ((y << 8) + 359 * v) >> 8, & so on. y << 8 has no
+ * bits in the low byte, so that's y + ((359 * v) >> 8) exactly, & the chroma terms only
+ * need working out once for each pair of pixels
+ */
+#define R_V 359
+#define G_U -88
+#define G_V -183
+#define B_U 454
+
+// 2^24 / d, rounded up: n * recip[d] >> 24 is n / d exactly for the n & d used here
+static unsigned long long recip[256];
+static int recipReady = 0;
+
+static void portableRgb(const unsigned char *yuyv, unsigned char *rgb, int pixels)
+{
+	int i, y, u, v, dr, dg, db;
+
+	for (i = 0; i < pixels; i += 2, yuyv += 4, rgb += 6) {
+		u = yuyv[1] - 128;
+		v = yuyv[3] - 128;
+		dr = (R_V * v) >> 8;
+		dg = (G_U * u + G_V * v) >> 8;
+		db = (B_U * u) >> 8;
+
+		y = yuyv[0];
+		rgb[0] = CLAMP(y + dr);
+		rgb[1] = CLAMP(y + dg);
+		rgb[2] = CLAMP(y + db);
+		y = yuyv[2];
+		rgb[3] = CLAMP(y + dr);
+		rgb[4] = CLAMP(y + dg);
+		rgb[5] = CLAMP(y + db);
+	}
+}
+
+static void portableY(const unsigned char *yuyv, unsigned char *y, int pixels)
+{
+	int i;
+
+	for (i = 0; i < pixels; i++)
+		y[i] = yuyv[2 * i];
+}
+
+static void portableThreshold(const unsigned char *yuyv, unsigned char *mask, int pixels,
+		const yuvRange *range)
+{
+	// locals, or every store to mask would make the compiler read range again
+	int yMin = range->yMin, yMax = range->yMax;
+	int uMin = range->uMin, uMax = range->uMax;
+	int vMin = range->vMin, vMax = range->vMax;
+	int i, c;
+
+	for (i = 0; i < pixels; i += 2, yuyv += 4, mask += 2) {
+		c = (yuyv[1] >= uMin) & (yuyv[1] <= uMax) & (yuyv[3] >= vMin) & (yuyv[3] <= vMax);
+		mask[0] = 255 * (c & (yuyv[0] >= yMin) & (yuyv[0] <= yMax));
+		mask[1] = 255 * (c & (yuyv[2] >= yMin) & (yuyv[2] <= yMax));
+	}
+}
+
+#ifdef COLORCONV_SSE2
+/*
+ * 16 pixels at a time. Y is the low byte of each 16 bit lane & U, V alternate in the
+ * high bytes, so once they're shifted down _mm_madd_epi16 works out a chroma term for
+ * each pair of pixels in 32 bits, as the scalar code does. _mm_packus_epi16 does the
+ * clamping. Returns the number of pixels done
+ */
+static __m128i chroma(__m128i uv, __m128i coef)
+{
+	__m128i d = _mm_srai_epi32(_mm_madd_epi16(uv, coef), 8);
+
+	d = _mm_packs_epi32(d, d);			// fits: the terms are at most 227 either way
+	return _mm_unpacklo_epi16(d, d);	// the same for both pixels of a pair
+}
+
+static int sse2Rgb(const unsigned char *yuyv, unsigned char *rgb, int pixels)
+{
+	const __m128i lowByte = _mm_set1_epi16(0x00ff);
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i rCoef = _mm_set_epi16(R_V, 0, R_V, 0, R_V, 0, R_V, 0);
+	const __m128i gCoef = _mm_set_epi16(G_V, G_U, G_V, G_U, G_V, G_U, G_V, G_U);
+	const __m128i bCoef = _mm_set_epi16(0, B_U, 0, B_U, 0, B_U, 0, B_U);
+	__m128i in0, in1, y0, y1, uv0, uv1, r, g, b;
+	unsigned char rs[16], gs[16], bs[16];
+	int i, j;
+
+	for (i = 0; i + 16 <= pixels; i += 16, yuyv += 32) {
+		in0 = _mm_loadu_si128((const __m128i *)yuyv);
+		in1 = _mm_loadu_si128((const __m128i *)(yuyv + 16));
+		y0 = _mm_and_si128(in0, lowByte);
+		y1 = _mm_and_si128(in1, lowByte);
+		uv0 = _mm_sub_epi16(_mm_srli_epi16(in0, 8), bias);
+		uv1 = _mm_sub_epi16(_mm_srli_epi16(in1, 8), bias);
+
+		r = _mm_packus_epi16(_mm_add_epi16(y0, chroma(uv0, rCoef)),
+				_mm_add_epi16(y1, chroma(uv1, rCoef)));
+		g = _mm_packus_epi16(_mm_add_epi16(y0, chroma(uv0, gCoef)),
+				_mm_add_epi16(y1, chroma(uv1, gCoef)));
+		b = _mm_packus_epi16(_mm_add_epi16(y0, chroma(uv0, bCoef)),
+				_mm_add_epi16(y1, chroma(uv1, bCoef)));
+
+		// SSE2 can't shuffle bytes, so interleave the planes to RGB24 by hand
+		_mm_storeu_si128((__m128i *)rs, r);
+		_mm_storeu_si128((__m128i *)gs, g);
+		_mm_storeu_si128((__m128i *)bs, b);
+		for (j = 0; j < 16; j++, rgb += 3) {
+			rgb[0] = rs[j];
+			rgb[1] = gs[j];
+			rgb[2] = bs[j];
+		}
+	}
+	return i;
+}
+
+static int sse2Y(const unsigned char *yuyv, unsigned char *y, int pixels)
+{
+	const __m128i lowByte = _mm_set1_epi16(0x00ff);
+	__m128i in0, in1;
+	int i;
+
+	for (i = 0; i + 16 <= pixels; i += 16, yuyv += 32) {
+		in0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)yuyv), lowByte);
+		in1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(yuyv + 16)), lowByte);
+		_mm_storeu_si128((__m128i *)(y + i), _mm_packus_epi16(in0, in1));
+	}
+	return i;
+}
+
+// 0x00ff in each 16 bit lane whose pixel is inside range, from 8 pixels of YUYV
+static __m128i inside(__m128i in, __m128i lo, __m128i hi)
+{
+	const __m128i lowByte = _mm_set1_epi16(0x00ff);
+	__m128i ok, c;
+
+	// each byte Y, U or V: 0xff if it's within its limits
+	ok = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(in, lo), in),
+			_mm_cmpeq_epi8(_mm_min_epu8(in, hi), in));
+
+	// U's result is in the high byte of a pair's first lane & V's in the second's
+	c = _mm_srli_epi16(ok, 8);
+	c = _mm_and_si128(c, _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 3, 0, 1)),
+			_MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_and_si128(_mm_and_si128(ok, lowByte), c);
+}
+
+static int sse2Threshold(const unsigned char *yuyv, unsigned char *mask, int pixels,
+		const yuvRange *range)
+{
+	const __m128i lo = _mm_set_epi8(range->vMin, range->yMin, range->uMin, range->yMin,
+			range->vMin, range->yMin, range->uMin, range->yMin,
+			range->vMin, range->yMin, range->uMin, range->yMin,
+			range->vMin, range->yMin, range->uMin, range->yMin);
+	const __m128i hi = _mm_set_epi8(range->vMax, range->yMax, range->uMax, range->yMax,
+			range->vMax, range->yMax, range->uMax, range->yMax,
+			range->vMax, range->yMax, range->uMax, range->yMax,
+			range->vMax, range->yMax, range->uMax, range->yMax);
+	__m128i m0, m1;
+	int i;
+
+	for (i = 0; i + 16 <= pixels; i += 16, yuyv += 32) {
+		m0 = inside(_mm_loadu_si128((const __m128i *)yuyv), lo, hi);
+		m1 = inside(_mm_loadu_si128((const __m128i *)(yuyv + 16)), lo, hi);
+		_mm_storeu_si128((__m128i *)(mask + i), _mm_packus_epi16(m0, m1));
+	}
+	return i;
+}
+
+/*
+ * HSV 8 pixels at a time, in 16 bit lanes as sse2Rgb() works them out. The hue's three
+ * cases are picked with masks, so there's a single divide for all of them. It's done in
+ * float: the numerators are at most 255 * 255 & the denominators 255, so the truncated
+ * float quotient is the exact integer one divide() gives
+ */
+static __m128i quotient(__m128i n, __m128i d, __m128 scale)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128 lo, hi;
+
+	// n is signed & d positive: widen both to 32 bits
+	lo = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(n, n), 16)), scale),
+			_mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero)));
+	hi = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(n, n), 16)), scale),
+			_mm_cvtepi32_ps(_mm_unpackhi_epi16(d, zero)));
+	return _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+}
+
+static int sse2Hsv(const unsigned char *yuyv, unsigned char *hsv, int pixels)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i lowByte = _mm_set1_epi16(0x00ff);
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i rCoef = _mm_set_epi16(R_V, 0, R_V, 0, R_V, 0, R_V, 0);
+	const __m128i gCoef = _mm_set_epi16(G_V, G_U, G_V, G_U, G_V, G_U, G_V, G_U);
+	const __m128i bCoef = _mm_set_epi16(0, B_U, 0, B_U, 0, B_U, 0, B_U);
+	__m128i in, y, uv, r, g, b, max, min, delta, isR, isG, isB, diff, h, s;
+	unsigned char hs[16], ss[16], vs[16];
+	int i, j;
+
+	for (i = 0; i + 8 <= pixels; i += 8, yuyv += 16) {
+		in = _mm_loadu_si128((const __m128i *)yuyv);
+		y = _mm_and_si128(in, lowByte);
+		uv = _mm_sub_epi16(_mm_srli_epi16(in, 8), bias);
+		r = _mm_add_epi16(y, chroma(uv, rCoef));
+		g = _mm_add_epi16(y, chroma(uv, gCoef));
+		b = _mm_add_epi16(y, chroma(uv, bCoef));
+		r = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), zero);	// clamp
+		g = _mm_unpacklo_epi8(_mm_packus_epi16(g, g), zero);
+		b = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), zero);
+
+		max = _mm_max_epi16(_mm_max_epi16(r, g), b);
+		min = _mm_min_epi16(_mm_min_epi16(r, g), b);
+		delta = _mm_sub_epi16(max, min);
+
+		// which of r, g & b is the max, in rgbToHsv()'s order
+		isR = _mm_cmpeq_epi16(max, r);
+		isG = _mm_andnot_si128(isR, _mm_cmpeq_epi16(max, g));
+		isB = _mm_andnot_si128(_mm_or_si128(isR, isG), _mm_cmpeq_epi16(max, max));
+		diff = _mm_or_si128(_mm_or_si128(_mm_and_si128(isR, _mm_sub_epi16(g, b)),
+				_mm_and_si128(isG, _mm_sub_epi16(b, r))), _mm_and_si128(isB, _mm_sub_epi16(r, g)));
+		h = quotient(_mm_mullo_epi16(diff, _mm_set1_epi16(43)), _mm_max_epi16(delta, one),
+				_mm_set1_ps(1.0f));
+		h = _mm_add_epi16(h, _mm_or_si128(_mm_and_si128(isG, _mm_set1_epi16(85)),
+				_mm_and_si128(isB, _mm_set1_epi16(171))));
+		h = _mm_andnot_si128(_mm_cmpeq_epi16(delta, zero), h);
+		s = quotient(delta, _mm_max_epi16(max, one), _mm_set1_ps(255.0f));
+
+		_mm_storeu_si128((__m128i *)hs, _mm_packus_epi16(_mm_and_si128(h, lowByte), zero));
+		_mm_storeu_si128((__m128i *)ss, _mm_packus_epi16(s, zero));
+		_mm_storeu_si128((__m128i *)vs, _mm_packus_epi16(max, zero));
+		for (j = 0; j < 8; j++, hsv += 3) {
+			hsv[0] = hs[j];
+			hsv[1] = ss[j];
+			hsv[2] = vs[j];
+		}
+	}
+	return i;
+}
+#endif
+
+void yuyvToRgb(const unsigned char *yuyv, unsigned char *rgb, int pixels)
+{
+	int done = 0;
+
+#ifdef COLORCONV_SSE2
+	done = sse2Rgb(yuyv, rgb, pixels);
+#endif
+	portableRgb(yuyv + 2 * done, rgb + 3 * done, pixels - done);
+}
+
+void yuyvToY(const unsigned char *yuyv, unsigned char *y, int pixels)
+{
+	int done = 0;
+
+#ifdef COLORCONV_SSE2
+	done = sse2Y(yuyv, y, pixels);
+#endif
+	portableY(yuyv + 2 * done, y + done, pixels - done);
+}
+
+void yuyvThreshold(const unsigned char *yuyv, unsigned char *mask, int pixels,
+		const yuvRange *range)
+{
+	int done = 0;
+
+#ifdef COLORCONV_SSE2
+	done = sse2Threshold(yuyv, mask, pixels, range);
+#endif
+	portableThreshold(yuyv + 2 * done, mask + done, pixels - done, range);
+}
+
+// n / d for n >= 0, without a divide: the ARM9 has none
+static inline int divide(int n, int d)
+{
+	return (int)((n * recip[d]) >> 24);
+}
+
+static inline void rgbToHsv(int r, int g, int b, unsigned char *hsv)
+{
+	int max, min, delta, h;
+
+	max = (r > g) ? r : g;
+	max = (b > max) ? b : max;
+	min = (r < g) ? r : g;
+	min = (b < min) ? b : min;
+	delta = max - min;
+
+	if (delta == 0)
+		h = 0;
+	else if (max == r)
+		h = (g >= b) ? divide(43 * (g - b), delta) : -divide(43 * (b - g), delta);
+	else if (max == g)
+		h = 85 + ((b >= r) ? divide(43 * (b - r), delta) : -divide(43 * (r - b), delta));
+	else
+		h = 171 + ((r >= g) ? divide(43 * (r - g), delta) : -divide(43 * (g - r), delta));
+
+	hsv[0] = h & 255;
+	hsv[1] = (max == 0) ? 0 : divide(255 * delta, max);
+	hsv[2] = max;
+}
+
+static void portableHsv(const unsigned char *yuyv, unsigned char *hsv, int pixels)
+{
+	int i, y, u, v, dr, dg, db;
+
+	if (!recipReady) {
+		for (i = 1; i < 256; i++)
+			recip[i] = ((1ULL << 24) + i - 1) / i;
+		recipReady = 1;
+	}
+
+	for (i = 0; i < pixels; i += 2, yuyv += 4, hsv += 6) {
+		u = yuyv[1] - 128;
+		v = yuyv[3] - 128;
+		dr = (R_V * v) >> 8;
+		dg = (G_U * u + G_V * v) >> 8;
+		db = (B_U * u) >> 8;
+
+		y = yuyv[0];
+		rgbToHsv(CLAMP(y + dr), CLAMP(y + dg), CLAMP(y + db), hsv);
+		y = yuyv[2];
+		rgbToHsv(CLAMP(y + dr), CLAMP(y + dg), CLAMP(y + db), hsv + 3);
+	}
+}
+
+void yuyvToHsv(const unsigned char *yuyv, unsigned char *hsv, int pixels)
+{
+	int done = 0;
+
+#ifdef COLORCONV_SSE2
+	done = sse2Hsv(yuyv, hsv, pixels);
+#endif
+	portableHsv(yuyv + 2 * done, hsv + 3 * done, pixels - done);
+}
@@ -0,0 +1,39 @@
+/*
+ * colorconv.h
+ *
+ *  Created on: Dec 27, 2012
+ *      Author: bouchier
+ */
+
+#ifndef COLORCONV_H_
+#define COLORCONV_H_
+
+/*
+ * Colour conversion of YUYV camera frames. The RGB conversion gives exactly what the
+ * original yuyv2rgb() loop did, & the others are defined by the scalar references in
+ * ColorBench, which checks every kernel against them.
+ *
+ * Each kernel has a portable C version, written branch-free so the ARM's conditional
+ * instructions or a vectorising compiler can use it, & an SSE2 version used on a PC
+ * (define COLORCONV_NO_SIMD to leave it out). pixels must be even: YUYV shares U & V
+ * between each pair of pixels.
+ */
+
+// a box in YUV space, inclusive
+typedef struct {
+	unsigned char yMin, yMax;
+	unsigned char uMin, uMax;
+	unsigned char vMin, vMax;
+} yuvRange;
+
+void yuyvToRgb(const unsigned char *yuyv, unsigned char *rgb, int pixels);
+void yuyvToY(const unsigned char *yuyv, unsigned char *y, int pixels);
+
+// hue 0-255 for a full turn, red at 0, green at 85 & blue at 171; saturation & value 0-255
+void yuyvToHsv(const unsigned char *yuyv, unsigned char *hsv, int pixels);
+
+// a byte per pixel, 255 if it's inside range & 0 if not, straight from the YUYV
+void yuyvThreshold(const unsigned char *yuyv, unsigned char *mask, int pixels,
+		const yuvRange *range);
+
+#endif /* COLORCONV_H_ */
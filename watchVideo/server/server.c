@@ -9,6 +9,7 @@
 #include <netinet/in.h>
 #include <strings.h>
 #include <string.h>
+#include <fcntl.h>
 
 void error(char *msg)
 {
@@ -43,6 +44,29 @@ int wait4client(int portno)
      return(newsockfd);
 }
 
+/* a non-blocking socket listening for clients on portno, for them to be
+   accepted as they come */
+int listen4clients(int portno)
+{
+     int sockfd, enable = 1;
+     struct sockaddr_in serv_addr;
+
+     sockfd = socket(AF_INET, SOCK_STREAM, 0);
+     if (sockfd < 0) 
+        error("ERROR opening socket");
+     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+     bzero((char *) &serv_addr, sizeof(serv_addr));
+     serv_addr.sin_family = AF_INET;
+     serv_addr.sin_addr.s_addr = INADDR_ANY;
+     serv_addr.sin_port = htons(portno);
+     if (bind(sockfd, (struct sockaddr *) &serv_addr,
+              sizeof(serv_addr)) < 0) 
+              error("ERROR on binding");
+     listen(sockfd,5);
+     fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+     return(sockfd);
+}
+
 int echoSocket(int newsockfd)
 {
      int n;
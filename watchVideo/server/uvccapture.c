@@ -33,12 +33,20 @@
 #include "jpeglib.h"
 #include <time.h>
 #include <linux/videodev2.h>
-#include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "v4l2uvc.h"
+#include "colorconv.h"
+#include "jpegenc.h"
+#include "videoproto.h"
 
-int wait4client(int);
+int listen4clients(int);
 
 //static const char version[] = VERSION;
 int run = 1;
@@ -49,6 +57,7 @@ char *videodevice = "/dev/video0";
 //int format = V4L2_PIX_FMT_MJPEG;
 int format = V4L2_PIX_FMT_YUYV;	// for DealExtreme camera
 int grabmethod = 1;
+int nbBuffers = 4;		// capture buffers; more rides out stalls, fewer means fresher frames
 int width = 160;
 int height = 120;
 int brightness = 0, contrast = 0, saturation = 0, gain = 0;
@@ -57,147 +66,397 @@ int quality = 95;
 int post_capture_command_wait = 0;
 struct vdIn *videoIn;
 int port = 5005;
-int outputType = 0;
 
-typedef struct {
-	volatile int doCapture;	// set to 1 by cmdHandler, cleared by main when capture is complete
-	unsigned char *imgArray;
-	int imgLength;
-	int imgWidth;
-	int imgHeight;
-	int videoSocket;
-	int pixelCnt;
-} ctrlStruct;
-
-void yuyv2Y (struct vdIn *vd,  ctrlStruct *ctrl)
+void
+sigcatch (int sig)
 {
-	unsigned char *yuyv, *iA;
-	unsigned char *end;
-
-	iA = ctrl->imgArray;
-	ctrl->imgWidth = vd->width;
-	ctrl->imgHeight = vd->height;
-	yuyv = vd->framebuffer;
-	end = yuyv + 2*(ctrl->imgWidth * ctrl->imgHeight); // 2 bytes/pixel
-	for (; yuyv<end; yuyv+=2, iA++) {
-		*iA = *yuyv;
-	}
-	ctrl->imgLength = (int)iA - (int)(ctrl->imgArray);
-	ctrl->pixelCnt = ctrl->imgLength;
+	fprintf (stderr, "Exiting...\n");
+	run = 0;
+	sleep(2);
+	exit(0);
 }
 
-void yuyv2rgb (struct vdIn *vd, ctrlStruct *ctrl)
-{
-	unsigned char *yuyv, *iA;
-	unsigned char *end;
-	int r, g, b;
-	int y0, y2, u, v;
-	int pixelCnt = 0;
+/*
+ * Converted frames, shared by the viewers sending them. A frame is converted once for
+ * each format some viewer is due a frame in, & each viewer holds a reference to the
+ * frame it's sending until it's all gone. A viewer holds one frame at most, so the pool
+ * never runs out.
+ */
+#define MAX_CLIENTS 8
+#define FRAME_POOL (MAX_CLIENTS + VIDEO_FORMATS)
 
-	iA = ctrl->imgArray;
-	ctrl->imgWidth = vd->width;
-	ctrl->imgHeight = vd->height;
+typedef struct {
+	int refs;			// 0 when it's free
+	int format;
+	int width;
+	int height;
+	int length;
+	unsigned int seq;
+	struct timeval stamp;
+	unsigned char *data;
+} videoFrame;
+
+videoFrame pool[FRAME_POOL];
 
-	yuyv = vd->framebuffer;
-	end = yuyv + 2*(ctrl->imgWidth * ctrl->imgHeight); // 2 bytes/pixel
+typedef struct {
+	int fd;				// -1 if the slot's free
+	int legacy;			// the original protocol: a frame for each request byte
+	int wanted;			// legacy: frames asked for & not yet sent
+	int format;
+	int intervalMs;		// between frames; 0 for every frame
+	struct timeval due;	// when the next frame's due
+	int watching;		// waiting for room to write
+	unsigned char in[sizeof(videoSubscribe)];
+	int inLen;
+	videoFrame *frame;	// being sent, or NULL
+	unsigned char header[sizeof(videoHeader)];
+	int headerLen;
+	int sent;			// bytes of header & frame written so far
+	unsigned long frames;
+	unsigned int dropped;
+} videoClient;
+
+videoClient clients[MAX_CLIENTS];
+int epfd;
+unsigned int frameSeq = 0;
+
+// epoll data for the sockets that aren't clients
+int listenTag, cameraTag;
+
+int poolInit(int bytes)
+{
+	int i;
 
-	for (; yuyv<end; yuyv+=4) {
-		y0 = yuyv[0] << 8;
-		u = yuyv[1] - 128;
-		v = yuyv[3] - 128;
+	for (i = 0; i < FRAME_POOL; i++) {
+		if ((pool[i].data = malloc(bytes)) == NULL)
+			return -1;
+		pool[i].refs = 0;
+	}
+	return 0;
+}
 
-		r = (y0 + (359 * v)) >> 8;
-		g = (y0 - (88 * u) - (183 * v)) >> 8;
-		b = (y0 + (454 * u)) >> 8;
+void frameRelease(videoFrame *f)
+{
+	f->refs--;
+}
 
-		*(iA++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
-		*(iA++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
-		*(iA++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
+// the camera's frame in format, or NULL if it can't be had in that format
+videoFrame *frameConvert(unsigned char *raw, int bytes, int format, struct timeval *stamp)
+{
+	videoFrame *f;
+	int i, pixels = videoIn->width * videoIn->height;
+
+	for (i = 0; pool[i].refs != 0; i++)
+		;
+	f = &pool[i];
+	f->format = format;
+	f->width = videoIn->width;
+	f->height = videoIn->height;
+	f->seq = frameSeq;
+	f->stamp = *stamp;
+
+	if (videoIn->formatIn == V4L2_PIX_FMT_MJPEG) {
+		if (format != VIDEO_JPEG)
+			return NULL;
+		f->length = uvcCopyJpeg(videoIn, raw, bytes, f->data, 3 * pixels);
+	} else if (format == VIDEO_Y) {
+		yuyvToY(raw, f->data, pixels);
+		f->length = pixels;
+	} else if (format == VIDEO_RGB) {
+		yuyvToRgb(raw, f->data, pixels);
+		f->length = 3 * pixels;
+	} else {
+		f->length = jpegEncodeYuyv(raw, f->width, f->height, quality, 422, f->data, 3 * pixels);
+	}
+	if (f->length < 0)
+		return NULL;
+	f->refs = 1;		// the capture loop's, until it's given to the viewers due it
+	return f;
+}
 
-		y2 = yuyv[2] << 8;
+void clientWatch(videoClient *c, int out)
+{
+	struct epoll_event ev;
+
+	if (out == c->watching)
+		return;
+	ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->watching = out;
+}
 
-		r = (y2 + (359 * v)) >> 8;
-		g = (y2 - (88 * u) - (183 * v)) >> 8;
-		b = (y2 + (454 * u)) >> 8;
+void clientDrop(videoClient *c, char *why)
+{
+	fprintf (stderr, "viewer %d %s after %lu frames, %u dropped\n", c->fd, why, c->frames, c->dropped);
+	if (c->frame != NULL)
+		frameRelease(c->frame);
+	c->frame = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+}
 
-		*(iA++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
-		*(iA++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
-		*(iA++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
+// as much of the frame as the socket takes; returns -1 if the viewer's gone
+int clientSend(videoClient *c)
+{
+	struct iovec iov[2];
+	int n, cnt;
+
+	while (c->sent < c->headerLen + c->frame->length) {
+		cnt = 0;
+		if (c->sent < c->headerLen) {
+			iov[cnt].iov_base = c->header + c->sent;
+			iov[cnt++].iov_len = c->headerLen - c->sent;
+			iov[cnt].iov_base = c->frame->data;
+			iov[cnt++].iov_len = c->frame->length;
+		} else {
+			iov[cnt].iov_base = c->frame->data + c->sent - c->headerLen;
+			iov[cnt++].iov_len = c->frame->length - (c->sent - c->headerLen);
+		}
+		n = writev(c->fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				clientWatch(c, 1);
+				return 0;
+			}
+			clientDrop(c, "disconnected");
+			return -1;
+		}
+		c->sent += n;
+	}
+	frameRelease(c->frame);
+	c->frame = NULL;
+	clientWatch(c, 0);
+	return 0;
+}
 
-		pixelCnt += 2;
+// start sending the viewer f, with the header its protocol uses
+int clientStart(videoClient *c, videoFrame *f)
+{
+	videoHeader h;
+	unsigned int netInt[3];
+
+	c->frame = f;
+	f->refs++;
+	c->sent = 0;
+	c->frames++;
+	if (c->legacy) {
+		netInt[0] = htonl(f->width);
+		netInt[1] = htonl(f->height);
+		netInt[2] = htonl(f->length);
+		memcpy(c->header, netInt, sizeof(netInt));
+		c->headerLen = sizeof(netInt);
+		c->wanted--;
+	} else {
+		memcpy(h.magic, VIDEO_FRAME_MAGIC, 2);
+		h.version = VIDEO_VERSION;
+		h.format = f->format;
+		h.width = htons(f->width);
+		h.height = htons(f->height);
+		h.seq = htonl(f->seq);
+		h.stampMs = htonl(f->stamp.tv_sec * 1000 + f->stamp.tv_usec / 1000);
+		h.dropped = htonl(c->dropped);
+		h.length = htonl(f->length);
+		memcpy(c->header, &h, sizeof(h));
+		c->headerLen = sizeof(h);
 	}
-	ctrl->imgLength = (int)iA - (int)ctrl->imgArray;
-	ctrl->pixelCnt = pixelCnt;
+	return clientSend(c);
 }
 
-void
-sigcatch (int sig)
+// whether the viewer should have this frame, going by what it asked for
+int clientDue(videoClient *c, struct timeval *now)
 {
-	fprintf (stderr, "Exiting...\n");
-	run = 0;
-	sleep(2);
-	exit(0);
+	struct timeval interval;
+
+	if (c->legacy)
+		return c->wanted > 0;
+	if (c->intervalMs == 0)
+		return 1;
+	if (timercmp(now, &c->due, <))
+		return 0;
+	interval.tv_sec = c->intervalMs / 1000;
+	interval.tv_usec = (c->intervalMs % 1000) * 1000;
+	timeradd(&c->due, &interval, &c->due);
+	if (timercmp(&c->due, now, <))		// fell behind: start the count again from now
+		timeradd(now, &interval, &c->due);
+	return 1;
 }
 
-/* handle commands from RoombaComm client as long as the socket stays open */
-void
-cmdHandler(ctrlStruct * ctrl)
+/*
+ * A frame from the camera: convert it to the formats it's due in & start sending it.
+ * Viewers still sending an earlier frame skip this one, so capture never waits for them
+ */
+void captureFrame(void)
 {
-	unsigned char clientCmd[256];
-	int rv;
-	int netInt;
+	videoFrame *made[VIDEO_FORMATS] = { NULL };
+	int tried[VIDEO_FORMATS] = { 0 };
+	unsigned char *raw;
+	struct timeval now;
+	videoClient *c;
+	int index, bytes, i;
+
+	if ((index = uvcGrabRef (videoIn, &raw, &bytes)) < 0) {
+		fprintf (stderr, "Error grabbing\n");
+		close_v4l2 (videoIn);
+		free (videoIn);
+		exit (1);
+	}
+	frameSeq++;
+	gettimeofday(&now, NULL);
+	if (verbose >= 2)
+		fprintf (stderr, "-");
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		c = &clients[i];
+		if ((c->fd < 0) || !clientDue(c, &now))
+			continue;
+		if (c->frame != NULL) {
+			c->dropped++;
+			continue;
+		}
+		if (!tried[c->format]) {
+			made[c->format] = frameConvert(raw, bytes, c->format, &videoIn->dequeued[index]);
+			tried[c->format] = 1;
+		}
+		if (made[c->format] != NULL)
+			clientStart(c, made[c->format]);
+	}
+	for (i = 0; i < VIDEO_FORMATS; i++) {
+		if (made[i] != NULL)
+			frameRelease(made[i]);
+	}
 
-	while (run) {
-		//fprintf (stderr, "waiting for command from client\n");
-		rv = read(ctrl->videoSocket, &clientCmd, 10);
-		if (rv < 0) {
-			perror("socket read: ");
-			exit(-1);
+	if (uvcRelease (videoIn, index) < 0) {
+		close_v4l2 (videoIn);
+		free (videoIn);
+		exit (1);
+	}
+	if ((verbose >= 1) && ((videoIn->frames % 300) == 0)) {
+		uvcPrintStats (videoIn);
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd >= 0)
+				fprintf (stderr, "viewer %d: %lu frames sent, %u dropped\n", clients[i].fd,
+						clients[i].frames, clients[i].dropped);
 		}
-		if (verbose > 1) fprintf (stderr, "received command %d\n", clientCmd[0]);
+	}
+}
 
-		if (clientCmd[0] == 200)
-			outputType = 0;		// grayscale output
-		else if (clientCmd[0] == 201)
-			outputType = 1;		// rgb output
+int clientSubscribe(videoClient *c, videoSubscribe *sub)
+{
+	if ((memcmp(sub->magic, VIDEO_SUBSCRIBE_MAGIC, 2) != 0) || (sub->version != VIDEO_VERSION) ||
+			(sub->format >= VIDEO_FORMATS)) {
+		clientDrop(c, "sent a bad subscription");
+		return -1;
+	}
+	if ((videoIn->formatIn == V4L2_PIX_FMT_MJPEG) && (sub->format != VIDEO_JPEG)) {
+		clientDrop(c, "asked for raw frames from an MJPEG camera");
+		return -1;
+	}
+	c->legacy = 0;
+	c->format = sub->format;
+	c->intervalMs = sub->fps ? 1000 / sub->fps : 0;
+	gettimeofday(&c->due, NULL);
+	c->dropped = 0;
+	if (verbose >= 1)
+		fprintf (stderr, "viewer %d subscribed to format %d at %d fps\n", c->fd, c->format, sub->fps);
+	return 0;
+}
 
-		ctrl->doCapture = 1;	// tell startvideoserver() to capture a snapshot
-		if (verbose > 1) fprintf (stderr, "waiting for capture to complete");
+void clientRead(videoClient *c)
+{
+	int n;
 
-		while (ctrl->doCapture == 1) {
-			fprintf (stderr, ".");
-			usleep(50000);
+	n = read(c->fd, c->in + c->inLen, sizeof(c->in) - c->inLen);
+	if (n == 0) {
+		clientDrop(c, "disconnected");
+		return;
+	}
+	if (n < 0) {
+		if ((errno != EINTR) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+			clientDrop(c, "disconnected");
+		return;
+	}
+	c->inLen += n;
+
+	while (c->inLen > 0) {
+		if (c->in[0] == VIDEO_SUBSCRIBE_MAGIC[0]) {
+			if (c->inLen < (int)sizeof(videoSubscribe))
+				return;
+			if (clientSubscribe(c, (videoSubscribe *)c->in) < 0)
+				return;
+			n = sizeof(videoSubscribe);
+		} else {
+			// the original protocol: any other byte asks for a frame, grey or RGB
+			if (videoIn->formatIn == V4L2_PIX_FMT_MJPEG) {
+				clientDrop(c, "asked for raw frames from an MJPEG camera");
+				return;
+			}
+			if (c->in[0] == VIDEO_LEGACY_Y)
+				c->format = VIDEO_Y;
+			else if (c->in[0] == VIDEO_LEGACY_RGB)
+				c->format = VIDEO_RGB;
+			if (verbose > 1) fprintf (stderr, "received command %d\n", c->in[0]);
+			c->legacy = 1;
+			c->wanted++;
+			n = 1;
 		}
+		memmove(c->in, c->in + n, c->inLen - n);
+		c->inLen -= n;
+	}
+}
 
-		if (verbose > 2) fprintf (stderr, "writing %d image bytes to socket, width %d height %d, pixelCnt %d\n", ctrl->imgLength, ctrl->imgWidth, ctrl->imgHeight, ctrl->pixelCnt);
-
-		// convert size variables to network byte order
-		netInt = htonl(ctrl->imgWidth);
-		write (ctrl->videoSocket, &netInt, 4);
-		netInt = htonl(ctrl->imgHeight);
-		write (ctrl->videoSocket, &netInt, 4);
-		netInt = htonl(ctrl->imgLength);
-		write (ctrl->videoSocket, &netInt, 4);
-		write (ctrl->videoSocket, ctrl->imgArray, ctrl->imgLength);
-		if (verbose > 2) fprintf (stderr, "wrote image & params\n");
+void clientAccept(int listener)
+{
+	struct epoll_event ev;
+	videoClient *c = NULL;
+	int fd, i, enable = 1;
+
+	while ((fd = accept(listener, NULL, NULL)) >= 0) {
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd < 0) {
+				c = &clients[i];
+				break;
+			}
+		}
+		if (i == MAX_CLIENTS) {
+			fprintf (stderr, "already %d viewers, turning another away\n", MAX_CLIENTS);
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+		memset(c, 0, sizeof(videoClient));
+		c->fd = fd;
+		c->format = VIDEO_Y;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+		fprintf (stderr, "viewer %d connected\n", fd);
 	}
 }
 
 void startVideoSrvr()
 {
-	pthread_t videoSocketThread;
+	struct epoll_event ev, events[MAX_CLIENTS + 2];
+	videoClient *c;
+	int listener, i, n;
 
 	/* alloc mameory for the videoIn struct & initialize */
 	videoIn = (struct vdIn *) calloc (1, sizeof (struct vdIn));
+	videoIn->nbBuffers = nbBuffers;
 	if (init_videoIn
 			(videoIn, (char *) videodevice, width, height, format, grabmethod) < 0)
 		exit (1);
 
-	/* alloc memory for the control struct & video out array & initialize */
-	ctrlStruct ctrl;
-	if ((ctrl.imgArray = malloc(3 * width * height)) < 0) // enough space for rgb
+	/* alloc memory for the converted frames & initialize */
+	if (poolInit(3 * videoIn->width * videoIn->height) < 0) // enough space for rgb
 		exit(-1);
-	ctrl.doCapture = 0;
+	for (i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+	signal (SIGPIPE, SIG_IGN);		// a viewer going away is a write error, not a signal
 
 	//Reset all camera controls
 	if (verbose >= 1)
@@ -241,45 +500,35 @@ void startVideoSrvr()
 				v4l2GetControl (videoIn, V4L2_CID_GAIN));
 	}
 
-	// wait for a video client to connect before proceeding
-	fprintf (stderr, "waiting for video client connection on port %d\n", port);
-	if ((ctrl.videoSocket = wait4client(port)) <= 0) {
-		fprintf (stderr, "error connecting to client: %d\n", ctrl.videoSocket);
-		exit(-1);
-	}
-	// start the thread that handles the video client requests
-	pthread_create(&videoSocketThread, NULL, (void *)cmdHandler, (void *)&ctrl);
+	// viewers connect & disconnect as they like; frames go out to those connected as they're captured
+	epfd = epoll_create(MAX_CLIENTS + 2);
+	listener = listen4clients(port);
+	fprintf (stderr, "waiting for video clients on port %d\n", port);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listenTag;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+	ev.data.ptr = &cameraTag;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, videoIn->fd, &ev);
 
 	while (run) {
-		if (verbose >= 2)
-			fprintf (stderr, "-");
-
-		if (uvcGrab (videoIn) < 0) {
-			fprintf (stderr, "Error grabbing\n");
-			close_v4l2 (videoIn);
-			free (videoIn);
-			exit (1);
+		if ((n = epoll_wait(epfd, events, MAX_CLIENTS + 2, 1000)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
 		}
-
-		if (ctrl.doCapture == 1) {
-
-			if (verbose >= 1) {
-				fprintf (stderr, "captured %d byte image at 0x%x %dx%d\n", videoIn->framesizeIn,
-						(int)videoIn->framebuffer, videoIn->width, videoIn->height);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &listenTag) {
+				clientAccept(listener);
+			} else if (events[i].data.ptr == &cameraTag) {
+				captureFrame();
 			} else {
-				fprintf (stderr, "+");
+				c = (videoClient *)events[i].data.ptr;
+				if ((c->fd >= 0) && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+					clientRead(c);
+				if ((c->fd >= 0) && (c->frame != NULL) && (events[i].events & EPOLLOUT))
+					clientSend(c);
 			}
-
-			if (outputType == 0)
-				yuyv2Y(videoIn, &ctrl);
-			else
-				yuyv2rgb(videoIn, &ctrl);
-
-			if (verbose >=1)
-				fprintf (stderr, "converted image to luminance or rgb in buffer at 0x%x\n", (int)ctrl.imgArray);
-
-			videoIn->getPict = 0;
-			ctrl.doCapture = 0;
 		}
 	}
 	close_v4l2 (videoIn);
@@ -305,9 +554,10 @@ void usage (void)
 			"-c<command>\tCommand to run after each image capture(executed as <command> <output_filename>)\n");
 	fprintf (stderr,
 			"-t<integer>\tTake continuous shots with <integer> seconds between them (0 for single shot)\n");
-	//  fprintf (stderr,
-	//	   "-q<percentage>\tJPEG Quality Compression Level (activates YUYV capture)\n");
+	fprintf (stderr,
+			"-q<percentage>\tJPEG Quality for JPEG viewers (activates YUYV capture) (default: 95)\n");
 	fprintf (stderr, "-r\t\tUse read instead of mmap for image capture\n");
+	fprintf (stderr, "-b<count>\tCapture buffers (default: 4)\n");
 	fprintf (stderr,
 			"-w\t\tWait for capture command to finish before starting next capture\n");
 	fprintf (stderr, "-m\t\tToggles capture mode from YUYV to MJPEG capture\n");
@@ -358,6 +608,10 @@ int main (int argc, char *argv[])
 			grabmethod = 0;
 			break;
 
+		case 'b':
+			nbBuffers = atoi (&argv[1][2]);
+			break;
+
 		case 'm':
 			format = V4L2_PIX_FMT_MJPEG;
 			break;
@@ -22,7 +22,9 @@
 #                                                                              #
 *******************************************************************************/
 
-#define NB_BUFFER 16
+#include <sys/time.h>
+
+#define NB_BUFFER 16		/* most buffers; the default to ask the driver for */
 #define DHT_SIZE 420
 
 // only define these if we need to
@@ -62,13 +64,40 @@ struct vdIn {
   int signalquit;
   int toggleAvi;
   int getPict;
+  int nbBuffers;		/* buffers to ask the driver for, NB_BUFFER if 0. Set before
+				   init_videoIn(); it holds how many the driver gave after */
 
+  /* per-frame statistics, see uvcPrintStats() */
+  unsigned int frames;
+  unsigned int dropped;		/* gaps in the driver's frame sequence numbers */
+  unsigned int lastSequence;
+  unsigned long long latencyUs;	/* driver's capture timestamp to dequeue */
+  unsigned long latencyMaxUs;
+  unsigned int latencyFrames;
+  unsigned long long heldUs;	/* dequeue to release */
+  unsigned long heldMaxUs;
+  int outstanding;		/* buffers dequeued & not yet released */
+  int jpegDht;			/* MJPEG: 1 if the camera leaves out the Huffman tables,
+				   -1 until its first frame's been looked at */
+  struct timeval dequeued[NB_BUFFER];
 };
 
 int
   init_videoIn (struct vdIn *vd, char *device, int width, int height,
 		int format, int grabmethod);
 int uvcGrab (struct vdIn *vd);
+
+/* Zero-copy capture: uvcGrabRef() dequeues a frame & points *frame at the driver's
+   mmap'd buffer instead of copying it out, & returns the buffer's index, or -1 on
+   error. The frame stays valid until the index is given back with uvcRelease(), & the
+   driver has one less buffer to capture into until then, so release it promptly. */
+int uvcGrabRef (struct vdIn *vd, unsigned char **frame, int *bytes);
+int uvcRelease (struct vdIn *vd, int index);
+/* an MJPEG frame from uvcGrabRef() as a complete JPEG, with the Huffman tables the
+   camera leaves out; returns its length, or -1 if it won't fit in max bytes */
+int uvcCopyJpeg (struct vdIn *vd, const unsigned char *frame, int bytes,
+		 unsigned char *out, int max);
+void uvcPrintStats (struct vdIn *vd);
 int close_v4l2 (struct vdIn *vd);
 
 int v4l2GetControl (struct vdIn *vd, int control);
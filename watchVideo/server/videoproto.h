@@ -0,0 +1,60 @@
+/*
+ * videoproto.h
+ *
+ *  Created on: Jan 2, 2013
+ *      Author: bouchier
+ */
+
+#ifndef VIDEOPROTO_H_
+#define VIDEOPROTO_H_
+
+/*
+ * What the video server & its viewers send each other. Every multi-byte field is in
+ * network byte order.
+ *
+ * A viewer subscribes by sending a videoSubscribe, & from then on the server sends it
+ * frames in that format, each a videoHeader & length bytes of image, at up to fps
+ * frames a second. It can send another videoSubscribe to change format or rate. A
+ * viewer that isn't keeping up gets fewer frames rather than old ones: while a frame's
+ * still being sent to it, the frames it would have had are dropped & counted in the
+ * next header.
+ *
+ * The original protocol still works: a single byte, 200 for grey or 201 for RGB, asks
+ * for one frame, which comes back after 3 ints, its width, height & length.
+ */
+
+#define VIDEO_VERSION 1
+#define VIDEO_SUBSCRIBE_MAGIC "VS"
+#define VIDEO_FRAME_MAGIC "VF"
+
+// formats
+#define VIDEO_Y 0			// a byte of luminance a pixel
+#define VIDEO_RGB 1			// 3 bytes a pixel
+#define VIDEO_JPEG 2
+#define VIDEO_FORMATS 3
+
+// the original protocol's requests
+#define VIDEO_LEGACY_Y 200
+#define VIDEO_LEGACY_RGB 201
+
+typedef struct {
+	unsigned char magic[2];		// VIDEO_SUBSCRIBE_MAGIC
+	unsigned char version;		// VIDEO_VERSION
+	unsigned char format;
+	unsigned char fps;			// 0 for every frame the camera captures
+	unsigned char reserved[3];
+} videoSubscribe;
+
+typedef struct {
+	unsigned char magic[2];		// VIDEO_FRAME_MAGIC
+	unsigned char version;
+	unsigned char format;
+	unsigned short width;
+	unsigned short height;
+	unsigned int seq;			// the camera's frame number; gaps are frames this viewer didn't get
+	unsigned int stampMs;		// when the frame was captured, ms on the server's clock
+	unsigned int dropped;		// frames dropped since subscribing because this viewer was behind
+	unsigned int length;		// bytes of image after the header
+} videoHeader;
+
+#endif /* VIDEOPROTO_H_ */